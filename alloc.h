@@ -0,0 +1,486 @@
+/*
+ * alloc.h - C99 pluggable allocator interface
+ * Copyright (C) Ethan Marshall - 2023
+ *
+ * Requirements: stdlib.h string.h
+ *
+ * Every hlc container obtains its memory through this header. By default, the
+ * C standard library allocator is used. This can be changed in two ways:
+ *
+ * 1. Globally, by defining any of HLC_MALLOC, HLC_CALLOC, HLC_REALLOC or
+ *    HLC_FREE before including any hlc header (eg. to use jemalloc or
+ *    mimalloc everywhere).
+ * 2. Per container, by passing an allocator_t to the *_alloc constructor of
+ *    the container (eg. to place a set of related containers in an arena).
+ *
+ * Allocation statistics may also be collected for all containers by defining
+ * HLC_ALLOC_STATS, as described below.
+ */
+
+#ifndef HLC_ALLOC_H
+#define HLC_ALLOC_H
+
+#ifdef HLC_AUTO_INCLUDE
+#define ALLOC_AUTO_INCLUDE
+#endif
+
+#ifdef ALLOC_AUTO_INCLUDE
+#include <stdlib.h>
+#include <string.h>
+#endif
+
+/*
+ * HLC_MALLOC, HLC_CALLOC, HLC_REALLOC and HLC_FREE are the system allocation
+ * routines, used for any container which has no allocator of its own. Each
+ * must behave exactly as its C standard library counterpart.
+ */
+#ifndef HLC_MALLOC
+#define HLC_MALLOC(size) malloc(size)
+#endif
+#ifndef HLC_CALLOC
+#define HLC_CALLOC(n, size) calloc(n, size)
+#endif
+#ifndef HLC_REALLOC
+#define HLC_REALLOC(ptr, size) realloc(ptr, size)
+#endif
+#ifndef HLC_FREE
+#define HLC_FREE(ptr) free(ptr)
+#endif
+
+/*
+ * allocator_t is an allocator which may be attached to a container in place
+ * of the system allocator. ctx is passed back unmodified to each routine and
+ * is usually a pointer to the state of the allocator (an arena, a pool...).
+ *
+ * All sizes are in bytes. The size of the block is passed back to resize and
+ * release, so the allocator need not record it. Only alloc is required:
+ *
+ * - alloc returns a block of at least size bytes, aligned for any type, or
+ *   NULL on failure.
+ * - resize (optional) behaves as realloc, leaving the original block intact
+ *   on failure. If NULL, a new block is allocated and the data copied over.
+ * - release (optional) returns a block to the allocator. If NULL, blocks are
+ *   never individually freed (as with an arena).
+ */
+typedef struct allocator {
+	void *(*alloc)(void *ctx, size_t size);
+	void *(*resize)(void *ctx, void *ptr, size_t oldsize, size_t newsize);
+	void (*release)(void *ctx, void *ptr, size_t size);
+	void *ctx;
+} allocator_t;
+
+/*
+ * alloc_module is the hlc module which made an allocation, used to attribute
+ * allocation statistics (see HLC_ALLOC_STATS). Allocations made directly
+ * through alloc_malloc and friends are attributed to ALLOC_MOD_OTHER.
+ */
+enum alloc_module {
+	ALLOC_MOD_OTHER,
+	ALLOC_MOD_STR,
+	ALLOC_MOD_VECT,
+	ALLOC_MOD_SLICE,
+	ALLOC_MOD_BUF,
+	ALLOC_MOD_UTF,
+	ALLOC_MOD_CHAN,
+	ALLOC_MOD_POOL,
+	ALLOC_MOD_COUNT
+};
+
+/* Internal: the kinds of operation counted by the allocation statistics */
+enum {
+	_ALLOC_OP_ALLOC,
+	_ALLOC_OP_REALLOC,
+	_ALLOC_OP_FREE
+};
+
+#ifdef HLC_ALLOC_STATS
+/*
+ * Allocation statistics (REQUIRES C11, stdio.h and stdatomic.h)
+ *
+ * If HLC_ALLOC_STATS is defined before including any hlc header, every
+ * allocation, reallocation and free made by an hlc container is counted, both
+ * per module and per call site (the function which made the call, such as
+ * str_grow or _vect_resize). Reallocations which moved the block, and so had
+ * to copy it, are counted separately, along with the number of bytes copied.
+ * Counters are updated with relaxed atomics and are safe to use from any
+ * thread.
+ *
+ * Every translation unit must see the same HLC_ALLOC_STATS setting, and
+ * exactly one must also define ALLOC_STATS_IMPL before including this header,
+ * to provide storage for the counters.
+ *
+ * Note that utf_decode hands its buffer to the caller to free, so those bytes
+ * remain counted as live.
+ */
+
+#ifdef ALLOC_AUTO_INCLUDE
+#include <stdio.h>
+#include <stdatomic.h>
+#endif
+
+/*
+ * ALLOC_STATS_SITES is the maximum number of call sites which are tracked.
+ * Allocations from further sites are only counted against their module.
+ */
+#ifndef ALLOC_STATS_SITES
+#define ALLOC_STATS_SITES 64
+#endif
+
+/*
+ * alloc_count_t is a snapshot of allocation counters. bytes is the total
+ * requested by allocations and growing reallocations. live and peak are the
+ * current and highest number of bytes outstanding, which are only tracked per
+ * module, as blocks are usually freed from a different site to the one which
+ * allocated them.
+ */
+typedef struct {
+	size_t allocs, reallocs, copies, frees;
+	size_t bytes, copied, live, peak;
+} alloc_count_t;
+
+/*
+ * alloc_site_t is a snapshot of the counters for one call site, which is
+ * named after the function which made the allocation.
+ */
+typedef struct {
+	const char *site;
+	enum alloc_module module;
+	alloc_count_t count;
+} alloc_site_t;
+
+/*
+ * alloc_snapshot_t is a copy of all allocation statistics, see
+ * alloc_stats_snapshot. Sites are sorted busiest first (by allocations plus
+ * reallocations).
+ */
+typedef struct {
+	alloc_count_t modules[ALLOC_MOD_COUNT];
+	alloc_site_t sites[ALLOC_STATS_SITES];
+	size_t nsites;
+} alloc_snapshot_t;
+
+/* Internal: live counters, mirroring alloc_count_t */
+struct _alloc_counters {
+	atomic_size_t allocs, reallocs, copies, frees;
+	atomic_size_t bytes, copied, live, peak;
+};
+
+struct _alloc_stats {
+	struct _alloc_counters modules[ALLOC_MOD_COUNT];
+	struct {
+		_Atomic(const char *) site;
+		atomic_int module;
+		struct _alloc_counters count;
+	} sites[ALLOC_STATS_SITES];
+};
+
+extern struct _alloc_stats _alloc_stats;
+#ifdef ALLOC_STATS_IMPL
+struct _alloc_stats _alloc_stats;
+#endif
+
+/* Internal: returns the counters for site, claiming a slot if required */
+static inline struct _alloc_counters *_alloc_site(enum alloc_module mod, const char *site)
+{
+	size_t h = 5381;
+
+	for (const char *walk = site; *walk; walk++)
+		h = h * 33 + (unsigned char)*walk;
+
+	for (size_t i = 0; i < ALLOC_STATS_SITES; i++) {
+		size_t slot = (h + i) % ALLOC_STATS_SITES;
+		const char *name = atomic_load_explicit(&_alloc_stats.sites[slot].site,
+				memory_order_acquire);
+
+		if (!name) {
+			if (atomic_compare_exchange_strong(&_alloc_stats.sites[slot].site,
+						&name, site)) {
+				atomic_store_explicit(&_alloc_stats.sites[slot].module, mod,
+						memory_order_relaxed);
+				return &_alloc_stats.sites[slot].count;
+			}
+			/* lost the race: name is now the winner */
+		}
+		if (name == site || strcmp(name, site) == 0)
+			return &_alloc_stats.sites[slot].count;
+	}
+
+	return NULL;
+}
+
+/* Internal: adds n to counter c */
+#define _alloc_count(c, n) atomic_fetch_add_explicit(&(c), (n), memory_order_relaxed)
+
+/* Internal: adjusts the live byte count of module counters c by +add-sub */
+static inline void _alloc_live(struct _alloc_counters *c, size_t add, size_t sub)
+{
+	size_t live, peak;
+
+	if (add >= sub) {
+		live = atomic_fetch_add_explicit(&c->live, add - sub, memory_order_relaxed);
+		live += add - sub;
+	} else {
+		atomic_fetch_sub_explicit(&c->live, sub - add, memory_order_relaxed);
+		return;
+	}
+
+	peak = atomic_load_explicit(&c->peak, memory_order_relaxed);
+	while (live > peak && !atomic_compare_exchange_weak_explicit(&c->peak, &peak,
+				live, memory_order_relaxed, memory_order_relaxed));
+}
+
+/*
+ * Internal: records a successful allocation (op _ALLOC_OP_ALLOC), reallocation
+ * (_ALLOC_OP_REALLOC, which moved the block if moved is set) or free
+ * (_ALLOC_OP_FREE) made by mod from site. Only sizes are recorded, so a free
+ * may be recorded before the block is released.
+ */
+static inline void _alloc_record(enum alloc_module mod, const char *site,
+		int op, size_t oldsize, size_t newsize, int moved)
+{
+	struct _alloc_counters *c[2] = {&_alloc_stats.modules[mod], _alloc_site(mod, site)};
+
+	for (int i = 0; i < 2 && c[i]; i++) {
+		if (op == _ALLOC_OP_ALLOC) {
+			_alloc_count(c[i]->allocs, 1);
+			_alloc_count(c[i]->bytes, newsize);
+		} else if (op == _ALLOC_OP_FREE) {
+			_alloc_count(c[i]->frees, 1);
+		} else {
+			_alloc_count(c[i]->reallocs, 1);
+			if (newsize > oldsize)
+				_alloc_count(c[i]->bytes, newsize - oldsize);
+			if (moved) {
+				_alloc_count(c[i]->copies, 1);
+				_alloc_count(c[i]->copied, (oldsize < newsize) ? oldsize : newsize);
+			}
+		}
+	}
+
+	_alloc_live(c[0], (op != _ALLOC_OP_FREE) ? newsize : 0,
+			(op != _ALLOC_OP_ALLOC) ? oldsize : 0);
+}
+
+#define _ALLOC_RECORD(mod, site, op, oldsize, newsize, moved) \
+	_alloc_record(mod, site, op, oldsize, newsize, moved)
+
+/*
+ * alloc_module_name returns a printable name for the module mod.
+ */
+static inline const char *alloc_module_name(enum alloc_module mod)
+{
+	static const char *names[ALLOC_MOD_COUNT] = {
+		"other", "str", "vect", "slice", "buf", "utf", "chan", "pool",
+	};
+
+	return (mod < ALLOC_MOD_COUNT) ? names[mod] : "?";
+}
+
+/* Internal: copies live counters c to out */
+static inline void _alloc_load(alloc_count_t *out, struct _alloc_counters *c)
+{
+	out->allocs = atomic_load_explicit(&c->allocs, memory_order_relaxed);
+	out->reallocs = atomic_load_explicit(&c->reallocs, memory_order_relaxed);
+	out->copies = atomic_load_explicit(&c->copies, memory_order_relaxed);
+	out->frees = atomic_load_explicit(&c->frees, memory_order_relaxed);
+	out->bytes = atomic_load_explicit(&c->bytes, memory_order_relaxed);
+	out->copied = atomic_load_explicit(&c->copied, memory_order_relaxed);
+	out->live = atomic_load_explicit(&c->live, memory_order_relaxed);
+	out->peak = atomic_load_explicit(&c->peak, memory_order_relaxed);
+}
+
+/* Internal: qsort comparator ordering sites busiest first */
+static inline int _alloc_site_cmp(const void *a, const void *b)
+{
+	const alloc_count_t *x = &((const alloc_site_t *)a)->count;
+	const alloc_count_t *y = &((const alloc_site_t *)b)->count;
+	size_t wx = x->allocs + x->reallocs, wy = y->allocs + y->reallocs;
+
+	return (wx < wy) - (wx > wy);
+}
+
+/*
+ * alloc_stats_snapshot copies the current allocation statistics to snap.
+ * Counters are read individually, so a snapshot taken while other threads are
+ * allocating may be very slightly inconsistent.
+ */
+static inline void alloc_stats_snapshot(alloc_snapshot_t *snap)
+{
+	memset(snap, 0, sizeof(*snap));
+
+	for (int i = 0; i < ALLOC_MOD_COUNT; i++)
+		_alloc_load(&snap->modules[i], &_alloc_stats.modules[i]);
+
+	for (size_t i = 0; i < ALLOC_STATS_SITES; i++) {
+		const char *site = atomic_load_explicit(&_alloc_stats.sites[i].site,
+				memory_order_acquire);
+		if (!site)
+			continue;
+
+		snap->sites[snap->nsites].site = site;
+		snap->sites[snap->nsites].module = atomic_load_explicit(
+				&_alloc_stats.sites[i].module, memory_order_relaxed);
+		_alloc_load(&snap->sites[snap->nsites].count, &_alloc_stats.sites[i].count);
+		snap->nsites++;
+	}
+
+	qsort(snap->sites, snap->nsites, sizeof(snap->sites[0]), _alloc_site_cmp);
+}
+
+/*
+ * alloc_stats_reset zeroes all allocation statistics. The live byte counts
+ * restart from zero, so blocks allocated before the reset and freed after it
+ * will cause them to wrap. It must not be called concurrently with any
+ * allocation.
+ */
+static inline void alloc_stats_reset(void)
+{
+	memset(&_alloc_stats, 0, sizeof(_alloc_stats));
+}
+
+/*
+ * alloc_stats_dump writes a human-readable table of the current allocation
+ * statistics to f, with call sites sorted busiest first.
+ */
+static inline void alloc_stats_dump(FILE *f)
+{
+	alloc_snapshot_t snap;
+
+	alloc_stats_snapshot(&snap);
+
+	fprintf(f, "%-24s %10s %10s %10s %10s %12s %12s %12s\n", "module",
+			"allocs", "reallocs", "copies", "frees", "copied", "live", "peak");
+	for (int i = 0; i < ALLOC_MOD_COUNT; i++) {
+		alloc_count_t *c = &snap.modules[i];
+		fprintf(f, "%-24s %10zu %10zu %10zu %10zu %12zu %12zu %12zu\n",
+				alloc_module_name(i), c->allocs, c->reallocs,
+				c->copies, c->frees, c->copied, c->live, c->peak);
+	}
+
+	fprintf(f, "\n%-24s %10s %10s %10s %10s %12s %12s\n", "site",
+			"allocs", "reallocs", "copies", "frees", "copied", "bytes");
+	for (size_t i = 0; i < snap.nsites; i++) {
+		alloc_count_t *c = &snap.sites[i].count;
+		fprintf(f, "%-24s %10zu %10zu %10zu %10zu %12zu %12zu (%s)\n",
+				snap.sites[i].site, c->allocs, c->reallocs, c->copies,
+				c->frees, c->copied, c->bytes,
+				alloc_module_name(snap.sites[i].module));
+	}
+}
+
+#else /* HLC_ALLOC_STATS */
+
+#define _ALLOC_RECORD(mod, site, op, oldsize, newsize, moved) \
+	((void)(mod), (void)(site), (void)(op), (void)(oldsize), (void)(newsize), (void)(moved))
+
+#endif /* HLC_ALLOC_STATS */
+
+/*
+ * Internal: the implementations of alloc_malloc and friends, which also take
+ * the module and call site to which the allocation is attributed.
+ */
+static inline void *_alloc_malloc_at(const allocator_t *a, size_t size,
+		enum alloc_module mod, const char *site)
+{
+	void *ret;
+
+	if (!a)
+		ret = HLC_MALLOC(size);
+	else
+		ret = a->alloc(a->ctx, size);
+
+	if (ret)
+		_ALLOC_RECORD(mod, site, _ALLOC_OP_ALLOC, 0, size, 0);
+	return ret;
+}
+
+static inline void *_alloc_calloc_at(const allocator_t *a, size_t n, size_t size,
+		enum alloc_module mod, const char *site)
+{
+	void *ret;
+
+	if (size && n > ((size_t)-1) / size)
+		return NULL;
+
+	if (!a) {
+		ret = HLC_CALLOC(n, size);
+	} else {
+		ret = a->alloc(a->ctx, n * size);
+		if (ret)
+			memset(ret, 0, n * size);
+	}
+
+	if (ret)
+		_ALLOC_RECORD(mod, site, _ALLOC_OP_ALLOC, 0, n * size, 0);
+	return ret;
+}
+
+static inline void *_alloc_realloc_at(const allocator_t *a, void *ptr, size_t oldsize,
+		size_t newsize, enum alloc_module mod, const char *site)
+{
+	/* ptr may be released below, so only its representation is kept to compare */
+	unsigned char old[sizeof(ptr)];
+	void *ret;
+
+	if (!ptr)
+		return _alloc_malloc_at(a, newsize, mod, site);
+	memcpy(old, &ptr, sizeof(ptr));
+
+	if (!a) {
+		ret = HLC_REALLOC(ptr, newsize);
+	} else if (a->resize) {
+		ret = a->resize(a->ctx, ptr, oldsize, newsize);
+	} else {
+		ret = a->alloc(a->ctx, newsize);
+		if (!ret)
+			return NULL;
+		memcpy(ret, ptr, (oldsize < newsize) ? oldsize : newsize);
+		if (a->release)
+			a->release(a->ctx, ptr, oldsize);
+	}
+
+	if (ret)
+		_ALLOC_RECORD(mod, site, _ALLOC_OP_REALLOC, oldsize, newsize, memcmp(old, &ret, sizeof(ret)) != 0);
+	return ret;
+}
+
+static inline void _alloc_free_at(const allocator_t *a, void *ptr, size_t size,
+		enum alloc_module mod, const char *site)
+{
+	if (!ptr)
+		return;
+
+	_ALLOC_RECORD(mod, site, _ALLOC_OP_FREE, size, 0, 0);
+
+	if (!a)
+		HLC_FREE(ptr);
+	else if (a->release)
+		a->release(a->ctx, ptr, size);
+}
+
+/*
+ * alloc_malloc allocates size bytes from a, or from HLC_MALLOC if a is NULL.
+ */
+#define alloc_malloc(a, size) _alloc_malloc_at(a, size, ALLOC_MOD_OTHER, __func__)
+
+/*
+ * alloc_calloc allocates n zeroed elements of size bytes each from a, or from
+ * HLC_CALLOC if a is NULL. If n * size would overflow, NULL is returned.
+ */
+#define alloc_calloc(a, n, size) _alloc_calloc_at(a, n, size, ALLOC_MOD_OTHER, __func__)
+
+/*
+ * alloc_realloc resizes the block ptr (currently oldsize bytes) to newsize
+ * bytes, using a or HLC_REALLOC if a is NULL. As with realloc, a NULL ptr
+ * allocates a new block and the original block is left intact on failure.
+ */
+#define alloc_realloc(a, ptr, oldsize, newsize) \
+	_alloc_realloc_at(a, ptr, oldsize, newsize, ALLOC_MOD_OTHER, __func__)
+
+/*
+ * alloc_free returns the block ptr (of size bytes) to a, or to HLC_FREE if a
+ * is NULL. A NULL ptr is a no-op.
+ */
+#define alloc_free(a, ptr, size) _alloc_free_at(a, ptr, size, ALLOC_MOD_OTHER, __func__)
+
+#endif /* HLC_ALLOC_H */
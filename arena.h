@@ -0,0 +1,320 @@
+/*
+ * arena.h - C99 chunked bump allocator
+ * Copyright (C) Ethan Marshall - 2023
+ *
+ * Requirements: stddef.h stdint.h stdlib.h string.h alloc.h
+ *
+ * An arena hands out memory by bumping a pointer through large chunks, which
+ * are only returned to the system all together. This makes allocation almost
+ * free and deallocation entirely free for groups of objects which all die at
+ * the same time (eg. everything allocated while handling one request).
+ *
+ * Containers may be placed in an arena by passing arena_allocator(&arena) to
+ * their *_alloc constructor (str_new_alloc, slc_make_alloc, vect_init_alloc).
+ */
+
+#ifndef HLC_ARENA_H
+#define HLC_ARENA_H
+
+#ifdef HLC_AUTO_INCLUDE
+#define ARENA_AUTO_INCLUDE
+#endif
+
+#ifdef ARENA_AUTO_INCLUDE
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "alloc.h"
+#endif
+
+/*
+ * arena_default_chunk is the chunk size used if zero is passed to arena_init.
+ */
+static const size_t arena_default_chunk = 64 * 1024;
+
+/* Internal: a type with the strictest alignment of any standard type */
+union _arena_maxalign {
+	long double ld;
+	long long ll;
+	void *p;
+	void (*fp)(void);
+};
+
+/* Internal: used to find the alignment of _arena_maxalign in C99 */
+struct _arena_align_probe {
+	char c;
+	union _arena_maxalign u;
+};
+
+/*
+ * ARENA_ALIGN is the alignment of all memory returned by arena_alloc, which is
+ * suitable for any standard type.
+ */
+#define ARENA_ALIGN offsetof(struct _arena_align_probe, u)
+
+/*
+ * Internal: a chunk of arena memory. size bytes of data follow the header, of
+ * which the first used bytes have been handed out.
+ */
+struct _arena_chunk {
+	struct _arena_chunk *prev;
+	size_t size, used;
+	union _arena_maxalign data[];
+};
+
+/*
+ * arena_t is a bump allocator. It must be initialized with arena_init and
+ * released with arena_free. It is not safe for concurrent use.
+ *
+ * All memory handed out by an arena remains valid until the arena is reset,
+ * restored to a mark taken before the allocation, or freed.
+ */
+typedef struct {
+	/* most recently allocated chunk; older chunks linked through prev */
+	struct _arena_chunk *head;
+	/* most recent allocation, which may be resized or released in place */
+	void *last;
+	size_t chunksiz;
+	allocator_t alloc;
+} arena_t;
+
+/*
+ * arena_mark_t is a saved position in an arena, see arena_save.
+ */
+typedef struct {
+	struct _arena_chunk *chunk;
+	size_t used;
+} arena_mark_t;
+
+/*
+ * arena_init initializes an empty arena which will request memory from the
+ * system allocator in chunks of at least chunksiz bytes. If chunksiz is zero,
+ * arena_default_chunk is used. No memory is allocated until first use.
+ */
+static inline void arena_init(arena_t *a, size_t chunksiz)
+{
+	a->head = NULL;
+	a->last = NULL;
+	a->chunksiz = chunksiz ? chunksiz : arena_default_chunk;
+	memset(&a->alloc, 0, sizeof(a->alloc));
+}
+
+/*
+ * Internal: pushes a new chunk able to hold at least need bytes.
+ */
+static inline struct _arena_chunk *_arena_chunk_new(arena_t *a, size_t need)
+{
+	struct _arena_chunk *c;
+	size_t size = (need > a->chunksiz) ? need : a->chunksiz;
+
+	if (size > ((size_t)-1) - sizeof(*c))
+		return NULL;
+
+	c = HLC_MALLOC(sizeof(*c) + size);
+	if (!c)
+		return NULL;
+	c->prev = a->head;
+	c->size = size;
+	c->used = 0;
+	a->head = c;
+
+	return c;
+}
+
+/*
+ * arena_alloc_aligned returns size bytes from the arena a, aligned to align
+ * bytes, which must be a power of two. If align is not a power of two or a
+ * new chunk cannot be allocated, NULL is returned.
+ */
+static inline void *arena_alloc_aligned(arena_t *a, size_t size, size_t align)
+{
+	struct _arena_chunk *c = a->head;
+	uintptr_t base, p;
+
+	if (align == 0 || (align & (align - 1)))
+		return NULL;
+
+	if (c) {
+		base = (uintptr_t)c->data;
+		p = (base + c->used + (align - 1)) & ~(uintptr_t)(align - 1);
+		if (p - base <= c->size && size <= c->size - (p - base)) {
+			c->used = (p - base) + size;
+			a->last = (void *)p;
+			return a->last;
+		}
+	}
+
+	/* does not fit: worst case padding is align - 1 bytes */
+	if (size > ((size_t)-1) - align)
+		return NULL;
+	c = _arena_chunk_new(a, size + align - 1);
+	if (!c)
+		return NULL;
+
+	base = (uintptr_t)c->data;
+	p = (base + (align - 1)) & ~(uintptr_t)(align - 1);
+	c->used = (p - base) + size;
+	a->last = (void *)p;
+
+	return a->last;
+}
+
+/*
+ * arena_alloc returns size bytes from the arena a, aligned for any standard
+ * type, or NULL if a new chunk cannot be allocated.
+ */
+static inline void *arena_alloc(arena_t *a, size_t size)
+{
+	return arena_alloc_aligned(a, size, ARENA_ALIGN);
+}
+
+/*
+ * arena_realloc resizes the block ptr from oldsize to newsize bytes. If ptr
+ * is the most recent allocation from a and the chunk has room, the block is
+ * resized in place with no copy. Otherwise, a new block is allocated and the
+ * data copied, leaving the old block unused until the arena is reset. If ptr
+ * is NULL, arena_realloc is equivalent to arena_alloc. On failure, NULL is
+ * returned and ptr remains valid.
+ */
+static inline void *arena_realloc(arena_t *a, void *ptr, size_t oldsize, size_t newsize)
+{
+	struct _arena_chunk *c = a->head;
+	void *ret;
+
+	if (!ptr)
+		return arena_alloc(a, newsize);
+
+	if (ptr == a->last) {
+		size_t off = (uintptr_t)ptr - (uintptr_t)c->data;
+		if (newsize <= c->size - off) {
+			c->used = off + newsize;
+			return ptr;
+		}
+	}
+
+	ret = arena_alloc(a, newsize);
+	if (!ret)
+		return NULL;
+	memcpy(ret, ptr, (oldsize < newsize) ? oldsize : newsize);
+
+	return ret;
+}
+
+/*
+ * arena_release gives back the block ptr to the arena. This is only possible
+ * if ptr is the most recent allocation, in which case its space will be
+ * handed out again; any other block is left in place until the arena is
+ * reset.
+ */
+static inline void arena_release(arena_t *a, void *ptr)
+{
+	if (!ptr || ptr != a->last)
+		return;
+
+	a->head->used = (uintptr_t)ptr - (uintptr_t)a->head->data;
+	a->last = NULL;
+}
+
+/*
+ * arena_save returns a mark recording the current position of the arena,
+ * which can later be passed to arena_restore to discard every allocation
+ * made since in one step. This is useful for scoped temporaries. Marks may be
+ * nested, but must be restored in reverse order.
+ */
+static inline arena_mark_t arena_save(arena_t *a)
+{
+	arena_mark_t m;
+
+	m.chunk = a->head;
+	m.used = a->head ? a->head->used : 0;
+
+	return m;
+}
+
+/*
+ * arena_restore rolls the arena a back to the mark m, invalidating all memory
+ * allocated since m was taken and releasing any chunks allocated since to the
+ * system. Restoring a mark taken before a later reset of the arena, or after a
+ * mark which has already been restored, is undefined.
+ */
+static inline void arena_restore(arena_t *a, arena_mark_t m)
+{
+	while (a->head != m.chunk) {
+		struct _arena_chunk *prev = a->head->prev;
+		HLC_FREE(a->head);
+		a->head = prev;
+	}
+
+	if (a->head)
+		a->head->used = m.used;
+	a->last = NULL;
+}
+
+/*
+ * arena_reset invalidates all memory allocated from the arena a, but keeps the
+ * most recent chunk ready for re-use, so that an arena which is reset in a
+ * loop reaches a steady state with no calls to the system allocator.
+ */
+static inline void arena_reset(arena_t *a)
+{
+	struct _arena_chunk *c;
+
+	if (!a->head)
+		return;
+
+	c = a->head->prev;
+	while (c) {
+		struct _arena_chunk *prev = c->prev;
+		HLC_FREE(c);
+		c = prev;
+	}
+
+	a->head->prev = NULL;
+	a->head->used = 0;
+	a->last = NULL;
+}
+
+/*
+ * arena_free releases all memory associated with the arena a. The arena is
+ * left empty and may be used again.
+ */
+static inline void arena_free(arena_t *a)
+{
+	arena_restore(a, (arena_mark_t){NULL, 0});
+}
+
+/* Internal: allocator_t routines for arena_allocator */
+static inline void *_arena_alloc_cb(void *ctx, size_t size)
+{
+	return arena_alloc(ctx, size);
+}
+
+static inline void *_arena_resize_cb(void *ctx, void *ptr, size_t oldsize, size_t newsize)
+{
+	return arena_realloc(ctx, ptr, oldsize, newsize);
+}
+
+static inline void _arena_release_cb(void *ctx, void *ptr, size_t size)
+{
+	(void)size;
+	arena_release(ctx, ptr);
+}
+
+/*
+ * arena_allocator returns an allocator which allocates from the arena a, for
+ * use with the *_alloc constructors of containers. Growing the most recently
+ * allocated container happens in place. The allocator is only valid for as
+ * long as a, and a must not be moved in memory while it is in use.
+ */
+static inline const allocator_t *arena_allocator(arena_t *a)
+{
+	a->alloc.alloc = _arena_alloc_cb;
+	a->alloc.resize = _arena_resize_cb;
+	a->alloc.release = _arena_release_cb;
+	a->alloc.ctx = a;
+
+	return &a->alloc;
+}
+
+#endif /* HLC_ARENA_H */
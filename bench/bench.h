@@ -0,0 +1,300 @@
+/*
+ * bench.h - micro-benchmark harness for hlc
+ * Copyright (C) Ethan Marshall - 2023
+ *
+ * Requirements: stdio.h stdlib.h string.h time.h (POSIX clock_gettime)
+ *
+ * Each benchmark is a function which performs the operation under test
+ * b->iters times. The harness calibrates iters so that one sample takes about
+ * bench_sample_ns, runs a warmup, then collects BENCH_SAMPLES samples and
+ * reports percentiles of the time per operation. On x86, the time stamp
+ * counter is also read to report reference cycles per operation.
+ *
+ * On Linux, hardware performance counters (see perfctr.h) are also collected
+ * over the timed samples and reported per operation, when the kernel allows
+ * it. Define BENCH_NO_PERFCTR to disable this.
+ *
+ * Benchmark programs should call bench_init with their arguments, which are:
+ * 	-j		print results as JSON (one object per line)
+ * 	<filter>	only run benchmarks whose name contains filter
+ */
+
+#ifdef HLC_AUTO_INCLUDE
+#define BENCH_AUTO_INCLUDE
+#endif
+
+#if defined(__linux__) && !defined(BENCH_NO_PERFCTR)
+#define BENCH_PERFCTR
+#endif
+
+#ifdef BENCH_AUTO_INCLUDE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef BENCH_PERFCTR
+#define PERFCTR_AUTO_INCLUDE
+#include "../perfctr.h"
+#endif
+#endif
+
+/* BENCH_SAMPLES is the number of timed samples taken per benchmark */
+#ifndef BENCH_SAMPLES
+#define BENCH_SAMPLES 51
+#endif
+/* BENCH_WARMUP is the number of untimed samples run before measuring */
+#ifndef BENCH_WARMUP
+#define BENCH_WARMUP 5
+#endif
+/* bench_sample_ns is the target duration of one sample */
+static const double bench_sample_ns = 2e6;
+
+/*
+ * bench_t is the state of one running benchmark. The benchmark function must
+ * perform its operation iters times. arg and size are as passed to bench_run.
+ */
+typedef struct {
+	size_t iters, size;
+	void *arg;
+	/* internal: timing of the current sample */
+	struct timespec start, end;
+	unsigned long long tsc_start, tsc_end;
+	int stopped;
+} bench_t;
+
+typedef void (*bench_func)(bench_t *b);
+
+/*
+ * bench_result_t is the result of a benchmark, in nanoseconds (and cycles,
+ * where available) per operation.
+ */
+typedef struct {
+	const char *name;
+	size_t size, iters;
+	double min, p50, p90, p99, max, mean;
+	double cycles;
+#ifdef BENCH_PERFCTR
+	/* mean hardware event counts per operation, if counters > 0 */
+	int counters;
+	double events[PERFCTR_COUNT];
+#endif
+} bench_result_t;
+
+/* Internal: options given to bench_init */
+static int _bench_json;
+static const char *_bench_filter;
+
+#ifdef BENCH_PERFCTR
+/* Internal: hardware counters, if any could be opened */
+static perfctr_t _bench_pc;
+static int _bench_pc_ok;
+#endif
+
+static inline unsigned long long _bench_tsc(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	unsigned int lo, hi;
+	__asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((unsigned long long)hi << 32) | lo;
+#else
+	return 0;
+#endif
+}
+
+static inline double _bench_ns(const struct timespec *a, const struct timespec *b)
+{
+	return (double)(b->tv_sec - a->tv_sec) * 1e9 + (double)(b->tv_nsec - a->tv_nsec);
+}
+
+/*
+ * bench_keep prevents the compiler from optimizing away the computation of
+ * the value pointed to by p.
+ */
+static inline void bench_keep(const void *p)
+{
+#ifdef __GNUC__
+	__asm__ __volatile__ ("" : : "g"(p) : "memory");
+#else
+	static const void *volatile sink;
+	sink = p;
+#endif
+}
+
+/*
+ * bench_reset restarts the timer of the current sample, excluding any setup
+ * performed so far by the benchmark function.
+ */
+static inline void bench_reset(bench_t *b)
+{
+#ifdef BENCH_PERFCTR
+	if (_bench_pc_ok)
+		perfctr_start(&_bench_pc);
+#endif
+	clock_gettime(CLOCK_MONOTONIC, &b->start);
+	b->tsc_start = _bench_tsc();
+}
+
+/*
+ * bench_stop stops the timer of the current sample, excluding any teardown
+ * performed afterwards by the benchmark function.
+ */
+static inline void bench_stop(bench_t *b)
+{
+	b->tsc_end = _bench_tsc();
+	clock_gettime(CLOCK_MONOTONIC, &b->end);
+#ifdef BENCH_PERFCTR
+	if (_bench_pc_ok)
+		perfctr_stop(&_bench_pc);
+#endif
+	b->stopped = 1;
+}
+
+/*
+ * bench_init parses the command line arguments of a benchmark program.
+ */
+static inline void bench_init(int argc, char **argv)
+{
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0)
+			_bench_json = 1;
+		else
+			_bench_filter = argv[i];
+	}
+
+#ifdef BENCH_PERFCTR
+	_bench_pc_ok = perfctr_open(&_bench_pc) > 0;
+#endif
+}
+
+/* Internal: runs one sample of fn, returning ns/op and storing cycles/op */
+static inline double _bench_sample(bench_t *b, bench_func fn, double *cycles)
+{
+	b->stopped = 0;
+	bench_reset(b);
+	fn(b);
+	if (!b->stopped)
+		bench_stop(b);
+
+	*cycles = (double)(b->tsc_end - b->tsc_start) / (double)b->iters;
+	return _bench_ns(&b->start, &b->end) / (double)b->iters;
+}
+
+static inline int _bench_cmp(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * bench_report prints the result r in the format selected by bench_init.
+ */
+static inline void bench_report(const bench_result_t *r)
+{
+	if (_bench_json) {
+		printf("{\"name\":\"%s\",\"size\":%zu,\"iters\":%zu,\"ns\":{\"min\":%.3f,"
+				"\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f,"
+				"\"mean\":%.3f},\"cycles\":%.3f",
+				r->name, r->size, r->iters, r->min, r->p50, r->p90,
+				r->p99, r->max, r->mean, r->cycles);
+#ifdef BENCH_PERFCTR
+		if (r->counters) {
+			printf(",\"counters\":{");
+			for (int i = 0; i < PERFCTR_COUNT; i++) {
+				printf("%s\"%s\":%.3f", i ? "," : "", perfctr_name(i),
+						r->events[i]);
+			}
+			printf("}");
+		}
+#endif
+		printf("}\n");
+	} else {
+		printf("%-32s %8zu %12.2f %12.2f %12.2f %12.2f %10.1f",
+				r->name, r->size, r->min, r->p50, r->p90,
+				r->p99, r->cycles);
+#ifdef BENCH_PERFCTR
+		if (r->counters) {
+			const double *e = r->events;
+			printf(" %10.1f %6.2f %10.2f %10.2f", e[PERFCTR_INSTRUCTIONS],
+					e[PERFCTR_CYCLES] ? e[PERFCTR_INSTRUCTIONS] / e[PERFCTR_CYCLES] : 0,
+					e[PERFCTR_BRANCH_MISSES], e[PERFCTR_CACHE_MISSES]);
+		}
+#endif
+		printf("\n");
+	}
+	fflush(stdout);
+}
+
+/*
+ * bench_run runs the benchmark fn under the given name and input size,
+ * reports the result and returns it. arg and size are passed through to fn.
+ * If the name does not match the filter given to bench_init, nothing is run
+ * and the result is zeroed.
+ */
+static inline bench_result_t bench_run(const char *name, size_t size, bench_func fn, void *arg)
+{
+	static int header;
+	double samples[BENCH_SAMPLES], cycles[BENCH_SAMPLES], ns, sum = 0;
+	bench_t b = {0};
+	bench_result_t r = {0};
+
+	r.name = name;
+	r.size = size;
+	if (_bench_filter && !strstr(name, _bench_filter))
+		return r;
+
+	if (!_bench_json && !header) {
+		printf("%-32s %8s %12s %12s %12s %12s %10s", "benchmark", "size",
+				"min ns/op", "p50 ns/op", "p90 ns/op", "p99 ns/op", "cyc/op");
+#ifdef BENCH_PERFCTR
+		if (_bench_pc_ok)
+			printf(" %10s %6s %10s %10s", "ins/op", "ipc", "brmiss/op", "cmiss/op");
+#endif
+		printf("\n");
+		header = 1;
+	}
+
+	b.arg = arg;
+	b.size = size;
+
+	/* calibrate: grow iters until one sample is long enough */
+	for (b.iters = 1;; b.iters *= 2) {
+		ns = _bench_sample(&b, fn, &cycles[0]) * (double)b.iters;
+		if (ns >= bench_sample_ns / 4 || b.iters >= ((size_t)1 << 40))
+			break;
+	}
+	if (ns < bench_sample_ns)
+		b.iters = (size_t)((double)b.iters * bench_sample_ns / (ns + 1));
+	if (b.iters == 0)
+		b.iters = 1;
+
+	for (size_t i = 0; i < BENCH_WARMUP; i++)
+		_bench_sample(&b, fn, &cycles[0]);
+	for (size_t i = 0; i < BENCH_SAMPLES; i++) {
+		samples[i] = _bench_sample(&b, fn, &cycles[i]);
+		sum += samples[i];
+#ifdef BENCH_PERFCTR
+		for (int j = 0; _bench_pc_ok && j < PERFCTR_COUNT; j++)
+			r.events[j] += (double)_bench_pc.values[j];
+#endif
+	}
+#ifdef BENCH_PERFCTR
+	r.counters = _bench_pc_ok;
+	for (int j = 0; j < PERFCTR_COUNT; j++)
+		r.events[j] /= (double)b.iters * BENCH_SAMPLES;
+#endif
+
+	qsort(samples, BENCH_SAMPLES, sizeof(samples[0]), _bench_cmp);
+	qsort(cycles, BENCH_SAMPLES, sizeof(cycles[0]), _bench_cmp);
+
+	r.iters = b.iters;
+	r.min = samples[0];
+	r.p50 = samples[BENCH_SAMPLES / 2];
+	r.p90 = samples[(BENCH_SAMPLES - 1) * 90 / 100];
+	r.p99 = samples[(BENCH_SAMPLES - 1) * 99 / 100];
+	r.max = samples[BENCH_SAMPLES - 1];
+	r.mean = sum / (double)BENCH_SAMPLES;
+	r.cycles = cycles[BENCH_SAMPLES / 2];
+
+	bench_report(&r);
+	return r;
+}
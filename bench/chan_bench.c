@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define HLC_AUTO_INCLUDE
+#define CHAN_IMPL
+#define TIMER_IMPL
+#include "bench.h"
+#include "../chan.h"
+
+/* buffer sizes: 1 makes every message a handoff between sleeping threads */
+static const size_t caps[] = {1, 64, 1024};
+
+/* senders in the fan-in benchmarks */
+#define NSENDERS 4
+
+chan_declare(size_t, zchan);
+
+/* the baseline: a ring buffer protected by a mutex, with condition variables */
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t nonempty, nonfull;
+	size_t *buf, cap, head, len;
+} lockq_t;
+
+static void lockq_push(lockq_t *q, size_t v)
+{
+	pthread_mutex_lock(&q->lock);
+	while (q->len == q->cap)
+		pthread_cond_wait(&q->nonfull, &q->lock);
+	q->buf[(q->head + q->len++) % q->cap] = v;
+	pthread_cond_signal(&q->nonempty);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static size_t lockq_pop(lockq_t *q)
+{
+	size_t v;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->len == 0)
+		pthread_cond_wait(&q->nonempty, &q->lock);
+	v = q->buf[q->head];
+	q->head = (q->head + 1) % q->cap;
+	q->len--;
+	pthread_cond_signal(&q->nonfull);
+	pthread_mutex_unlock(&q->lock);
+	return v;
+}
+
+typedef struct {
+	size_t iters;
+	zchan *ch;
+	lockq_t *q;
+} sender_t;
+
+static void *chan_sender(void *arg)
+{
+	sender_t *s = arg;
+
+	for (size_t i = 0; i < s->iters; i++)
+		chan_send(s->ch, i);
+	return NULL;
+}
+
+static void *lockq_sender(void *arg)
+{
+	sender_t *s = arg;
+
+	for (size_t i = 0; i < s->iters; i++)
+		lockq_push(s->q, i);
+	return NULL;
+}
+
+/* one thread sends b->iters values, which this thread receives */
+static void bench_chan_spsc(bench_t *b)
+{
+	sender_t s = {b->iters, chan_new(zchan, b->size, CHAN_SPSC), NULL};
+	pthread_t t;
+	size_t v;
+
+	bench_reset(b);
+	pthread_create(&t, NULL, chan_sender, &s);
+	for (size_t i = 0; i < b->iters; i++)
+		chan_recv(s.ch, &v);
+	bench_keep(&v);
+	pthread_join(t, NULL);
+	bench_stop(b);
+
+	chan_free(s.ch);
+}
+
+/* values moved per chan_send_n and chan_recv_n in the batch benchmark */
+#define BATCH 32
+
+static void *chan_batch_sender(void *arg)
+{
+	sender_t *s = arg;
+	size_t buf[BATCH], n;
+
+	for (size_t i = 0; i < s->iters; i += n) {
+		n = (s->iters - i < BATCH) ? s->iters - i : BATCH;
+		for (size_t j = 0; j < n; j++)
+			buf[j] = i + j;
+		chan_send_n(s->ch, buf, n);
+	}
+	return NULL;
+}
+
+/* as bench_chan_spsc, but values are moved in batches */
+static void bench_chan_batch(bench_t *b)
+{
+	sender_t s = {b->iters, chan_new(zchan, b->size, CHAN_SPSC), NULL};
+	pthread_t t;
+	size_t buf[BATCH];
+
+	bench_reset(b);
+	pthread_create(&t, NULL, chan_batch_sender, &s);
+	for (size_t i = 0; i < b->iters;)
+		i += chan_recv_n(s.ch, buf, BATCH);
+	bench_keep(buf);
+	pthread_join(t, NULL);
+	bench_stop(b);
+
+	chan_free(s.ch);
+}
+
+/* NSENDERS threads send b->iters values between them, which this thread receives */
+static void bench_chan_mpmc(bench_t *b)
+{
+	zchan *ch = chan_new(zchan, b->size, CHAN_MPMC);
+	sender_t s[NSENDERS];
+	pthread_t t[NSENDERS];
+	size_t v;
+
+	for (int i = 0; i < NSENDERS; i++) {
+		s[i] = (sender_t){b->iters / NSENDERS, ch, NULL};
+		if (i == 0)
+			s[i].iters += b->iters % NSENDERS;
+	}
+
+	bench_reset(b);
+	for (int i = 0; i < NSENDERS; i++)
+		pthread_create(&t[i], NULL, chan_sender, &s[i]);
+	for (size_t i = 0; i < b->iters; i++)
+		chan_recv(ch, &v);
+	bench_keep(&v);
+	for (int i = 0; i < NSENDERS; i++)
+		pthread_join(t[i], NULL);
+	bench_stop(b);
+
+	chan_free(ch);
+}
+
+/* as bench_chan_mpmc, but each sender has its own channel, selected over */
+static void bench_chan_select(bench_t *b)
+{
+	sender_t s[NSENDERS];
+	pthread_t t[NSENDERS];
+	chan_case_t cs[NSENDERS];
+	size_t v;
+
+	for (int i = 0; i < NSENDERS; i++) {
+		s[i] = (sender_t){b->iters / NSENDERS, chan_new(zchan, b->size, CHAN_SPSC), NULL};
+		if (i == 0)
+			s[i].iters += b->iters % NSENDERS;
+		cs[i] = chan_case_recv(s[i].ch, &v);
+	}
+
+	bench_reset(b);
+	for (int i = 0; i < NSENDERS; i++)
+		pthread_create(&t[i], NULL, chan_sender, &s[i]);
+	for (size_t i = 0; i < b->iters; i++)
+		chan_select(cs, NSENDERS);
+	bench_keep(&v);
+	for (int i = 0; i < NSENDERS; i++)
+		pthread_join(t[i], NULL);
+	bench_stop(b);
+
+	for (int i = 0; i < NSENDERS; i++)
+		chan_free(s[i].ch);
+}
+
+static void bench_lockq_fanin(bench_t *b)
+{
+	lockq_t q = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+		PTHREAD_COND_INITIALIZER, malloc(b->size * sizeof(size_t)), b->size, 0, 0};
+	sender_t s[NSENDERS];
+	pthread_t t[NSENDERS];
+	size_t v = 0;
+
+	for (int i = 0; i < NSENDERS; i++) {
+		s[i] = (sender_t){b->iters / NSENDERS, NULL, &q};
+		if (i == 0)
+			s[i].iters += b->iters % NSENDERS;
+	}
+
+	bench_reset(b);
+	for (int i = 0; i < NSENDERS; i++)
+		pthread_create(&t[i], NULL, lockq_sender, &s[i]);
+	for (size_t i = 0; i < b->iters; i++)
+		v += lockq_pop(&q);
+	bench_keep(&v);
+	for (int i = 0; i < NSENDERS; i++)
+		pthread_join(t[i], NULL);
+	bench_stop(b);
+
+	free(q.buf);
+}
+
+static void bench_lockq(bench_t *b)
+{
+	lockq_t q = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+		PTHREAD_COND_INITIALIZER, malloc(b->size * sizeof(size_t)), b->size, 0, 0};
+	sender_t s = {b->iters, NULL, &q};
+	pthread_t t;
+	size_t v = 0;
+
+	bench_reset(b);
+	pthread_create(&t, NULL, lockq_sender, &s);
+	for (size_t i = 0; i < b->iters; i++)
+		v += lockq_pop(&q);
+	bench_keep(&v);
+	pthread_join(t, NULL);
+	bench_stop(b);
+
+	free(q.buf);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+
+	for (size_t i = 0; i < sizeof(caps) / sizeof(caps[0]); i++) {
+		bench_run("chan_spsc", caps[i], bench_chan_spsc, NULL);
+		bench_run("chan_spsc_batch", caps[i], bench_chan_batch, NULL);
+		bench_run("mutex_queue", caps[i], bench_lockq, NULL);
+	}
+	/* every message is a handoff straight from the sender to the receiver */
+	bench_run("chan_unbuffered", 0, bench_chan_spsc, NULL);
+	for (size_t i = 0; i < sizeof(caps) / sizeof(caps[0]); i++) {
+		bench_run("chan_mpmc_fanin", caps[i], bench_chan_mpmc, NULL);
+		bench_run("chan_select_fanin", caps[i], bench_chan_select, NULL);
+		bench_run("mutex_queue_fanin", caps[i], bench_lockq_fanin, NULL);
+	}
+}
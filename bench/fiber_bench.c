@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define HLC_AUTO_INCLUDE
+#define CHAN_IMPL
+#define TIMER_IMPL
+#include "bench.h"
+#include "../fiber.h"
+
+/* fibers parked at once in fiber_parked */
+#define NPARKED 100000
+
+chan_declare(long, lchan);
+
+static pool_t *pool, *one;
+
+static void nop(void *arg)
+{
+	bench_keep(arg);
+}
+
+/* spawns b->iters fibers which return at once, then waits for them */
+static void bench_fiber_spawn(bench_t *b)
+{
+	pool_group_t g = POOL_GROUP_INIT;
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++)
+		fiber_spawn(pool, &g, nop, NULL);
+	pool_wait(pool, &g);
+	bench_stop(b);
+}
+
+static void yielder(void *arg)
+{
+	size_t n = *(size_t *)arg;
+
+	for (size_t i = 0; i < n; i++)
+		fiber_yield();
+}
+
+/* a lone fiber yielding on a single thread: a switch out and back per op */
+static void bench_fiber_yield(bench_t *b)
+{
+	pool_group_t g = POOL_GROUP_INIT;
+
+	bench_reset(b);
+	fiber_spawn(one, &g, yielder, &b->iters);
+	pool_wait(one, &g);
+	bench_stop(b);
+}
+
+typedef struct {
+	lchan *in, *out;
+	size_t n;
+} pp_t;
+
+static void ping(pp_t *p)
+{
+	long v = 0;
+
+	for (size_t i = 0; i < p->n; i++) {
+		chan_send(p->out, v);
+		chan_recv(p->in, &v);
+	}
+}
+
+static void pong(pp_t *p)
+{
+	long v;
+
+	for (size_t i = 0; i < p->n; i++) {
+		chan_recv(p->in, &v);
+		chan_send(p->out, v + 1);
+	}
+}
+
+static void fiber_ping(void *arg)
+{
+	ping(arg);
+}
+
+static void fiber_pong(void *arg)
+{
+	pong(arg);
+}
+
+/* a round trip between two fibers, over unbuffered channels, on one thread */
+static void bench_fiber_pingpong(bench_t *b)
+{
+	pool_group_t g = POOL_GROUP_INIT;
+	lchan *x = chan_new(lchan, 0, CHAN_SPSC), *y = chan_new(lchan, 0, CHAN_SPSC);
+	pp_t p = {y, x, b->iters}, q = {x, y, b->iters};
+
+	bench_reset(b);
+	fiber_spawn(one, &g, fiber_ping, &p);
+	fiber_spawn(one, &g, fiber_pong, &q);
+	pool_wait(one, &g);
+	bench_stop(b);
+
+	chan_free(x);
+	chan_free(y);
+}
+
+static void *thread_pong(void *arg)
+{
+	pong(arg);
+	return NULL;
+}
+
+/* the baseline: the same between two threads */
+static void bench_thread_pingpong(bench_t *b)
+{
+	lchan *x = chan_new(lchan, 0, CHAN_SPSC), *y = chan_new(lchan, 0, CHAN_SPSC);
+	pp_t p = {y, x, b->iters}, q = {x, y, b->iters};
+	pthread_t t;
+
+	bench_reset(b);
+	pthread_create(&t, NULL, thread_pong, &q);
+	ping(&p);
+	pthread_join(t, NULL);
+	bench_stop(b);
+
+	chan_free(x);
+	chan_free(y);
+}
+
+static void waiter(void *arg)
+{
+	long v;
+
+	chan_recv((lchan *)arg, &v);
+}
+
+/* b->size fibers parked on one channel at once, then woken by closing it */
+static void bench_fiber_parked(bench_t *b)
+{
+	pool_group_t g = POOL_GROUP_INIT;
+	lchan *ch;
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		ch = chan_new(lchan, 1, CHAN_MPMC);
+		for (size_t j = 0; j < b->size; j++)
+			fiber_spawn(pool, &g, waiter, ch);
+		chan_close(ch);
+		pool_wait(pool, &g);
+		chan_free(ch);
+	}
+	bench_stop(b);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+	pool = pool_new(0);
+	one = pool_new(1);
+
+	bench_run("fiber_spawn", 1, bench_fiber_spawn, NULL);
+	bench_run("fiber_yield", 1, bench_fiber_yield, NULL);
+	bench_run("fiber_pingpong", 1, bench_fiber_pingpong, NULL);
+	bench_run("thread_pingpong", 1, bench_thread_pingpong, NULL);
+	bench_run("fiber_parked", NPARKED, bench_fiber_parked, NULL);
+
+	pool_free(one);
+	pool_free(pool);
+}
@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define HLC_AUTO_INCLUDE
+#define CHAN_IMPL
+#define TIMER_IMPL
+#include "bench.h"
+#include "../loop.h"
+
+chan_declare(long, lchan);
+
+static loop_t loop;
+
+static void *run_loop(void *arg)
+{
+	loop_run(arg);
+	return NULL;
+}
+
+typedef struct {
+	loop_chan_t w;
+	lchan *out;
+	long v;
+} echo_t;
+
+/* replies to each value, into a channel with room for it */
+static void echo_chan(void *arg, int ok)
+{
+	echo_t *e = arg;
+
+	if (ok)
+		chan_try_send(e->out, e->v + 1);
+}
+
+/* a round trip from a thread to the loop and back, over channels */
+static void bench_loop_chan(bench_t *b)
+{
+	lchan *in = chan_new(lchan, 1, CHAN_SPSC), *out = chan_new(lchan, 1, CHAN_SPSC);
+	echo_t e = {.out = out};
+	pthread_t t;
+	long v = 0;
+
+	loop_add_chan(&loop, &e.w, chan_case_recv(in, &e.v), echo_chan, &e);
+	pthread_create(&t, NULL, run_loop, &loop);
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		chan_send(in, v);
+		chan_recv(out, &v);
+	}
+	bench_stop(b);
+
+	loop_stop(&loop);
+	pthread_join(t, NULL);
+	loop_del_chan(&loop, &e.w);
+	chan_free(in);
+	chan_free(out);
+}
+
+typedef struct {
+	loop_fd_t w;
+	int in, out;
+} pipe_echo_t;
+
+static void echo_pipe(void *arg, uint32_t events)
+{
+	pipe_echo_t *e = arg;
+	long v;
+
+	(void)events;
+	if (read(e->in, &v, sizeof(v)) == sizeof(v)) {
+		v++;
+		if (write(e->out, &v, sizeof(v)) != sizeof(v))
+			abort();
+	}
+}
+
+/* the same over pipes, as the loop would serve a socket */
+static void bench_loop_pipe(bench_t *b)
+{
+	int in[2], out[2];
+	pipe_echo_t e;
+	pthread_t t;
+	long v = 0;
+
+	if (pipe(in) || pipe(out))
+		abort();
+	e.in = in[0];
+	e.out = out[1];
+	loop_add_fd(&loop, &e.w, in[0], EPOLLIN, echo_pipe, &e);
+	pthread_create(&t, NULL, run_loop, &loop);
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		if (write(in[1], &v, sizeof(v)) != sizeof(v) || read(out[0], &v, sizeof(v)) != sizeof(v))
+			abort();
+	}
+	bench_stop(b);
+
+	loop_stop(&loop);
+	pthread_join(t, NULL);
+	loop_del_fd(&loop, &e.w);
+	for (int i = 0; i < 2; i++) {
+		close(in[i]);
+		close(out[i]);
+	}
+}
+
+typedef struct {
+	lchan *in, *out;
+	size_t n;
+} pp_t;
+
+static void *thread_echo(void *arg)
+{
+	pp_t *p = arg;
+	long v;
+
+	for (size_t i = 0; i < p->n; i++) {
+		chan_recv(p->in, &v);
+		chan_send(p->out, v + 1);
+	}
+	return NULL;
+}
+
+/* the baseline: a round trip to a thread blocked on a channel, with no loop */
+static void bench_thread_chan(bench_t *b)
+{
+	lchan *in = chan_new(lchan, 1, CHAN_SPSC), *out = chan_new(lchan, 1, CHAN_SPSC);
+	pp_t p = {in, out, b->iters};
+	pthread_t t;
+	long v = 0;
+
+	pthread_create(&t, NULL, thread_echo, &p);
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		chan_send(in, v);
+		chan_recv(out, &v);
+	}
+	bench_stop(b);
+
+	pthread_join(t, NULL);
+	chan_free(in);
+	chan_free(out);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+	if (loop_init(&loop))
+		abort();
+
+	bench_run("loop_chan_pingpong", 1, bench_loop_chan, NULL);
+	bench_run("loop_pipe_pingpong", 1, bench_loop_pipe, NULL);
+	bench_run("thread_chan_pingpong", 1, bench_thread_chan, NULL);
+
+	loop_destroy(&loop);
+}
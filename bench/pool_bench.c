@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define HLC_AUTO_INCLUDE
+#include "bench.h"
+#include "../pool.h"
+
+/* elements per parallel loop */
+static const size_t sizes[] = {4096, 65536, 1048576};
+
+static pool_t *pool;
+static long *data;
+
+static void nop(void *arg)
+{
+	bench_keep(arg);
+}
+
+/* spawns b->iters empty tasks in one group from outside the pool, then waits */
+static void bench_pool_spawn(bench_t *b)
+{
+	pool_group_t g = POOL_GROUP_INIT;
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++)
+		pool_spawn(pool, &g, nop, NULL);
+	pool_wait(pool, &g);
+	bench_stop(b);
+}
+
+static void spawn_children(void *arg)
+{
+	pool_group_t g = POOL_GROUP_INIT;
+	size_t n = *(size_t *)arg;
+
+	for (size_t i = 0; i < n; i++)
+		pool_spawn(pool, &g, nop, NULL);
+	pool_wait(pool, &g);
+}
+
+/* as bench_pool_spawn, but spawned by a worker, onto its own deque */
+static void bench_pool_spawn_worker(bench_t *b)
+{
+	pool_group_t g = POOL_GROUP_INIT;
+
+	bench_reset(b);
+	pool_spawn(pool, &g, spawn_children, &b->iters);
+	pool_wait(pool, &g);
+	bench_stop(b);
+}
+
+static void *thread_nop(void *arg)
+{
+	bench_keep(arg);
+	return NULL;
+}
+
+/* the baseline: a thread per task */
+static void bench_pthread_spawn(bench_t *b)
+{
+	pthread_t t;
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		pthread_create(&t, NULL, thread_nop, NULL);
+		pthread_join(t, NULL);
+	}
+	bench_stop(b);
+}
+
+typedef struct {
+	size_t lo, hi;
+} part_t;
+
+static void sum_range(void *arg, size_t lo, size_t hi)
+{
+	long sum = 0;
+
+	for (size_t i = lo; i < hi; i++)
+		sum += data[i];
+	bench_keep(&sum);
+	(void)arg;
+}
+
+/* sums b->size elements with pool_for, b->iters times */
+static void bench_pool_for(bench_t *b)
+{
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++)
+		pool_for(pool, b->size, 1024, sum_range, NULL);
+	bench_stop(b);
+}
+
+static void *thread_sum(void *arg)
+{
+	part_t *p = arg;
+
+	sum_range(NULL, p->lo, p->hi);
+	return NULL;
+}
+
+/* the baseline: a thread per CPU for every loop, as in spawning per batch */
+static void bench_pthread_for(bench_t *b)
+{
+	int n = pool_threads(pool);
+	pthread_t *t = malloc(n * sizeof(*t));
+	part_t *p = malloc(n * sizeof(*p));
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		for (int j = 0; j < n; j++) {
+			p[j].lo = b->size * j / n;
+			p[j].hi = b->size * (j + 1) / n;
+			pthread_create(&t[j], NULL, thread_sum, &p[j]);
+		}
+		for (int j = 0; j < n; j++)
+			pthread_join(t[j], NULL);
+	}
+	bench_stop(b);
+
+	free(t);
+	free(p);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+	pool = pool_new(0);
+	data = calloc(sizes[2], sizeof(*data));
+
+	bench_run("pool_spawn", 1, bench_pool_spawn, NULL);
+	bench_run("pool_spawn_worker", 1, bench_pool_spawn_worker, NULL);
+	bench_run("pthread_spawn", 1, bench_pthread_spawn, NULL);
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		bench_run("pool_for", sizes[i], bench_pool_for, NULL);
+		bench_run("pthread_for", sizes[i], bench_pthread_for, NULL);
+	}
+
+	free(data);
+	pool_free(pool);
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HLC_AUTO_INCLUDE
+#include "bench.h"
+#include "../alloc.h"
+#include "../slice.h"
+
+static const size_t sizes[] = {16, 256, 4096, 65536};
+
+/* grows a slice to b->size elements, one element at a time */
+static void bench_slc_grow_exact(bench_t *b)
+{
+	for (size_t i = 0; i < b->iters; i++) {
+		slice_t s = slc_new(int);
+		for (size_t j = 1; j <= b->size; j++)
+			slc_grow(&s, j);
+		bench_keep(s.buf);
+		slc_free(&s);
+	}
+}
+
+/* grows a slice to b->size elements, doubling its capacity */
+static void bench_slc_grow_double(bench_t *b)
+{
+	for (size_t i = 0; i < b->iters; i++) {
+		slice_t s = slc_new(int);
+		for (size_t j = 1; j <= b->size; j++) {
+			if (j > slc_cap(&s))
+				slc_grow(&s, slc_cap(&s) * 2);
+		}
+		bench_keep(s.buf);
+		slc_free(&s);
+	}
+}
+
+static void bench_realloc_double(bench_t *b)
+{
+	for (size_t i = 0; i < b->iters; i++) {
+		size_t cap = 2;
+		int *arr = calloc(cap, sizeof(int));
+		for (size_t j = 1; j <= b->size; j++) {
+			if (j > cap) {
+				arr = realloc(arr, cap * 2 * sizeof(int));
+				memset(arr + cap, 0, cap * sizeof(int));
+				cap *= 2;
+			}
+		}
+		bench_keep(arr);
+		free(arr);
+	}
+}
+
+static void bench_slc_copy(bench_t *b)
+{
+	slice_t src = slc_make(int, b->size, b->size);
+	slice_t dst = slc_make(int, b->size, b->size);
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		size_t n = slc_copy(&dst, &src);
+		bench_keep(&n);
+		bench_keep(dst.buf);
+	}
+	bench_stop(b);
+
+	slc_free(&src);
+	slc_free(&dst);
+}
+
+static void bench_libc_memmove(bench_t *b)
+{
+	int *src = calloc(b->size, sizeof(int));
+	int *dst = calloc(b->size, sizeof(int));
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		memmove(dst, src, b->size * sizeof(int));
+		bench_keep(dst);
+	}
+	bench_stop(b);
+
+	free(src);
+	free(dst);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+
+	for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		/* quadratic: keep the largest size out of the exact growth run */
+		if (sizes[i] <= 4096)
+			bench_run("slc_grow_exact", sizes[i], bench_slc_grow_exact, NULL);
+		bench_run("slc_grow_double", sizes[i], bench_slc_grow_double, NULL);
+		bench_run("realloc_double", sizes[i], bench_realloc_double, NULL);
+		bench_run("slc_copy", sizes[i], bench_slc_copy, NULL);
+		bench_run("libc_memmove", sizes[i], bench_libc_memmove, NULL);
+	}
+}
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HLC_AUTO_INCLUDE
+#include "bench.h"
+#include "../alloc.h"
+#include "../str/str.c"
+
+static const size_t sizes[] = {16, 256, 4096, 65536};
+static char *input, *needle_input;
+
+/* fills the inputs with size bytes of text, the latter ending in "needle" */
+static void make_input(size_t size)
+{
+	free(input);
+	free(needle_input);
+	input = malloc(size + 1);
+	needle_input = malloc(size + 1);
+
+	for (size_t i = 0; i < size; i++)
+		input[i] = needle_input[i] = 'a' + (i % 26);
+	input[size] = needle_input[size] = '\0';
+	if (size >= 6)
+		memcpy(needle_input + size - 6, "needle", 6);
+}
+
+static void bench_str_from(bench_t *b)
+{
+	for (size_t i = 0; i < b->iters; i++) {
+		string_t s = str_from(input);
+		bench_keep(s.s);
+		str_free(&s);
+	}
+}
+
+static void bench_libc_strdup(bench_t *b)
+{
+	for (size_t i = 0; i < b->iters; i++) {
+		size_t len = strlen(input);
+		char *s = malloc(len + 1);
+		memcpy(s, input, len + 1);
+		bench_keep(s);
+		free(s);
+	}
+}
+
+/* appends b->size bytes in pieces of 16 */
+static void bench_str_append(bench_t *b)
+{
+	string_t piece = str_from("0123456789abcdef");
+
+	for (size_t i = 0; i < b->iters; i++) {
+		string_t s = str_new();
+		for (size_t j = 0; j < b->size; j += 16)
+			str_append(&s, &piece);
+		bench_keep(s.s);
+		str_free(&s);
+	}
+
+	str_free(&piece);
+}
+
+static void bench_libc_append(bench_t *b)
+{
+	const char *piece = "0123456789abcdef";
+
+	for (size_t i = 0; i < b->iters; i++) {
+		size_t len = 0, cap = 32;
+		char *s = malloc(cap);
+		for (size_t j = 0; j < b->size; j += 16) {
+			if (len + 17 > cap) {
+				cap *= 2;
+				s = realloc(s, cap);
+			}
+			memcpy(s + len, piece, 16);
+			len += 16;
+			s[len] = '\0';
+		}
+		bench_keep(s);
+		free(s);
+	}
+}
+
+static void bench_str_fmt(bench_t *b)
+{
+	for (size_t i = 0; i < b->iters; i++) {
+		string_t s = str_fmt("%s:%zu", input, i);
+		bench_keep(s.s);
+		str_free(&s);
+	}
+}
+
+static void bench_libc_snprintf(bench_t *b)
+{
+	for (size_t i = 0; i < b->iters; i++) {
+		int len = snprintf(NULL, 0, "%s:%zu", input, i);
+		char *s = malloc(len + 1);
+		snprintf(s, len + 1, "%s:%zu", input, i);
+		bench_keep(s);
+		free(s);
+	}
+}
+
+static void bench_str_contains(bench_t *b)
+{
+	string_t s = str_from(needle_input);
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		int r = str_contains(&s, "needle");
+		bench_keep(&r);
+	}
+	bench_stop(b);
+
+	str_free(&s);
+}
+
+static void bench_libc_strstr(bench_t *b)
+{
+	for (size_t i = 0; i < b->iters; i++) {
+		char *r = strstr(needle_input, "needle");
+		bench_keep(r);
+	}
+}
+
+static void bench_str_compare(bench_t *b)
+{
+	string_t x = str_from(input), y = str_from(input);
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		int r = str_compare(&x, &y);
+		bench_keep(&r);
+	}
+	bench_stop(b);
+
+	str_free(&x);
+	str_free(&y);
+}
+
+static void bench_libc_strcmp(bench_t *b)
+{
+	char *copy = malloc(b->size + 1);
+	memcpy(copy, input, b->size + 1);
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		int r = strcmp(input, copy);
+		bench_keep(&r);
+	}
+	bench_stop(b);
+
+	free(copy);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+
+	for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		make_input(sizes[i]);
+
+		bench_run("str_from", sizes[i], bench_str_from, NULL);
+		bench_run("libc_strdup", sizes[i], bench_libc_strdup, NULL);
+		bench_run("str_append", sizes[i], bench_str_append, NULL);
+		bench_run("libc_append", sizes[i], bench_libc_append, NULL);
+		bench_run("str_fmt", sizes[i], bench_str_fmt, NULL);
+		bench_run("libc_snprintf", sizes[i], bench_libc_snprintf, NULL);
+		bench_run("str_contains", sizes[i], bench_str_contains, NULL);
+		bench_run("libc_strstr", sizes[i], bench_libc_strstr, NULL);
+		bench_run("str_compare", sizes[i], bench_str_compare, NULL);
+		bench_run("libc_strcmp", sizes[i], bench_libc_strcmp, NULL);
+	}
+
+	free(input);
+	free(needle_input);
+}
@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <semaphore.h>
+
+#define HLC_AUTO_INCLUDE
+#include "bench.h"
+#include "../sync.h"
+
+/* thread counts; the last is well beyond the number of CPUs on most hosts */
+static const size_t threads[] = {1, 2, 4, 32};
+
+static spinlock_t spin = SPINLOCK_INIT;
+static ticketlock_t ticket = TICKETLOCK_INIT;
+static mcslock_t mcs = MCSLOCK_INIT;
+static mutex_t mutex = MUTEX_INIT;
+static pthread_mutex_t pmutex = PTHREAD_MUTEX_INITIALIZER;
+static rwlock_t rw;
+static seqlock_t seq = SEQLOCK_INIT;
+static pthread_rwlock_t prw = PTHREAD_RWLOCK_INITIALIZER;
+static waitgroup_t wg = WAITGROUP_INIT;
+static semaphore_t sem = SEMAPHORE_INIT(1);
+static sem_t psem;
+static barrier_t barrier;
+static pthread_barrier_t pbarrier;
+static once_t once = ONCE_INIT;
+static pthread_once_t ponce = PTHREAD_ONCE_INIT;
+static counter_t stat;
+static _Atomic int64_t shared_stat;
+
+/* the wait group of a batch job, as commonly written with pthreads */
+static struct {
+	pthread_mutex_t m;
+	pthread_cond_t zero;
+	long count;
+} pwg = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0};
+
+/* read-mostly data, as read by the *_read benchmarks */
+static struct { size_t a, b; } table;
+
+/* the shared state touched by every (short) critical section */
+static volatile size_t counter;
+static atomic_int ready, go, running;
+
+typedef struct {
+	size_t iters;
+	void (*fn)(size_t iters);
+} worker_t;
+
+static void *worker(void *arg)
+{
+	worker_t *w = arg;
+
+	atomic_fetch_add(&ready, 1);
+	while (!atomic_load(&go))
+		sync_yield();
+	w->fn(w->iters);
+	atomic_fetch_sub(&running, 1);
+	return NULL;
+}
+
+/*
+ * runs fn on b->size threads, which share b->iters operations between them.
+ * Only the operations are timed, not thread creation or exit.
+ */
+static void run_threads(bench_t *b, void (*fn)(size_t iters))
+{
+	pthread_t tids[32];
+	worker_t w = {b->iters / b->size, fn};
+
+	atomic_store(&ready, 0);
+	atomic_store(&go, 0);
+	atomic_store(&running, (int)b->size);
+	for (size_t i = 0; i < b->size; i++)
+		pthread_create(&tids[i], NULL, worker, &w);
+	while (atomic_load(&ready) != (int)b->size)
+		sync_yield();
+
+	bench_reset(b);
+	atomic_store(&go, 1);
+	while (atomic_load(&running))
+		sync_yield();
+	bench_stop(b);
+
+	for (size_t i = 0; i < b->size; i++)
+		pthread_join(tids[i], NULL);
+}
+
+static void spin_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		spin_lock(&spin);
+		counter++;
+		spin_unlock(&spin);
+	}
+}
+
+static void ticket_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		ticket_lock(&ticket);
+		counter++;
+		ticket_unlock(&ticket);
+	}
+}
+
+static void mcs_ops(size_t iters)
+{
+	mcs_node_t node;
+
+	for (size_t i = 0; i < iters; i++) {
+		mcs_lock(&mcs, &node);
+		counter++;
+		mcs_unlock(&mcs, &node);
+	}
+}
+
+static void mutex_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		mutex_lock(&mutex);
+		counter++;
+		mutex_unlock(&mutex);
+	}
+}
+
+static void pmutex_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		pthread_mutex_lock(&pmutex);
+		counter++;
+		pthread_mutex_unlock(&pmutex);
+	}
+}
+
+static void rwlock_read_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		int token = rw_rdlock(&rw);
+		bench_keep(&table);
+		rw_rdunlock(&rw, token);
+	}
+}
+
+static void seqlock_read_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		size_t a, b;
+		unsigned s;
+		do {
+			s = seq_read_begin(&seq);
+			a = table.a;
+			b = table.b;
+		} while (seq_read_retry(&seq, s));
+		bench_keep(&a);
+		bench_keep(&b);
+	}
+}
+
+static void pthread_rwlock_read_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		pthread_rwlock_rdlock(&prw);
+		bench_keep(&table);
+		pthread_rwlock_unlock(&prw);
+	}
+}
+
+static void wg_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		wg_add(&wg, 1);
+		wg_done(&wg);
+	}
+}
+
+static void pwg_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		pthread_mutex_lock(&pwg.m);
+		pwg.count++;
+		pthread_mutex_unlock(&pwg.m);
+		pthread_mutex_lock(&pwg.m);
+		if (!--pwg.count)
+			pthread_cond_broadcast(&pwg.zero);
+		pthread_mutex_unlock(&pwg.m);
+	}
+}
+
+static void sema_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		sema_wait(&sem);
+		counter++;
+		sema_post(&sem, 1);
+	}
+}
+
+static void psem_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++) {
+		sem_wait(&psem);
+		counter++;
+		sem_post(&psem);
+	}
+}
+
+static void barrier_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++)
+		barrier_wait(&barrier);
+}
+
+static void pbarrier_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++)
+		pthread_barrier_wait(&pbarrier);
+}
+
+static void nop(void *arg)
+{
+	bench_keep(arg);
+}
+
+static void counter_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++)
+		counter_inc(&stat);
+}
+
+/* the baseline: every thread increments the same line */
+static void atomic_counter_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++)
+		atomic_fetch_add_explicit(&shared_stat, 1, memory_order_relaxed);
+}
+
+static void pnop(void)
+{
+}
+
+static void once_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++)
+		once_call(&once, nop, NULL);
+}
+
+static void ponce_ops(size_t iters)
+{
+	for (size_t i = 0; i < iters; i++)
+		pthread_once(&ponce, pnop);
+}
+
+static void bench_spinlock(bench_t *b) { run_threads(b, spin_ops); }
+static void bench_ticketlock(bench_t *b) { run_threads(b, ticket_ops); }
+static void bench_mcslock(bench_t *b) { run_threads(b, mcs_ops); }
+static void bench_mutex(bench_t *b) { run_threads(b, mutex_ops); }
+static void bench_pthread_mutex(bench_t *b) { run_threads(b, pmutex_ops); }
+static void bench_rwlock_read(bench_t *b) { run_threads(b, rwlock_read_ops); }
+static void bench_seqlock_read(bench_t *b) { run_threads(b, seqlock_read_ops); }
+static void bench_pthread_rwlock_read(bench_t *b) { run_threads(b, pthread_rwlock_read_ops); }
+static void bench_wg(bench_t *b) { run_threads(b, wg_ops); }
+static void bench_pthread_wg(bench_t *b) { run_threads(b, pwg_ops); }
+static void bench_sema(bench_t *b) { run_threads(b, sema_ops); }
+static void bench_posix_sem(bench_t *b) { run_threads(b, psem_ops); }
+static void bench_once(bench_t *b) { run_threads(b, once_ops); }
+static void bench_pthread_once(bench_t *b) { run_threads(b, ponce_ops); }
+static void bench_counter(bench_t *b) { run_threads(b, counter_ops); }
+static void bench_atomic_counter(bench_t *b) { run_threads(b, atomic_counter_ops); }
+
+static void bench_barrier(bench_t *b)
+{
+	barrier_init(&barrier, (int)b->size);
+	run_threads(b, barrier_ops);
+}
+
+static void bench_pthread_barrier(bench_t *b)
+{
+	pthread_barrier_init(&pbarrier, NULL, (unsigned)b->size);
+	run_threads(b, pbarrier_ops);
+	pthread_barrier_destroy(&pbarrier);
+}
+
+int main(int argc, char **argv)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	bench_init(argc, argv);
+	rw_init(&rw);
+	sem_init(&psem, 0, 1);
+
+	for (size_t i = 0; i < sizeof(threads)/sizeof(threads[0]); i++) {
+		bench_run("spinlock", threads[i], bench_spinlock, NULL);
+		bench_run("mutex", threads[i], bench_mutex, NULL);
+		bench_run("pthread_mutex", threads[i], bench_pthread_mutex, NULL);
+		bench_run("rwlock_read", threads[i], bench_rwlock_read, NULL);
+		bench_run("seqlock_read", threads[i], bench_seqlock_read, NULL);
+		bench_run("pthread_rwlock_read", threads[i], bench_pthread_rwlock_read, NULL);
+		bench_run("waitgroup", threads[i], bench_wg, NULL);
+		bench_run("pthread_waitgroup", threads[i], bench_pthread_wg, NULL);
+		bench_run("semaphore", threads[i], bench_sema, NULL);
+		bench_run("posix_sem", threads[i], bench_posix_sem, NULL);
+		bench_run("barrier", threads[i], bench_barrier, NULL);
+		bench_run("pthread_barrier", threads[i], bench_pthread_barrier, NULL);
+		bench_run("once", threads[i], bench_once, NULL);
+		bench_run("pthread_once", threads[i], bench_pthread_once, NULL);
+		bench_run("counter", threads[i], bench_counter, NULL);
+		bench_run("atomic_counter", threads[i], bench_atomic_counter, NULL);
+
+		/*
+		 * Fair locks convoy once waiters are preempted, as every handoff
+		 * must wait for the next thread in line to be scheduled.
+		 */
+		if ((long)threads[i] > cpus)
+			continue;
+		bench_run("ticketlock", threads[i], bench_ticketlock, NULL);
+		bench_run("mcslock", threads[i], bench_mcslock, NULL);
+	}
+}
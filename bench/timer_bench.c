@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HLC_AUTO_INCLUDE
+#define TIMER_IMPL
+#include "bench.h"
+#include "../timer.h"
+
+/* the numbers of timers pending while others are started and stopped */
+static const size_t sizes[] = {16, 1000, 100000};
+
+/* deadlines are spread over this much time, in ns (ticks of 1us) */
+#define SPREAD 10000000000u
+#define TICK 1000
+
+/* a random 64-bit number (xorshift64) */
+static uint64_t rnd(void)
+{
+	static uint64_t x = 88172645463325252u;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return x;
+}
+
+static void nop(void *arg)
+{
+	bench_keep(arg);
+}
+
+/*
+ * The baseline: a binary min-heap of timers by deadline, each of which knows
+ * its position, so that it can be stopped in O(log n).
+ */
+typedef struct {
+	uint64_t deadline;
+	size_t pos;
+} htimer_t;
+
+typedef struct {
+	htimer_t **v;
+	size_t len;
+} heap_t;
+
+static void heap_set(heap_t *h, size_t i, htimer_t *t)
+{
+	h->v[i] = t;
+	t->pos = i;
+}
+
+static void heap_up(heap_t *h, size_t i)
+{
+	htimer_t *t = h->v[i];
+
+	for (; i && h->v[(i - 1) / 2]->deadline > t->deadline; i = (i - 1) / 2)
+		heap_set(h, i, h->v[(i - 1) / 2]);
+	heap_set(h, i, t);
+}
+
+static void heap_down(heap_t *h, size_t i)
+{
+	htimer_t *t = h->v[i];
+	size_t c;
+
+	while ((c = 2 * i + 1) < h->len) {
+		if (c + 1 < h->len && h->v[c + 1]->deadline < h->v[c]->deadline)
+			c++;
+		if (h->v[c]->deadline >= t->deadline)
+			break;
+		heap_set(h, i, h->v[c]);
+		i = c;
+	}
+	heap_set(h, i, t);
+}
+
+static void heap_add(heap_t *h, htimer_t *t, uint64_t deadline)
+{
+	t->deadline = deadline;
+	heap_set(h, h->len++, t);
+	heap_up(h, t->pos);
+}
+
+static void heap_del(heap_t *h, htimer_t *t)
+{
+	size_t i = t->pos;
+
+	if (i == --h->len)
+		return;
+	heap_set(h, i, h->v[h->len]);
+	heap_up(h, i);
+	heap_down(h, h->v[i]->pos);
+}
+
+/* the timeout pattern: a timer started, then stopped long before it expires */
+static void bench_wheel_start_stop(bench_t *b)
+{
+	timer_wheel_t *w = malloc(sizeof(*w));
+	wtimer_t *bg = calloc(b->size, sizeof(*bg)), t = WTIMER_INIT;
+
+	timer_wheel_init(w, TICK, 0);
+	for (size_t i = 0; i < b->size; i++)
+		timer_wheel_add(w, &bg[i], rnd() % SPREAD, nop, NULL);
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		timer_wheel_add(w, &t, rnd() % SPREAD, nop, NULL);
+		timer_wheel_del(w, &t);
+	}
+	bench_stop(b);
+
+	free(bg);
+	free(w);
+}
+
+static void bench_heap_start_stop(bench_t *b)
+{
+	heap_t h = {malloc((b->size + 1) * sizeof(*h.v)), 0};
+	htimer_t *bg = calloc(b->size, sizeof(*bg)), t;
+
+	for (size_t i = 0; i < b->size; i++)
+		heap_add(&h, &bg[i], rnd() % SPREAD);
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		heap_add(&h, &t, rnd() % SPREAD);
+		heap_del(&h, &t);
+	}
+	bench_stop(b);
+
+	free(bg);
+	free(h.v);
+}
+
+/*
+ * The steady state of b->size pending timers: each op restarts one (stopping
+ * it first if it has not expired), then advances the time so that on average
+ * one expires.
+ */
+static void bench_wheel_expire(bench_t *b)
+{
+	timer_wheel_t *w = malloc(sizeof(*w));
+	wtimer_t *t = calloc(b->size, sizeof(*t));
+	uint64_t now = 0, step = SPREAD / b->size;
+	size_t fired = 0;
+
+	timer_wheel_init(w, TICK, 0);
+	for (size_t i = 0; i < b->size; i++)
+		timer_wheel_add(w, &t[i], rnd() % SPREAD, nop, NULL);
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		timer_wheel_del(w, &t[i % b->size]);
+		timer_wheel_add(w, &t[i % b->size], now + rnd() % SPREAD, nop, NULL);
+		fired += timer_wheel_advance(w, now += step);
+	}
+	bench_stop(b);
+
+	bench_keep(&fired);
+	free(t);
+	free(w);
+}
+
+/* an expired timer of the heap has no position */
+#define EXPIRED ((size_t)-1)
+
+static void bench_heap_expire(bench_t *b)
+{
+	heap_t h = {malloc(b->size * sizeof(*h.v)), 0};
+	htimer_t *t = calloc(b->size, sizeof(*t)), *f;
+	uint64_t now = 0, step = SPREAD / b->size;
+	size_t fired = 0;
+
+	for (size_t i = 0; i < b->size; i++)
+		heap_add(&h, &t[i], rnd() % SPREAD);
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		f = &t[i % b->size];
+		if (f->pos != EXPIRED)
+			heap_del(&h, f);
+		heap_add(&h, f, now + rnd() % SPREAD);
+		now += step;
+		while (h.len && h.v[0]->deadline <= now) {
+			f = h.v[0];
+			heap_del(&h, f);
+			f->pos = EXPIRED;
+			nop(f);
+			fired++;
+		}
+	}
+	bench_stop(b);
+
+	bench_keep(&fired);
+	free(t);
+	free(h.v);
+}
+
+/* the same as wheel_start_stop, on the shared wheel, with its lock */
+static void bench_wtimer_start_stop(bench_t *b)
+{
+	wtimer_t t = WTIMER_INIT;
+	uint64_t now = timer_now();
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		wtimer_start(&t, now + SPREAD + rnd() % SPREAD, nop, NULL);
+		wtimer_stop(&t);
+	}
+	bench_stop(b);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		bench_run("wheel_start_stop", sizes[i], bench_wheel_start_stop, NULL);
+		bench_run("heap_start_stop", sizes[i], bench_heap_start_stop, NULL);
+	}
+	for (size_t i = 0; i < sizeof(sizes) / sizeof(*sizes); i++) {
+		bench_run("wheel_expire", sizes[i], bench_wheel_expire, NULL);
+		bench_run("heap_expire", sizes[i], bench_heap_expire, NULL);
+	}
+	bench_run("wtimer_start_stop", 1, bench_wtimer_start_stop, NULL);
+}
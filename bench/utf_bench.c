@@ -0,0 +1,83 @@
+#include <locale.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#define HLC_AUTO_INCLUDE
+#include "bench.h"
+#include "../alloc.h"
+#include "../utf.h"
+
+static const size_t sizes[] = {16, 256, 4096, 65536};
+static char *input;
+
+/* fills input with size bytes of mixed one and two byte UTF-8 */
+static void make_input(size_t size)
+{
+	size_t i = 0;
+
+	free(input);
+	input = malloc(size + 1);
+	while (i < size) {
+		if (i % 8 == 0 && i + 2 <= size) {
+			memcpy(input + i, "\xc2\xa3", 2); /* pound sign */
+			i += 2;
+		} else {
+			input[i] = 'a' + (i % 26);
+			i++;
+		}
+	}
+	input[size] = '\0';
+}
+
+static void bench_utf_decode(bench_t *b)
+{
+	for (size_t i = 0; i < b->iters; i++) {
+		size_t len;
+		rune_t *r = utf_decode(input, &len);
+		bench_keep(r);
+		free(r);
+	}
+}
+
+static void bench_libc_mbstowcs(bench_t *b)
+{
+	for (size_t i = 0; i < b->iters; i++) {
+		size_t len = mbstowcs(NULL, input, 0);
+		wchar_t *r = malloc((len + 1) * sizeof(wchar_t));
+		mbstowcs(r, input, len + 1);
+		bench_keep(r);
+		free(r);
+	}
+}
+
+static void bench_utf_next(bench_t *b)
+{
+	for (size_t i = 0; i < b->iters; i++) {
+		char *walk = input;
+		size_t len = b->size;
+		rune_t sum = 0;
+		while (len)
+			sum += utf_next(&walk, &len);
+		bench_keep(&sum);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+	if (!setlocale(LC_ALL, "C.UTF-8"))
+		setlocale(LC_ALL, "");
+
+	for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		make_input(sizes[i]);
+
+		bench_run("utf_decode", sizes[i], bench_utf_decode, NULL);
+		bench_run("libc_mbstowcs", sizes[i], bench_libc_mbstowcs, NULL);
+		bench_run("utf_next", sizes[i], bench_utf_next, NULL);
+	}
+
+	free(input);
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HLC_AUTO_INCLUDE
+#include "bench.h"
+#include "../alloc.h"
+#include "../vect.h"
+
+vect_declare(int, vector_int);
+
+static const size_t sizes[] = {16, 256, 4096, 65536};
+
+/* appends b->size elements to a fresh vector */
+static void bench_vect_append(bench_t *b)
+{
+	for (size_t i = 0; i < b->iters; i++) {
+		vector_int v = vect_init(vector_int);
+		for (size_t j = 0; j < b->size; j++)
+			vect_append(&v, (int)j);
+		bench_keep(v.v.buf);
+		vect_destroy(&v);
+	}
+}
+
+static void bench_array_append(bench_t *b)
+{
+	for (size_t i = 0; i < b->iters; i++) {
+		size_t len = 0, cap = 0;
+		int *arr = NULL;
+		for (size_t j = 0; j < b->size; j++) {
+			if (len == cap) {
+				cap = (cap + 1) * 2;
+				arr = realloc(arr, cap * sizeof(int));
+			}
+			arr[len++] = (int)j;
+		}
+		bench_keep(arr);
+		free(arr);
+	}
+}
+
+/* sums all b->size elements; one op is a full pass */
+static void bench_vect_get(bench_t *b)
+{
+	vector_int v = vect_init(vector_int);
+	for (size_t j = 0; j < b->size; j++)
+		vect_append(&v, (int)j);
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		long sum = 0;
+		for (size_t j = 0; j < vect_len(&v); j++)
+			sum += vect_get(&v, j);
+		bench_keep(&sum);
+	}
+	bench_stop(b);
+
+	vect_destroy(&v);
+}
+
+static void bench_array_get(bench_t *b)
+{
+	int *arr = malloc(b->size * sizeof(int));
+	for (size_t j = 0; j < b->size; j++)
+		arr[j] = (int)j;
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		long sum = 0;
+		for (size_t j = 0; j < b->size; j++)
+			sum += arr[j];
+		bench_keep(&sum);
+	}
+	bench_stop(b);
+
+	free(arr);
+}
+
+/* searches for a missing element; one op is a full pass */
+static void bench_vect_contains(bench_t *b)
+{
+	vector_int v = vect_init(vector_int);
+	for (size_t j = 0; j < b->size; j++)
+		vect_append(&v, (int)j);
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		int r = vect_contains(&v, -1);
+		bench_keep(&r);
+	}
+	bench_stop(b);
+
+	vect_destroy(&v);
+}
+
+static void bench_array_contains(bench_t *b)
+{
+	int *arr = malloc(b->size * sizeof(int));
+	for (size_t j = 0; j < b->size; j++)
+		arr[j] = (int)j;
+
+	bench_reset(b);
+	for (size_t i = 0; i < b->iters; i++) {
+		int r = 0, needle = -1;
+		bench_keep(&needle);
+		for (size_t j = 0; j < b->size; j++) {
+			if (arr[j] == needle) {
+				r = 1;
+				break;
+			}
+		}
+		bench_keep(&r);
+	}
+	bench_stop(b);
+
+	free(arr);
+}
+
+int main(int argc, char **argv)
+{
+	bench_init(argc, argv);
+
+	for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		bench_run("vect_append", sizes[i], bench_vect_append, NULL);
+		bench_run("array_append", sizes[i], bench_array_append, NULL);
+		bench_run("vect_get", sizes[i], bench_vect_get, NULL);
+		bench_run("array_get", sizes[i], bench_array_get, NULL);
+		bench_run("vect_contains", sizes[i], bench_vect_contains, NULL);
+		bench_run("array_contains", sizes[i], bench_array_contains, NULL);
+	}
+}
@@ -2,7 +2,7 @@
  * buf.h - utility macros for temporary buffers
  * Copyright (C) Ethan Marshall - 2023
  *
- * Requirements: stdlib.h
+ * Requirements: stdlib.h stdio.h string.h alloc.h
  */
 
 #ifdef HLC_AUTO_INCLUDE
@@ -11,6 +11,44 @@
 
 #ifdef BUF_AUTO_INCLUDE
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "alloc.h"
+#endif
+
+/*
+ * BUF_GROWTH_NUM and BUF_GROWTH_DEN form the fraction by which the capacity of
+ * a buffer is multiplied each time it must grow. The default of 2/1 doubles
+ * the capacity; 3/2 trades more frequent reallocation for less wasted space.
+ * Either may be defined before including this header, but BUF_GROWTH_NUM must
+ * not be less than BUF_GROWTH_DEN. A buffer always grows by at least one
+ * element.
+ */
+#ifndef BUF_GROWTH_NUM
+#define BUF_GROWTH_NUM 2
+#endif
+#ifndef BUF_GROWTH_DEN
+#define BUF_GROWTH_DEN 1
+#endif
+
+/*
+ * BUF_MALLOC, BUF_REALLOC and BUF_DEALLOC are the routines through which all
+ * buffer storage is allocated, resized and released, defaulting to the hlc
+ * system allocator (see alloc.h). All sizes are in bytes.
+ * The previous size of a block is passed along so that allocators which do not
+ * track block sizes themselves (such as arenas or pools) can be plugged in by
+ * defining these before including this header. BUF_REALLOC must leave the
+ * original block intact and return NULL on failure, as realloc does.
+ */
+#ifndef BUF_MALLOC
+#define BUF_MALLOC(size) _alloc_malloc_at(NULL, size, ALLOC_MOD_BUF, __func__)
+#endif
+#ifndef BUF_REALLOC
+#define BUF_REALLOC(ptr, oldsize, newsize) \
+	_alloc_realloc_at(NULL, ptr, oldsize, newsize, ALLOC_MOD_BUF, __func__)
+#endif
+#ifndef BUF_DEALLOC
+#define BUF_DEALLOC(ptr, size) _alloc_free_at(NULL, ptr, size, ALLOC_MOD_BUF, __func__)
 #endif
 
 /*
@@ -21,14 +59,49 @@
 #define LENGTH(x) (sizeof(x)/sizeof(x[0]))
 #endif
 
+/*
+ * Internal: grows the buffer whose pointer variable is at bufp, holding
+ * elements of esize bytes, from capacity *cap by the configured growth factor.
+ * On success the pointer variable and *cap are updated and one is returned. If
+ * the new size would overflow or allocation fails, zero is returned and the
+ * buffer is left untouched.
+ */
+static inline int _buf_grow(void *bufp, size_t esize, size_t *cap)
+{
+	void *old, *new;
+	size_t inc, newcap;
+
+	inc = *cap / BUF_GROWTH_DEN;
+	if (BUF_GROWTH_NUM > BUF_GROWTH_DEN &&
+			inc > ((size_t)-1) / (BUF_GROWTH_NUM - BUF_GROWTH_DEN))
+		return 0;
+	inc *= BUF_GROWTH_NUM - BUF_GROWTH_DEN;
+	if (inc == 0)
+		inc = 1;
+
+	newcap = *cap + inc;
+	if (newcap < *cap || newcap > ((size_t)-1) / esize)
+		return 0;
+
+	memcpy(&old, bufp, sizeof(old));
+	new = BUF_REALLOC(old, esize * *cap, esize * newcap);
+	if (!new)
+		return 0;
+	memcpy(bufp, &new, sizeof(new));
+	*cap = newcap;
+
+	return 1;
+}
+
 /*
  * BUF_NEW creates a new heap buffer of elements type typename and buffer
  * variable name bufname. The buffer initially starts with two element capacity
- * and doubles on reallocation.
+ * and grows by BUF_GROWTH_NUM/BUF_GROWTH_DEN on reallocation. If the initial
+ * allocation fails, the buffer starts with zero capacity.
  */
-#define BUF_NEW(typename, bufname)				\
-	typename *bufname = malloc(sizeof(typename) * 2);	\
-	size_t bufname##_len = 0, bufname##_cap = 2;
+#define BUF_NEW(typename, bufname)					\
+	typename *bufname = BUF_MALLOC(sizeof(typename) * 2);		\
+	size_t bufname##_len = 0, bufname##_cap = bufname ? 2 : 0;
 
 /*
  * BUF_ATTACH inherits buffer data from already stored information. All normal
@@ -64,24 +137,32 @@
  */
 #define BUF_CAP(bufname) (bufname##_cap)
 
+/*
+ * BUF_TRY_PUSH appends a new item into the buffer and evaluates to one. If
+ * the buffer is full and growing it fails (either because the allocator
+ * returned NULL or because the new size would overflow), no element is
+ * appended, the buffer is left as it was and BUF_TRY_PUSH evaluates to zero.
+ * This allows callers to shed load or apply backpressure under memory
+ * pressure.
+ */
+#define BUF_TRY_PUSH(bufname, elem)						\
+	((bufname##_len < bufname##_cap ||					\
+	  _buf_grow(&bufname, sizeof(*bufname), &bufname##_cap))		\
+	 ? (bufname[bufname##_len++] = (elem), 1)				\
+	 : 0)
+
 /*
  * BUF_PUSH appends a new item into the buffer. If memory reallocation occurs
- * and fails, the call blocks until memory is available. No checks are done
- * against overflows of the size counters, as you will be *way* over your
- * system memory limit by then.
+ * and fails, BUF_PUSH panics, printing debugging information to standard
+ * error. If you would rather handle allocation failure, use BUF_TRY_PUSH.
  */
-#define BUF_PUSH(bufname, elem)					\
-	if (bufname##_len == bufname##_cap) {			\
-		void *tmp = NULL;				\
-		while (!tmp)					\
-			tmp = realloc(bufname,			\
-					sizeof(*bufname) * 	\
-					bufname##_cap * 2);	\
-		bufname = tmp;					\
-		bufname##_cap *= 2;				\
-	}							\
-	bufname[bufname##_len] = elem;				\
-	bufname##_len++;					\
+#define BUF_PUSH(bufname, elem)							\
+	do {									\
+		if (!BUF_TRY_PUSH(bufname, elem)) {				\
+			fprintf(stderr, "PANIC: out of memory (buffer realloc)\n");	\
+			abort();						\
+		}								\
+	} while (0)
 
 /*
  * BUF_GET returns a pointer to the element at the ith index, or null if it is
@@ -93,6 +174,6 @@
  * BUF_FREE frees all memory associated with the given heap buffer and sets all
  * counters associated with it to zero.
  */
-#define BUF_FREE(bufname) free(bufname); \
+#define BUF_FREE(bufname) BUF_DEALLOC(bufname, sizeof(*bufname) * bufname##_cap); \
 	bufname##_len = 0; \
 	bufname##_cap = 0;
@@ -0,0 +1,1607 @@
+/*
+ * chan.h - C11 implementation of a type-safe, by-value CSP channel, Go style
+ * Copyright (C) Ethan Marshall - 2023
+ *
+ * Requirements: stdlib.h stdint.h string.h limits.h time.h stdatomic.h pthread.h
+ *               alloc.h sync.h timer.h
+ *               CHAN_IMPL and TIMER_IMPL in one translation unit (see below)
+ *
+ * A channel is a bounded FIFO queue through which threads pass values of one
+ * type. Values are copied in and out of the channel, so a value may go out of
+ * scope as soon as it has been sent. A sender blocks while the channel is
+ * full, and a receiver while it is empty, by sleeping in the kernel (see
+ * sync.h) until the other side makes progress.
+ *
+ * The implementation depends on how the channel is shared, which is fixed
+ * when the channel is created (see chan_mode):
+ *
+ * CHAN_SPSC: exactly one thread sends and exactly one thread receives (at a
+ *            time). Sending and receiving are wait-free unless the channel is
+ *            full or empty: each costs one copy and one release store, and
+ *            the two sides touch each other's cache lines only when their
+ *            cached view of the other's index runs out.
+ * CHAN_MPMC: any number of threads send and receive. Each slot of the ring
+ *            carries a sequence number which says whether it is ready to be
+ *            written or read in the current lap (after Vyukov), so sending
+ *            and receiving are lock-free: each claims a slot with one
+ *            compare-and-swap, and senders never contend with receivers
+ *            unless the channel is nearly full or empty.
+ *
+ * In either mode, each send or receive then checks whether a thread is
+ * asleep on the other side, with a load of a line the sleepers write only
+ * when they queue. The check must be ordered after the update which the
+ * sleeper waits for, else a thread could queue itself and check the channel
+ * just before the update became visible, while the updater read the queue as
+ * empty, and sleep forever. That ordering is paid for by the thread going to
+ * sleep, with sync_heavy_fence (a membarrier(2) system call on Linux), so the
+ * update itself needs no fence (see sync_light_fence).
+ *
+ * A channel created with a capacity of zero is unbuffered, whatever its mode:
+ * as in Go, a send waits for a receiver (and vice versa), and the value is
+ * copied straight from the sender to the receiver, with whichever arrived
+ * first woken by the other. Any number of threads may share it.
+ *
+ * A thread may wait on several channels at once with chan_select, which
+ * sleeps once, queued on every channel, until one of its cases can proceed.
+ * Sleeping operations may be given a deadline, and timers which send on a
+ * channel are made with chan_after and chan_ticker; both are kept on the
+ * timer wheel of timer.h.
+ *
+ * Any thread may close a channel. Once closed, sends fail, and receives drain
+ * whatever was sent before closing, then fail; every thread sleeping on the
+ * channel is woken. As in Go, closing is normally done once all senders are
+ * done: a send which races with closing is a programming error (in Go, it
+ * panics), and may be lost.
+ *
+ * Exactly one translation unit of a program using channels must define
+ * CHAN_IMPL before including this header, to provide the state through which
+ * a fiber (see fiber.h) parks on a channel rather than blocking its thread:
+ * there is one for the whole program, so that it does so whichever
+ * translation unit the channel operation was compiled in. The same unit must
+ * also define TIMER_IMPL (see timer.h).
+ */
+
+#ifndef HLC_CHAN_H
+#define HLC_CHAN_H
+
+#ifdef HLC_AUTO_INCLUDE
+#define CHAN_AUTO_INCLUDE
+#endif
+
+#ifdef CHAN_AUTO_INCLUDE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "alloc.h"
+#include "sync.h"
+#include "timer.h"
+#endif
+
+/*
+ * chan_mode selects the implementation of a channel, according to how many
+ * threads may send and receive on it concurrently. Using a channel with more
+ * threads than its mode allows is undefined.
+ */
+enum chan_mode {
+	CHAN_SPSC,
+	CHAN_MPMC
+};
+
+/*
+ * Internal: a user-space thread (such as a fiber of fiber.h) which waits on a
+ * channel by parking itself, rather than the OS thread which runs it. park
+ * returns once *state is set, and is woken to check it by unpark, which may
+ * be called before park, in which case park returns at once.
+ */
+struct _chan_task {
+	void (*park)(struct _chan_task *t, atomic_int *state);
+	void (*unpark)(struct _chan_task *t);
+};
+
+/* Internal: the task running on the calling thread, if any (see CHAN_IMPL) */
+extern _Thread_local struct _chan_task *_chan_task_running;
+#ifdef CHAN_IMPL
+_Thread_local struct _chan_task *_chan_task_running;
+#endif
+
+/*
+ * Internal: returns the task running on the calling thread. It is never
+ * inlined, as a task may move to another thread while parked, and the
+ * compiler could otherwise reuse the address of the old thread's variable.
+ */
+#ifdef __GNUC__
+__attribute__((noinline, unused))
+#endif
+static struct _chan_task *_chan_task_self(void)
+{
+	return _chan_task_running;
+}
+
+/*
+ * Internal: a thread parked on a channel. state points to its futex word,
+ * which is zero until the thread is woken, and which is shared by every
+ * waiter of a chan_select. done is set once the waker has finished with both.
+ * queued is protected by the lock of the queue. task is the task which the
+ * thread is running, if any, to be unparked rather than woken.
+ *
+ * On an unbuffered channel, elem is the value to be sent or the space to
+ * receive into, and ok is set by the thread which completed the handoff.
+ */
+struct _chan_waiter {
+	struct _chan_waiter *next, *prev;
+	int queued, ok;
+	void *elem;
+	atomic_int *state;
+	struct _chan_task *task;
+	atomic_int done;
+};
+
+/*
+ * Internal: a FIFO queue of parked threads. len is the number of waiters, so
+ * that waking an empty queue costs a single load. lock points to the mutex
+ * which protects the queue: its own, or on an unbuffered channel, the one
+ * shared by both queues.
+ */
+struct _chan_wq {
+	atomic_int len;
+	mutex_t *lock;
+	mutex_t mu;
+	struct _chan_waiter *head, *tail;
+};
+
+/*
+ * _chan_t is the internal generic channel implementation, which deals in
+ * untyped elements of a size given to each routine. Each side's index shares
+ * its cache line only with that side's cached copy of the other index.
+ */
+struct _chan_t {
+	/* written by senders */
+	SYNC_ALIGNED atomic_size_t tail;
+	size_t head_cache;
+	/* written by receivers */
+	SYNC_ALIGNED atomic_size_t head;
+	size_t tail_cache;
+	/* constant once the channel is created, apart from closed */
+	SYNC_ALIGNED unsigned char *buf;
+	/* CHAN_MPMC only: the sequence number of each slot */
+	atomic_size_t *seq;
+	size_t cap, mask, tsiz;
+	enum chan_mode mode;
+	atomic_int closed;
+	const allocator_t *alloc;
+	/* the block holding the typed channel, as obtained from alloc (see chan_new) */
+	void *block;
+	/* waiters are rarely queued, but their queues are checked on every operation */
+	SYNC_ALIGNED struct _chan_wq recvq;
+	SYNC_ALIGNED struct _chan_wq sendq;
+};
+
+/*
+ * Internal: initializes c to hold cap elements of size tsiz, or if cap is
+ * zero, to be unbuffered. Returns zero if memory is exhausted.
+ */
+static inline int _chan_init(struct _chan_t *c, size_t tsiz, size_t cap, enum chan_mode mode,
+		const allocator_t *alloc)
+{
+	size_t ring = 1;
+
+	memset(c, 0, sizeof(*c));
+	c->tsiz = tsiz;
+	c->mode = mode;
+	c->alloc = alloc;
+	c->recvq.lock = &c->recvq.mu;
+	/* handing off needs both queues at once, so an unbuffered channel has one lock */
+	c->sendq.lock = cap ? &c->sendq.mu : &c->recvq.mu;
+	if (cap == 0)
+		return 1;
+	if (cap > SIZE_MAX / 2)
+		return 0;
+	/* an MPMC slot's sequence number cannot tell this lap from the next with one slot */
+	while (ring < cap || (mode == CHAN_MPMC && ring < 2))
+		ring *= 2;
+	if (tsiz && ring > SIZE_MAX / tsiz)
+		return 0;
+
+	c->buf = _alloc_malloc_at(alloc, ring * tsiz, ALLOC_MOD_CHAN, __func__);
+	if (!c->buf)
+		return 0;
+	if (mode == CHAN_MPMC) {
+		c->seq = _alloc_malloc_at(alloc, ring * sizeof(*c->seq), ALLOC_MOD_CHAN, __func__);
+		if (!c->seq) {
+			_alloc_free_at(alloc, c->buf, ring * tsiz, ALLOC_MOD_CHAN, __func__);
+			return 0;
+		}
+		/* slot i is first written when tail is i */
+		for (size_t i = 0; i < ring; i++)
+			atomic_init(&c->seq[i], i);
+	}
+	c->cap = cap;
+	c->mask = ring - 1;
+
+	return 1;
+}
+
+/* Internal: frees the storage of c */
+static inline void _chan_destroy(struct _chan_t *c)
+{
+	_alloc_free_at(c->alloc, c->buf, (c->mask + 1) * c->tsiz, ALLOC_MOD_CHAN, __func__);
+	_alloc_free_at(c->alloc, c->seq, (c->mask + 1) * sizeof(*c->seq), ALLOC_MOD_CHAN, __func__);
+	c->buf = NULL;
+	c->seq = NULL;
+}
+
+/*
+ * Internal: allocates size bytes from alloc, aligned to a cache line as the
+ * members of _chan_t require, where alloc only aligns for standard types. The
+ * block actually allocated is stored in *block, to be freed with
+ * _chan_free_block.
+ */
+static inline void *_chan_alloc_block(const allocator_t *alloc, size_t size, void **block)
+{
+	unsigned char *p;
+
+	if (size > SIZE_MAX - (SYNC_CACHE_LINE - 1))
+		return NULL;
+	p = _alloc_malloc_at(alloc, size + SYNC_CACHE_LINE - 1, ALLOC_MOD_CHAN, __func__);
+	if (!(*block = p))
+		return NULL;
+
+	return p + (SYNC_CACHE_LINE - (uintptr_t)p % SYNC_CACHE_LINE) % SYNC_CACHE_LINE;
+}
+
+/* Internal: frees block, as allocated by _chan_alloc_block for size bytes */
+static inline void _chan_free_block(const allocator_t *alloc, void *block, size_t size)
+{
+	_alloc_free_at(alloc, block, size + SYNC_CACHE_LINE - 1, ALLOC_MOD_CHAN, __func__);
+}
+
+/* Internal: frees c, of a typed channel of size bytes, and all of its storage */
+static inline void _chan_free(struct _chan_t *c, size_t size)
+{
+	const allocator_t *alloc = c->alloc;
+	void *block = c->block;
+
+	_chan_destroy(c);
+	_chan_free_block(alloc, block, size);
+}
+
+/* Internal: queues w on q, with q locked, to be woken through state */
+static inline void _chan_wq_link(struct _chan_wq *q, struct _chan_waiter *w, atomic_int *state)
+{
+	w->state = state;
+	w->task = _chan_task_self();
+	atomic_store_explicit(&w->done, 0, memory_order_relaxed);
+	w->next = NULL;
+	w->queued = 1;
+	w->ok = 0;
+
+	w->prev = q->tail;
+	if (q->tail)
+		q->tail->next = w;
+	else
+		q->head = w;
+	q->tail = w;
+	atomic_fetch_add_explicit(&q->len, 1, memory_order_relaxed);
+}
+
+/* Internal: queues w on q, to be woken through state, without fencing */
+static inline void _chan_wq_queue(struct _chan_wq *q, struct _chan_waiter *w, atomic_int *state)
+{
+	mutex_lock(q->lock);
+	_chan_wq_link(q, w, state);
+	mutex_unlock(q->lock);
+}
+
+/*
+ * Internal: queues w on q, to be woken through the futex word state, which
+ * the caller must have zeroed. The caller must check its condition again
+ * before parking, as a waker which ran before w was queued will not have
+ * seen it.
+ */
+static inline void _chan_wq_add(struct _chan_wq *q, struct _chan_waiter *w, atomic_int *state)
+{
+	_chan_wq_queue(q, w, state);
+
+	/* pairs with the fence in _chan_wq_wake: either we see its update, or it sees us */
+	sync_heavy_fence();
+}
+
+/* Internal: unlinks w from q, with q locked */
+static inline void _chan_wq_unlink(struct _chan_wq *q, struct _chan_waiter *w)
+{
+	if (w->prev)
+		w->prev->next = w->next;
+	else
+		q->head = w->next;
+	if (w->next)
+		w->next->prev = w->prev;
+	else
+		q->tail = w->prev;
+	w->queued = 0;
+	atomic_fetch_sub_explicit(&q->len, 1, memory_order_relaxed);
+}
+
+/*
+ * Internal: removes w from q, returning zero if it had already been woken (and
+ * so removed by the waker). A waiter must always be removed before it goes out
+ * of scope: this also waits for the waker to finish with it.
+ */
+static inline int _chan_wq_remove(struct _chan_wq *q, struct _chan_waiter *w)
+{
+	unsigned spins = 0;
+	int queued;
+
+	mutex_lock(q->lock);
+	queued = w->queued;
+	if (queued)
+		_chan_wq_unlink(q, w);
+	mutex_unlock(q->lock);
+
+	/* the waker has unlinked w, but may not yet have finished with it */
+	while (!queued && !atomic_load_explicit(&w->done, memory_order_acquire))
+		_sync_backoff(&spins);
+
+	return queued;
+}
+
+/*
+ * Internal: lets the owner of w, which has been unlinked and whose state has
+ * been set, carry on. w and its state may go out of scope as soon as it is
+ * done.
+ */
+static inline void _chan_waiter_release(struct _chan_waiter *w)
+{
+	atomic_int *state = w->state;
+
+	if (w->task) {
+		/* a task may exit once done, so it is unparked first */
+		w->task->unpark(w->task);
+		atomic_store_explicit(&w->done, 1, memory_order_release);
+		return;
+	}
+	atomic_store_explicit(&w->done, 1, memory_order_release);
+	/* at worst, a spurious wakeup for whatever reuses the address */
+	_sync_futex_wake(state, 1);
+}
+
+/*
+ * Internal: wakes up to n of the threads parked on q, oldest first. It must
+ * be called after the update which the waiters are waiting for.
+ *
+ * Waiters are woken after q is unlocked, as a woken thread immediately takes
+ * the lock to remove itself.
+ */
+static inline void _chan_wq_wake(struct _chan_wq *q, int n)
+{
+	struct _chan_waiter *w, *woken = NULL, *next;
+
+	sync_light_fence();
+	if (!atomic_load_explicit(&q->len, memory_order_relaxed))
+		return;
+
+	mutex_lock(q->lock);
+	for (; n > 0 && (w = q->head); n--) {
+		_chan_wq_unlink(q, w);
+		w->next = woken;
+		woken = w;
+	}
+	mutex_unlock(q->lock);
+
+	for (w = woken; w; w = next) {
+		next = w->next;
+		atomic_store_explicit(w->state, 1, memory_order_release);
+		_chan_waiter_release(w);
+	}
+}
+
+/* Internal: the deadline of a parked thread (see _chan_park) */
+struct _chan_timeout {
+	wtimer_t timer;
+	atomic_int *state;
+	struct _chan_task *task;
+};
+
+/*
+ * Internal: times out a parked thread, unless it has been woken already. Its
+ * state is set to -1, so that it can no longer be claimed by a handoff.
+ */
+static inline void _chan_timeout(void *arg)
+{
+	struct _chan_timeout *to = arg;
+	int zero = 0;
+
+	if (!atomic_compare_exchange_strong_explicit(to->state, &zero, -1,
+				memory_order_acq_rel, memory_order_relaxed))
+		return;
+	if (to->task)
+		to->task->unpark(to->task);
+	else
+		_sync_futex_wake(to->state, 1);
+}
+
+/*
+ * Internal: sleeps until one of the waiters sharing the futex word state is
+ * woken, or the deadline (if any) passes. Returns zero on timeout. A task
+ * parks itself instead, leaving its thread free to run others.
+ *
+ * Deadlines are kept on the timer wheel of timer.h, whose thread wakes the
+ * waiter if it is still parked by then, rather than by the kernel, so that
+ * the many timeouts which are cancelled early cost little.
+ */
+static inline int _chan_park(atomic_int *state, const struct timespec *deadline)
+{
+	struct _chan_task *t = _chan_task_self();
+	struct _chan_timeout to;
+	int zero = 0, armed = 0;
+
+	if (deadline && _sync_expired(deadline)) {
+		atomic_compare_exchange_strong_explicit(state, &zero, -1,
+				memory_order_acq_rel, memory_order_relaxed);
+	} else if (deadline) {
+		to.state = state;
+		to.task = t;
+		wtimer_start(&to.timer, (uint64_t)deadline->tv_sec * 1000000000u +
+				(uint64_t)deadline->tv_nsec, _chan_timeout, &to);
+		armed = 1;
+	}
+
+	if (t) {
+		t->park(t, state);
+	} else {
+		while (!atomic_load_explicit(state, memory_order_acquire))
+			_sync_futex_wait(state, 0, NULL);
+	}
+	/* to may not go out of scope while the timer's thread is using it */
+	if (armed)
+		wtimer_stop(&to.timer);
+
+	return atomic_load_explicit(state, memory_order_acquire) > 0;
+}
+
+/*
+ * Internal: gives up waiting on q after the wait was satisfied some other way.
+ * If w was woken in the meantime, the wakeup is passed on to another waiter,
+ * which may be able to use it.
+ */
+static inline void _chan_wq_cancel(struct _chan_wq *q, struct _chan_waiter *w)
+{
+	if (!_chan_wq_remove(q, w))
+		_chan_wq_wake(q, 1);
+}
+
+/*
+ * Internal: takes the oldest waiter from q, a queue of an unbuffered channel
+ * which is locked, and claims it for a handoff. Waiters whose chan_select has
+ * already been woken by another channel are skipped. Returns NULL if no
+ * waiter could be claimed.
+ */
+static inline struct _chan_waiter *_chan_sync_claim(struct _chan_wq *q)
+{
+	struct _chan_waiter *w;
+	int zero;
+
+	while ((w = q->head)) {
+		_chan_wq_unlink(q, w);
+		zero = 0;
+		if (atomic_compare_exchange_strong_explicit(w->state, &zero, 1,
+					memory_order_acq_rel, memory_order_relaxed))
+			return w;
+		/* its owner is already awake, and only waits for us to be done with w */
+		atomic_store_explicit(&w->done, 1, memory_order_release);
+	}
+
+	return NULL;
+}
+
+/*
+ * Internal: the implementation of sending (if send is true) and receiving on
+ * an unbuffered channel. The element at elem (of size ts) is copied straight
+ * to or from a thread waiting on the other side, which is then woken. If
+ * there is none, the calling thread waits to be claimed by the other side
+ * until the deadline (if any), or fails at once if block is zero. Returns
+ * true (>0) on success, zero if c is closed or block is zero and there was no
+ * other side, and -1 on timeout.
+ */
+static inline int _chan_sync(struct _chan_t *c, void *elem, size_t ts, int send, int block,
+		const struct timespec *deadline)
+{
+	struct _chan_wq *mine = send ? &c->sendq : &c->recvq, *theirs = send ? &c->recvq : &c->sendq;
+	struct _chan_waiter w, *o;
+	atomic_int state;
+
+	for (;;) {
+		mutex_lock(mine->lock);
+		if (atomic_load_explicit(&c->closed, memory_order_relaxed)) {
+			mutex_unlock(mine->lock);
+			return 0;
+		}
+		if ((o = _chan_sync_claim(theirs))) {
+			if (send)
+				memcpy(o->elem, elem, ts);
+			else
+				memcpy(elem, o->elem, ts);
+			o->ok = 1;
+			mutex_unlock(mine->lock);
+			_chan_waiter_release(o);
+			return 1;
+		}
+		if (!block) {
+			mutex_unlock(mine->lock);
+			return 0;
+		}
+
+		atomic_store_explicit(&state, 0, memory_order_relaxed);
+		w.elem = elem;
+		_chan_wq_link(mine, &w, &state);
+		mutex_unlock(mine->lock);
+
+		_chan_park(&state, deadline);
+		/* we are unlinked before our state is set, so still being queued means a timeout */
+		if (_chan_wq_remove(mine, &w))
+			return -1;
+		if (w.ok)
+			return 1;
+		/* woken without a handoff, by chan_close */
+	}
+}
+
+/* Internal: the CHAN_SPSC implementation of _chan_try_send, without waking */
+static inline int _chan_spsc_send(struct _chan_t *c, const void *val, size_t ts)
+{
+	size_t tail = atomic_load_explicit(&c->tail, memory_order_relaxed);
+
+	if (tail - c->head_cache >= c->cap) {
+		c->head_cache = atomic_load_explicit(&c->head, memory_order_acquire);
+		if (tail - c->head_cache >= c->cap)
+			return 0;
+	}
+
+	memcpy(c->buf + (tail & c->mask) * ts, val, ts);
+	atomic_store_explicit(&c->tail, tail + 1, memory_order_release);
+
+	return 1;
+}
+
+/* Internal: the CHAN_SPSC implementation of _chan_try_recv, without waking */
+static inline int _chan_spsc_recv(struct _chan_t *c, void *out, size_t ts)
+{
+	size_t head = atomic_load_explicit(&c->head, memory_order_relaxed);
+
+	if (head == c->tail_cache) {
+		c->tail_cache = atomic_load_explicit(&c->tail, memory_order_acquire);
+		if (head == c->tail_cache)
+			return 0;
+	}
+
+	memcpy(out, c->buf + (head & c->mask) * ts, ts);
+	atomic_store_explicit(&c->head, head + 1, memory_order_release);
+
+	return 1;
+}
+
+/*
+ * Internal: the CHAN_MPMC implementation of _chan_try_send, without waking.
+ *
+ * Slot i is ready to be written in the lap where tail is pos when its
+ * sequence number is pos, and ready to be read once the sender sets it to
+ * pos + 1. The receiver then sets it to pos + ring size, ready for the next
+ * lap.
+ */
+static inline int _chan_mpmc_send(struct _chan_t *c, const void *val, size_t ts)
+{
+	size_t pos = atomic_load_explicit(&c->tail, memory_order_relaxed), seq;
+	intptr_t dif;
+
+	for (;;) {
+		seq = atomic_load_explicit(&c->seq[pos & c->mask], memory_order_acquire);
+		dif = (intptr_t)seq - (intptr_t)pos;
+		if (dif < 0)
+			return 0;
+		if (dif > 0) {
+			/* another sender claimed the slot first */
+			pos = atomic_load_explicit(&c->tail, memory_order_relaxed);
+			continue;
+		}
+		/* the ring may be larger than the capacity asked for */
+		if (c->cap <= c->mask &&
+				pos - atomic_load_explicit(&c->head, memory_order_relaxed) >= c->cap)
+			return 0;
+		if (atomic_compare_exchange_weak_explicit(&c->tail, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed))
+			break;
+	}
+
+	memcpy(c->buf + (pos & c->mask) * ts, val, ts);
+	atomic_store_explicit(&c->seq[pos & c->mask], pos + 1, memory_order_release);
+
+	return 1;
+}
+
+/* Internal: the CHAN_MPMC implementation of _chan_try_recv, without waking */
+static inline int _chan_mpmc_recv(struct _chan_t *c, void *out, size_t ts)
+{
+	size_t pos = atomic_load_explicit(&c->head, memory_order_relaxed), seq;
+	intptr_t dif;
+
+	for (;;) {
+		seq = atomic_load_explicit(&c->seq[pos & c->mask], memory_order_acquire);
+		dif = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (dif < 0)
+			return 0;
+		if (dif > 0) {
+			pos = atomic_load_explicit(&c->head, memory_order_relaxed);
+			continue;
+		}
+		if (atomic_compare_exchange_weak_explicit(&c->head, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed))
+			break;
+	}
+
+	memcpy(out, c->buf + (pos & c->mask) * ts, ts);
+	atomic_store_explicit(&c->seq[pos & c->mask], pos + c->mask + 1, memory_order_release);
+
+	return 1;
+}
+
+/*
+ * Internal: copies the element at val (of size ts) into c without blocking.
+ * Returns zero if c is full or closed.
+ */
+static inline int _chan_try_send(struct _chan_t *c, const void *val, size_t ts)
+{
+	int sent;
+
+	if (!c->cap)
+		return _chan_sync(c, (void *)val, ts, 1, 0, NULL) > 0;
+	if (atomic_load_explicit(&c->closed, memory_order_relaxed))
+		return 0;
+	if (c->mode == CHAN_SPSC)
+		sent = _chan_spsc_send(c, val, ts);
+	else
+		sent = _chan_mpmc_send(c, val, ts);
+
+	if (sent)
+		_chan_wq_wake(&c->recvq, 1);
+	return sent;
+}
+
+/*
+ * Internal: copies the oldest element of c (of size ts) to out without
+ * blocking. Returns zero if c is empty.
+ */
+static inline int _chan_try_recv(struct _chan_t *c, void *out, size_t ts)
+{
+	int received;
+
+	if (!c->cap)
+		return _chan_sync(c, out, ts, 0, 0, NULL) > 0;
+	if (c->mode == CHAN_SPSC)
+		received = _chan_spsc_recv(c, out, ts);
+	else
+		received = _chan_mpmc_recv(c, out, ts);
+
+	if (received)
+		_chan_wq_wake(&c->sendq, 1);
+	return received;
+}
+
+/* Internal: copies n elements from vals into the ring of c, from index pos */
+static inline void _chan_copy_in(struct _chan_t *c, size_t pos, const void *vals, size_t n,
+		size_t ts)
+{
+	size_t off = pos & c->mask, first = c->mask + 1 - off;
+
+	if (first > n)
+		first = n;
+	memcpy(c->buf + off * ts, vals, first * ts);
+	memcpy(c->buf, (const unsigned char *)vals + first * ts, (n - first) * ts);
+}
+
+/* Internal: copies n elements from the ring of c, from index pos, to out */
+static inline void _chan_copy_out(struct _chan_t *c, size_t pos, void *out, size_t n, size_t ts)
+{
+	size_t off = pos & c->mask, first = c->mask + 1 - off;
+
+	if (first > n)
+		first = n;
+	memcpy(out, c->buf + off * ts, first * ts);
+	memcpy((unsigned char *)out + first * ts, c->buf, (n - first) * ts);
+}
+
+/* Internal: the CHAN_SPSC implementation of _chan_try_send_n, without waking */
+static inline size_t _chan_spsc_send_n(struct _chan_t *c, const void *vals, size_t n, size_t ts)
+{
+	size_t tail = atomic_load_explicit(&c->tail, memory_order_relaxed);
+
+	if (c->cap - (tail - c->head_cache) < n)
+		c->head_cache = atomic_load_explicit(&c->head, memory_order_acquire);
+	if (n > c->cap - (tail - c->head_cache))
+		n = c->cap - (tail - c->head_cache);
+	if (!n)
+		return 0;
+
+	_chan_copy_in(c, tail, vals, n, ts);
+	atomic_store_explicit(&c->tail, tail + n, memory_order_release);
+
+	return n;
+}
+
+/* Internal: the CHAN_SPSC implementation of _chan_try_recv_n, without waking */
+static inline size_t _chan_spsc_recv_n(struct _chan_t *c, void *out, size_t n, size_t ts)
+{
+	size_t head = atomic_load_explicit(&c->head, memory_order_relaxed);
+
+	if (c->tail_cache - head < n)
+		c->tail_cache = atomic_load_explicit(&c->tail, memory_order_acquire);
+	if (n > c->tail_cache - head)
+		n = c->tail_cache - head;
+	if (!n)
+		return 0;
+
+	_chan_copy_out(c, head, out, n, ts);
+	atomic_store_explicit(&c->head, head + n, memory_order_release);
+
+	return n;
+}
+
+/*
+ * Internal: the CHAN_MPMC implementation of _chan_try_send_n, without waking.
+ * The longest run of free slots from tail, up to n, is claimed with a single
+ * compare-and-swap; each slot must still be published by its own sequence
+ * number, in order.
+ */
+static inline size_t _chan_mpmc_send_n(struct _chan_t *c, const void *vals, size_t n, size_t ts)
+{
+	size_t pos = atomic_load_explicit(&c->tail, memory_order_relaxed), used, seq, k;
+	intptr_t dif;
+
+	for (;;) {
+		seq = atomic_load_explicit(&c->seq[pos & c->mask], memory_order_acquire);
+		dif = (intptr_t)seq - (intptr_t)pos;
+		if (dif < 0)
+			return 0;
+		used = pos - atomic_load_explicit(&c->head, memory_order_relaxed);
+		if (dif > 0 || used > c->cap) {
+			/* our view of tail is out of date */
+			pos = atomic_load_explicit(&c->tail, memory_order_relaxed);
+			continue;
+		}
+
+		k = (c->cap - used < n) ? c->cap - used : n;
+		for (size_t i = 1; i < k; i++) {
+			if (atomic_load_explicit(&c->seq[(pos + i) & c->mask],
+						memory_order_acquire) != pos + i) {
+				k = i;
+				break;
+			}
+		}
+		if (!k)
+			return 0;
+		if (atomic_compare_exchange_weak_explicit(&c->tail, &pos, pos + k,
+					memory_order_relaxed, memory_order_relaxed))
+			break;
+	}
+
+	_chan_copy_in(c, pos, vals, k, ts);
+	for (size_t i = 0; i < k; i++)
+		atomic_store_explicit(&c->seq[(pos + i) & c->mask], pos + i + 1, memory_order_release);
+
+	return k;
+}
+
+/* Internal: the CHAN_MPMC implementation of _chan_try_recv_n, without waking */
+static inline size_t _chan_mpmc_recv_n(struct _chan_t *c, void *out, size_t n, size_t ts)
+{
+	size_t pos = atomic_load_explicit(&c->head, memory_order_relaxed), seq, k;
+	intptr_t dif;
+
+	for (;;) {
+		seq = atomic_load_explicit(&c->seq[pos & c->mask], memory_order_acquire);
+		dif = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (dif < 0)
+			return 0;
+		if (dif > 0) {
+			pos = atomic_load_explicit(&c->head, memory_order_relaxed);
+			continue;
+		}
+
+		for (k = 1; k < n; k++) {
+			if (atomic_load_explicit(&c->seq[(pos + k) & c->mask],
+						memory_order_acquire) != pos + k + 1)
+				break;
+		}
+		if (atomic_compare_exchange_weak_explicit(&c->head, &pos, pos + k,
+					memory_order_relaxed, memory_order_relaxed))
+			break;
+	}
+
+	_chan_copy_out(c, pos, out, k, ts);
+	for (size_t i = 0; i < k; i++)
+		atomic_store_explicit(&c->seq[(pos + i) & c->mask], pos + i + c->mask + 1,
+				memory_order_release);
+
+	return k;
+}
+
+/* Internal: the number of waiters to wake after moving n elements through c */
+static inline int _chan_wake_count(struct _chan_t *c, size_t n)
+{
+	if (c->mode == CHAN_SPSC)
+		return 1;
+	return (n > INT_MAX) ? INT_MAX : (int)n;
+}
+
+/*
+ * Internal: copies up to n elements from vals (each of size ts) into c
+ * without blocking. Returns the number copied, which is zero if c is full or
+ * closed.
+ */
+static inline size_t _chan_try_send_n(struct _chan_t *c, const void *vals, size_t n, size_t ts)
+{
+	size_t sent = 0;
+
+	if (!c->cap) {
+		while (sent < n && _chan_sync(c, (unsigned char *)vals + sent * ts, ts, 1, 0, NULL) > 0)
+			sent++;
+		return sent;
+	}
+	if (!n || atomic_load_explicit(&c->closed, memory_order_relaxed))
+		return 0;
+	if (c->mode == CHAN_SPSC)
+		sent = _chan_spsc_send_n(c, vals, n, ts);
+	else
+		sent = _chan_mpmc_send_n(c, vals, n, ts);
+
+	if (sent)
+		_chan_wq_wake(&c->recvq, _chan_wake_count(c, sent));
+	return sent;
+}
+
+/*
+ * Internal: copies up to n of the oldest elements of c (each of size ts) to
+ * out without blocking. Returns the number copied, which is zero if c is
+ * empty.
+ */
+static inline size_t _chan_try_recv_n(struct _chan_t *c, void *out, size_t n, size_t ts)
+{
+	size_t received = 0;
+
+	if (!c->cap) {
+		while (received < n &&
+				_chan_sync(c, (unsigned char *)out + received * ts, ts, 0, 0, NULL) > 0)
+			received++;
+		return received;
+	}
+	if (!n)
+		return 0;
+	if (c->mode == CHAN_SPSC)
+		received = _chan_spsc_recv_n(c, out, n, ts);
+	else
+		received = _chan_mpmc_recv_n(c, out, n, ts);
+
+	if (received)
+		_chan_wq_wake(&c->sendq, _chan_wake_count(c, received));
+	return received;
+}
+
+/*
+ * Internal: copies the element at val into c, sleeping while c is full until
+ * the deadline (if any). Returns true (>0) on success, zero if c is closed and
+ * -1 on timeout.
+ */
+static inline int _chan_send(struct _chan_t *c, const void *val, size_t ts,
+		const struct timespec *deadline)
+{
+	struct _chan_waiter w;
+	atomic_int state;
+
+	if (!c->cap)
+		return _chan_sync(c, (void *)val, ts, 1, 1, deadline);
+	for (;;) {
+		if (_chan_try_send(c, val, ts))
+			return 1;
+		if (atomic_load_explicit(&c->closed, memory_order_acquire))
+			return 0;
+
+		atomic_store_explicit(&state, 0, memory_order_relaxed);
+		_chan_wq_add(&c->sendq, &w, &state);
+		if (_chan_try_send(c, val, ts)) {
+			_chan_wq_cancel(&c->sendq, &w);
+			return 1;
+		}
+		if (atomic_load_explicit(&c->closed, memory_order_acquire)) {
+			_chan_wq_cancel(&c->sendq, &w);
+			return 0;
+		}
+		if (!_chan_park(&state, deadline)) {
+			_chan_wq_cancel(&c->sendq, &w);
+			return -1;
+		}
+		_chan_wq_remove(&c->sendq, &w);
+	}
+}
+
+/*
+ * Internal: copies the oldest element of c to out, sleeping while c is empty
+ * until the deadline (if any). Returns true (>0) on success, zero if c is
+ * closed and drained and -1 on timeout.
+ */
+static inline int _chan_recv(struct _chan_t *c, void *out, size_t ts,
+		const struct timespec *deadline)
+{
+	struct _chan_waiter w;
+	atomic_int state;
+
+	if (!c->cap)
+		return _chan_sync(c, out, ts, 0, 1, deadline);
+	for (;;) {
+		if (_chan_try_recv(c, out, ts))
+			return 1;
+		/* anything sent before closing must still be received */
+		if (atomic_load_explicit(&c->closed, memory_order_acquire))
+			return _chan_try_recv(c, out, ts);
+
+		atomic_store_explicit(&state, 0, memory_order_relaxed);
+		_chan_wq_add(&c->recvq, &w, &state);
+		if (_chan_try_recv(c, out, ts)) {
+			_chan_wq_cancel(&c->recvq, &w);
+			return 1;
+		}
+		if (atomic_load_explicit(&c->closed, memory_order_acquire)) {
+			_chan_wq_cancel(&c->recvq, &w);
+			return _chan_try_recv(c, out, ts);
+		}
+		if (!_chan_park(&state, deadline)) {
+			_chan_wq_cancel(&c->recvq, &w);
+			return -1;
+		}
+		_chan_wq_remove(&c->recvq, &w);
+	}
+}
+
+/*
+ * Internal: copies the n elements at vals into c, in as few batches as
+ * possible, sleeping while c is full until the deadline (if any). Returns the
+ * number copied, which is less than n only if c was closed or the deadline
+ * passed.
+ */
+static inline size_t _chan_send_n(struct _chan_t *c, const void *vals, size_t n, size_t ts,
+		const struct timespec *deadline)
+{
+	const unsigned char *p = vals;
+	struct _chan_waiter w;
+	atomic_int state;
+	size_t sent = 0;
+
+	if (!c->cap) {
+		while (sent < n && _chan_sync(c, (void *)(p + sent * ts), ts, 1, 1, deadline) > 0)
+			sent++;
+		return sent;
+	}
+	for (;;) {
+		sent += _chan_try_send_n(c, p + sent * ts, n - sent, ts);
+		if (sent == n || atomic_load_explicit(&c->closed, memory_order_acquire))
+			return sent;
+
+		atomic_store_explicit(&state, 0, memory_order_relaxed);
+		_chan_wq_add(&c->sendq, &w, &state);
+		sent += _chan_try_send_n(c, p + sent * ts, n - sent, ts);
+		if (sent == n || atomic_load_explicit(&c->closed, memory_order_acquire)) {
+			_chan_wq_cancel(&c->sendq, &w);
+			return sent;
+		}
+		if (!_chan_park(&state, deadline)) {
+			_chan_wq_cancel(&c->sendq, &w);
+			return sent;
+		}
+		_chan_wq_remove(&c->sendq, &w);
+	}
+}
+
+/*
+ * Internal: copies up to n of the oldest elements of c to out, sleeping while
+ * c is empty until the deadline (if any). Returns the number copied, which
+ * is zero only if c is closed and drained, or the deadline passed.
+ */
+static inline size_t _chan_recv_n(struct _chan_t *c, void *out, size_t n, size_t ts,
+		const struct timespec *deadline)
+{
+	struct _chan_waiter w;
+	atomic_int state;
+	size_t received;
+
+	if (!n)
+		return 0;
+	if (!c->cap) {
+		if (_chan_sync(c, out, ts, 0, 1, deadline) <= 0)
+			return 0;
+		return 1 + _chan_try_recv_n(c, (unsigned char *)out + ts, n - 1, ts);
+	}
+	for (;;) {
+		if ((received = _chan_try_recv_n(c, out, n, ts)))
+			return received;
+		if (atomic_load_explicit(&c->closed, memory_order_acquire))
+			return _chan_try_recv_n(c, out, n, ts);
+
+		atomic_store_explicit(&state, 0, memory_order_relaxed);
+		_chan_wq_add(&c->recvq, &w, &state);
+		if ((received = _chan_try_recv_n(c, out, n, ts))) {
+			_chan_wq_cancel(&c->recvq, &w);
+			return received;
+		}
+		if (atomic_load_explicit(&c->closed, memory_order_acquire)) {
+			_chan_wq_cancel(&c->recvq, &w);
+			return _chan_try_recv_n(c, out, n, ts);
+		}
+		if (!_chan_park(&state, deadline)) {
+			_chan_wq_cancel(&c->recvq, &w);
+			return 0;
+		}
+		_chan_wq_remove(&c->recvq, &w);
+	}
+}
+
+/* Internal: closes c, waking every parked thread */
+static inline void _chan_close(struct _chan_t *c)
+{
+	atomic_store_explicit(&c->closed, 1, memory_order_release);
+	_chan_wq_wake(&c->sendq, INT_MAX);
+	_chan_wq_wake(&c->recvq, INT_MAX);
+}
+
+/* Internal: returns the number of elements buffered in c */
+static inline size_t _chan_len(struct _chan_t *c)
+{
+	size_t head = atomic_load_explicit(&c->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&c->tail, memory_order_relaxed);
+
+	return (tail > head) ? tail - head : 0;
+}
+
+/*
+ * chan_case_t is one case of a chan_select: a send of *val on a channel, or
+ * a receive from it into *val. Cases are made with chan_case_send and
+ * chan_case_recv; a case whose channel has been set to NULL is never chosen.
+ * Once the case is chosen, ok is true (>0) if the value was sent or received,
+ * or false (0) if the channel was closed.
+ */
+typedef struct {
+	struct _chan_t *c;
+	int send;
+	void *val;
+	int ok;
+	/* internal: the order in which cases are tried, and waiting state */
+	int _ord, _woken;
+	struct _chan_waiter _w;
+} chan_case_t;
+
+/* Internal: the state of the calling thread's random number generator */
+static _Thread_local uint32_t _chan_rand_state;
+static atomic_uint _chan_rand_seed;
+
+/* Internal: returns a random number below n (xorshift32) */
+static inline uint32_t _chan_rand(uint32_t n)
+{
+	uint32_t x = _chan_rand_state;
+
+	/* each thread is seeded differently, the first time it selects */
+	while (!x)
+		x = atomic_fetch_add_explicit(&_chan_rand_seed, 1, memory_order_relaxed) * 0x9e3779b9u;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	_chan_rand_state = x;
+
+	return x % n;
+}
+
+/* Internal: returns the wait queue of c on which cs waits */
+static inline struct _chan_wq *_chan_case_wq(chan_case_t *cs)
+{
+	return cs->send ? &cs->c->sendq : &cs->c->recvq;
+}
+
+/*
+ * Internal: performs cs if it can proceed without blocking, returning true if
+ * it did (including finding its channel closed).
+ */
+static inline int _chan_case_try(chan_case_t *cs)
+{
+	if (cs->send) {
+		if ((cs->ok = _chan_try_send(cs->c, cs->val, cs->c->tsiz)))
+			return 1;
+		return atomic_load_explicit(&cs->c->closed, memory_order_acquire);
+	}
+	if ((cs->ok = _chan_try_recv(cs->c, cs->val, cs->c->tsiz)))
+		return 1;
+	if (atomic_load_explicit(&cs->c->closed, memory_order_acquire)) {
+		cs->ok = _chan_try_recv(cs->c, cs->val, cs->c->tsiz);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Internal: tries the cases in their random order, without blocking, and
+ * returns the index of the first which could proceed, or -1 if none could.
+ */
+static inline int _chan_select_poll(chan_case_t *cases, int n)
+{
+	chan_case_t *cs;
+
+	for (int i = 0; i < n; i++) {
+		cs = &cases[cases[i]._ord];
+		if (cs->c && _chan_case_try(cs))
+			return cs - cases;
+	}
+
+	return -1;
+}
+
+/*
+ * Internal: returns true if any case looks able to proceed, without
+ * performing it. The answer may be wrong, but not for a case which became
+ * ready before its waiter was queued.
+ */
+static inline int _chan_select_ready(chan_case_t *cases, int n)
+{
+	struct _chan_t *c;
+
+	for (int i = 0; i < n; i++) {
+		if (!(c = cases[i].c))
+			continue;
+		if (atomic_load_explicit(&c->closed, memory_order_relaxed))
+			return 1;
+		if (!c->cap) {
+			if (atomic_load_explicit(cases[i].send ? &c->recvq.len : &c->sendq.len,
+						memory_order_relaxed))
+				return 1;
+		} else if (cases[i].send ? _chan_len(c) < c->cap : _chan_len(c) > 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Internal: queues the waiter of cs on its channel for task, rather than for
+ * the calling thread, as chan_select would before parking: task is unparked
+ * once the case may be able to proceed, or has been performed by a handoff,
+ * and state set as for chan_select. This lets something other than a thread
+ * or a fiber (such as the event loop of loop.h) wait on a channel.
+ */
+static inline void _chan_case_watch(chan_case_t *cs, atomic_int *state, struct _chan_task *task)
+{
+	struct _chan_wq *q = _chan_case_wq(cs);
+
+	cs->_w.elem = cs->val;
+	mutex_lock(q->lock);
+	_chan_wq_link(q, &cs->_w, state);
+	cs->_w.task = task;
+	mutex_unlock(q->lock);
+
+	sync_heavy_fence();
+}
+
+/*
+ * Internal: performs one of the n cases, chosen at random from those which
+ * can proceed. If none can, returns -1 if block is zero; otherwise waits on
+ * every channel at once until one can, or until the deadline (if any)
+ * passes, when -1 is returned.
+ */
+static inline int _chan_select(chan_case_t *cases, int n, int block,
+		const struct timespec *deadline)
+{
+	atomic_int state;
+	int k, parked, j, t, zero;
+
+	/* a fresh random permutation per call, so that no case is favoured */
+	for (int i = 0; i < n; i++)
+		cases[i]._ord = i;
+	for (int i = n - 1; i > 0; i--) {
+		j = (int)_chan_rand((uint32_t)i + 1);
+		t = cases[i]._ord;
+		cases[i]._ord = cases[j]._ord;
+		cases[j]._ord = t;
+	}
+
+	for (;;) {
+		if ((k = _chan_select_poll(cases, n)) >= 0 || !block)
+			return k;
+
+		atomic_store_explicit(&state, 0, memory_order_relaxed);
+		for (int i = 0; i < n; i++) {
+			if (cases[i].c) {
+				cases[i]._w.elem = cases[i].val;
+				_chan_wq_queue(_chan_case_wq(&cases[i]), &cases[i]._w, &state);
+			}
+		}
+		/* one fence for every queue, as in _chan_wq_add */
+		sync_heavy_fence();
+
+		/*
+		 * A case may have become ready while we were queueing. It cannot be
+		 * performed yet, as the other side of an unbuffered channel may have
+		 * claimed us in the meantime, so we must first claim ourselves.
+		 */
+		parked = 1;
+		zero = 0;
+		if (_chan_select_ready(cases, n))
+			atomic_compare_exchange_strong(&state, &zero, 1);
+		else
+			parked = _chan_park(&state, deadline);
+
+		k = -1;
+		for (int i = 0; i < n; i++) {
+			if (!cases[i].c)
+				continue;
+			cases[i]._woken = !_chan_wq_remove(_chan_case_wq(&cases[i]), &cases[i]._w);
+			/* at most one handoff can have claimed us */
+			if (cases[i]._woken && cases[i]._w.ok)
+				cases[k = i].ok = 1;
+		}
+		if (k < 0)
+			k = _chan_select_poll(cases, n);
+		/* wakeups for the buffered cases not taken may be usable by another waiter */
+		for (int i = 0; i < n; i++) {
+			if (i != k && cases[i].c && cases[i].c->cap && cases[i]._woken)
+				_chan_wq_wake(_chan_case_wq(&cases[i]), 1);
+		}
+
+		if (k >= 0 || !parked)
+			return k;
+	}
+}
+
+/*
+ * chan_declare declares a new channel type tname which carries values of the
+ * given type. It is type-safe for that type and will not accept values not of
+ * this type. As with vect.h, it is used through function pointers inside the
+ * provided struct, which are auto-generated at compile time; the generated
+ * tname##_chan_* functions may also be called directly.
+ */
+#define chan_declare(type, tname)							\
+	typedef struct tname##_struct {							\
+		struct _chan_t c;							\
+		/* function impls */							\
+		int (*send)(struct tname##_struct *this, type val);			\
+		int (*recv)(struct tname##_struct *this, type *out);			\
+		int (*timedsend)(struct tname##_struct *this, type val,			\
+				const struct timespec *deadline);			\
+		int (*timedrecv)(struct tname##_struct *this, type *out,		\
+				const struct timespec *deadline);			\
+		int (*try_send)(struct tname##_struct *this, type val);			\
+		int (*try_recv)(struct tname##_struct *this, type *out);		\
+		size_t (*send_n)(struct tname##_struct *this, const type *vals, size_t n);	\
+		size_t (*recv_n)(struct tname##_struct *this, type *out, size_t n);	\
+		size_t (*try_send_n)(struct tname##_struct *this, const type *vals, size_t n);	\
+		size_t (*try_recv_n)(struct tname##_struct *this, type *out, size_t n);	\
+		chan_case_t (*case_send)(struct tname##_struct *this, const type *val);	\
+		chan_case_t (*case_recv)(struct tname##_struct *this, type *out);	\
+	} tname;									\
+	static inline int tname##_chan_send(struct tname##_struct *this, type val)	\
+	{										\
+		return _chan_send(&this->c, &val, sizeof(type), NULL) > 0;		\
+	}										\
+	static inline int tname##_chan_recv(struct tname##_struct *this, type *out)	\
+	{										\
+		return _chan_recv(&this->c, out, sizeof(type), NULL) > 0;		\
+	}										\
+	static inline int tname##_chan_timedsend(struct tname##_struct *this, type val,	\
+			const struct timespec *deadline)				\
+	{										\
+		return _chan_send(&this->c, &val, sizeof(type), deadline);		\
+	}										\
+	static inline int tname##_chan_timedrecv(struct tname##_struct *this,		\
+			type *out, const struct timespec *deadline)			\
+	{										\
+		return _chan_recv(&this->c, out, sizeof(type), deadline);		\
+	}										\
+	static inline int tname##_chan_try_send(struct tname##_struct *this, type val)	\
+	{										\
+		return _chan_try_send(&this->c, &val, sizeof(type));			\
+	}										\
+	static inline int tname##_chan_try_recv(struct tname##_struct *this, type *out)	\
+	{										\
+		return _chan_try_recv(&this->c, out, sizeof(type));			\
+	}										\
+	static inline size_t tname##_chan_send_n(struct tname##_struct *this,		\
+			const type *vals, size_t n)					\
+	{										\
+		return _chan_send_n(&this->c, vals, n, sizeof(type), NULL);		\
+	}										\
+	static inline size_t tname##_chan_recv_n(struct tname##_struct *this,		\
+			type *out, size_t n)						\
+	{										\
+		return _chan_recv_n(&this->c, out, n, sizeof(type), NULL);		\
+	}										\
+	static inline size_t tname##_chan_try_send_n(struct tname##_struct *this,	\
+			const type *vals, size_t n)					\
+	{										\
+		return _chan_try_send_n(&this->c, vals, n, sizeof(type));		\
+	}										\
+	static inline size_t tname##_chan_try_recv_n(struct tname##_struct *this,	\
+			type *out, size_t n)						\
+	{										\
+		return _chan_try_recv_n(&this->c, out, n, sizeof(type));		\
+	}										\
+	static inline chan_case_t tname##_chan_case_send(struct tname##_struct *this,	\
+			const type *val)						\
+	{										\
+		return (chan_case_t){.c = &this->c, .send = 1, .val = (void *)val};	\
+	}										\
+	static inline chan_case_t tname##_chan_case_recv(struct tname##_struct *this,	\
+			type *out)							\
+	{										\
+		return (chan_case_t){.c = &this->c, .send = 0, .val = out};		\
+	}										\
+	static inline tname *tname##_chan_new_alloc(size_t cap, enum chan_mode mode,	\
+			const allocator_t *alloc)					\
+	{										\
+		void *block;								\
+		tname *ret = _chan_alloc_block(alloc, sizeof(tname), &block);		\
+		if (!ret)								\
+			return NULL;							\
+		if (!_chan_init(&ret->c, sizeof(type), cap, mode, alloc)) {		\
+			_chan_free_block(alloc, block, sizeof(tname));			\
+			return NULL;							\
+		}									\
+		ret->c.block = block;							\
+		ret->send = tname##_chan_send;						\
+		ret->recv = tname##_chan_recv;						\
+		ret->timedsend = tname##_chan_timedsend;				\
+		ret->timedrecv = tname##_chan_timedrecv;				\
+		ret->try_send = tname##_chan_try_send;					\
+		ret->try_recv = tname##_chan_try_recv;					\
+		ret->send_n = tname##_chan_send_n;					\
+		ret->recv_n = tname##_chan_recv_n;					\
+		ret->try_send_n = tname##_chan_try_send_n;				\
+		ret->try_recv_n = tname##_chan_try_recv_n;				\
+		ret->case_send = tname##_chan_case_send;				\
+		ret->case_recv = tname##_chan_case_recv;				\
+		return ret;								\
+	}										\
+	/* little hack to allow portable						\
+	 * semi colons after chan_declares */						\
+	struct _chan_decl_isoc_workaround
+
+/*
+ * chan_new returns a new channel of the declared type tname, which buffers up
+ * to cap values (or if cap is zero, is unbuffered) and is shared according to
+ * mode. It returns NULL if memory is exhausted. The channel must be freed
+ * with chan_free.
+ */
+#define chan_new(tname, cap, mode) tname##_chan_new_alloc(cap, mode, NULL)
+
+/*
+ * chan_new_alloc returns a new channel, as in chan_new, whose storage is
+ * obtained from the allocator alloc. alloc must remain valid for the lifetime
+ * of the channel.
+ */
+#define chan_new_alloc(tname, cap, mode, alloc) tname##_chan_new_alloc(cap, mode, alloc)
+
+/*
+ * chan_free frees the channel ch and all of its storage. No thread may use
+ * the channel during or after the call.
+ */
+#define chan_free(ch) _chan_free(&(ch)->c, sizeof(*(ch)))
+
+/*
+ * chan_send copies val into ch, sleeping while ch is full. Returns true (>0)
+ * if val was sent, or false (0) if ch is closed.
+ */
+#define chan_send(ch, val) ((ch)->send(ch, val))
+
+/*
+ * chan_recv copies the oldest value in ch to *out, sleeping while ch is empty.
+ * Returns true (>0) if a value was received, or false (0) if ch is closed and
+ * every value sent before it was closed has been received.
+ */
+#define chan_recv(ch, out) ((ch)->recv(ch, out))
+
+/*
+ * chan_timedsend is as chan_send, but returns -1 if val could not be sent by
+ * the CLOCK_MONOTONIC time deadline (see sync_deadline). Deadlines have the
+ * resolution of timer.h (TIMER_TICK_NS), and are never cut short.
+ */
+#define chan_timedsend(ch, val, deadline) ((ch)->timedsend(ch, val, deadline))
+
+/*
+ * chan_timedrecv is as chan_recv, but returns -1 if nothing could be
+ * received by the CLOCK_MONOTONIC time deadline, as in chan_timedsend.
+ */
+#define chan_timedrecv(ch, out, deadline) ((ch)->timedrecv(ch, out, deadline))
+
+/*
+ * chan_try_send is as chan_send, but returns false (0) instead of sleeping if
+ * ch is full.
+ */
+#define chan_try_send(ch, val) ((ch)->try_send(ch, val))
+
+/*
+ * chan_try_recv is as chan_recv, but returns false (0) instead of sleeping if
+ * ch is empty.
+ */
+#define chan_try_recv(ch, out) ((ch)->try_recv(ch, out))
+
+/*
+ * chan_send_n copies the n values in the array vals into ch, in order,
+ * sleeping while ch is full. Values are moved in as few batches as the free
+ * space allows, each costing about as much synchronization as a single
+ * chan_send. Returns the number of values sent, which is less than n only if
+ * ch was closed.
+ */
+#define chan_send_n(ch, vals, n) ((ch)->send_n(ch, vals, n))
+
+/*
+ * chan_recv_n sleeps until ch is not empty, then copies as many of its oldest
+ * values as are available, up to n, to the array out. Returns the number of
+ * values received, which is zero only if ch is closed and every value sent
+ * before it was closed has been received.
+ */
+#define chan_recv_n(ch, out, n) ((ch)->recv_n(ch, out, n))
+
+/*
+ * chan_try_send_n is as chan_send_n, but returns instead of sleeping once ch
+ * is full, having sent as many values as would fit.
+ */
+#define chan_try_send_n(ch, vals, n) ((ch)->try_send_n(ch, vals, n))
+
+/*
+ * chan_try_recv_n is as chan_recv_n, but returns zero instead of sleeping if
+ * ch is empty.
+ */
+#define chan_try_recv_n(ch, out, n) ((ch)->try_recv_n(ch, out, n))
+
+/*
+ * chan_case_send returns a chan_select case which sends *val on ch. *val is
+ * only copied if the case is chosen.
+ */
+#define chan_case_send(ch, val) ((ch)->case_send(ch, val))
+
+/*
+ * chan_case_recv returns a chan_select case which receives a value from ch
+ * into *out.
+ */
+#define chan_case_recv(ch, out) ((ch)->case_recv(ch, out))
+
+/*
+ * chan_select performs exactly one of the n cases in the array cases, as
+ * with Go's select statement, sleeping until one can proceed. If several can,
+ * one is chosen at random. A send on or receive from a closed channel can
+ * always proceed, setting the ok field of its case to false. Returns the
+ * index of the case performed.
+ *
+ * If no case can proceed, the calling thread sleeps once, waiting on every
+ * channel together. The cases must not be modified or reused by another
+ * thread during the call.
+ */
+#define chan_select(cases, n) _chan_select(cases, n, 1, NULL)
+
+/*
+ * chan_try_select is as chan_select, but returns -1 instead of sleeping if no
+ * case can proceed, like a select statement with a default case.
+ */
+#define chan_try_select(cases, n) _chan_select(cases, n, 0, NULL)
+
+/*
+ * chan_timedselect is as chan_select, but returns -1 if no case has proceeded
+ * by the CLOCK_MONOTONIC time deadline (see sync_deadline), as in
+ * chan_timedsend.
+ */
+#define chan_timedselect(cases, n, deadline) _chan_select(cases, n, 1, deadline)
+
+/*
+ * chan_close closes ch, waking every thread sleeping on it. Closing a closed
+ * channel has no effect.
+ */
+#define chan_close(ch) _chan_close(&(ch)->c)
+
+/*
+ * chan_closed returns true (>0) if ch has been closed.
+ */
+#define chan_closed(ch) atomic_load_explicit(&(ch)->c.closed, memory_order_acquire)
+
+/*
+ * chan_len returns the number of values buffered in ch, which may be out of
+ * date as soon as it is returned.
+ */
+#define chan_len(ch) _chan_len(&(ch)->c)
+
+/*
+ * chan_cap returns the number of values which ch can buffer.
+ */
+#define chan_cap(ch) ((ch)->c.cap)
+
+/* timer_chan is the type of the channel of a chan_timer_t */
+chan_declare(uint64_t, timer_chan);
+
+/*
+ * chan_timer_t is a timer which sends the time on a channel when it fires, as
+ * made by chan_after or chan_ticker. It must be stopped with chan_timer_stop.
+ */
+typedef struct {
+	/* receives the CLOCK_MONOTONIC time (see timer_now) at which the timer fired */
+	timer_chan *ch;
+	wtimer_t t;
+	uint64_t deadline, period;
+	atomic_int stopped;
+} chan_timer_t;
+
+/* Internal: sends the time on the channel of the chan_timer_t arg, and starts the next period */
+static inline void _chan_timer_fire(void *arg)
+{
+	chan_timer_t *ct = arg;
+	uint64_t now = timer_now();
+
+	/* as in Go, a tick which the receiver is not ready for is dropped */
+	chan_try_send(ct->ch, now);
+	if (!ct->period || atomic_load_explicit(&ct->stopped, memory_order_acquire))
+		return;
+
+	/* ticks stay in phase, skipping any which were missed */
+	ct->deadline += ct->period;
+	if (ct->deadline <= now)
+		ct->deadline += ((now - ct->deadline) / ct->period + 1) * ct->period;
+	wtimer_start(&ct->t, ct->deadline, _chan_timer_fire, ct);
+}
+
+/* Internal: returns a timer which first fires ns nanoseconds from now, or NULL */
+static inline chan_timer_t *_chan_timer_new(uint64_t ns, uint64_t period)
+{
+	chan_timer_t *ct = _alloc_malloc_at(NULL, sizeof(*ct), ALLOC_MOD_CHAN, __func__);
+
+	if (!ct)
+		return NULL;
+	if (!(ct->ch = chan_new(timer_chan, 1, CHAN_MPMC))) {
+		_alloc_free_at(NULL, ct, sizeof(*ct), ALLOC_MOD_CHAN, __func__);
+		return NULL;
+	}
+
+	ct->deadline = timer_now() + ns;
+	ct->period = period;
+	atomic_init(&ct->stopped, 0);
+	wtimer_start(&ct->t, ct->deadline, _chan_timer_fire, ct);
+
+	return ct;
+}
+
+/*
+ * chan_after returns a timer whose channel receives the time once, ns
+ * nanoseconds from now, as Go's time.After. Its channel can be used in a
+ * chan_select, eg. to give up on the other cases after a while. Returns NULL
+ * if memory is exhausted.
+ */
+#define chan_after(ns) _chan_timer_new(ns, 0)
+
+/*
+ * chan_ticker returns a timer whose channel receives the time every ns
+ * nanoseconds (which must not be zero), as Go's time.Ticker. Ticks which the
+ * receiver is not ready for are dropped. Returns NULL if memory is exhausted.
+ */
+#define chan_ticker(ns) _chan_timer_new(ns, ns)
+
+/*
+ * chan_timer_stop stops the timer ct, and frees it along with its channel.
+ * Returns true (>0) if it stopped ct before ct next fired.
+ */
+static inline int chan_timer_stop(chan_timer_t *ct)
+{
+	int pending;
+
+	atomic_store_explicit(&ct->stopped, 1, memory_order_release);
+	pending = wtimer_stop(&ct->t);
+
+	chan_free(ct->ch);
+	_alloc_free_at(NULL, ct, sizeof(*ct), ALLOC_MOD_CHAN, __func__);
+
+	return pending;
+}
+
+#endif /* HLC_CHAN_H */
@@ -0,0 +1,571 @@
+/*
+ * fiber.h - C11 stackful coroutines (fibers), scheduled on a thread pool
+ * Copyright (C) Ethan Marshall - 2023
+ *
+ * Requirements: stddef.h stdint.h stdlib.h string.h limits.h time.h stdatomic.h
+ *               pthread.h unistd.h sys/mman.h alloc.h sync.h timer.h pool.h
+ *               chan.h
+ *               CHAN_IMPL and TIMER_IMPL in one translation unit (see chan.h)
+ *               ucontext.h (where no context switch is hand-written)
+ *
+ * A fiber is a function which runs on its own stack, and which may be
+ * suspended part way through and resumed later, possibly by another thread.
+ * Fibers are run by the workers of a pool_t (see pool.h): resuming a fiber is
+ * a task, which switches to the fiber's stack, and back again once the fiber
+ * yields, parks or returns. Any number of fibers may thus share a few threads
+ * (M:N scheduling), at the cost of a stack each rather than a thread each.
+ *
+ * A fiber which blocks on a channel (see chan.h) parks itself, rather than
+ * the thread running it, and is resumed by whichever thread wakes it. Every
+ * other blocking call (mutex_lock, pool_wait, a system call) blocks the
+ * thread, and with it the fibers waiting to run. The deadlines of timed
+ * channel operations are kept by timer.h, whose thread unparks the fiber.
+ *
+ * The context switch saves only the registers which a function call must
+ * preserve, and is written by hand for x86_64 and aarch64 (with GCC or
+ * Clang). Elsewhere, or if FIBER_UCONTEXT is defined, swapcontext is used,
+ * which also saves the signal mask, with a system call.
+ *
+ * As with chan.h, exactly one translation unit must define CHAN_IMPL, which
+ * also provides the record of the fiber each thread is running.
+ *
+ * Thread-local variables need care in a fiber: it may resume on another
+ * thread after parking or yielding, while the compiler may reuse the address
+ * of the first thread's variable for the rest of the function.
+ */
+
+#ifndef HLC_FIBER_H
+#define HLC_FIBER_H
+
+#if !defined(FIBER_UCONTEXT) && defined(__GNUC__) && (defined(__x86_64__) || defined(__aarch64__))
+#define _FIBER_ASM
+#endif
+
+#if defined(__SANITIZE_ADDRESS__)
+#define _FIBER_ASAN
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define _FIBER_ASAN
+#endif
+#endif
+
+#ifdef HLC_AUTO_INCLUDE
+#define FIBER_AUTO_INCLUDE
+#endif
+
+#ifdef FIBER_AUTO_INCLUDE
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifndef _FIBER_ASM
+#include <ucontext.h>
+#endif
+#include "alloc.h"
+#include "sync.h"
+#include "timer.h"
+#include "pool.h"
+#include "chan.h"
+#endif
+
+/* AddressSanitizer must be told when the stack changes under it */
+#ifdef _FIBER_ASAN
+#include <sanitizer/common_interface_defs.h>
+#include <sanitizer/asan_interface.h>
+#endif
+
+/*
+ * FIBER_STACK_SIZE is the size in bytes of each fiber's stack. Stacks are
+ * reserved rather than committed: a page of memory is used only once a
+ * fiber's calls reach it, so a large size costs address space, not memory.
+ */
+#ifndef FIBER_STACK_SIZE
+#define FIBER_STACK_SIZE (64 * 1024)
+#endif
+
+/*
+ * FIBER_GUARD_MAX is the number of stacks which have a guard page below
+ * them, so that a fiber which overflows its stack faults rather than
+ * corrupting memory. Each guard page costs the process two kernel mappings,
+ * of which Linux allows about 65530 by default (vm.max_map_count), and which
+ * malloc and thread stacks need too; further stacks go unguarded, rather than
+ * limiting the number of fibers.
+ */
+#ifndef FIBER_GUARD_MAX
+#define FIBER_GUARD_MAX 8192
+#endif
+
+/*
+ * FIBER_STACK_CACHE is the number of stacks of finished fibers which keep
+ * their memory, ready for new fibers. The memory of any other stacks which
+ * are not in use is returned to the system, though their address space is
+ * kept for reuse.
+ */
+#ifndef FIBER_STACK_CACHE
+#define FIBER_STACK_CACHE 64
+#endif
+
+/* Internal: the number of stacks reserved at once, in a single mapping */
+#define _FIBER_SLAB 64
+
+/* Internal: the states of a fiber, as seen by fiber_park and fiber_unpark */
+enum {
+	_FIBER_RUNNING,
+	_FIBER_PARKING,  /* switching out, to be parked */
+	_FIBER_PARKED,
+	_FIBER_NOTIFIED  /* unparked before it finished parking */
+};
+
+/* Internal: what the thread which ran a fiber does with it once it switches out */
+enum {
+	_FIBER_YIELD,
+	_FIBER_PARK,
+	_FIBER_EXIT
+};
+
+/*
+ * fiber_t is a fiber. It lives at the top of its own stack, and is freed with
+ * the stack once its function returns.
+ */
+typedef struct fiber {
+	/* the face which chan.h sees: must be first */
+	struct _chan_task task;
+	void (*fn)(void *arg);
+	void *arg;
+	pool_t *pool;
+	pool_group_t *group;
+	atomic_int state;
+	int action;
+	/* the pool task which resumes the fiber, queued at most once at a time */
+	struct _pool_task resume;
+#ifdef _FIBER_ASM
+	/* the saved stack pointers of the fiber and of the thread which resumed it */
+	void *sp, *ret;
+#else
+	ucontext_t ctx, ret;
+#endif
+	/* the bottom of the stack */
+	unsigned char *stack;
+	/* the next free stack */
+	struct fiber *next;
+#ifdef _FIBER_ASAN
+	void *fake;
+	const void *ret_stack;
+	size_t ret_size;
+#endif
+} fiber_t;
+
+/* Internal: the stacks not in use, most recently used first, and the number guarded */
+static mutex_t _fiber_stacks_lock = MUTEX_INIT;
+static fiber_t *_fiber_stacks;
+static size_t _fiber_nstacks, _fiber_nguarded;
+
+/*
+ * fiber_self returns the fiber which the calling thread is running, or NULL
+ * if it is not running one. It is never inlined, as the fiber may move to
+ * another thread (see above).
+ */
+#ifdef __GNUC__
+__attribute__((noinline, unused))
+#endif
+static fiber_t *fiber_self(void)
+{
+	/* the only tasks which run on a thread (see chan.h) are fibers */
+	struct _chan_task *t = _chan_task_self();
+
+	return t ? (fiber_t *)((char *)t - offsetof(fiber_t, task)) : NULL;
+}
+
+#ifdef _FIBER_ASM
+/*
+ * Internal: saves the stack pointer of the calling context into *save and
+ * switches to the context whose stack pointer is to, returning once another
+ * switch comes back to *save. The return address and frame pointer are saved
+ * on the stack; every other register which the context may be using is
+ * declared clobbered, so the compiler saves what it needs around the switch.
+ */
+#if defined(__x86_64__)
+static inline void _fiber_switch(void **save, void *to)
+{
+	/* the red zone below the stack pointer may be in use, so skip it */
+	__asm__ volatile(
+		"subq $128, %%rsp\n\t"
+		"leaq 1f(%%rip), %%rax\n\t"
+		"pushq %%rax\n\t"
+		"pushq %%rbp\n\t"
+		"movq %%rsp, (%0)\n\t"
+		"movq %1, %%rsp\n\t"
+		"popq %%rbp\n\t"
+		"retq\n"
+		"1:\n\t"
+		"addq $128, %%rsp"
+		: "+D"(save), "+S"(to)
+		:
+		: "rax", "rbx", "rcx", "rdx", "r8", "r9", "r10", "r11", "r12", "r13",
+		  "r14", "r15", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5", "xmm6",
+		  "xmm7", "xmm8", "xmm9", "xmm10", "xmm11", "xmm12", "xmm13", "xmm14",
+		  "xmm15", "memory", "cc");
+}
+#else
+static inline void _fiber_switch(void **save, void *to)
+{
+	register void **x0 __asm__("x0") = save;
+	register void *x1 __asm__("x1") = to;
+
+	__asm__ volatile(
+		"adr x9, 1f\n\t"
+		"sub sp, sp, #16\n\t"
+		"stp x29, x9, [sp]\n\t"
+		"mov x10, sp\n\t"
+		"str x10, [%0]\n\t"
+		"mov sp, %1\n\t"
+		"ldp x29, x9, [sp]\n\t"
+		"add sp, sp, #16\n\t"
+		"br x9\n"
+		"1:"
+		: "+r"(x0), "+r"(x1)
+		:
+		: "x2", "x3", "x4", "x5", "x6", "x7", "x8", "x9", "x10", "x11", "x12",
+		  "x13", "x14", "x15", "x16", "x17", "x19", "x20", "x21", "x22", "x23",
+		  "x24", "x25", "x26", "x27", "x28", "x30", "v0", "v1", "v2", "v3", "v4",
+		  "v5", "v6", "v7", "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15",
+		  "v16", "v17", "v18", "v19", "v20", "v21", "v22", "v23", "v24", "v25",
+		  "v26", "v27", "v28", "v29", "v30", "v31", "memory", "cc");
+}
+#endif
+#endif
+
+/* Internal: tells AddressSanitizer that f is running again, on whichever thread */
+static inline void _fiber_resumed(fiber_t *f)
+{
+#ifdef _FIBER_ASAN
+	__sanitizer_finish_switch_fiber(f->fake, &f->ret_stack, &f->ret_size);
+#else
+	(void)f;
+#endif
+}
+
+/* Internal: switches from the calling thread to f, returning once f switches out */
+static inline void _fiber_enter(fiber_t *f)
+{
+#ifdef _FIBER_ASAN
+	void *fake;
+
+	__sanitizer_start_switch_fiber(&fake, f->stack, (size_t)((unsigned char *)f - f->stack));
+#endif
+#ifdef _FIBER_ASM
+	_fiber_switch(&f->ret, f->sp);
+#else
+	swapcontext(&f->ret, &f->ctx);
+#endif
+#ifdef _FIBER_ASAN
+	__sanitizer_finish_switch_fiber(fake, NULL, NULL);
+#endif
+}
+
+/* Internal: switches from f back to the thread which resumed it, having set f->action */
+static inline void _fiber_leave(fiber_t *f)
+{
+#ifdef _FIBER_ASAN
+	__sanitizer_start_switch_fiber(f->action == _FIBER_EXIT ? NULL : &f->fake,
+			f->ret_stack, f->ret_size);
+#endif
+#ifdef _FIBER_ASM
+	_fiber_switch(&f->sp, f->ret);
+#else
+	swapcontext(&f->ctx, &f->ret);
+#endif
+	_fiber_resumed(f);
+}
+
+/* Internal: where every fiber starts */
+static inline void _fiber_entry(void)
+{
+	fiber_t *f = fiber_self();
+
+	_fiber_resumed(f);
+	f->fn(f->arg);
+	f->action = _FIBER_EXIT;
+	_fiber_leave(f);
+	/* not reached: the stack is gone */
+	abort();
+}
+
+/* Internal: prepares the stack of f so that switching to it calls _fiber_entry */
+static inline void _fiber_init_context(fiber_t *f)
+{
+#ifdef _FIBER_ASM
+	uintptr_t top = (uintptr_t)f & ~(uintptr_t)15, *sp;
+
+#if defined(__x86_64__)
+	/* the frame pointer, then the return address, as _fiber_switch pushed them */
+	sp = (uintptr_t *)(top - 3 * sizeof(*sp));
+	sp[0] = 0;
+	sp[1] = (uintptr_t)_fiber_entry;
+	/* as if _fiber_entry had been called, by a function which never returns */
+	sp[2] = 0;
+#else
+	sp = (uintptr_t *)(top - 2 * sizeof(*sp));
+	sp[0] = 0;
+	sp[1] = (uintptr_t)_fiber_entry;
+#endif
+	f->sp = sp;
+#else
+	getcontext(&f->ctx);
+	f->ctx.uc_stack.ss_sp = f->stack;
+	f->ctx.uc_stack.ss_size = (size_t)((unsigned char *)f - f->stack);
+	f->ctx.uc_link = NULL;
+	makecontext(&f->ctx, _fiber_entry, 0);
+#endif
+}
+
+/*
+ * Internal: returns a fiber with an unused stack, or NULL. Stacks are
+ * reserved _FIBER_SLAB at a time, so that stacks which go unguarded share a
+ * mapping, and are never unmapped, as splitting a mapping may fail.
+ */
+static inline fiber_t *_fiber_new(void)
+{
+	size_t page, len;
+	unsigned char *map;
+	fiber_t *f;
+
+	mutex_lock(&_fiber_stacks_lock);
+	if ((f = _fiber_stacks)) {
+		_fiber_stacks = f->next;
+		_fiber_nstacks--;
+		mutex_unlock(&_fiber_stacks_lock);
+		return f;
+	}
+
+	page = (size_t)sysconf(_SC_PAGESIZE);
+	len = (FIBER_STACK_SIZE + sizeof(*f) + page - 1) / page * page + page;
+	map = mmap(NULL, len * _FIBER_SLAB, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (map == MAP_FAILED) {
+		mutex_unlock(&_fiber_stacks_lock);
+		return NULL;
+	}
+
+	for (int i = _FIBER_SLAB - 1; i >= 0; i--, map += len) {
+		if (_fiber_nguarded < FIBER_GUARD_MAX && !mprotect(map, page, PROT_NONE))
+			_fiber_nguarded++;
+		f = (fiber_t *)(map + len) - 1;
+		f->stack = map + page;
+		if (i) {
+			f->next = _fiber_stacks;
+			_fiber_stacks = f;
+			_fiber_nstacks++;
+		}
+	}
+	mutex_unlock(&_fiber_stacks_lock);
+
+	return f;
+}
+
+/*
+ * Internal: frees the stack of f, which has finished. Beyond the first
+ * FIBER_STACK_CACHE free stacks, the memory of the stack is released.
+ */
+static inline void _fiber_free(fiber_t *f)
+{
+	size_t page = (size_t)sysconf(_SC_PAGESIZE);
+	/* the page which holds f stays */
+	unsigned char *top = (unsigned char *)((uintptr_t)f & ~(uintptr_t)(page - 1));
+
+#ifdef _FIBER_ASAN
+	/* frames left on the stack when f switched out for good are still poisoned */
+	__asan_unpoison_memory_region(f->stack, (size_t)((unsigned char *)f - f->stack));
+#endif
+	mutex_lock(&_fiber_stacks_lock);
+	if (_fiber_nstacks >= FIBER_STACK_CACHE)
+		madvise(f->stack, (size_t)(top - f->stack), MADV_DONTNEED);
+	f->next = _fiber_stacks;
+	_fiber_stacks = f;
+	_fiber_nstacks++;
+	mutex_unlock(&_fiber_stacks_lock);
+}
+
+/*
+ * Internal: queues f, which is not running, to be resumed by its pool. A
+ * fiber which yields goes to the back of the pool's shared queue, behind the
+ * work already waiting; otherwise, as with any task a worker spawns, the
+ * current worker resumes it next unless another steals it first. Unlike
+ * pool_spawn, this never runs f on the spot, as the caller may be in the
+ * middle of waking it.
+ */
+static inline void _fiber_schedule(fiber_t *f, int last)
+{
+	pool_t *p = f->pool;
+	struct _pool_worker *self = _pool_worker_of(p);
+
+	if (last || !self || !_pool_push(p, self, &f->resume))
+		_pool_inject(p, &f->resume);
+	_pool_notify(p);
+}
+
+/* Internal: makes f (or nothing) the fiber which the calling thread is running */
+static inline void _fiber_set_running(fiber_t *f)
+{
+	_chan_task_running = f ? &f->task : NULL;
+}
+
+/*
+ * Internal: the pool task which runs the fiber arg until it switches out,
+ * then acts on whatever it switched out for. The fiber is not touched once
+ * it may have been resumed elsewhere.
+ */
+static inline void _fiber_resume(void *arg)
+{
+	fiber_t *f = arg, *prev = fiber_self();
+	pool_group_t *g;
+	int state = _FIBER_PARKING;
+
+	_fiber_set_running(f);
+	_fiber_enter(f);
+	/* not a fiber, unless a fiber resumed f while it waited in pool_wait */
+	_fiber_set_running(prev);
+
+	switch (f->action) {
+	case _FIBER_YIELD:
+		_fiber_schedule(f, 1);
+		break;
+	case _FIBER_PARK:
+		if (!atomic_compare_exchange_strong_explicit(&f->state, &state, _FIBER_PARKED,
+				memory_order_acq_rel, memory_order_acquire)) {
+			/* unparked while it was switching out */
+			atomic_store_explicit(&f->state, _FIBER_RUNNING, memory_order_relaxed);
+			_fiber_schedule(f, 0);
+		}
+		break;
+	case _FIBER_EXIT:
+		g = f->group;
+		_fiber_free(f);
+		if (g)
+			_pool_group_done(g);
+		break;
+	}
+}
+
+/*
+ * fiber_park suspends the calling fiber until another thread or fiber calls
+ * fiber_unpark on it. If fiber_unpark was called since the fiber last parked,
+ * it returns at once. It may also return spuriously, so the caller should
+ * check the condition it is waiting for and park again if need be.
+ */
+static inline void fiber_park(void)
+{
+	fiber_t *f = fiber_self();
+	int state = _FIBER_RUNNING;
+
+	if (!atomic_compare_exchange_strong_explicit(&f->state, &state, _FIBER_PARKING,
+			memory_order_acq_rel, memory_order_acquire)) {
+		/* already unparked */
+		atomic_store_explicit(&f->state, _FIBER_RUNNING, memory_order_relaxed);
+		return;
+	}
+
+	f->action = _FIBER_PARK;
+	_fiber_leave(f);
+}
+
+/*
+ * fiber_unpark resumes f if it is parked, or else makes its next fiber_park
+ * return at once. f must not have finished.
+ */
+static inline void fiber_unpark(fiber_t *f)
+{
+	int state = atomic_load_explicit(&f->state, memory_order_relaxed);
+
+	for (;;) {
+		if (state == _FIBER_NOTIFIED)
+			return;
+		if (state == _FIBER_PARKED) {
+			if (atomic_compare_exchange_weak_explicit(&f->state, &state, _FIBER_RUNNING,
+					memory_order_acq_rel, memory_order_relaxed)) {
+				_fiber_schedule(f, 0);
+				return;
+			}
+		} else if (atomic_compare_exchange_weak_explicit(&f->state, &state, _FIBER_NOTIFIED,
+				memory_order_release, memory_order_relaxed)) {
+			/* f is running, or its thread will see this once it has switched out */
+			return;
+		}
+	}
+}
+
+/*
+ * fiber_yield lets the other fibers waiting to run on the pool run before the
+ * calling fiber continues. Called from outside a fiber, it yields the thread.
+ */
+static inline void fiber_yield(void)
+{
+	fiber_t *f = fiber_self();
+
+	if (!f) {
+		sync_yield();
+		return;
+	}
+
+	f->action = _FIBER_YIELD;
+	_fiber_leave(f);
+}
+
+/* Internal: waits on a channel as a fiber (see struct _chan_task) */
+static inline void _fiber_chan_park(struct _chan_task *t, atomic_int *state)
+{
+	(void)t;
+	while (!atomic_load_explicit(state, memory_order_acquire))
+		fiber_park();
+}
+
+static inline void _fiber_chan_unpark(struct _chan_task *t)
+{
+	fiber_unpark((fiber_t *)t);
+}
+
+/*
+ * fiber_spawn creates a fiber which runs fn(arg) on the workers of p, as part
+ * of the group g (or of no group, if g is NULL), so that pool_wait on g
+ * returns once it has returned. Returns true (>0) on success, or zero if
+ * memory is exhausted.
+ *
+ * Fibers must have finished before p is freed.
+ */
+static inline int fiber_spawn(pool_t *p, pool_group_t *g, void (*fn)(void *arg), void *arg)
+{
+	fiber_t *f = _fiber_new();
+
+	if (!f)
+		return 0;
+
+	f->task.park = _fiber_chan_park;
+	f->task.unpark = _fiber_chan_unpark;
+	f->fn = fn;
+	f->arg = arg;
+	f->pool = p;
+	f->group = g;
+	f->resume.fn = _fiber_resume;
+	f->resume.arg = f;
+	f->resume.group = NULL;
+	f->resume.embedded = 1;
+	atomic_init(&f->state, _FIBER_RUNNING);
+#ifdef _FIBER_ASAN
+	f->fake = NULL;
+#endif
+	_fiber_init_context(f);
+
+	if (g)
+		atomic_fetch_add_explicit(&g->pending, 2, memory_order_relaxed);
+	_fiber_schedule(f, 0);
+
+	return 1;
+}
+
+#endif /* HLC_FIBER_H */
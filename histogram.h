@@ -0,0 +1,322 @@
+/*
+ * histogram.h - C99 log-linear (HDR style) histogram for latencies
+ * Copyright (C) Ethan Marshall - 2023
+ *
+ * Requirements: stdint.h stdio.h string.h
+ *
+ * A histogram_t counts unsigned 64-bit values (typically nanoseconds) in
+ * buckets whose width grows with the magnitude of the value, so that any value
+ * from zero to UINT64_MAX is recorded in constant time and space, with a fixed
+ * relative precision. Values below 2^HISTOGRAM_SUB_BITS are counted exactly;
+ * above that, each power of two is split into 2^(HISTOGRAM_SUB_BITS - 1)
+ * linear buckets, so reported values are within 1 / 2^(HISTOGRAM_SUB_BITS - 1)
+ * of the true value (1.6% by default).
+ *
+ * Unlike a mean, percentiles such as p99 and p999 expose rare stalls, such as
+ * those caused by reallocation or lock contention. A histogram is not
+ * thread-safe: give each thread its own and combine them with histogram_merge.
+ * Histograms may be stored or sent elsewhere with histogram_serialize, which
+ * produces a compact, run-length encoded byte string.
+ */
+
+#ifndef HLC_HISTOGRAM_H
+#define HLC_HISTOGRAM_H
+
+#ifdef HLC_AUTO_INCLUDE
+#define HISTOGRAM_AUTO_INCLUDE
+#endif
+
+#ifdef HISTOGRAM_AUTO_INCLUDE
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#endif
+
+/*
+ * HISTOGRAM_SUB_BITS sets the precision of all histograms. Histograms built
+ * with a different precision cannot be merged or deserialized.
+ */
+#ifndef HISTOGRAM_SUB_BITS
+#define HISTOGRAM_SUB_BITS 7
+#endif
+
+#define _HIST_SUB (1u << HISTOGRAM_SUB_BITS)
+#define _HIST_HALF (_HIST_SUB / 2)
+/* HISTOGRAM_BUCKETS is the number of buckets needed to cover all of uint64_t */
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS) * _HIST_HALF + _HIST_SUB)
+
+/* Internal: first byte of serialized histograms, then HISTOGRAM_SUB_BITS */
+#define _HIST_MAGIC 0xB7
+
+/*
+ * histogram_t is a histogram of recorded values. It must be initialized with
+ * histogram_init. total is the number of values recorded, and min, max and sum
+ * are exact.
+ */
+typedef struct {
+	uint64_t total, min, max, sum;
+	uint64_t counts[HISTOGRAM_BUCKETS];
+} histogram_t;
+
+/*
+ * histogram_init initializes (or resets) h to be empty.
+ */
+static inline void histogram_init(histogram_t *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+/* Internal: returns the index of the highest set bit of v, which is nonzero */
+static inline unsigned _hist_msb(uint64_t v)
+{
+#ifdef __GNUC__
+	return 63 - (unsigned)__builtin_clzll(v);
+#else
+	unsigned b = 0;
+	while (v >>= 1)
+		b++;
+	return b;
+#endif
+}
+
+/* Internal: returns the bucket which counts v */
+static inline size_t _hist_bucket(uint64_t v)
+{
+	unsigned shift;
+
+	if (v < _HIST_SUB)
+		return (size_t)v;
+	shift = _hist_msb(v) - HISTOGRAM_SUB_BITS + 1;
+
+	return (size_t)shift * _HIST_HALF + (size_t)(v >> shift);
+}
+
+/* Internal: returns the lowest value counted by bucket i */
+static inline uint64_t _hist_lowest(size_t i)
+{
+	size_t shift;
+
+	if (i < _HIST_SUB)
+		return i;
+	shift = i / _HIST_HALF - 1;
+
+	return (uint64_t)(i - shift * _HIST_HALF) << shift;
+}
+
+/* Internal: returns the highest value counted by bucket i */
+static inline uint64_t _hist_highest(size_t i)
+{
+	return (i + 1 < HISTOGRAM_BUCKETS) ? _hist_lowest(i + 1) - 1 : UINT64_MAX;
+}
+
+/*
+ * histogram_record_n records the value v n times.
+ */
+static inline void histogram_record_n(histogram_t *h, uint64_t v, uint64_t n)
+{
+	if (n == 0)
+		return;
+
+	h->counts[_hist_bucket(v)] += n;
+	h->total += n;
+	h->sum += v * n;
+	if (v < h->min)
+		h->min = v;
+	if (v > h->max)
+		h->max = v;
+}
+
+/*
+ * histogram_record records the value v once.
+ */
+static inline void histogram_record(histogram_t *h, uint64_t v)
+{
+	histogram_record_n(h, v, 1);
+}
+
+/*
+ * histogram_merge adds all values recorded in src to dst.
+ */
+static inline void histogram_merge(histogram_t *dst, const histogram_t *src)
+{
+	if (src->total == 0)
+		return;
+
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++)
+		dst->counts[i] += src->counts[i];
+	dst->total += src->total;
+	dst->sum += src->sum;
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+/*
+ * histogram_percentile returns the value below or at which p percent of the
+ * recorded values fall (eg. 99.9 for p999), to within the precision of h. The
+ * result is the highest value equivalent to the value found, clamped to the
+ * exact minimum and maximum. An empty histogram returns zero.
+ */
+static inline uint64_t histogram_percentile(const histogram_t *h, double p)
+{
+	uint64_t rank, seen = 0, v = h->max;
+
+	if (h->total == 0)
+		return 0;
+	if (p <= 0)
+		return h->min;
+	if (p >= 100)
+		return h->max;
+
+	/* the rank of the value, counting from one */
+	rank = (uint64_t)(p / 100 * (double)h->total + 0.5);
+	if (rank == 0)
+		rank = 1;
+
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen += h->counts[i];
+		if (seen >= rank) {
+			v = _hist_highest(i);
+			break;
+		}
+	}
+
+	if (v < h->min)
+		return h->min;
+	return (v > h->max) ? h->max : v;
+}
+
+/*
+ * histogram_mean returns the exact mean of the recorded values, or zero if h
+ * is empty.
+ */
+static inline double histogram_mean(const histogram_t *h)
+{
+	return h->total ? (double)h->sum / (double)h->total : 0;
+}
+
+/* Internal: LEB128 encodes v at buf + off, if it fits in len bytes */
+static inline size_t _hist_put(unsigned char *buf, size_t len, size_t off, uint64_t v)
+{
+	do {
+		if (buf && off < len)
+			buf[off] = (unsigned char)((v & 0x7F) | ((v > 0x7F) ? 0x80 : 0));
+		off++;
+		v >>= 7;
+	} while (v);
+
+	return off;
+}
+
+/* Internal: LEB128 decodes a value at *off, returning zero if truncated */
+static inline int _hist_get(const unsigned char *buf, size_t len, size_t *off, uint64_t *v)
+{
+	*v = 0;
+	for (unsigned shift = 0; *off < len && shift < 64; shift += 7) {
+		unsigned char c = buf[(*off)++];
+		*v |= (uint64_t)(c & 0x7F) << shift;
+		if (!(c & 0x80))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * histogram_serialize writes h into buf, which is len bytes long, returning
+ * the number of bytes required. If this is greater than len, buf is
+ * incomplete and must not be used; buf may be NULL to query the size.
+ *
+ * Counts are variable-length encoded, and runs of empty buckets are collapsed,
+ * so a typical latency histogram takes well under a kilobyte.
+ */
+static inline size_t histogram_serialize(const histogram_t *h, unsigned char *buf, size_t len)
+{
+	size_t off = 0, zeros = 0;
+
+	if (buf && len >= 2) {
+		buf[0] = _HIST_MAGIC;
+		buf[1] = HISTOGRAM_SUB_BITS;
+	}
+	off = 2;
+	off = _hist_put(buf, len, off, h->min);
+	off = _hist_put(buf, len, off, h->max);
+	off = _hist_put(buf, len, off, h->sum);
+
+	/* counts are stored as c << 1, and runs of n empty buckets as n << 1 | 1 */
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		if (h->counts[i] == 0) {
+			zeros++;
+			continue;
+		}
+		if (zeros)
+			off = _hist_put(buf, len, off, (uint64_t)zeros << 1 | 1);
+		off = _hist_put(buf, len, off, h->counts[i] << 1);
+		zeros = 0;
+	}
+
+	return off;
+}
+
+/*
+ * histogram_deserialize replaces the contents of h with the len bytes at buf,
+ * which were written by histogram_serialize. If buf is malformed or was built
+ * with a different HISTOGRAM_SUB_BITS, zero is returned and h is left empty.
+ */
+static inline int histogram_deserialize(histogram_t *h, const unsigned char *buf, size_t len)
+{
+	size_t off = 2, i = 0;
+	uint64_t v;
+
+	histogram_init(h);
+	if (len < 2 || buf[0] != _HIST_MAGIC || buf[1] != HISTOGRAM_SUB_BITS)
+		return 0;
+	if (!_hist_get(buf, len, &off, &h->min) || !_hist_get(buf, len, &off, &h->max) ||
+			!_hist_get(buf, len, &off, &h->sum))
+		goto bad;
+
+	while (off < len) {
+		if (!_hist_get(buf, len, &off, &v))
+			goto bad;
+		if (v & 1) {
+			if ((v >> 1) > HISTOGRAM_BUCKETS - i)
+				goto bad;
+			i += (size_t)(v >> 1);
+			continue;
+		}
+		if (i >= HISTOGRAM_BUCKETS)
+			goto bad;
+		h->counts[i++] = v >> 1;
+		h->total += v >> 1;
+	}
+
+	if (h->total == 0)
+		h->min = UINT64_MAX;
+	return 1;
+
+bad:
+	histogram_init(h);
+	return 0;
+}
+
+/*
+ * histogram_dump prints a summary of h to f: the count, mean and common
+ * percentiles.
+ */
+static inline void histogram_dump(const histogram_t *h, FILE *f)
+{
+	static const double pcts[] = {50, 90, 99, 99.9, 99.99};
+
+	fprintf(f, "count: %llu, min: %llu, mean: %.1f, max: %llu\n",
+			(unsigned long long)h->total,
+			(unsigned long long)(h->total ? h->min : 0),
+			histogram_mean(h), (unsigned long long)h->max);
+	for (size_t i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++) {
+		fprintf(f, "p%-6g %llu\n", pcts[i],
+				(unsigned long long)histogram_percentile(h, pcts[i]));
+	}
+}
+
+#endif /* HLC_HISTOGRAM_H */
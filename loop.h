@@ -0,0 +1,539 @@
+/*
+ * loop.h - C11 event loop over file descriptors, timers and channels
+ * Copyright (C) Ethan Marshall - 2023
+ *
+ * Requirements: stddef.h stdint.h stdlib.h string.h limits.h errno.h time.h
+ *               stdatomic.h pthread.h unistd.h sys/epoll.h sys/eventfd.h
+ *               (Linux only) alloc.h sync.h timer.h chan.h
+ *               CHAN_IMPL and TIMER_IMPL in one translation unit (see chan.h)
+ *
+ * An event loop waits, on a single thread, for whichever comes first of its
+ * file descriptors becoming ready, its timers expiring and its channels (see
+ * chan.h) being able to send or receive, and calls a function for each event.
+ * A thread serving both sockets and channels thus sleeps once, in epoll_wait,
+ * rather than polling one while blocked on the other.
+ *
+ * File descriptors are watched by epoll, level-triggered unless asked
+ * otherwise. Timers are kept on a timer wheel of the loop's own (see
+ * timer.h), whose next deadline bounds each wait.
+ *
+ * A channel is watched through a chan_case_t, which the loop performs itself
+ * once it can proceed, exactly as chan_select would, before calling the
+ * watcher's function. While the case cannot proceed, the loop queues itself
+ * on the channel in place of a parked thread, and whichever thread would have
+ * woken that thread instead queues the watcher to be run and writes to the
+ * loop's eventfd, which epoll is watching. The eventfd is written at most
+ * once per wait, however many watchers are woken.
+ *
+ * The loop, and its watchers and timers, belong to the thread running it:
+ * only loop_stop may be called from another thread. Functions called by the
+ * loop may add and remove any watcher, including their own.
+ */
+
+#ifndef HLC_LOOP_H
+#define HLC_LOOP_H
+
+#ifdef HLC_AUTO_INCLUDE
+#define LOOP_AUTO_INCLUDE
+#endif
+
+#ifdef LOOP_AUTO_INCLUDE
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "alloc.h"
+#include "sync.h"
+#include "timer.h"
+#include "chan.h"
+#endif
+
+/* LOOP_EVENTS is the most events which one call to epoll_wait returns */
+#ifndef LOOP_EVENTS
+#define LOOP_EVENTS 64
+#endif
+
+/*
+ * loop_fd_t watches a file descriptor, calling fn with its argument and the
+ * epoll events which occurred (EPOLLIN, EPOLLOUT, EPOLLHUP and so on).
+ */
+typedef struct {
+	int fd;
+	void (*fn)(void *arg, uint32_t events);
+	void *arg;
+} loop_fd_t;
+
+struct loop;
+
+/*
+ * loop_chan_t watches a channel, through a case (see chan_case_recv and
+ * chan_case_send) which is performed each time it can proceed, and after
+ * which fn is called with its argument and the ok of the case. A watcher
+ * whose channel has been closed (ok is false) is removed before fn is called.
+ */
+typedef struct loop_chan {
+	chan_case_t cs;
+	void (*fn)(void *arg, int ok);
+	void *arg;
+	/* internal: the loop, and the task it queues on the channel */
+	struct loop *_loop;
+	struct _chan_task _task;
+	atomic_int _state;
+	/* internal: set while queued on the channel, or on the loop's idle list */
+	int _armed, _idle;
+	struct loop_chan *_next, *_prev;
+	/* internal: set while on the woken stack or the ready list */
+	atomic_int _woken;
+	struct loop_chan *_next_ready;
+} loop_chan_t;
+
+/*
+ * loop_t is an event loop. It is initialized with loop_init and destroyed
+ * with loop_destroy.
+ */
+typedef struct loop {
+	int epfd, efd;
+	timer_wheel_t wheel;
+	/* the events of the last wait, and the next to be run */
+	struct epoll_event events[LOOP_EVENTS];
+	int nevents, next;
+	/* channel watchers not queued on their channels, and the next to be run */
+	loop_chan_t *idle, *cursor;
+	/* channel watchers woken by other threads, and those taken from them */
+	_Atomic(loop_chan_t *) woken;
+	loop_chan_t *ready;
+	/* set once the eventfd has been written since the last wait */
+	atomic_int notified;
+	atomic_int stopped;
+} loop_t;
+
+/* Internal: writes to the eventfd of l, unless it has been already */
+static inline void _loop_notify(loop_t *l)
+{
+	uint64_t one = 1;
+
+	if (!atomic_exchange(&l->notified, 1)) {
+		while (write(l->efd, &one, sizeof(one)) < 0 && errno == EINTR)
+			;
+	}
+}
+
+/*
+ * loop_init initializes l. Returns zero on success, or -1 (with errno set) if
+ * the epoll instance or eventfd could not be created.
+ */
+static inline int loop_init(loop_t *l)
+{
+	struct epoll_event ev;
+
+	memset(l, 0, sizeof(*l));
+	timer_wheel_init(&l->wheel, TIMER_TICK_NS, timer_now());
+	if ((l->epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		return -1;
+	if ((l->efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) < 0) {
+		close(l->epfd);
+		return -1;
+	}
+
+	/* the eventfd is the only event without a watcher */
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, l->efd, &ev) < 0) {
+		close(l->efd);
+		close(l->epfd);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * loop_destroy closes the epoll instance and eventfd of l. Every channel
+ * watcher must have been removed first; file descriptors and timers are
+ * simply forgotten.
+ */
+static inline void loop_destroy(loop_t *l)
+{
+	close(l->efd);
+	close(l->epfd);
+}
+
+/*
+ * loop_stop makes the loop_run of l return, once any function it is running
+ * has returned. It may be called from any thread, or from a function called
+ * by l.
+ */
+static inline void loop_stop(loop_t *l)
+{
+	atomic_store(&l->stopped, 1);
+	_loop_notify(l);
+}
+
+/*
+ * loop_add_fd starts watching the file descriptor fd, calling fn(arg, events)
+ * whenever any of the given epoll events (such as EPOLLIN | EPOLLOUT, with
+ * EPOLLET for edge-triggered) occur. Returns zero on success, or -1 (with
+ * errno set) as epoll_ctl does.
+ */
+static inline int loop_add_fd(loop_t *l, loop_fd_t *w, int fd, uint32_t events,
+		void (*fn)(void *arg, uint32_t events), void *arg)
+{
+	struct epoll_event ev;
+
+	w->fd = fd;
+	w->fn = fn;
+	w->arg = arg;
+	ev.events = events;
+	ev.data.ptr = w;
+
+	return epoll_ctl(l->epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+/* loop_mod_fd changes the events which w is watching for */
+static inline int loop_mod_fd(loop_t *l, loop_fd_t *w, uint32_t events)
+{
+	struct epoll_event ev;
+
+	ev.events = events;
+	ev.data.ptr = w;
+
+	return epoll_ctl(l->epfd, EPOLL_CTL_MOD, w->fd, &ev);
+}
+
+/*
+ * loop_del_fd stops watching the file descriptor of w, which must be done
+ * before it is closed. Its function is not called again, even for events
+ * already waited for.
+ */
+static inline int loop_del_fd(loop_t *l, loop_fd_t *w)
+{
+	for (int i = l->next; i < l->nevents; i++) {
+		if (l->events[i].data.ptr == w)
+			l->events[i].data.ptr = l;
+	}
+
+	return epoll_ctl(l->epfd, EPOLL_CTL_DEL, w->fd, NULL);
+}
+
+/*
+ * loop_add_timer starts t, to call fn(arg) from the loop once the
+ * CLOCK_MONOTONIC time deadline (in nanoseconds, see timer_now) has passed,
+ * within TIMER_TICK_NS. t must not be pending.
+ */
+static inline void loop_add_timer(loop_t *l, wtimer_t *t, uint64_t deadline,
+		void (*fn)(void *arg), void *arg)
+{
+	timer_wheel_add(&l->wheel, t, deadline, fn, arg);
+}
+
+/*
+ * loop_del_timer stops t. Returns true (>0) if it was pending, in which case
+ * its function will not be called.
+ */
+static inline int loop_del_timer(loop_t *l, wtimer_t *t)
+{
+	return timer_wheel_del(&l->wheel, t);
+}
+
+/* Internal: puts w on the idle list of l, to be queued on its channel */
+static inline void _loop_idle(loop_t *l, loop_chan_t *w)
+{
+	w->_idle = 1;
+	w->_prev = NULL;
+	if ((w->_next = l->idle))
+		l->idle->_prev = w;
+	l->idle = w;
+}
+
+/* Internal: takes w off the idle list of l */
+static inline void _loop_unidle(loop_t *l, loop_chan_t *w)
+{
+	if (l->cursor == w)
+		l->cursor = w->_next;
+	if (w->_prev)
+		w->_prev->_next = w->_next;
+	else
+		l->idle = w->_next;
+	if (w->_next)
+		w->_next->_prev = w->_prev;
+	w->_idle = 0;
+}
+
+/*
+ * Internal: wakes the loop of a channel watcher, from whichever thread woke
+ * the watcher. The watcher is pushed onto the woken stack at most once until
+ * the loop takes it off, however often it is woken.
+ */
+static inline void _loop_chan_unpark(struct _chan_task *t)
+{
+	loop_chan_t *w = (loop_chan_t *)((char *)t - offsetof(loop_chan_t, _task));
+	loop_t *l = w->_loop;
+
+	if (atomic_exchange(&w->_woken, 1))
+		return;
+	w->_next_ready = atomic_load_explicit(&l->woken, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak(&l->woken, &w->_next_ready, w))
+		;
+	_loop_notify(l);
+}
+
+/* Internal: moves the woken stack of l to its ready list, oldest first */
+static inline void _loop_take_woken(loop_t *l)
+{
+	loop_chan_t *w = atomic_exchange(&l->woken, NULL), *oldest = NULL, *next, **tail = &l->ready;
+
+	for (; w; w = next) {
+		next = w->_next_ready;
+		w->_next_ready = oldest;
+		oldest = w;
+	}
+	while (*tail)
+		tail = &(*tail)->_next_ready;
+	*tail = oldest;
+}
+
+/*
+ * Internal: takes w, which is armed, off its channel. Returns true if its
+ * case has been performed: by a handoff while it was queued, or now, if
+ * perform is true and it can proceed. A wakeup which goes unused is passed on
+ * to another waiter of the channel, as in chan_select.
+ */
+static inline int _loop_chan_disarm(loop_chan_t *w, int perform)
+{
+	struct _chan_wq *q = _chan_case_wq(&w->cs);
+	int woken;
+
+	w->_armed = 0;
+	woken = !_chan_wq_remove(q, &w->cs._w);
+	if (woken && w->cs._w.ok)
+		return w->cs.ok = 1;
+	if (perform && _chan_case_try(&w->cs))
+		return 1;
+	if (woken && w->cs.c->cap)
+		_chan_wq_wake(q, 1);
+
+	return 0;
+}
+
+/*
+ * Internal: calls the function of w, whose case has been performed, leaving
+ * it idle, or removing it if its channel is closed.
+ */
+static inline void _loop_chan_call(loop_t *l, loop_chan_t *w)
+{
+	if (w->cs.ok)
+		_loop_idle(l, w);
+	w->fn(w->arg, w->cs.ok);
+}
+
+/*
+ * Internal: performs the case of w, an idle watcher, if it can proceed, or
+ * queues it on its channel. Returns true if its function was called.
+ *
+ * w is only left unqueued once its function has been called, as the loop
+ * relies on being woken through the channel for every other watcher.
+ */
+static inline int _loop_chan_arm(loop_t *l, loop_chan_t *w)
+{
+	int zero;
+
+	_loop_unidle(l, w);
+	for (;;) {
+		if (_chan_case_try(&w->cs))
+			break;
+
+		atomic_store_explicit(&w->_state, 0, memory_order_relaxed);
+		_chan_case_watch(&w->cs, &w->_state, &w->_task);
+		w->_armed = 1;
+
+		/* it may have become ready while being queued, before anyone could see it */
+		if (!_chan_select_ready(&w->cs, 1))
+			return 0;
+
+		/*
+		 * A buffered case can be tried while queued. If it still cannot
+		 * proceed, another thread is part way through the operation
+		 * which will let it, and will wake it once done.
+		 */
+		if (w->cs.c->cap) {
+			if (!_chan_case_try(&w->cs))
+				return 0;
+			_loop_chan_disarm(w, 0);
+			break;
+		}
+
+		/*
+		 * An unbuffered case must first claim itself, as the other side
+		 * may claim it for a handoff meanwhile. If it was, it has been
+		 * woken, and is run from the ready list. Otherwise, the waiter
+		 * which made it look ready was already claimed by a third
+		 * thread, and is about to leave the channel: queue again.
+		 */
+		zero = 0;
+		if (!atomic_compare_exchange_strong(&w->_state, &zero, 1))
+			return 0;
+		if (_loop_chan_disarm(w, 1))
+			break;
+	}
+	_loop_chan_call(l, w);
+
+	return 1;
+}
+
+/*
+ * Internal: runs a woken watcher w, performing its case if it can proceed,
+ * and otherwise leaving it to be queued again. Returns true if its function
+ * was called.
+ */
+static inline int _loop_chan_run(loop_t *l, loop_chan_t *w)
+{
+	/* a wakeup for an earlier wait, since overtaken */
+	if (!w->_armed)
+		return 0;
+	if (!_loop_chan_disarm(w, 1)) {
+		_loop_idle(l, w);
+		return 0;
+	}
+	_loop_chan_call(l, w);
+
+	return 1;
+}
+
+/*
+ * loop_add_chan starts watching the channel of the case cs, performing it
+ * whenever it can proceed and then calling fn(arg, ok), where ok is that of
+ * the case. The value of a send case is read, and that of a receive case
+ * written, each time the case is performed.
+ */
+static inline void loop_add_chan(loop_t *l, loop_chan_t *w, chan_case_t cs,
+		void (*fn)(void *arg, int ok), void *arg)
+{
+	w->cs = cs;
+	w->fn = fn;
+	w->arg = arg;
+	w->_loop = l;
+	w->_task.park = NULL;
+	w->_task.unpark = _loop_chan_unpark;
+	w->_armed = 0;
+	atomic_init(&w->_woken, 0);
+	_loop_idle(l, w);
+}
+
+/*
+ * loop_del_chan stops watching the channel of w. Returns true (>0) if its
+ * case had been performed, by a thread on the other side of an unbuffered
+ * channel, without its function having been called yet: the value was then
+ * sent, or received into the case's value, all the same.
+ */
+static inline int loop_del_chan(loop_t *l, loop_chan_t *w)
+{
+	loop_chan_t **p;
+	int done = 0;
+
+	if (w->_idle)
+		_loop_unidle(l, w);
+	if (w->_armed)
+		done = _loop_chan_disarm(w, 0);
+
+	/* once off its channel, w can no longer be woken, but may have been already */
+	if (atomic_load(&w->_woken)) {
+		_loop_take_woken(l);
+		for (p = &l->ready; *p != w; p = &(*p)->_next_ready)
+			;
+		*p = w->_next_ready;
+	}
+
+	return done;
+}
+
+/*
+ * loop_run_once waits for events on l, unless block is false, then calls
+ * the functions of every watcher and timer which is ready. It does not wait
+ * if there is something to do already. Returns the number of functions
+ * called, or -1 (with errno set) if epoll_wait failed.
+ */
+static inline int loop_run_once(loop_t *l, int block)
+{
+	int n = 0, timeout = -1;
+	uint64_t next, now;
+	loop_chan_t *w;
+	loop_fd_t *f;
+
+	for (w = l->idle; w; w = l->cursor) {
+		l->cursor = w->_next;
+		n += _loop_chan_arm(l, w);
+	}
+
+	/*
+	 * Every watcher is now queued on its channel, except those added or
+	 * performed by the functions just called, which are armed without
+	 * waiting.
+	 */
+	if (!block || n || l->ready ||
+			atomic_load_explicit(&l->woken, memory_order_relaxed) ||
+			atomic_load_explicit(&l->stopped, memory_order_relaxed)) {
+		timeout = 0;
+	} else if ((next = timer_wheel_next(&l->wheel)) != UINT64_MAX) {
+		now = timer_now();
+		next = (next > now) ? (next - now + 999999) / 1000000 : 0;
+		timeout = (next < INT_MAX) ? (int)next : INT_MAX;
+	}
+
+	l->next = 0;
+	if ((l->nevents = epoll_wait(l->epfd, l->events, LOOP_EVENTS, timeout)) < 0) {
+		l->nevents = 0;
+		if (errno != EINTR)
+			return -1;
+	}
+	while (l->next < l->nevents) {
+		struct epoll_event *ev = &l->events[l->next++];
+		uint64_t count;
+
+		if (!ev->data.ptr) {
+			/* the eventfd: woken watchers are taken below, after it is reset */
+			while (read(l->efd, &count, sizeof(count)) < 0 && errno == EINTR)
+				;
+			atomic_store(&l->notified, 0);
+		} else if (ev->data.ptr != l) {
+			f = ev->data.ptr;
+			f->fn(f->arg, ev->events);
+			n++;
+		}
+	}
+	l->nevents = 0;
+
+	_loop_take_woken(l);
+	while ((w = l->ready)) {
+		l->ready = w->_next_ready;
+		atomic_store(&w->_woken, 0);
+		n += _loop_chan_run(l, w);
+	}
+
+	return n + (int)timer_wheel_advance(&l->wheel, timer_now());
+}
+
+/*
+ * loop_run runs l until loop_stop is called (which may be before loop_run
+ * is), after which it may be run again. Returns zero once stopped, or -1
+ * (with errno set) if epoll_wait failed.
+ */
+static inline int loop_run(loop_t *l)
+{
+	while (!atomic_load(&l->stopped)) {
+		if (loop_run_once(l, 1) < 0)
+			return -1;
+	}
+	atomic_store(&l->stopped, 0);
+
+	return 0;
+}
+
+#endif /* HLC_LOOP_H */
@@ -0,0 +1,180 @@
+/*
+ * perfctr.h - hardware performance counters for a region of code (Linux)
+ * Copyright (C) Ethan Marshall - 2023
+ *
+ * Requirements: stdint.h string.h unistd.h sys/ioctl.h sys/syscall.h
+ *               linux/perf_event.h
+ *
+ * A thin wrapper around perf_event_open(2) which counts CPU cycles,
+ * instructions, cache references and misses and branches and branch
+ * mispredictions for the calling thread, in user space only. This tells you
+ * *why* a region of code is slow (eg. branch misses versus memory stalls),
+ * rather than just how slow it is.
+ *
+ * Counters are opened as one group, so they are always scheduled together.
+ * Access to the counters may be restricted by the kernel (see
+ * /proc/sys/kernel/perf_event_paranoid) or unavailable inside containers and
+ * virtual machines. Counters which cannot be opened are marked unavailable
+ * and read as zero, so callers need not treat this specially.
+ *
+ * When compiling with a strict ISO C standard (eg. -std=c99), _GNU_SOURCE must
+ * be defined so that syscall(2) is declared.
+ */
+
+#ifndef HLC_PERFCTR_H
+#define HLC_PERFCTR_H
+
+#ifdef HLC_AUTO_INCLUDE
+#define PERFCTR_AUTO_INCLUDE
+#endif
+
+#ifdef PERFCTR_AUTO_INCLUDE
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/*
+ * perfctr_event is one of the hardware events counted by a perfctr_t.
+ */
+enum perfctr_event {
+	PERFCTR_CYCLES,
+	PERFCTR_INSTRUCTIONS,
+	PERFCTR_CACHE_REFS,
+	PERFCTR_CACHE_MISSES,
+	PERFCTR_BRANCHES,
+	PERFCTR_BRANCH_MISSES,
+	PERFCTR_COUNT
+};
+
+/*
+ * perfctr_t is a group of hardware counters for the thread which opened it.
+ * values holds the counts between the last perfctr_start and perfctr_stop,
+ * scaled up if the kernel had to multiplex the counters.
+ */
+typedef struct {
+	int fd[PERFCTR_COUNT];
+	/* the first counter which opened; controls the group */
+	int leader;
+	uint64_t values[PERFCTR_COUNT];
+} perfctr_t;
+
+/* Internal: perf_event config for each perfctr_event */
+static const uint64_t _perfctr_config[PERFCTR_COUNT] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_REFERENCES,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+/*
+ * perfctr_name returns a short printable name for the event e.
+ */
+static inline const char *perfctr_name(enum perfctr_event e)
+{
+	static const char *names[PERFCTR_COUNT] = {
+		"cycles", "instructions", "cache_refs", "cache_misses",
+		"branches", "branch_misses",
+	};
+
+	return (e < PERFCTR_COUNT) ? names[e] : "?";
+}
+
+/*
+ * perfctr_open opens all counters for the calling thread, initially stopped.
+ * The number of counters which could be opened is returned; if zero, no
+ * counters are available and all other routines are no-ops.
+ */
+static inline int perfctr_open(perfctr_t *p)
+{
+	struct perf_event_attr attr;
+	int opened = 0;
+
+	p->leader = -1;
+	for (int i = 0; i < PERFCTR_COUNT; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.size = sizeof(attr);
+		attr.config = _perfctr_config[i];
+		attr.disabled = (p->leader < 0);
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		p->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1,
+				(p->leader < 0) ? -1 : p->fd[p->leader], 0);
+		p->values[i] = 0;
+		if (p->fd[i] < 0)
+			continue;
+
+		if (p->leader < 0)
+			p->leader = i;
+		opened++;
+	}
+
+	return opened;
+}
+
+/*
+ * perfctr_available returns true (>0) if the event e could be opened.
+ */
+static inline int perfctr_available(const perfctr_t *p, enum perfctr_event e)
+{
+	return p->fd[e] >= 0;
+}
+
+/*
+ * perfctr_start zeroes and starts all counters.
+ */
+static inline void perfctr_start(perfctr_t *p)
+{
+	if (p->leader < 0)
+		return;
+
+	ioctl(p->fd[p->leader], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(p->fd[p->leader], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+/*
+ * perfctr_stop stops all counters and stores their counts in p->values.
+ */
+static inline void perfctr_stop(perfctr_t *p)
+{
+	uint64_t buf[3];
+
+	if (p->leader < 0)
+		return;
+	ioctl(p->fd[p->leader], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+	for (int i = 0; i < PERFCTR_COUNT; i++) {
+		p->values[i] = 0;
+		if (p->fd[i] < 0 || read(p->fd[i], buf, sizeof(buf)) != sizeof(buf))
+			continue;
+
+		/* value, time enabled, time running: scale if multiplexed */
+		if (buf[2] && buf[2] < buf[1])
+			p->values[i] = (uint64_t)((double)buf[0] * ((double)buf[1] / (double)buf[2]));
+		else
+			p->values[i] = buf[0];
+	}
+}
+
+/*
+ * perfctr_close closes all counters.
+ */
+static inline void perfctr_close(perfctr_t *p)
+{
+	for (int i = 0; i < PERFCTR_COUNT; i++) {
+		if (p->fd[i] >= 0)
+			close(p->fd[i]);
+		p->fd[i] = -1;
+	}
+	p->leader = -1;
+}
+
+#endif /* HLC_PERFCTR_H */
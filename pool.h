@@ -0,0 +1,691 @@
+/*
+ * pool.h - C11 work-stealing thread pool
+ * Copyright (C) Ethan Marshall - 2023
+ *
+ * Requirements: stddef.h stdint.h stdlib.h string.h limits.h time.h stdatomic.h
+ *               pthread.h unistd.h alloc.h sync.h
+ *
+ * A pool runs tasks (a function and its argument) on a fixed set of worker
+ * threads, created once, so that spawning a task costs an allocation from a
+ * per-worker cache and a push onto a deque rather than a thread.
+ *
+ * Each worker owns a deque of tasks (after Chase and Lev). The owner pushes
+ * and pops at the bottom without any atomic read-modify-write unless the
+ * deque is nearly empty, so a task which spawns more tasks keeps running the
+ * newest of them, whose data is still in its cache. A worker which runs out
+ * of tasks steals the oldest task of a worker chosen at random, and so takes
+ * the largest remaining piece of work. Tasks spawned from outside the pool go
+ * to a shared queue. Workers which find no work spin briefly, then sleep in
+ * the kernel (see sync.h) until more is spawned.
+ *
+ * Tasks are gathered into groups (pool_group_t), which a thread may wait on
+ * with pool_wait. A worker waiting on a group runs other tasks in the
+ * meantime, so tasks may spawn and wait for tasks of their own (fork-join)
+ * without tying up the pool. pool_for divides a loop over an index range,
+ * such as the elements of a slice_t or vector, among the workers.
+ */
+
+#ifndef HLC_POOL_H
+#define HLC_POOL_H
+
+#ifdef HLC_AUTO_INCLUDE
+#define POOL_AUTO_INCLUDE
+#endif
+
+#ifdef POOL_AUTO_INCLUDE
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "alloc.h"
+#include "sync.h"
+#endif
+
+/*
+ * POOL_SPIN is the number of times an idle worker searches for work, backing
+ * off between searches, before it sleeps. Waking a sleeping worker costs the
+ * spawner a system call.
+ */
+#ifndef POOL_SPIN
+#define POOL_SPIN 64
+#endif
+
+/*
+ * POOL_TASK_CACHE is the number of freed tasks which each worker keeps for
+ * reuse, rather than returning them to the allocator.
+ */
+#ifndef POOL_TASK_CACHE
+#define POOL_TASK_CACHE 256
+#endif
+
+/*
+ * POOL_FOR_SPLIT is the number of pieces per worker into which pool_for
+ * divides a range, so that workers which finish early can steal the rest.
+ */
+#ifndef POOL_FOR_SPLIT
+#define POOL_FOR_SPLIT 4
+#endif
+
+/* pool_func is a task, which is called with the argument it was spawned with */
+typedef void (*pool_func)(void *arg);
+
+/*
+ * pool_group_t is a set of tasks which may be waited on together. It is
+ * initialized with POOL_GROUP_INIT or pool_group_init, and may be reused once
+ * waited on.
+ */
+typedef struct {
+	/* twice the number of unfinished tasks, plus one while a thread sleeps on them */
+	atomic_int pending;
+} pool_group_t;
+
+#define POOL_GROUP_INIT {0}
+
+static inline void pool_group_init(pool_group_t *g)
+{
+	atomic_init(&g->pending, 0);
+}
+
+/*
+ * Internal: a spawned task, linked through next while queued or cached. An
+ * embedded task is part of some other object (see fiber.h), which owns it, so
+ * is not freed once run.
+ */
+struct _pool_task {
+	pool_func fn;
+	void *arg;
+	pool_group_t *group;
+	struct _pool_task *next;
+	int embedded;
+};
+
+/*
+ * Internal: the circular array of a deque. When the deque grows, the old
+ * array is kept (as retired) until the pool is freed, as thieves may still be
+ * reading it.
+ */
+struct _pool_array {
+	size_t mask;
+	struct _pool_array *retired;
+	_Atomic(struct _pool_task *) tasks[];
+};
+
+/*
+ * Internal: a worker thread and its deque. The owner works at the bottom of
+ * the deque, and thieves take from the top, which has its own cache line.
+ */
+struct _pool_worker {
+	SYNC_ALIGNED atomic_llong bottom;
+	_Atomic(struct _pool_array *) array;
+	struct _pool_task *cache;
+	int ncache;
+	uint32_t rand;
+	struct pool *pool;
+	pthread_t thread;
+	SYNC_ALIGNED atomic_llong top;
+};
+
+/*
+ * pool_t is a pool of worker threads. It is created with pool_new and freed
+ * with pool_free.
+ */
+typedef struct pool {
+	struct _pool_worker *workers;
+	int nworkers;
+	const allocator_t *alloc;
+	/* tasks spawned from outside the pool, oldest first */
+	SYNC_ALIGNED mutex_t lock;
+	struct _pool_task *head, *tail;
+	atomic_int injected;
+	/* idle workers sleep on epoch, which changes whenever work is spawned */
+	SYNC_ALIGNED atomic_int epoch;
+	atomic_int sleepers;
+	atomic_int stop;
+} pool_t;
+
+/* Internal: the worker which the calling thread is, if any */
+static _Thread_local struct _pool_worker *_pool_self;
+/* Internal: the random state of threads which are not workers */
+static _Thread_local uint32_t _pool_rand_state;
+static atomic_uint _pool_rand_seed;
+
+/* Internal: returns the calling thread's worker in p, or NULL if it has none */
+static inline struct _pool_worker *_pool_worker_of(pool_t *p)
+{
+	return (_pool_self && _pool_self->pool == p) ? _pool_self : NULL;
+}
+
+/* Internal: returns a random number below n (xorshift32) from state */
+static inline uint32_t _pool_rand(uint32_t *state, uint32_t n)
+{
+	uint32_t x = *state;
+
+	/* each thread is seeded differently, the first time it steals */
+	while (!x)
+		x = atomic_fetch_add_explicit(&_pool_rand_seed, 1, memory_order_relaxed) * 0x9e3779b9u;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+
+	return x % n;
+}
+
+/* Internal: returns a new, empty deque array of size (a power of two) slots */
+static inline struct _pool_array *_pool_array_new(pool_t *p, size_t size)
+{
+	struct _pool_array *a;
+
+	if (size > (SIZE_MAX - sizeof(*a)) / sizeof(a->tasks[0]))
+		return NULL;
+	a = _alloc_malloc_at(p->alloc, sizeof(*a) + size * sizeof(a->tasks[0]), ALLOC_MOD_POOL,
+			__func__);
+	if (!a)
+		return NULL;
+	a->mask = size - 1;
+	a->retired = NULL;
+
+	return a;
+}
+
+/* Internal: frees a and every array it retired */
+static inline void _pool_array_free(pool_t *p, struct _pool_array *a)
+{
+	struct _pool_array *next;
+
+	for (; a; a = next) {
+		next = a->retired;
+		_alloc_free_at(p->alloc, a, sizeof(*a) + (a->mask + 1) * sizeof(a->tasks[0]),
+				ALLOC_MOD_POOL, __func__);
+	}
+}
+
+/*
+ * Internal: pushes t onto the bottom of the deque of w, which must be the
+ * calling thread's. Returns zero if the deque was full and could not grow.
+ */
+static inline int _pool_push(pool_t *p, struct _pool_worker *w, struct _pool_task *t)
+{
+	long long b = atomic_load_explicit(&w->bottom, memory_order_relaxed);
+	long long top = atomic_load_explicit(&w->top, memory_order_acquire);
+	struct _pool_array *a = atomic_load_explicit(&w->array, memory_order_relaxed), *grown;
+
+	if (b - top > (long long)a->mask) {
+		if (!(grown = _pool_array_new(p, (a->mask + 1) * 2)))
+			return 0;
+		for (long long i = top; i < b; i++)
+			atomic_store_explicit(&grown->tasks[i & grown->mask],
+					atomic_load_explicit(&a->tasks[i & a->mask], memory_order_relaxed),
+					memory_order_relaxed);
+		grown->retired = a;
+		atomic_store_explicit(&w->array, grown, memory_order_release);
+		a = grown;
+	}
+
+	/* a thief which reads the slot must see the task it points to */
+	atomic_store_explicit(&a->tasks[b & a->mask], t, memory_order_release);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+
+	return 1;
+}
+
+/*
+ * Internal: pops the newest task from the bottom of the deque of w, which must
+ * be the calling thread's. Returns NULL if the deque is empty.
+ */
+static inline struct _pool_task *_pool_take(struct _pool_worker *w)
+{
+	long long b = atomic_load_explicit(&w->bottom, memory_order_relaxed) - 1, t;
+	struct _pool_array *a = atomic_load_explicit(&w->array, memory_order_relaxed);
+	struct _pool_task *task = NULL;
+
+	atomic_store_explicit(&w->bottom, b, memory_order_relaxed);
+	/* a thief must either see the bottom lowered, or we must see its top raised */
+	atomic_thread_fence(memory_order_seq_cst);
+	t = atomic_load_explicit(&w->top, memory_order_relaxed);
+
+	if (t <= b) {
+		task = atomic_load_explicit(&a->tasks[b & a->mask], memory_order_relaxed);
+		if (t == b) {
+			/* the last task: race the thieves for it */
+			if (!atomic_compare_exchange_strong_explicit(&w->top, &t, t + 1,
+						memory_order_seq_cst, memory_order_relaxed))
+				task = NULL;
+			atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+		}
+	} else {
+		atomic_store_explicit(&w->bottom, b + 1, memory_order_relaxed);
+	}
+
+	return task;
+}
+
+/*
+ * Internal: steals the oldest task from the top of the deque of w. Returns
+ * NULL if the deque is empty, or another thread took the task first.
+ */
+static inline struct _pool_task *_pool_steal(struct _pool_worker *w)
+{
+	long long t = atomic_load_explicit(&w->top, memory_order_acquire), b;
+	struct _pool_array *a;
+	struct _pool_task *task;
+
+	atomic_thread_fence(memory_order_seq_cst);
+	b = atomic_load_explicit(&w->bottom, memory_order_acquire);
+	if (t >= b)
+		return NULL;
+
+	a = atomic_load_explicit(&w->array, memory_order_acquire);
+	task = atomic_load_explicit(&a->tasks[t & a->mask], memory_order_acquire);
+	if (!atomic_compare_exchange_strong_explicit(&w->top, &t, t + 1,
+				memory_order_seq_cst, memory_order_relaxed))
+		return NULL;
+
+	return task;
+}
+
+/* Internal: appends t to the queue of tasks spawned from outside p */
+static inline void _pool_inject(pool_t *p, struct _pool_task *t)
+{
+	t->next = NULL;
+	mutex_lock(&p->lock);
+	if (p->tail)
+		p->tail->next = t;
+	else
+		p->head = t;
+	p->tail = t;
+	atomic_fetch_add_explicit(&p->injected, 1, memory_order_relaxed);
+	mutex_unlock(&p->lock);
+}
+
+/* Internal: removes the oldest task spawned from outside p, or returns NULL */
+static inline struct _pool_task *_pool_dequeue(pool_t *p)
+{
+	struct _pool_task *t;
+
+	if (!atomic_load_explicit(&p->injected, memory_order_relaxed))
+		return NULL;
+
+	mutex_lock(&p->lock);
+	if ((t = p->head)) {
+		if (!(p->head = t->next))
+			p->tail = NULL;
+		atomic_fetch_sub_explicit(&p->injected, 1, memory_order_relaxed);
+	}
+	mutex_unlock(&p->lock);
+
+	return t;
+}
+
+/*
+ * Internal: finds a task for the calling thread (the worker self, or NULL if
+ * it is not one of p's): its own newest task, else the oldest spawned from
+ * outside the pool, else one stolen from another worker. Returns NULL if
+ * none could be found.
+ */
+static inline struct _pool_task *_pool_find(pool_t *p, struct _pool_worker *self)
+{
+	struct _pool_worker *victim;
+	struct _pool_task *t;
+	uint32_t start;
+
+	if (self && (t = _pool_take(self)))
+		return t;
+	if ((t = _pool_dequeue(p)))
+		return t;
+
+	/* visit every other worker, starting from one at random */
+	start = _pool_rand(self ? &self->rand : &_pool_rand_state, (uint32_t)p->nworkers);
+	for (int i = 0; i < p->nworkers; i++) {
+		victim = &p->workers[(start + (uint32_t)i) % (uint32_t)p->nworkers];
+		if (victim != self && (t = _pool_steal(victim)))
+			return t;
+	}
+
+	return NULL;
+}
+
+/* Internal: returns true if any task is queued in p */
+static inline int _pool_has_work(pool_t *p)
+{
+	struct _pool_worker *w;
+
+	if (atomic_load(&p->injected))
+		return 1;
+	for (int i = 0; i < p->nworkers; i++) {
+		w = &p->workers[i];
+		if (atomic_load(&w->top) < atomic_load(&w->bottom))
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Internal: wakes a sleeping worker of p, if there is one, after work is spawned */
+static inline void _pool_notify(pool_t *p)
+{
+	/* pairs with the increment of sleepers: either it sees our work, or we see it */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (!atomic_load_explicit(&p->sleepers, memory_order_relaxed))
+		return;
+
+	atomic_fetch_add_explicit(&p->epoch, 1, memory_order_release);
+	_sync_futex_wake(&p->epoch, 1);
+}
+
+/* Internal: returns a task for the calling thread to spawn, or NULL */
+static inline struct _pool_task *_pool_task_new(pool_t *p, struct _pool_worker *self)
+{
+	struct _pool_task *t;
+
+	if (self && (t = self->cache)) {
+		self->cache = t->next;
+		self->ncache--;
+		return t;
+	}
+
+	return _alloc_malloc_at(p->alloc, sizeof(*t), ALLOC_MOD_POOL, __func__);
+}
+
+/* Internal: frees t, caching it in self (if not NULL) for reuse */
+static inline void _pool_task_free(pool_t *p, struct _pool_worker *self, struct _pool_task *t)
+{
+	if (self && self->ncache < POOL_TASK_CACHE) {
+		t->next = self->cache;
+		self->cache = t;
+		self->ncache++;
+		return;
+	}
+
+	_alloc_free_at(p->alloc, t, sizeof(*t), ALLOC_MOD_POOL, __func__);
+}
+
+/* Internal: marks one task of g as finished, waking its waiter if it was the last */
+static inline void _pool_group_done(pool_group_t *g)
+{
+	/* g may go out of scope as soon as pending drops, so only its address is used after */
+	if (atomic_fetch_sub_explicit(&g->pending, 2, memory_order_acq_rel) == 3)
+		_sync_futex_wake(&g->pending, INT_MAX);
+}
+
+/* Internal: runs t on the calling thread (the worker self, or NULL), then frees it */
+static inline void _pool_run(pool_t *p, struct _pool_worker *self, struct _pool_task *t)
+{
+	pool_group_t *g = t->group;
+	int embedded = t->embedded;
+
+	t->fn(t->arg);
+	/* an embedded task may be queued again, or gone, once it has run */
+	if (!embedded)
+		_pool_task_free(p, self, t);
+	if (g)
+		_pool_group_done(g);
+}
+
+/* Internal: the main loop of a worker thread */
+static inline void *_pool_main(void *arg)
+{
+	struct _pool_worker *self = arg;
+	pool_t *p = self->pool;
+	struct _pool_task *t;
+	unsigned spins = 0;
+	int idle = 0, epoch;
+
+	_pool_self = self;
+	for (;;) {
+		if ((t = _pool_find(p, self))) {
+			_pool_run(p, self, t);
+			idle = 0;
+			spins = 0;
+			continue;
+		}
+		if (atomic_load_explicit(&p->stop, memory_order_acquire))
+			break;
+		if (++idle < POOL_SPIN) {
+			_sync_backoff(&spins);
+			continue;
+		}
+
+		epoch = atomic_load_explicit(&p->epoch, memory_order_acquire);
+		atomic_fetch_add(&p->sleepers, 1);
+		if (!_pool_has_work(p) && !atomic_load(&p->stop))
+			_sync_futex_wait(&p->epoch, epoch, NULL);
+		atomic_fetch_sub_explicit(&p->sleepers, 1, memory_order_relaxed);
+		idle = 0;
+		spins = 0;
+	}
+
+	return NULL;
+}
+
+/* Internal: stops and joins the first n workers of p, then frees p */
+static inline void _pool_destroy(pool_t *p, int n)
+{
+	struct _pool_worker *w;
+	struct _pool_task *t, *next;
+
+	atomic_store(&p->stop, 1);
+	atomic_fetch_add_explicit(&p->epoch, 1, memory_order_release);
+	_sync_futex_wake(&p->epoch, INT_MAX);
+
+	for (int i = 0; i < n; i++)
+		pthread_join(p->workers[i].thread, NULL);
+	for (int i = 0; i < p->nworkers; i++) {
+		w = &p->workers[i];
+		for (t = w->cache; t; t = next) {
+			next = t->next;
+			_alloc_free_at(p->alloc, t, sizeof(*t), ALLOC_MOD_POOL, __func__);
+		}
+		_pool_array_free(p, atomic_load_explicit(&w->array, memory_order_relaxed));
+	}
+
+	free(p->workers);
+	free(p);
+}
+
+/*
+ * pool_new_alloc returns a new pool of nthreads worker threads, or if
+ * nthreads is zero, one per online CPU. Tasks and deques are allocated from
+ * alloc (or the system allocator if NULL), which must remain valid, and safe
+ * to use from any thread, for the lifetime of the pool. Returns NULL if
+ * memory is exhausted or a thread could not be created.
+ */
+static inline pool_t *pool_new_alloc(int nthreads, const allocator_t *alloc)
+{
+	pool_t *p;
+	struct _pool_worker *w;
+	int started = 0;
+
+	if (nthreads <= 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		nthreads = (cpus > 0 && cpus < INT_MAX) ? (int)cpus : 1;
+	}
+	if (!(p = sync_aligned_alloc(sizeof(*p))))
+		return NULL;
+	memset(p, 0, sizeof(*p));
+	p->alloc = alloc;
+	p->nworkers = nthreads;
+	if ((size_t)nthreads > SIZE_MAX / sizeof(*w) ||
+			!(p->workers = sync_aligned_alloc((size_t)nthreads * sizeof(*w)))) {
+		free(p);
+		return NULL;
+	}
+	memset(p->workers, 0, (size_t)nthreads * sizeof(*w));
+
+	for (int i = 0; i < nthreads; i++) {
+		w = &p->workers[i];
+		w->pool = p;
+		atomic_init(&w->array, _pool_array_new(p, 64));
+		if (!atomic_load_explicit(&w->array, memory_order_relaxed))
+			goto fail;
+	}
+	for (; started < nthreads; started++) {
+		w = &p->workers[started];
+		if (pthread_create(&w->thread, NULL, _pool_main, w))
+			goto fail;
+	}
+
+	return p;
+
+fail:
+	_pool_destroy(p, started);
+	return NULL;
+}
+
+/*
+ * pool_new returns a new pool of nthreads worker threads (or one per CPU if
+ * zero), as in pool_new_alloc, using the system allocator.
+ */
+#define pool_new(nthreads) pool_new_alloc(nthreads, NULL)
+
+/*
+ * pool_free runs any tasks still queued on p, then stops its workers and
+ * frees it. No task may be spawned on p during or after the call.
+ */
+static inline void pool_free(pool_t *p)
+{
+	_pool_destroy(p, p->nworkers);
+}
+
+/*
+ * pool_threads returns the number of worker threads in p.
+ */
+static inline int pool_threads(pool_t *p)
+{
+	return p->nworkers;
+}
+
+/*
+ * pool_spawn queues fn(arg) to run on one of the workers of p, as part of
+ * the group g (or of no group, if g is NULL). A task spawned by a worker of p
+ * is run by that worker unless another steals it first. If memory is
+ * exhausted, fn(arg) is run immediately by the calling thread instead.
+ */
+static inline void pool_spawn(pool_t *p, pool_group_t *g, pool_func fn, void *arg)
+{
+	struct _pool_worker *self = _pool_worker_of(p);
+	struct _pool_task *t = _pool_task_new(p, self);
+
+	if (!t) {
+		fn(arg);
+		return;
+	}
+	t->fn = fn;
+	t->arg = arg;
+	t->group = g;
+	t->embedded = 0;
+	if (g)
+		atomic_fetch_add_explicit(&g->pending, 2, memory_order_relaxed);
+
+	if (!self) {
+		_pool_inject(p, t);
+	} else if (!_pool_push(p, self, t)) {
+		_pool_run(p, self, t);
+		return;
+	}
+	_pool_notify(p);
+}
+
+/*
+ * pool_wait returns once every task spawned in the group g has finished. The
+ * calling thread runs queued tasks of p (of any group) while it waits, and
+ * only sleeps once there are none left for it to run.
+ */
+static inline void pool_wait(pool_t *p, pool_group_t *g)
+{
+	struct _pool_worker *self = _pool_worker_of(p);
+	struct _pool_task *t;
+	unsigned spins = 0;
+	int pending, idle = 0;
+
+	while ((pending = atomic_load_explicit(&g->pending, memory_order_acquire)) > 1) {
+		if ((t = _pool_find(p, self))) {
+			_pool_run(p, self, t);
+			idle = 0;
+			spins = 0;
+			continue;
+		}
+		if (++idle < POOL_SPIN) {
+			_sync_backoff(&spins);
+			continue;
+		}
+
+		/* the last task to finish wakes us once it sees we are asleep */
+		pending = atomic_fetch_or_explicit(&g->pending, 1, memory_order_acquire) | 1;
+		if (pending > 1)
+			_sync_futex_wait(&g->pending, pending, NULL);
+		idle = 0;
+		spins = 0;
+	}
+
+	atomic_store_explicit(&g->pending, 0, memory_order_relaxed);
+}
+
+/* Internal: one piece of a pool_for */
+struct _pool_range {
+	void (*fn)(void *arg, size_t lo, size_t hi);
+	void *arg;
+	size_t lo, hi;
+};
+
+/* Internal: the task which runs one piece of a pool_for */
+static inline void _pool_range_run(void *arg)
+{
+	struct _pool_range *r = arg;
+
+	r->fn(r->arg, r->lo, r->hi);
+}
+
+/*
+ * pool_for calls fn(arg, lo, hi) for disjoint ranges [lo, hi) which together
+ * cover [0, n), in parallel on the workers of p, and returns once every call
+ * has returned. Each range holds at least grain indices (unless n is
+ * smaller), so grain should be large enough that a call is worth a task. To
+ * loop over a slice_t s, for example, n is slc_len(&s).
+ *
+ * If memory is exhausted, the whole range is run by the calling thread.
+ */
+static inline void pool_for(pool_t *p, size_t n, size_t grain,
+		void (*fn)(void *arg, size_t lo, size_t hi), void *arg)
+{
+	pool_group_t g = POOL_GROUP_INIT;
+	struct _pool_range *r;
+	size_t pieces, size, extra, lo = 0;
+
+	if (!grain)
+		grain = 1;
+	pieces = n / grain;
+	if (pieces > (size_t)p->nworkers * POOL_FOR_SPLIT)
+		pieces = (size_t)p->nworkers * POOL_FOR_SPLIT;
+	if (pieces <= 1) {
+		if (n)
+			fn(arg, 0, n);
+		return;
+	}
+	if (!(r = _alloc_malloc_at(p->alloc, pieces * sizeof(*r), ALLOC_MOD_POOL, __func__))) {
+		fn(arg, 0, n);
+		return;
+	}
+
+	size = n / pieces;
+	extra = n % pieces;
+	for (size_t i = 0; i < pieces; i++) {
+		r[i] = (struct _pool_range){fn, arg, lo, lo + size + (i < extra)};
+		lo = r[i].hi;
+	}
+	/* the calling thread takes the first piece itself */
+	for (size_t i = pieces - 1; i > 0; i--)
+		pool_spawn(p, &g, _pool_range_run, &r[i]);
+	_pool_range_run(&r[0]);
+	pool_wait(p, &g);
+
+	_alloc_free_at(p->alloc, r, pieces * sizeof(*r), ALLOC_MOD_POOL, __func__);
+}
+
+#endif /* HLC_POOL_H */
@@ -0,0 +1,458 @@
+/*
+ * slab.h - C11 size-class slab allocator for small objects
+ * Copyright (C) Ethan Marshall - 2023
+ *
+ * Requirements: stddef.h stdlib.h string.h stdatomic.h alloc.h
+ *               sched.h (POSIX, for sched_yield)
+ *               SLAB_IMPL in one translation unit (see below)
+ *
+ * A slab allocator serves small blocks from fixed size classes (16, 32, 64,
+ * 128 and 256 bytes), carved out of large pages. Free blocks are kept on
+ * intrusive free lists (the link lives inside the free block itself), so no
+ * per-block header is needed. Each thread keeps a small cache of free blocks
+ * per class, so the common alloc/free pair touches no shared state; the cache
+ * is refilled from, and spilled back to, a shared locked depot in batches.
+ *
+ * A thread keeps caches for up to SLAB_TCACHES slabs at once. A thread which
+ * uses more slabs than that in turn evicts one cache each time it switches to
+ * a slab without one, returning all its blocks to their depot, and refills
+ * from the depot again afterwards: the cost of a switch is then a lock and
+ * copy per class in use, rather than nothing.
+ *
+ * Blocks larger than the largest class are passed through to the system
+ * allocator. Memory is only returned to the system by slab_destroy.
+ *
+ * Containers may draw from a slab by passing slab_allocator(&slab) to their
+ * *_alloc constructor. This suits long-lived processes with lots of small
+ * strings, such as those created by str_new.
+ *
+ * Exactly one translation unit of a program using slabs must define SLAB_IMPL
+ * before including this header, to provide storage for the thread caches:
+ * there is one set per thread for the whole program, so that slab_flush and
+ * slab_destroy find the blocks cached by any translation unit.
+ */
+
+#ifndef HLC_SLAB_H
+#define HLC_SLAB_H
+
+#ifdef HLC_AUTO_INCLUDE
+#define SLAB_AUTO_INCLUDE
+#endif
+
+#ifdef SLAB_AUTO_INCLUDE
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sched.h>
+#endif
+#include "alloc.h"
+#endif
+
+/* SLAB_MIN and SLAB_MAX are the smallest and largest size classes */
+#define SLAB_MIN 16
+#define SLAB_MAX 256
+/* SLAB_CLASSES is the number of size classes (powers of two MIN to MAX) */
+#define SLAB_CLASSES 5
+
+/*
+ * slab_page_size is the size of each page requested from the system
+ * allocator, which is then carved into blocks of one size class.
+ */
+static const size_t slab_page_size = 64 * 1024;
+
+/*
+ * SLAB_BATCH is the number of blocks moved between a thread cache and the
+ * depot at once. A thread cache holds at most 2 * SLAB_BATCH blocks per class.
+ */
+#ifndef SLAB_BATCH
+#define SLAB_BATCH 32
+#endif
+
+/* SLAB_TCACHES is the number of slabs for which each thread caches blocks */
+#ifndef SLAB_TCACHES
+#define SLAB_TCACHES 4
+#endif
+
+/*
+ * SLAB_SPIN_MAX is the longest backoff, in spin-wait hints, between two polls
+ * of a depot lock. Once reached, waiters yield the CPU between polls instead.
+ */
+#ifndef SLAB_SPIN_MAX
+#define SLAB_SPIN_MAX 64
+#endif
+
+/* Internal: a free block, linked through its own storage */
+struct _slab_obj {
+	struct _slab_obj *next;
+};
+
+/* Internal: a page of blocks; data is aligned for any type */
+struct _slab_page {
+	struct _slab_page *next;
+	union {
+		long double ld;
+		long long ll;
+		void *p;
+	} data[];
+};
+
+/* Internal: shared state for one size class */
+struct _slab_class {
+	atomic_flag lock;
+	struct _slab_obj *free;
+	struct _slab_page *pages;
+};
+
+/*
+ * slab_t is a slab allocator. It must be initialized with slab_init and
+ * destroyed with slab_destroy. It is safe for concurrent use by any number of
+ * threads.
+ */
+typedef struct {
+	struct _slab_class classes[SLAB_CLASSES];
+	allocator_t alloc;
+} slab_t;
+
+/* Internal: the calling thread's cache of free blocks for one slab */
+struct _slab_tcache {
+	slab_t *owner;
+	struct _slab_obj *free[SLAB_CLASSES];
+	size_t count[SLAB_CLASSES];
+};
+
+/* Internal: the thread caches, and the next to be evicted if all are in use */
+extern _Thread_local struct _slab_tcache _slab_tcache[SLAB_TCACHES];
+extern _Thread_local unsigned _slab_tcache_victim;
+#ifdef SLAB_IMPL
+_Thread_local struct _slab_tcache _slab_tcache[SLAB_TCACHES];
+_Thread_local unsigned _slab_tcache_victim;
+#endif
+
+static inline void slab_flush(slab_t *s);
+
+/*
+ * slab_init initializes an empty slab allocator. No memory is allocated until
+ * first use.
+ */
+static inline void slab_init(slab_t *s)
+{
+	for (int i = 0; i < SLAB_CLASSES; i++) {
+		atomic_flag_clear(&s->classes[i].lock);
+		s->classes[i].free = NULL;
+		s->classes[i].pages = NULL;
+	}
+	memset(&s->alloc, 0, sizeof(s->alloc));
+}
+
+/*
+ * Internal: returns the size class index for size, or -1 if size is too large
+ * to be served by a slab.
+ */
+static inline int _slab_class_of(size_t size)
+{
+	size_t cs = SLAB_MIN;
+	int c = 0;
+
+	if (size > SLAB_MAX)
+		return -1;
+	while (cs < size)
+		cs <<= 1, c++;
+
+	return c;
+}
+
+/*
+ * Internal: waits before the next poll of a depot lock, pausing twice as long
+ * each time, then yielding (a holder may be allocating a page, or have been
+ * preempted). *spins must be zero before the first wait.
+ */
+static inline void _slab_backoff(unsigned *spins)
+{
+	if (*spins >= SLAB_SPIN_MAX) {
+#if defined(__unix__) || defined(__APPLE__)
+		sched_yield();
+#endif
+		return;
+	}
+
+	*spins = *spins ? *spins * 2 : 1;
+	for (unsigned i = 0; i < *spins; i++) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		__asm__ __volatile__ ("pause" ::: "memory");
+#elif defined(__GNUC__) && (defined(__aarch64__) || defined(__arm__))
+		__asm__ __volatile__ ("yield" ::: "memory");
+#else
+		atomic_signal_fence(memory_order_seq_cst);
+#endif
+	}
+}
+
+static inline void _slab_lock(struct _slab_class *c)
+{
+	unsigned spins = 0;
+
+	while (atomic_flag_test_and_set_explicit(&c->lock, memory_order_acquire))
+		_slab_backoff(&spins);
+}
+
+static inline void _slab_unlock(struct _slab_class *c)
+{
+	atomic_flag_clear_explicit(&c->lock, memory_order_release);
+}
+
+/*
+ * Internal: carves a new page into blocks of class c and pushes them to the
+ * depot, which must be locked. Returns zero if the page cannot be allocated.
+ */
+static inline int _slab_carve(struct _slab_class *c, size_t bsize)
+{
+	struct _slab_page *page;
+	char *walk, *end;
+
+	page = HLC_MALLOC(slab_page_size);
+	if (!page)
+		return 0;
+	page->next = c->pages;
+	c->pages = page;
+
+	walk = (char *)page->data;
+	end = (char *)page + slab_page_size;
+	for (; walk + bsize <= end; walk += bsize) {
+		struct _slab_obj *o = (struct _slab_obj *)walk;
+		o->next = c->free;
+		c->free = o;
+	}
+
+	return 1;
+}
+
+/* Internal: returns the calling thread's cache for s, or NULL if it has none */
+static inline struct _slab_tcache *_slab_tcache_find(slab_t *s)
+{
+	for (int i = 0; i < SLAB_TCACHES; i++) {
+		if (_slab_tcache[i].owner == s)
+			return &_slab_tcache[i];
+	}
+
+	return NULL;
+}
+
+/*
+ * Internal: returns the calling thread's cache for s, taking a free one, or
+ * else evicting another slab's (returning its blocks to their owner), if it
+ * has none.
+ */
+static inline struct _slab_tcache *_slab_tcache_get(slab_t *s)
+{
+	struct _slab_tcache *tc = _slab_tcache_find(s);
+
+	if (tc)
+		return tc;
+	if (!(tc = _slab_tcache_find(NULL))) {
+		tc = &_slab_tcache[_slab_tcache_victim++ % SLAB_TCACHES];
+		slab_flush(tc->owner);
+	}
+	tc->owner = s;
+
+	return tc;
+}
+
+/*
+ * Internal: moves up to SLAB_BATCH blocks of class ci from the depot to the
+ * thread cache tc. Returns zero if no memory could be obtained.
+ */
+static inline int _slab_refill(slab_t *s, struct _slab_tcache *tc, int ci)
+{
+	struct _slab_class *c = &s->classes[ci];
+	int n;
+
+	_slab_lock(c);
+	if (!c->free && !_slab_carve(c, (size_t)SLAB_MIN << ci)) {
+		_slab_unlock(c);
+		return 0;
+	}
+	for (n = 0; n < SLAB_BATCH && c->free; n++) {
+		struct _slab_obj *o = c->free;
+		c->free = o->next;
+		o->next = tc->free[ci];
+		tc->free[ci] = o;
+		tc->count[ci]++;
+	}
+	_slab_unlock(c);
+
+	return 1;
+}
+
+/*
+ * Internal: returns n blocks of class ci from the thread cache tc to the
+ * depot.
+ */
+static inline void _slab_spill(slab_t *s, struct _slab_tcache *tc, int ci, size_t n)
+{
+	struct _slab_class *c = &s->classes[ci];
+	struct _slab_obj *first, *last;
+
+	if (n == 0)
+		return;
+
+	/* unlink the chain outside of the lock */
+	first = last = tc->free[ci];
+	for (size_t i = 1; i < n; i++)
+		last = last->next;
+	tc->free[ci] = last->next;
+	tc->count[ci] -= n;
+
+	_slab_lock(c);
+	last->next = c->free;
+	c->free = first;
+	_slab_unlock(c);
+}
+
+/*
+ * slab_alloc returns a block of at least size bytes from s, aligned for any
+ * standard type, or NULL if memory is exhausted. Sizes above SLAB_MAX are
+ * passed through to the system allocator.
+ */
+static inline void *slab_alloc(slab_t *s, size_t size)
+{
+	struct _slab_tcache *tc;
+	struct _slab_obj *o;
+	int ci = _slab_class_of(size);
+
+	if (ci < 0)
+		return HLC_MALLOC(size);
+
+	tc = _slab_tcache_get(s);
+	if (!tc->free[ci] && !_slab_refill(s, tc, ci))
+		return NULL;
+
+	o = tc->free[ci];
+	tc->free[ci] = o->next;
+	tc->count[ci]--;
+
+	return o;
+}
+
+/*
+ * slab_free returns the block ptr, which was allocated from s with the given
+ * size, to the allocator. The block may be freed by a different thread to the
+ * one which allocated it. A NULL ptr is a no-op.
+ */
+static inline void slab_free(slab_t *s, void *ptr, size_t size)
+{
+	struct _slab_tcache *tc;
+	struct _slab_obj *o = ptr;
+	int ci = _slab_class_of(size);
+
+	if (!ptr)
+		return;
+	if (ci < 0) {
+		HLC_FREE(ptr);
+		return;
+	}
+
+	tc = _slab_tcache_get(s);
+	o->next = tc->free[ci];
+	tc->free[ci] = o;
+	if (++tc->count[ci] > 2 * SLAB_BATCH)
+		_slab_spill(s, tc, ci, SLAB_BATCH);
+}
+
+/*
+ * slab_realloc resizes the block ptr from oldsize to newsize bytes. If both
+ * sizes fall in the same class, ptr is returned unchanged. On failure, NULL is
+ * returned and ptr remains valid.
+ */
+static inline void *slab_realloc(slab_t *s, void *ptr, size_t oldsize, size_t newsize)
+{
+	int oldc = _slab_class_of(oldsize), newc = _slab_class_of(newsize);
+	void *ret;
+
+	if (!ptr)
+		return slab_alloc(s, newsize);
+	if (oldc >= 0 && oldc == newc)
+		return ptr;
+	if (oldc < 0 && newc < 0)
+		return HLC_REALLOC(ptr, newsize);
+
+	ret = slab_alloc(s, newsize);
+	if (!ret)
+		return NULL;
+	memcpy(ret, ptr, (oldsize < newsize) ? oldsize : newsize);
+	slab_free(s, ptr, oldsize);
+
+	return ret;
+}
+
+/*
+ * slab_flush returns all blocks cached by the calling thread to the depot of
+ * s, making them available to other threads. Threads should call this before
+ * exiting, else their cached blocks are unusable until slab_destroy.
+ */
+static inline void slab_flush(slab_t *s)
+{
+	struct _slab_tcache *tc = _slab_tcache_find(s);
+
+	if (!tc)
+		return;
+	for (int i = 0; i < SLAB_CLASSES; i++)
+		_slab_spill(s, tc, i, tc->count[i]);
+	tc->owner = NULL;
+}
+
+/*
+ * slab_destroy releases all memory associated with s to the system. Every
+ * thread which used s must have called slab_flush (or exited) first, and no
+ * block allocated from s may be used afterwards.
+ */
+static inline void slab_destroy(slab_t *s)
+{
+	slab_flush(s);
+
+	for (int i = 0; i < SLAB_CLASSES; i++) {
+		struct _slab_page *page = s->classes[i].pages;
+		while (page) {
+			struct _slab_page *next = page->next;
+			HLC_FREE(page);
+			page = next;
+		}
+		s->classes[i].pages = NULL;
+		s->classes[i].free = NULL;
+	}
+}
+
+/* Internal: allocator_t routines for slab_allocator */
+static inline void *_slab_alloc_cb(void *ctx, size_t size)
+{
+	return slab_alloc(ctx, size);
+}
+
+static inline void *_slab_resize_cb(void *ctx, void *ptr, size_t oldsize, size_t newsize)
+{
+	return slab_realloc(ctx, ptr, oldsize, newsize);
+}
+
+static inline void _slab_release_cb(void *ctx, void *ptr, size_t size)
+{
+	slab_free(ctx, ptr, size);
+}
+
+/*
+ * slab_allocator returns an allocator which allocates from the slab s, for
+ * use with the *_alloc constructors of containers. The allocator is only
+ * valid for as long as s, and s must not be moved in memory while it is in
+ * use.
+ */
+static inline const allocator_t *slab_allocator(slab_t *s)
+{
+	s->alloc.alloc = _slab_alloc_cb;
+	s->alloc.resize = _slab_resize_cb;
+	s->alloc.release = _slab_release_cb;
+	s->alloc.ctx = s;
+
+	return &s->alloc;
+}
+
+#endif /* HLC_SLAB_H */
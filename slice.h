@@ -2,7 +2,7 @@
  * slice.h - C99 implementation of a slice buffer
  * Copyright (C) Ethan Marshall - 2023
  *
- * Requirements: stdlib.h stdio.h stdint.h string.h
+ * Requirements: stdlib.h stdio.h stdint.h string.h alloc.h trace.h
  */
 
 #ifdef HLC_AUTO_INCLUDE
@@ -14,6 +14,8 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include "alloc.h"
+#include "trace.h"
 #endif
 
 /*
@@ -41,6 +43,9 @@ static const size_t slc_initial_cap = 2;
  * have its capacity otherwise changed after having been resliced at least
  * once. No sanity check is provided to guard against this. It is *up to you*
  * to ensure this does not occur.
+ *
+ * The underlying array is obtained from alloc, or the system allocator if
+ * alloc is NULL. Subslices share the allocator of their base slice.
  */
 typedef struct {
 	void *buf;
@@ -50,9 +55,10 @@ typedef struct {
 	size_t len, cap;
 	/* subslice? */
 	int8_t sub;
+	const allocator_t *alloc;
 } slice_t;
 
-static slice_t _slc_make(size_t size, size_t ilen, size_t icap)
+static inline slice_t _slc_make_alloc(size_t size, size_t ilen, size_t icap, const allocator_t *alloc)
 {
 	slice_t s;
 	size_t cap;
@@ -67,7 +73,7 @@ static slice_t _slc_make(size_t size, size_t ilen, size_t icap)
 		abort();
 	}
 
-	s.buf = calloc(cap, size);
+	s.buf = _alloc_calloc_at(alloc, cap, size, ALLOC_MOD_SLICE, __func__);
 	if (!s.buf) {
 		fprintf(stderr, "PANIC: out of memory (slice alloc)\n");
 		abort();
@@ -76,10 +82,16 @@ static slice_t _slc_make(size_t size, size_t ilen, size_t icap)
 	s.len = ilen;
 	s.cap = cap;
 	s.sub = 0;
+	s.alloc = alloc;
 
 	return s;
 }
 
+static inline slice_t _slc_make(size_t size, size_t ilen, size_t icap)
+{
+	return _slc_make_alloc(size, ilen, icap, NULL);
+}
+
 /*
  * slc_make returns a new slice of length ilen and initial capacity icap, with
  * each element of type typename. If icap is zero, slc_initial_cap is used
@@ -87,7 +99,15 @@ static slice_t _slc_make(size_t size, size_t ilen, size_t icap)
  */
 #define slc_make(typename, len, cap) _slc_make(sizeof(typename), len, cap)
 
-static slice_t _slc_new(size_t size)
+/*
+ * slc_make_alloc is identical to slc_make, but the underlying array of the
+ * slice (including any future growth) is obtained from the allocator alloc.
+ * alloc must remain valid for the lifetime of the slice.
+ */
+#define slc_make_alloc(typename, len, cap, alloc) \
+	_slc_make_alloc(sizeof(typename), len, cap, alloc)
+
+static inline slice_t _slc_new(size_t size)
 {
 	return _slc_make(size, 0, 0);
 }
@@ -105,19 +125,19 @@ static slice_t _slc_new(size_t size)
  * After calling slc_free on the base slice, all subslices are invalidated and
  * are to be treated as dangling references.
  */
-static void slc_free(slice_t *s)
+static inline void slc_free(slice_t *s)
 {
 	if (s->sub)
 		return;
 
-	free(s->buf);
+	_alloc_free_at(s->alloc, s->buf, s->cap * s->esize, ALLOC_MOD_SLICE, __func__);
 	s->len = s->cap = 0;
 }
 
 /*
  * slc_len returns the current length of the slice, in units of elements.
  */
-static size_t slc_len(slice_t *s)
+static inline size_t slc_len(slice_t *s)
 {
 	return s->len;
 }
@@ -126,7 +146,7 @@ static size_t slc_len(slice_t *s)
  * slc_cap returns the current capacity of the slice, in units of elements.
  * This is the maximum index which the slice may be resliced to.
  */
-static size_t slc_cap(slice_t *s)
+static inline size_t slc_cap(slice_t *s)
 {
 	return s->cap;
 }
@@ -135,7 +155,7 @@ static size_t slc_cap(slice_t *s)
  * slc_buflen returns the current length of the slice's buffer, in units of
  * bytes. This is the actual length of the underlying array.
  */
-static size_t slc_buflen(slice_t *s)
+static inline size_t slc_buflen(slice_t *s)
 {
 	return s->esize * s->len;
 }
@@ -144,7 +164,7 @@ static size_t slc_buflen(slice_t *s)
  * slc_bufcap returns the current capacity of the slice's buffer, in units of
  * bytes. This is not particularly useful in reslicing or indexing.
  */
-static size_t slc_bufcap(slice_t *s)
+static inline size_t slc_bufcap(slice_t *s)
 {
 	return s->esize * s->cap;
 }
@@ -154,7 +174,7 @@ static size_t slc_bufcap(slice_t *s)
  * fails, slc_grow panics, printing debugging information to standard error. If
  * cap is less than the current capacity, no operation is performed.
  */
-static void slc_grow(slice_t *s, size_t cap)
+static inline void slc_grow(slice_t *s, size_t cap)
 {
 	int8_t *walk;
 	void *alloc;
@@ -169,14 +189,17 @@ static void slc_grow(slice_t *s, size_t cap)
 		abort();
 	}
 
-	alloc = realloc(s->buf, cap * s->esize);
+	TRACE_BEGIN_ARG("slc_grow", cap * s->esize);
+	alloc = _alloc_realloc_at(s->alloc, s->buf, s->cap * s->esize, cap * s->esize,
+			ALLOC_MOD_SLICE, __func__);
+	TRACE_END("slc_grow");
 	if (!alloc) {
 		fprintf(stderr, "PANIC: out of memory (slice realloc)\n");
 		abort();
 	}
 	s->buf = alloc;
 
-	for (walk = (int8_t *)s->buf + s->cap; walk < (int8_t *)s->buf + (cap * s->esize); walk++) {
+	for (walk = (int8_t *)s->buf + (s->cap * s->esize); walk < (int8_t *)s->buf + (cap * s->esize); walk++) {
 		*walk = 0;
 	}
 	s->cap = cap;
@@ -188,7 +211,7 @@ static void slc_grow(slice_t *s, size_t cap)
  * references in the case of an erroneous slc_free or slc_grow on the base
  * slice.
  */
-static slice_t slc_ref(slice_t *base)
+static inline slice_t slc_ref(slice_t *base)
 {
 	slice_t ret = *base;
 	ret.sub = 1;
@@ -208,7 +231,7 @@ static slice_t slc_ref(slice_t *base)
  * the upper bound is excluded. If a reslice is attempted past the slice's
  * capacity, or lower > upper, slc_reslice panics.
  */
-static slice_t slc_reslice(slice_t *base, size_t lower, size_t upper)
+static inline slice_t slc_reslice(slice_t *base, size_t lower, size_t upper)
 {
 	slice_t ret = slc_ref(base);
 
@@ -238,7 +261,7 @@ static slice_t slc_reslice(slice_t *base, size_t lower, size_t upper)
  * length of the source and the length of the destination. If the size of the
  * elements in the source and destination are not the same, slc_copy panics.
  */
-static size_t slc_copy(slice_t *dst, slice_t *src)
+static inline size_t slc_copy(slice_t *dst, slice_t *src)
 {
 	size_t count;
 
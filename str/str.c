@@ -5,14 +5,18 @@
  * NOTE: This is a source-header library. You must both compile this source
  * file and include the corresponding header.
  *
- * Requirements: corresponding str.h be in include path
+ * Requirements: corresponding str.h be in include path, alloc.h and trace.h
+ * in the parent directory
  */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <limits.h>
+#include <string.h>
 
+#include "../alloc.h"
+#include "../trace.h"
 #include "str.h"
 
 /* Initial string buffer size allocated by str_new in bytes */
@@ -21,19 +25,26 @@
 /* The maximum size of a string in bytes */
 #define STR_SIZE_MAX ((size_t)-1)
 
-string_t str_new()
+string_t str_new_alloc(const allocator_t *alloc)
 {
-	char *buf = calloc(STR_INITIAL_BUFSIZ, sizeof(char));
+	char *buf = _alloc_calloc_at(alloc, STR_INITIAL_BUFSIZ, sizeof(char),
+			ALLOC_MOD_STR, __func__);
 	return (string_t){
 		.s = buf,
 		.e = buf,
-		.cap = STR_INITIAL_BUFSIZ,
+		.cap = buf ? STR_INITIAL_BUFSIZ : 0,
+		.alloc = alloc,
 	};
 }
 
+string_t str_new()
+{
+	return str_new_alloc(NULL);
+}
+
 void str_free(string_t *str)
 {
-	free(str->s);
+	_alloc_free_at(str->alloc, str->s, str->cap, ALLOC_MOD_STR, __func__);
 	str->e = str->s = NULL;
 	str->cap = 0;
 }
@@ -51,6 +62,7 @@ size_t str_len(const string_t *str)
 
 int str_grow(string_t *str, size_t delta)
 {
+	char *buf;
 	int stat = 1;
 	size_t oldlen = str->e - str->s;
 	size_t newcap = str->cap + delta;
@@ -76,7 +88,13 @@ int str_grow(string_t *str, size_t delta)
 		newcap = str->cap * 2;
 	}
 
-	str->s = realloc(str->s, sizeof(char) * newcap);
+	TRACE_BEGIN_ARG("str_grow", newcap);
+	buf = _alloc_realloc_at(str->alloc, str->s, str->cap, sizeof(char) * newcap,
+			ALLOC_MOD_STR, __func__);
+	TRACE_END("str_grow");
+	if (!buf)
+		return 0;
+	str->s = buf;
 	str->e = str->s + oldlen;
 	str->cap = newcap;
 
@@ -98,7 +116,8 @@ int str_reserve(string_t *str, size_t delta)
 void str_compact(string_t *str)
 {
 	size_t len = str->e - str->s;
-	char *buf = realloc(str->s, len + 1);
+	char *buf = _alloc_realloc_at(str->alloc, str->s, str->cap, len + 1,
+			ALLOC_MOD_STR, __func__);
 	if (!buf)
 		return;
 
@@ -122,12 +141,12 @@ void str_reset(string_t *str)
 	str_truncate(str, 0);
 }
 
-string_t str_from(const char *cstr)
+string_t str_from_alloc(const char *cstr, const allocator_t *alloc)
 {
 	const char *walk = cstr;
-	string_t ret = str_new();
+	string_t ret = str_new_alloc(alloc);
 
-	if (!cstr)
+	if (!cstr || !ret.s)
 		return ret;
 
 	for (;;) {
@@ -143,7 +162,7 @@ string_t str_from(const char *cstr)
 		if ((size_t)(ret.e - ret.s) == ret.cap) {
 			if (!str_grow(&ret, 0)) {
 				str_free(&ret);
-				return str_new();
+				return str_new_alloc(alloc);
 			}
 		}
 	}
@@ -151,6 +170,11 @@ string_t str_from(const char *cstr)
 	return ret;
 }
 
+string_t str_from(const char *cstr)
+{
+	return str_from_alloc(cstr, NULL);
+}
+
 char *str_cstr(const string_t *str)
 {
 	return str->s;
@@ -159,9 +183,9 @@ char *str_cstr(const string_t *str)
 string_t str_clone(const string_t *str)
 {
 	if (str_len(str) == 0) {
-		return (string_t){NULL, NULL, 0};
+		return (string_t){NULL, NULL, 0, str->alloc};
 	}
-	return str_from(str_cstr(str));
+	return str_from_alloc(str_cstr(str), str->alloc);
 }
 
 string_t str_concat(const string_t *a, const string_t *b)
@@ -242,7 +266,7 @@ void str_append(string_t *dst, const string_t *src)
 
 string_t str_fmt(const char *fmt, ...)
 {
-	string_t str = (string_t){NULL, NULL, 0};
+	string_t str = (string_t){NULL, NULL, 0, NULL};
 	int wlen = 0, written = 0;
 	va_list tmp, args;
 
@@ -262,7 +286,7 @@ string_t str_fmt(const char *fmt, ...)
 
 	if (written < 0) {
 		str_free(&str);
-		return (string_t){NULL, NULL, 0};
+		return (string_t){NULL, NULL, 0, NULL};
 	}
 	str.e = str.s + written;
 
@@ -4,6 +4,8 @@
  *
  * NOTE: This is a source-header library. You must both compile the
  * corresponding source file and include this header.
+ *
+ * Requirements: alloc.h
  */
 
 /*
@@ -22,10 +24,14 @@
  * Although this struct is not returned as an opaque handle, the modification
  * of its internals is to be discouraged, especially in the case of the cap
  * field, which must *always* be read through str_cap and str_grow.
+ *
+ * The string buffer is obtained from alloc, or the system allocator if alloc
+ * is NULL (as is the case for a zero-initialized string).
  */
 typedef struct {
 	char *s, *e;
 	size_t cap;
+	const allocator_t *alloc;
 } string_t;
 
 /*
@@ -49,6 +55,13 @@ typedef int (*str_iterfunc)(size_t i, char elem);
  */
 string_t str_new();
 
+/*
+ * str_new_alloc is identical to str_new, but the string buffer (including any
+ * future growth) is obtained from the allocator alloc. alloc must remain valid
+ * for the lifetime of the string.
+ */
+string_t str_new_alloc(const allocator_t *alloc);
+
 /*
  * str_free frees all resources associated with a string and sets its length
  * and capacity to zero. A string can be used after a call to str_free, but
@@ -121,6 +134,12 @@ void str_reset(string_t *str);
  */
 string_t str_from(const char *cstr);
 
+/*
+ * str_from_alloc is identical to str_from, but the string buffer is obtained
+ * from the allocator alloc, as in str_new_alloc.
+ */
+string_t str_from_alloc(const char *cstr, const allocator_t *alloc);
+
 /*
  * str_cstr returns the contents of the string as a C string, compatible with
  * all standard library string functions. The string returned is a const to
@@ -134,7 +153,8 @@ char *str_cstr(const string_t *str);
 /*
  * str_clone constructs and returns a fresh copy of str. A new heap block is
  * allocated to store the new copy, as in strdup, unless the string has zero
- * length, in which case no allocation takes place.
+ * length, in which case no allocation takes place. The copy uses the same
+ * allocator as str.
  */
 string_t str_clone(const string_t *str);
 
@@ -0,0 +1,1878 @@
+/*
+ * sync.h - C11 synchronization primitives
+ * Copyright (C) Ethan Marshall - 2023
+ *
+ * Requirements: stddef.h stdint.h stdlib.h limits.h errno.h time.h stdatomic.h
+ *               sched.h (POSIX, for sched_yield), unistd.h sys/syscall.h
+ *               linux/futex.h (Linux only)
+ *
+ * Typed atomic variables (see sync_atomic_declare) wrap C11 atomics with
+ * explicit memory orders, for flags, counters and pointers published from one
+ * thread to another (the lock statistics below are kept in them). Code which
+ * pairs sequentially consistent fences, as the locks do, uses C11 atomics
+ * directly. Where the hardware supports it,
+ * sync_dwcas provides a double-width compare-and-swap, eg. for pointers
+ * tagged with a version count.
+ *
+ * Three spinning locks are provided, each padded to its own cache line so that
+ * neighbouring locks do not falsely share:
+ *
+ * spinlock_t:   a test-and-test-and-set lock. Cheapest when uncontended, but
+ *               unfair: a releasing thread may immediately retake the lock.
+ * ticketlock_t: a FIFO lock, where each thread takes a ticket and waits to be
+ *               served. Fair, but every waiter polls the same line.
+ * mcslock_t:    a FIFO queue lock, where each waiter spins on its own node.
+ *               Scales best under heavy contention, at the cost of a node per
+ *               acquisition.
+ *
+ * Waiters back off exponentially (with the CPU's spin-wait hint between
+ * polls), and yield their CPU once the backoff is exhausted, so that locks do
+ * not collapse when there are more threads than CPUs. Even so, the fair locks
+ * degrade badly when oversubscribed, as each handoff must wait for the next
+ * thread in line to be scheduled. Spinning locks suit short critical sections
+ * only.
+ *
+ * For critical sections which may be long, or when threads may outnumber
+ * CPUs, mutex_t spins only briefly before sleeping in the kernel. It comes
+ * with a matching condition variable, cond_t. On Linux, both are built
+ * directly on futex(2); elsewhere, sleeping falls back to yielding.
+ *
+ * For data which is read far more often than it is written, rwlock_t spreads
+ * its readers over several cache lines, so they do not contend with each
+ * other, and seqlock_t lets readers proceed without writing to shared memory
+ * at all, retrying if a writer intervened.
+ *
+ * counter_t is a statistics counter for very frequent increments from many
+ * threads, which it spreads over a shard per thread, summed when read.
+ *
+ * sync_light_fence and sync_heavy_fence move the cost of a store-load fence
+ * from a hot path onto a rare one, such as from a waker onto a sleeper.
+ *
+ * For coordinating groups of threads: waitgroup_t waits for a count of tasks
+ * to finish (as Go's sync.WaitGroup), semaphore_t counts units of a resource,
+ * barrier_t holds each of a fixed number of threads until all have arrived,
+ * and once_t runs an initializer exactly once. Each is a futex word or two,
+ * which a thread polls briefly before sleeping on it, and which is only woken
+ * by a system call when some thread is actually asleep.
+ *
+ * Types which are padded to a cache line must be suitably aligned if allocated
+ * on the heap (eg. with sync_aligned_alloc).
+ *
+ * Lock contention may be profiled by defining HLC_SYNC_STATS, as described at
+ * the end of this header.
+ *
+ * When compiling with a strict ISO C standard (eg. -std=c11), _GNU_SOURCE must
+ * be defined so that syscall(2) is declared.
+ */
+
+#ifndef HLC_SYNC_H
+#define HLC_SYNC_H
+
+#ifdef HLC_AUTO_INCLUDE
+#define SYNC_AUTO_INCLUDE
+#endif
+
+#ifdef SYNC_AUTO_INCLUDE
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <sched.h>
+#endif
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+#endif
+
+/* SYNC_CACHE_LINE is the assumed size of a cache line in bytes */
+#ifndef SYNC_CACHE_LINE
+#define SYNC_CACHE_LINE 64
+#endif
+
+/*
+ * SYNC_ALIGNED starts a struct member on a new cache line, which also pads
+ * the struct to a whole number of lines, eg.:
+ *
+ * 	struct stats {
+ * 		SYNC_ALIGNED aint_t hits;
+ * 		SYNC_ALIGNED aint_t misses;
+ * 	};
+ *
+ * places hits and misses on different lines, so that threads updating one do
+ * not slow down threads updating the other (false sharing).
+ */
+#define SYNC_ALIGNED _Alignas(SYNC_CACHE_LINE)
+
+/*
+ * SYNC_PADDED(type) is a struct holding a single member v of the given type,
+ * alone on its cache line(s). Arrays of these place each element on its own
+ * line, eg. for per-thread slots.
+ */
+#define SYNC_PADDED(type) struct { SYNC_ALIGNED type v; }
+
+/*
+ * sync_aligned_alloc allocates size bytes aligned to a cache line, which is
+ * required of heap allocated types containing SYNC_ALIGNED members. The block
+ * is freed with free. Returns NULL if memory is exhausted.
+ */
+static inline void *sync_aligned_alloc(size_t size)
+{
+	/* aligned_alloc requires a multiple of the alignment */
+	size_t rounded = (size + SYNC_CACHE_LINE - 1) & ~(size_t)(SYNC_CACHE_LINE - 1);
+
+	if (rounded < size)
+		return NULL;
+	return aligned_alloc(SYNC_CACHE_LINE, rounded ? rounded : SYNC_CACHE_LINE);
+}
+
+/*
+ * sync_atomic_declare(type, name) declares name##_t, an atomic variable of the
+ * given type (which may be any integer or pointer type), and its routines:
+ *
+ * 	type name##_load(const name##_t *a)		acquire
+ * 	type name##_load_relaxed(const name##_t *a)
+ * 	void name##_store(name##_t *a, type v)		release
+ * 	void name##_store_relaxed(name##_t *a, type v)
+ * 	type name##_exchange(name##_t *a, type v)	acquire and release
+ * 	int  name##_cas(name##_t *a, type *expected, type desired)
+ * 	int  name##_cas_weak(name##_t *a, type *expected, type desired)
+ *
+ * The cas routines set *a to desired if it equals *expected, returning true
+ * (>0) on success and storing the value found in *expected on failure; they
+ * acquire and release on success, and are relaxed on failure. The weak form
+ * may fail spuriously, and so belongs in a loop. The defaults suit the common
+ * pattern of publishing data with a release store and consuming it with an
+ * acquire load. A zeroed variable holds zero (or NULL); name##_init may be
+ * used otherwise.
+ *
+ * The types aint_t, auint_t, asize_t, au64_t and aptr_t (for void *) are
+ * declared by this header.
+ */
+#define sync_atomic_declare(type, name) \
+	typedef struct { _Atomic(type) v; } name##_t; \
+	static inline void name##_init(name##_t *a, type v) \
+	{ atomic_init(&a->v, v); } \
+	static inline type name##_load(const name##_t *a) \
+	{ return atomic_load_explicit((_Atomic(type) *)&a->v, memory_order_acquire); } \
+	static inline type name##_load_relaxed(const name##_t *a) \
+	{ return atomic_load_explicit((_Atomic(type) *)&a->v, memory_order_relaxed); } \
+	static inline void name##_store(name##_t *a, type v) \
+	{ atomic_store_explicit(&a->v, v, memory_order_release); } \
+	static inline void name##_store_relaxed(name##_t *a, type v) \
+	{ atomic_store_explicit(&a->v, v, memory_order_relaxed); } \
+	static inline type name##_exchange(name##_t *a, type v) \
+	{ return atomic_exchange_explicit(&a->v, v, memory_order_acq_rel); } \
+	static inline int name##_cas(name##_t *a, type *expected, type desired) \
+	{ \
+		return atomic_compare_exchange_strong_explicit(&a->v, expected, desired, \
+				memory_order_acq_rel, memory_order_relaxed); \
+	} \
+	static inline int name##_cas_weak(name##_t *a, type *expected, type desired) \
+	{ \
+		return atomic_compare_exchange_weak_explicit(&a->v, expected, desired, \
+				memory_order_acq_rel, memory_order_relaxed); \
+	}
+
+/*
+ * sync_atomic_int_declare(type, name) is as sync_atomic_declare, for an
+ * integer type, adding fetch operations which return the previous value:
+ *
+ * 	type name##_add(name##_t *a, type v)		acquire and release
+ * 	type name##_sub(name##_t *a, type v)		acquire and release
+ * 	type name##_and(name##_t *a, type v)		acquire and release
+ * 	type name##_or(name##_t *a, type v)		acquire and release
+ * 	type name##_xor(name##_t *a, type v)		acquire and release
+ * 	type name##_add_relaxed(name##_t *a, type v)
+ * 	type name##_sub_relaxed(name##_t *a, type v)
+ *
+ * The relaxed forms suit statistics counters, which order nothing.
+ */
+#define sync_atomic_int_declare(type, name) \
+	sync_atomic_declare(type, name) \
+	static inline type name##_add(name##_t *a, type v) \
+	{ return atomic_fetch_add_explicit(&a->v, v, memory_order_acq_rel); } \
+	static inline type name##_sub(name##_t *a, type v) \
+	{ return atomic_fetch_sub_explicit(&a->v, v, memory_order_acq_rel); } \
+	static inline type name##_and(name##_t *a, type v) \
+	{ return atomic_fetch_and_explicit(&a->v, v, memory_order_acq_rel); } \
+	static inline type name##_or(name##_t *a, type v) \
+	{ return atomic_fetch_or_explicit(&a->v, v, memory_order_acq_rel); } \
+	static inline type name##_xor(name##_t *a, type v) \
+	{ return atomic_fetch_xor_explicit(&a->v, v, memory_order_acq_rel); } \
+	static inline type name##_add_relaxed(name##_t *a, type v) \
+	{ return atomic_fetch_add_explicit(&a->v, v, memory_order_relaxed); } \
+	static inline type name##_sub_relaxed(name##_t *a, type v) \
+	{ return atomic_fetch_sub_explicit(&a->v, v, memory_order_relaxed); }
+
+sync_atomic_int_declare(int, aint)
+sync_atomic_int_declare(unsigned, auint)
+sync_atomic_int_declare(size_t, asize)
+sync_atomic_int_declare(uint64_t, au64)
+sync_atomic_declare(void *, aptr)
+
+/*
+ * aflag_t is an atomic boolean flag, which unlike the types above is
+ * guaranteed to be lock-free everywhere. It is initialized with AFLAG_INIT.
+ */
+typedef struct { atomic_flag f; } aflag_t;
+
+#define AFLAG_INIT {ATOMIC_FLAG_INIT}
+
+/* aflag_set sets f, returning its previous value (acquire) */
+static inline int aflag_set(aflag_t *f)
+{
+	return atomic_flag_test_and_set_explicit(&f->f, memory_order_acquire);
+}
+
+/* aflag_clear clears f (release) */
+static inline void aflag_clear(aflag_t *f)
+{
+	atomic_flag_clear_explicit(&f->f, memory_order_release);
+}
+
+/*
+ * sync_dword_t is a pair of machine words which can be compared and swapped
+ * as one by sync_dwcas. It must be aligned to twice the size of a word, which
+ * the type guarantees when it is declared normally.
+ */
+typedef struct {
+	_Alignas(2 * sizeof(uintptr_t)) uintptr_t lo;
+	uintptr_t hi;
+} sync_dword_t;
+
+/*
+ * SYNC_HAVE_DWCAS is defined if sync_dwcas is a single instruction (or
+ * load/store-exclusive pair). Elsewhere, it falls back to the compiler's
+ * generic atomics, which may take a lock and require linking with -latomic.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__aarch64__))
+#define SYNC_HAVE_DWCAS
+#endif
+
+/*
+ * sync_dwcas atomically sets *a to desired if it equals *expected, returning
+ * true (>0) if it did so. On failure, the value found is stored in *expected.
+ * It acquires and releases. All concurrent accesses to *a must be made
+ * through sync_dwcas or sync_dwload.
+ */
+static inline int sync_dwcas(sync_dword_t *a, sync_dword_t *expected, sync_dword_t desired)
+{
+#if defined(__GNUC__) && defined(__x86_64__)
+	unsigned char ok;
+
+	__asm__ __volatile__ ("lock cmpxchg16b %1\n\tsete %0"
+			: "=q"(ok), "+m"(*a), "+a"(expected->lo), "+d"(expected->hi)
+			: "b"(desired.lo), "c"(desired.hi)
+			: "memory", "cc");
+	return ok;
+#elif defined(__GNUC__) && defined(__aarch64__)
+	uintptr_t lo, hi;
+	unsigned failed;
+
+	do {
+		__asm__ __volatile__ ("ldaxp %0, %1, %2"
+				: "=&r"(lo), "=&r"(hi) : "Q"(*a) : "memory");
+		if (lo != expected->lo || hi != expected->hi) {
+			__asm__ __volatile__ ("clrex" ::: "memory");
+			expected->lo = lo;
+			expected->hi = hi;
+			return 0;
+		}
+		__asm__ __volatile__ ("stlxp %w0, %2, %3, %1"
+				: "=&r"(failed), "=Q"(*a)
+				: "r"(desired.lo), "r"(desired.hi) : "memory");
+	} while (failed);
+	return 1;
+#else
+	return __atomic_compare_exchange(a, expected, &desired, 0, __ATOMIC_ACQ_REL,
+			__ATOMIC_ACQUIRE);
+#endif
+}
+
+/*
+ * sync_dwload atomically reads *a (acquire). *a must be writable, as this may
+ * be implemented with a compare-and-swap.
+ */
+static inline sync_dword_t sync_dwload(sync_dword_t *a)
+{
+	sync_dword_t v = {0, 0};
+
+	/* fails unless *a is zero, storing the value found in v */
+	sync_dwcas(a, &v, v);
+	return v;
+}
+
+/*
+ * SYNC_SPIN_MAX is the longest backoff, in spin-wait hints, between two polls
+ * of a lock. Once reached, waiters yield the CPU between polls instead.
+ */
+#ifndef SYNC_SPIN_MAX
+#define SYNC_SPIN_MAX 128
+#endif
+
+/*
+ * sync_pause hints to the CPU that the caller is in a spin-wait loop, which
+ * saves power and frees resources for a sibling hyperthread.
+ */
+static inline void sync_pause(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__asm__ __volatile__ ("pause" ::: "memory");
+#elif defined(__GNUC__) && (defined(__aarch64__) || defined(__arm__))
+	__asm__ __volatile__ ("yield" ::: "memory");
+#else
+	atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+/*
+ * sync_yield gives up the CPU to another runnable thread, if there is one.
+ */
+static inline void sync_yield(void)
+{
+#if defined(__unix__) || defined(__APPLE__)
+	sched_yield();
+#else
+	sync_pause();
+#endif
+}
+
+/*
+ * Internal: waits before the next poll of a lock. *spins holds the current
+ * backoff and must be zero before the first wait.
+ */
+static inline void _sync_backoff(unsigned *spins)
+{
+	if (*spins >= SYNC_SPIN_MAX) {
+		sync_yield();
+		return;
+	}
+
+	*spins = *spins ? *spins * 2 : 1;
+	for (unsigned i = 0; i < *spins; i++)
+		sync_pause();
+}
+
+/*
+ * spinlock_t is a test-and-test-and-set spinlock. It is initialized with
+ * SPINLOCK_INIT or spin_init.
+ */
+typedef struct {
+	_Alignas(SYNC_CACHE_LINE) atomic_int locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT {0}
+
+static inline void spin_init(spinlock_t *l)
+{
+	atomic_init(&l->locked, 0);
+}
+
+/*
+ * spin_trylock acquires l if it is free, returning true (>0) if it did so.
+ */
+static inline int spin_trylock(spinlock_t *l)
+{
+	return !atomic_load_explicit(&l->locked, memory_order_relaxed) &&
+		!atomic_exchange_explicit(&l->locked, 1, memory_order_acquire);
+}
+
+/*
+ * spin_lock acquires l, waiting for as long as necessary.
+ */
+static inline void spin_lock(spinlock_t *l)
+{
+	unsigned spins = 0;
+
+	/* only attempt to write once the lock looks free, to keep the line shared */
+	while (!spin_trylock(l))
+		_sync_backoff(&spins);
+}
+
+/*
+ * spin_unlock releases l, which must be held by the caller.
+ */
+static inline void spin_unlock(spinlock_t *l)
+{
+	atomic_store_explicit(&l->locked, 0, memory_order_release);
+}
+
+/*
+ * ticketlock_t is a fair (FIFO) spinlock. It is initialized with
+ * TICKETLOCK_INIT or ticket_init. The ticket dispenser and the now-serving
+ * counter are kept on separate lines, so that arriving threads do not disturb
+ * the threads polling for their turn.
+ */
+typedef struct {
+	_Alignas(SYNC_CACHE_LINE) atomic_uint next;
+	_Alignas(SYNC_CACHE_LINE) atomic_uint serving;
+} ticketlock_t;
+
+#define TICKETLOCK_INIT {0, 0}
+
+static inline void ticket_init(ticketlock_t *l)
+{
+	atomic_init(&l->next, 0);
+	atomic_init(&l->serving, 0);
+}
+
+/*
+ * ticket_trylock acquires l if no thread holds or is waiting for it,
+ * returning true (>0) if it did so.
+ */
+static inline int ticket_trylock(ticketlock_t *l)
+{
+	unsigned serving = atomic_load_explicit(&l->serving, memory_order_relaxed);
+
+	return atomic_compare_exchange_strong_explicit(&l->next, &serving, serving + 1,
+			memory_order_acquire, memory_order_relaxed);
+}
+
+/*
+ * ticket_lock acquires l, after all threads which arrived before the caller.
+ */
+static inline void ticket_lock(ticketlock_t *l)
+{
+	unsigned ticket = atomic_fetch_add_explicit(&l->next, 1, memory_order_relaxed);
+	unsigned serving, spins = 0;
+
+	while ((serving = atomic_load_explicit(&l->serving, memory_order_acquire)) != ticket) {
+		/* back off in proportion to our place in the queue */
+		if (spins < 2 * SYNC_SPIN_MAX) {
+			for (unsigned i = (ticket - serving) * 4; i > 0; i--, spins++)
+				sync_pause();
+		} else {
+			sync_yield();
+		}
+	}
+}
+
+/*
+ * ticket_unlock releases l, which must be held by the caller.
+ */
+static inline void ticket_unlock(ticketlock_t *l)
+{
+	unsigned serving = atomic_load_explicit(&l->serving, memory_order_relaxed);
+	atomic_store_explicit(&l->serving, serving + 1, memory_order_release);
+}
+
+/*
+ * mcs_node_t is the queue node of one acquisition of an mcslock_t. It is
+ * usually placed on the stack of the locking thread, and must remain valid
+ * from mcs_lock until the matching mcs_unlock returns.
+ */
+typedef struct mcs_node {
+	_Alignas(SYNC_CACHE_LINE) _Atomic(struct mcs_node *) next;
+	atomic_int waiting;
+} mcs_node_t;
+
+/*
+ * mcslock_t is a fair (FIFO) queue lock, where each waiter spins only on its
+ * own node. It is initialized with MCSLOCK_INIT or mcs_init.
+ */
+typedef struct {
+	_Alignas(SYNC_CACHE_LINE) _Atomic(mcs_node_t *) tail;
+} mcslock_t;
+
+#define MCSLOCK_INIT {NULL}
+
+static inline void mcs_init(mcslock_t *l)
+{
+	atomic_init(&l->tail, NULL);
+}
+
+/*
+ * mcs_trylock acquires l using node if it is free, returning true (>0) if it
+ * did so.
+ */
+static inline int mcs_trylock(mcslock_t *l, mcs_node_t *node)
+{
+	mcs_node_t *expected = NULL;
+
+	atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+	return atomic_compare_exchange_strong_explicit(&l->tail, &expected, node,
+			memory_order_acquire, memory_order_relaxed);
+}
+
+/*
+ * mcs_lock acquires l using node, after all threads which arrived before the
+ * caller.
+ */
+static inline void mcs_lock(mcslock_t *l, mcs_node_t *node)
+{
+	mcs_node_t *prev;
+	unsigned spins = 0;
+
+	atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+	atomic_store_explicit(&node->waiting, 1, memory_order_relaxed);
+
+	prev = atomic_exchange_explicit(&l->tail, node, memory_order_acq_rel);
+	if (!prev)
+		return;
+
+	atomic_store_explicit(&prev->next, node, memory_order_release);
+	while (atomic_load_explicit(&node->waiting, memory_order_acquire))
+		_sync_backoff(&spins);
+}
+
+/*
+ * mcs_unlock releases l, which must be held by the caller using node, handing
+ * it directly to the next waiter, if any.
+ */
+static inline void mcs_unlock(mcslock_t *l, mcs_node_t *node)
+{
+	mcs_node_t *next = atomic_load_explicit(&node->next, memory_order_acquire);
+	unsigned spins = 0;
+
+	if (!next) {
+		mcs_node_t *expected = node;
+		if (atomic_compare_exchange_strong_explicit(&l->tail, &expected, NULL,
+					memory_order_release, memory_order_relaxed))
+			return;
+
+		/* a waiter has swapped itself in, but not yet linked to us */
+		while (!(next = atomic_load_explicit(&node->next, memory_order_acquire)))
+			_sync_backoff(&spins);
+	}
+
+	atomic_store_explicit(&next->waiting, 0, memory_order_release);
+}
+
+/*
+ * SYNC_MUTEX_SPIN is the number of times a contended mutex_lock polls the
+ * lock before going to sleep.
+ */
+#ifndef SYNC_MUTEX_SPIN
+#define SYNC_MUTEX_SPIN 100
+#endif
+
+/*
+ * sync_deadline returns the CLOCK_MONOTONIC time ns nanoseconds from now, for
+ * use as the deadline of the timed operations below.
+ */
+static inline struct timespec sync_deadline(uint64_t ns)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ns += (uint64_t)ts.tv_nsec;
+	ts.tv_sec += (time_t)(ns / 1000000000u);
+	ts.tv_nsec = (long)(ns % 1000000000u);
+
+	return ts;
+}
+
+/* Internal: returns true (>0) if the CLOCK_MONOTONIC time deadline has passed */
+static inline int _sync_expired(const struct timespec *deadline)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec > deadline->tv_sec ||
+		(now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+/*
+ * Internal: sleeps while *addr is val, until woken by _sync_futex_wake or
+ * until deadline (if not NULL). Spurious wakeups are possible. Returns zero
+ * if the deadline passed, else one.
+ */
+static inline int _sync_futex_wait(atomic_int *addr, int val, const struct timespec *deadline)
+{
+#ifdef __linux__
+	/* WAIT_BITSET takes an absolute CLOCK_MONOTONIC deadline, unlike WAIT */
+	if (syscall(SYS_futex, addr, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG, val,
+				deadline, NULL, FUTEX_BITSET_MATCH_ANY) < 0 && errno == ETIMEDOUT)
+		return 0;
+	return 1;
+#else
+	if (atomic_load_explicit(addr, memory_order_relaxed) == val)
+		sync_yield();
+	return !deadline || !_sync_expired(deadline);
+#endif
+}
+
+/* Internal: wakes up to n threads sleeping on addr */
+static inline void _sync_futex_wake(atomic_int *addr, int n)
+{
+#ifdef __linux__
+	syscall(SYS_futex, addr, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, n, NULL, NULL, 0);
+#else
+	(void)addr, (void)n;
+#endif
+}
+
+/*
+ * sync_light_fence and sync_heavy_fence are an asymmetric pair of fences:
+ * between a store and a later load, they order the two as a full (seq_cst)
+ * fence on each side would, when one side runs often and the other rarely.
+ * The classic use is a sleeper which registers itself and then checks its
+ * condition (sync_heavy_fence between the two), against a waker which makes
+ * the condition true and then checks for sleepers (sync_light_fence): either
+ * the sleeper sees the update, or the waker sees the sleeper.
+ *
+ * On Linux, sync_heavy_fence is a membarrier(2) system call, which makes
+ * every running thread of the process execute a full fence, and
+ * sync_light_fence only keeps the compiler from reordering across it. Where
+ * membarrier is unavailable, both are a full fence.
+ */
+#if defined(__linux__) && defined(SYS_membarrier)
+#define _SYNC_MEMBARRIER_PRIVATE_EXPEDITED (1 << 3)
+#define _SYNC_MEMBARRIER_REGISTER_PRIVATE_EXPEDITED (1 << 4)
+
+/*
+ * Internal: whether membarrier may be used: zero until the first fence, then
+ * 1 if the process was registered, else -1. Each translation unit has its own
+ * copy, but all will reach the same answer, as it depends only on the kernel.
+ */
+static aint_t _sync_membarrier;
+
+/* Internal: returns true (>0) if the fences may use membarrier */
+static inline int _sync_membarrier_ok(void)
+{
+	int ok = aint_load_relaxed(&_sync_membarrier);
+
+	if (!ok) {
+		ok = syscall(SYS_membarrier, _SYNC_MEMBARRIER_REGISTER_PRIVATE_EXPEDITED,
+				0, 0) ? -1 : 1;
+		aint_store_relaxed(&_sync_membarrier, ok);
+	}
+
+	return ok > 0;
+}
+#endif
+
+static inline void sync_light_fence(void)
+{
+#if defined(__linux__) && defined(SYS_membarrier)
+	if (_sync_membarrier_ok()) {
+		atomic_signal_fence(memory_order_seq_cst);
+		return;
+	}
+#endif
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+static inline void sync_heavy_fence(void)
+{
+#if defined(__linux__) && defined(SYS_membarrier)
+	if (_sync_membarrier_ok() &&
+			!syscall(SYS_membarrier, _SYNC_MEMBARRIER_PRIVATE_EXPEDITED, 0, 0))
+		return;
+#endif
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+/*
+ * mutex_t is a sleeping mutual exclusion lock, which is a single word and
+ * needs no destruction. An uncontended lock or unlock is one atomic operation.
+ * It is initialized with MUTEX_INIT or mutex_init.
+ */
+typedef struct {
+	/* 0: unlocked, 1: locked, 2: locked and threads may be sleeping */
+	atomic_int state;
+} mutex_t;
+
+#define MUTEX_INIT {0}
+
+static inline void mutex_init(mutex_t *m)
+{
+	atomic_init(&m->state, 0);
+}
+
+/*
+ * mutex_trylock acquires m if it is free, returning true (>0) if it did so.
+ */
+static inline int mutex_trylock(mutex_t *m)
+{
+	int c = 0;
+
+	return atomic_compare_exchange_strong_explicit(&m->state, &c, 1,
+			memory_order_acquire, memory_order_relaxed);
+}
+
+/*
+ * Internal: acquires m after an uncontended attempt failed, sleeping until
+ * deadline (if not NULL). Returns zero if the deadline passed.
+ */
+static inline int _mutex_lock_slow(mutex_t *m, const struct timespec *deadline)
+{
+	int c;
+
+	for (int i = 0; i < SYNC_MUTEX_SPIN; i++) {
+		sync_pause();
+		c = atomic_load_explicit(&m->state, memory_order_relaxed);
+		if (c == 2)
+			break;
+		if (c == 0 && mutex_trylock(m))
+			return 1;
+	}
+
+	/* mark the lock contended, so that the holder wakes us on unlock */
+	while (atomic_exchange_explicit(&m->state, 2, memory_order_acquire) != 0) {
+		if (!_sync_futex_wait(&m->state, 2, deadline))
+			return atomic_exchange_explicit(&m->state, 2, memory_order_acquire) == 0;
+	}
+
+	return 1;
+}
+
+/*
+ * mutex_lock acquires m, sleeping for as long as necessary.
+ */
+static inline void mutex_lock(mutex_t *m)
+{
+	if (!mutex_trylock(m))
+		_mutex_lock_slow(m, NULL);
+}
+
+/*
+ * mutex_timedlock acquires m, sleeping until at most the CLOCK_MONOTONIC time
+ * deadline (see sync_deadline). Returns true (>0) if m was acquired, or zero
+ * if the deadline passed first.
+ */
+static inline int mutex_timedlock(mutex_t *m, const struct timespec *deadline)
+{
+	return mutex_trylock(m) || _mutex_lock_slow(m, deadline);
+}
+
+/*
+ * mutex_unlock releases m, which must be held by the caller, waking one
+ * sleeping thread if there are any.
+ */
+static inline void mutex_unlock(mutex_t *m)
+{
+	if (atomic_exchange_explicit(&m->state, 0, memory_order_release) == 2)
+		_sync_futex_wake(&m->state, 1);
+}
+
+/*
+ * cond_t is a condition variable, used with a mutex_t. As with any condition
+ * variable, wakeups may be spurious, so waiters must recheck their condition
+ * in a loop. It is initialized with COND_INIT or cond_init and needs no
+ * destruction.
+ */
+typedef struct {
+	/* bumped by every signal, so a waiter cannot miss one */
+	atomic_int seq;
+	/* the mutex last used to wait, for cond_broadcast */
+	_Atomic(mutex_t *) m;
+} cond_t;
+
+#define COND_INIT {0, NULL}
+
+static inline void cond_init(cond_t *c)
+{
+	atomic_init(&c->seq, 0);
+	atomic_init(&c->m, NULL);
+}
+
+/*
+ * cond_timedwait atomically releases m, which must be held by the caller, and
+ * sleeps until c is signalled or until the CLOCK_MONOTONIC time deadline (if
+ * not NULL). m is reacquired before returning. Returns zero if the deadline
+ * passed, else true (>0).
+ */
+static inline int cond_timedwait(cond_t *c, mutex_t *m, const struct timespec *deadline)
+{
+	int seq = atomic_load_explicit(&c->seq, memory_order_relaxed);
+	int ret;
+
+	atomic_store_explicit(&c->m, m, memory_order_relaxed);
+	mutex_unlock(m);
+	ret = _sync_futex_wait(&c->seq, seq, deadline);
+
+	/*
+	 * Always take the contended path, as other waiters may have been moved
+	 * to sleep on the mutex by cond_broadcast, and must be woken in turn.
+	 */
+	while (atomic_exchange_explicit(&m->state, 2, memory_order_acquire) != 0)
+		_sync_futex_wait(&m->state, 2, NULL);
+
+	return ret;
+}
+
+/*
+ * cond_wait atomically releases m, which must be held by the caller, and
+ * sleeps until c is signalled. m is reacquired before returning.
+ */
+static inline void cond_wait(cond_t *c, mutex_t *m)
+{
+	cond_timedwait(c, m, NULL);
+}
+
+/*
+ * cond_signal wakes one thread waiting on c, if there are any.
+ */
+static inline void cond_signal(cond_t *c)
+{
+	atomic_fetch_add_explicit(&c->seq, 1, memory_order_release);
+	_sync_futex_wake(&c->seq, 1);
+}
+
+/*
+ * cond_broadcast wakes all threads waiting on c. Rather than waking them all
+ * at once only to contend for the mutex, one is woken and the rest are moved
+ * to sleep on the mutex, to be woken one at a time as it is released.
+ */
+static inline void cond_broadcast(cond_t *c)
+{
+	int seq = atomic_fetch_add_explicit(&c->seq, 1, memory_order_release) + 1;
+	mutex_t *m = atomic_load_explicit(&c->m, memory_order_relaxed);
+
+#ifdef __linux__
+	if (m && syscall(SYS_futex, &c->seq, FUTEX_CMP_REQUEUE | FUTEX_PRIVATE_FLAG, 1,
+				INT_MAX, &m->state, seq) >= 0)
+		return;
+#else
+	(void)seq, (void)m;
+#endif
+	_sync_futex_wake(&c->seq, INT_MAX);
+}
+
+/*
+ * SYNC_RW_SHARDS is the number of reader counters in a rwlock_t (a power of
+ * two). More shards mean less contention between readers, but a larger lock
+ * and slower writers.
+ */
+#ifndef SYNC_RW_SHARDS
+#define SYNC_RW_SHARDS 16
+#endif
+
+/* Internal: a reader count, on its own cache line */
+struct _rw_shard {
+	_Alignas(SYNC_CACHE_LINE) atomic_int readers;
+};
+
+/*
+ * rwlock_t is a reader-writer lock, favouring writers, for read-mostly data.
+ * Each reader only touches the counter of its own shard, so readers on
+ * different threads do not bounce a cache line between them. Writers are
+ * serialized by a mutex, then wait for every shard to drain; waiting readers
+ * sleep until the writer is done. It is initialized with rw_init (or by
+ * zeroing) and needs no destruction.
+ */
+typedef struct {
+	struct _rw_shard shards[SYNC_RW_SHARDS];
+	/* 0: no writer, 1: writer active or waiting, 2: as 1, readers asleep */
+	_Alignas(SYNC_CACHE_LINE) atomic_int writer;
+	mutex_t wlock;
+} rwlock_t;
+
+static inline void rw_init(rwlock_t *l)
+{
+	for (int i = 0; i < SYNC_RW_SHARDS; i++)
+		atomic_init(&l->shards[i].readers, 0);
+	atomic_init(&l->writer, 0);
+	mutex_init(&l->wlock);
+}
+
+/* Internal: the calling thread's number, once known (cached per translation unit) */
+static _Thread_local unsigned _sync_thread_no;
+
+/*
+ * Internal: returns the calling thread's number (never zero), by which it
+ * picks its shard of sharded types. The number must not depend on the
+ * translation unit asking, else threads reaching the same lock through
+ * different units would crowd onto the same shards. On Linux, it is the
+ * thread ID, which the kernel hands out in sequence, so that the threads of a
+ * program each have a shard to themselves until there are more threads than
+ * shards. Elsewhere, it is a hash of the address of the thread's storage.
+ */
+static inline unsigned _sync_thread_id(void)
+{
+	unsigned id = _sync_thread_no;
+
+	if (!id) {
+#ifdef __linux__
+		id = (unsigned)syscall(SYS_gettid);
+#else
+		uint64_t a = (uintptr_t)&_sync_thread_no;
+
+		id = (unsigned)(((a >> 4) * 0x9e3779b97f4a7c15u) >> 32);
+#endif
+		_sync_thread_no = id = id ? id : 1;
+	}
+
+	return id;
+}
+
+/*
+ * Internal: makes one attempt to acquire l for reading, returning the token
+ * for rw_rdunlock, or -1 if a writer holds or is waiting for l.
+ */
+static inline int _rw_rdlock_try(rwlock_t *l)
+{
+	int token = (int)(_sync_thread_id() % SYNC_RW_SHARDS);
+
+	/* seq_cst, as we must see the writer flag set after our increment */
+	atomic_fetch_add(&l->shards[token].readers, 1);
+	if (!atomic_load(&l->writer))
+		return token;
+	atomic_fetch_sub_explicit(&l->shards[token].readers, 1, memory_order_release);
+
+	return -1;
+}
+
+/*
+ * rw_rdlock acquires l for reading, which any number of threads may do at
+ * once, waiting while a writer holds or is waiting for l. It returns a token,
+ * which must be passed to the matching rw_rdunlock.
+ */
+static inline int rw_rdlock(rwlock_t *l)
+{
+	int token, w;
+
+	while ((token = _rw_rdlock_try(l)) < 0) {
+		/* get out of the writer's way until it is done */
+		while ((w = atomic_load_explicit(&l->writer, memory_order_relaxed))) {
+			if (w == 2 || atomic_compare_exchange_weak_explicit(&l->writer, &w, 2,
+						memory_order_relaxed, memory_order_relaxed))
+				_sync_futex_wait(&l->writer, 2, NULL);
+		}
+	}
+
+	return token;
+}
+
+/*
+ * rw_rdunlock releases a read lock on l, taken by the rw_rdlock which
+ * returned token.
+ */
+static inline void rw_rdunlock(rwlock_t *l, int token)
+{
+	atomic_fetch_sub_explicit(&l->shards[token].readers, 1, memory_order_release);
+}
+
+/*
+ * Internal: shuts out new readers of l, whose wlock is held by the caller,
+ * and waits for the current ones to leave. Returns true (>0) if it waited.
+ */
+static inline int _rw_drain(rwlock_t *l)
+{
+	int waited = 0;
+
+	atomic_store(&l->writer, 1);
+
+	for (int i = 0; i < SYNC_RW_SHARDS; i++) {
+		unsigned spins = 0;
+		while (atomic_load(&l->shards[i].readers)) {
+			waited = 1;
+			_sync_backoff(&spins);
+		}
+	}
+
+	return waited;
+}
+
+/*
+ * rw_wrlock acquires l for writing, exclusive of all readers and writers.
+ */
+static inline void rw_wrlock(rwlock_t *l)
+{
+	mutex_lock(&l->wlock);
+	_rw_drain(l);
+}
+
+/*
+ * rw_wrunlock releases a write lock on l, waking any sleeping readers.
+ */
+static inline void rw_wrunlock(rwlock_t *l)
+{
+	if (atomic_exchange_explicit(&l->writer, 0, memory_order_release) == 2)
+		_sync_futex_wake(&l->writer, INT_MAX);
+	mutex_unlock(&l->wlock);
+}
+
+/*
+ * SYNC_COUNTER_SHARDS is the number of shards of a counter_t (a power of
+ * two), each on its own cache line. Up to this many threads may add to a
+ * counter without sharing a line.
+ */
+#ifndef SYNC_COUNTER_SHARDS
+#define SYNC_COUNTER_SHARDS 32
+#endif
+
+/*
+ * counter_t is a counter for statistics, which many threads add to far more
+ * often than it is read. Each thread adds to its own shard (see rwlock_t), so
+ * that adding costs an uncontended atomic increment of a line which stays in
+ * the adding CPU's cache, rather than a line bounced between every CPU.
+ * Reading it sums every shard. It is initialized with counter_init (or by
+ * zeroing) and needs no destruction.
+ *
+ * Shards are per thread rather than per CPU: a thread's shard is a
+ * thread-local lookup and stays put when the thread migrates, while finding
+ * the current CPU costs a call on every add, and using it without an atomic
+ * needs restartable sequences (rseq).
+ */
+typedef struct {
+	SYNC_PADDED(_Atomic int64_t) shards[SYNC_COUNTER_SHARDS];
+} counter_t;
+
+static inline void counter_init(counter_t *c)
+{
+	for (int i = 0; i < SYNC_COUNTER_SHARDS; i++)
+		atomic_init(&c->shards[i].v, 0);
+}
+
+/* counter_add adds n (which may be negative) to c */
+static inline void counter_add(counter_t *c, int64_t n)
+{
+	atomic_fetch_add_explicit(&c->shards[_sync_thread_id() % SYNC_COUNTER_SHARDS].v, n,
+			memory_order_relaxed);
+}
+
+/* counter_inc adds one to c */
+static inline void counter_inc(counter_t *c)
+{
+	counter_add(c, 1);
+}
+
+/*
+ * counter_read returns the value of c: the sum of every add which finished
+ * before it was called, and of some of those still in progress. It is not
+ * ordered with respect to other memory.
+ */
+static inline int64_t counter_read(counter_t *c)
+{
+	int64_t sum = 0;
+
+	for (int i = 0; i < SYNC_COUNTER_SHARDS; i++)
+		sum += atomic_load_explicit(&c->shards[i].v, memory_order_relaxed);
+
+	return sum;
+}
+
+/*
+ * counter_take returns the value of c, as counter_read, and resets it to
+ * zero. Each shard is exchanged, so that every add is counted by exactly one
+ * take (or the final read), eg. when reporting a rate per interval.
+ */
+static inline int64_t counter_take(counter_t *c)
+{
+	int64_t sum = 0;
+
+	for (int i = 0; i < SYNC_COUNTER_SHARDS; i++) {
+		if (atomic_load_explicit(&c->shards[i].v, memory_order_relaxed))
+			sum += atomic_exchange_explicit(&c->shards[i].v, 0, memory_order_relaxed);
+	}
+
+	return sum;
+}
+
+/*
+ * seqlock_t protects a small struct which is read very often and written
+ * rarely. Readers never write to shared memory, so they scale perfectly, but
+ * must retry if a writer was active while they read:
+ *
+ * 	do {
+ * 		seq = seq_read_begin(&lock);
+ * 		copy = shared;
+ * 	} while (seq_read_retry(&lock, seq));
+ *
+ * Data read inside the loop may be torn, so it must only be copied, never
+ * used (eg. dereferenced), until seq_read_retry succeeds. Writers exclude each
+ * other, and are never blocked by readers. It is initialized with SEQLOCK_INIT
+ * or seq_init.
+ */
+typedef struct {
+	/* odd while a write is in progress */
+	_Alignas(SYNC_CACHE_LINE) atomic_uint seq;
+} seqlock_t;
+
+#define SEQLOCK_INIT {0}
+
+static inline void seq_init(seqlock_t *s)
+{
+	atomic_init(&s->seq, 0);
+}
+
+/*
+ * seq_read_begin starts a read of the data protected by s, waiting for any
+ * write in progress to finish, and returns the sequence number to be passed
+ * to seq_read_retry.
+ */
+static inline unsigned seq_read_begin(seqlock_t *s)
+{
+	unsigned seq, spins = 0;
+
+	while ((seq = atomic_load_explicit(&s->seq, memory_order_acquire)) & 1)
+		_sync_backoff(&spins);
+
+	return seq;
+}
+
+/*
+ * seq_read_retry returns true (>0) if the data read since seq_read_begin
+ * returned seq may be inconsistent, and so must be read again.
+ */
+static inline int seq_read_retry(seqlock_t *s, unsigned seq)
+{
+	/* keep the reads of the data before the recheck */
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(&s->seq, memory_order_relaxed) != seq;
+}
+
+/*
+ * seq_write_begin starts a write of the data protected by s, waiting for any
+ * other writer to finish.
+ */
+static inline void seq_write_begin(seqlock_t *s)
+{
+	unsigned seq = atomic_load_explicit(&s->seq, memory_order_relaxed), spins = 0;
+
+	while ((seq & 1) || !atomic_compare_exchange_weak_explicit(&s->seq, &seq, seq + 1,
+				memory_order_acquire, memory_order_relaxed)) {
+		_sync_backoff(&spins);
+		seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+	}
+
+	/* keep the writes of the data after the odd sequence is visible */
+	atomic_thread_fence(memory_order_release);
+}
+
+/*
+ * seq_write_end finishes the write started by seq_write_begin.
+ */
+static inline void seq_write_end(seqlock_t *s)
+{
+	atomic_fetch_add_explicit(&s->seq, 1, memory_order_release);
+}
+
+/*
+ * SYNC_WAIT_SPIN is the number of times wg_wait, sema_wait and barrier_wait
+ * poll before going to sleep.
+ */
+#ifndef SYNC_WAIT_SPIN
+#define SYNC_WAIT_SPIN 100
+#endif
+
+/* Internal: the number of CPUs online, once known */
+static aint_t _sync_ncpus;
+
+/*
+ * Internal: returns the number of CPUs online (read once). On a single CPU,
+ * polling for another thread only keeps that thread from running.
+ */
+static inline int _sync_cpus(void)
+{
+	int n = aint_load_relaxed(&_sync_ncpus);
+
+	if (!n) {
+#ifdef __linux__
+		n = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		n = (n > 0) ? n : 2;
+		aint_store_relaxed(&_sync_ncpus, n);
+	}
+
+	return n;
+}
+
+/*
+ * Internal: polls *addr until it no longer satisfies its condition (equal to
+ * val if eq is true, else different), up to SYNC_WAIT_SPIN times, unless
+ * there is only one CPU. Returns the value last read.
+ */
+static inline int _sync_spin_while(atomic_int *addr, int val, int eq)
+{
+	int c = atomic_load_explicit(addr, memory_order_acquire);
+	int spin = (_sync_cpus() > 1) ? SYNC_WAIT_SPIN : 0;
+
+	for (int i = 0; i < spin && (c == val) == eq; i++) {
+		sync_pause();
+		c = atomic_load_explicit(addr, memory_order_acquire);
+	}
+
+	return c;
+}
+
+/*
+ * waitgroup_t counts outstanding tasks, which any thread may wait for: each
+ * task is counted with wg_add before it starts, and calls wg_done when it is
+ * finished. It is initialized with WAITGROUP_INIT or wg_init, needs no
+ * destruction, and may be reused once every waiter has returned.
+ */
+typedef struct {
+	/* the count, shifted left by one, and whether any thread may be asleep */
+	atomic_int state;
+} waitgroup_t;
+
+#define WAITGROUP_INIT {0}
+
+static inline void wg_init(waitgroup_t *wg)
+{
+	atomic_init(&wg->state, 0);
+}
+
+/*
+ * wg_add adds n (which may be negative) to the count of wg, waking every
+ * waiter if it drops to zero. The count must never go below zero, nor above
+ * INT_MAX / 2.
+ */
+static inline void wg_add(waitgroup_t *wg, int n)
+{
+	int old = atomic_fetch_add_explicit(&wg->state, n * 2, memory_order_acq_rel);
+
+	if ((old >> 1) + n < 0)
+		abort();
+	if ((old >> 1) + n == 0 && (old & 1)) {
+		atomic_fetch_and_explicit(&wg->state, ~1, memory_order_relaxed);
+		_sync_futex_wake(&wg->state, INT_MAX);
+	}
+}
+
+/* wg_done takes one off the count of wg, as wg_add(wg, -1) */
+static inline void wg_done(waitgroup_t *wg)
+{
+	wg_add(wg, -1);
+}
+
+/*
+ * wg_timedwait sleeps until the count of wg is zero, or until the
+ * CLOCK_MONOTONIC time deadline (if not NULL) passes. Returns true (>0) if
+ * the count reached zero, or zero if the deadline passed first.
+ */
+static inline int wg_timedwait(waitgroup_t *wg, const struct timespec *deadline)
+{
+	int c = atomic_load_explicit(&wg->state, memory_order_acquire);
+
+	if (c >> 1)
+		c = _sync_spin_while(&wg->state, 0, 0);
+	while (c >> 1) {
+		/* flag ourselves, so that the last wg_done wakes us */
+		if (!(c & 1) && !atomic_compare_exchange_weak_explicit(&wg->state, &c, c | 1,
+					memory_order_acquire, memory_order_acquire))
+			continue;
+		if (!_sync_futex_wait(&wg->state, c | 1, deadline))
+			return !(atomic_load_explicit(&wg->state, memory_order_acquire) >> 1);
+		c = atomic_load_explicit(&wg->state, memory_order_acquire);
+	}
+
+	return 1;
+}
+
+/* wg_wait sleeps until the count of wg is zero */
+static inline void wg_wait(waitgroup_t *wg)
+{
+	wg_timedwait(wg, NULL);
+}
+
+/*
+ * semaphore_t is a counting semaphore: a count of available units, which
+ * sema_wait takes one at a time, sleeping while there are none, and which
+ * sema_post returns. It is initialized with SEMAPHORE_INIT(n) or sema_init,
+ * and needs no destruction.
+ */
+typedef struct {
+	atomic_int count;
+	/* the number of threads which may be asleep */
+	atomic_int sleepers;
+} semaphore_t;
+
+#define SEMAPHORE_INIT(n) {n, 0}
+
+static inline void sema_init(semaphore_t *s, int n)
+{
+	atomic_init(&s->count, n);
+	atomic_init(&s->sleepers, 0);
+}
+
+/*
+ * sema_trywait takes a unit from s if one is available, returning true (>0)
+ * if it did so.
+ */
+static inline int sema_trywait(semaphore_t *s)
+{
+	int c = atomic_load_explicit(&s->count, memory_order_relaxed);
+
+	while (c > 0) {
+		if (atomic_compare_exchange_weak_explicit(&s->count, &c, c - 1,
+					memory_order_acquire, memory_order_relaxed))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * sema_timedwait takes a unit from s, sleeping while there are none until the
+ * CLOCK_MONOTONIC time deadline (if not NULL). Returns true (>0) if a unit was
+ * taken, or zero if the deadline passed first.
+ */
+static inline int sema_timedwait(semaphore_t *s, const struct timespec *deadline)
+{
+	int ok = 1;
+
+	if (sema_trywait(s))
+		return 1;
+	_sync_spin_while(&s->count, 0, 1);
+	if (sema_trywait(s))
+		return 1;
+
+	/* pairs with sema_post: either it sees us asleep, or we see its unit */
+	atomic_fetch_add(&s->sleepers, 1);
+	while (!sema_trywait(s)) {
+		if (!ok) {
+			atomic_fetch_sub(&s->sleepers, 1);
+			return 0;
+		}
+		ok = _sync_futex_wait(&s->count, 0, deadline);
+	}
+	atomic_fetch_sub(&s->sleepers, 1);
+
+	return 1;
+}
+
+/* sema_wait takes a unit from s, sleeping while there are none */
+static inline void sema_wait(semaphore_t *s)
+{
+	sema_timedwait(s, NULL);
+}
+
+/* sema_post returns n units to s, waking as many sleeping threads */
+static inline void sema_post(semaphore_t *s, int n)
+{
+	atomic_fetch_add(&s->count, n);
+	if (atomic_load(&s->sleepers))
+		_sync_futex_wake(&s->count, n);
+}
+
+/*
+ * barrier_t holds each of a fixed number of threads in barrier_wait until all
+ * of them have arrived, after which it is ready for the next round. It is
+ * initialized with BARRIER_INIT(n) or barrier_init, and needs no destruction.
+ */
+typedef struct {
+	int n;
+	atomic_int arrived;
+	/* bumped by the last thread to arrive, releasing the rest */
+	atomic_int phase;
+	atomic_int sleepers;
+} barrier_t;
+
+#define BARRIER_INIT(n) {n, 0, 0, 0}
+
+static inline void barrier_init(barrier_t *b, int n)
+{
+	b->n = n;
+	atomic_init(&b->arrived, 0);
+	atomic_init(&b->phase, 0);
+	atomic_init(&b->sleepers, 0);
+}
+
+/*
+ * barrier_wait waits until all the threads of b have called barrier_wait,
+ * polling briefly then sleeping. Returns true (>0) in exactly one of them (the
+ * last to arrive), as with PTHREAD_BARRIER_SERIAL_THREAD, and zero in the
+ * rest.
+ */
+static inline int barrier_wait(barrier_t *b)
+{
+	int phase = atomic_load_explicit(&b->phase, memory_order_acquire);
+
+	if (atomic_fetch_add_explicit(&b->arrived, 1, memory_order_acq_rel) == b->n - 1) {
+		/* the next round cannot start until it sees the new phase */
+		atomic_store_explicit(&b->arrived, 0, memory_order_relaxed);
+		atomic_fetch_add(&b->phase, 1);
+		if (atomic_load(&b->sleepers))
+			_sync_futex_wake(&b->phase, INT_MAX);
+		return 1;
+	}
+
+	if (_sync_spin_while(&b->phase, phase, 1) != phase)
+		return 0;
+	atomic_fetch_add(&b->sleepers, 1);
+	while (atomic_load(&b->phase) == phase)
+		_sync_futex_wait(&b->phase, phase, NULL);
+	atomic_fetch_sub_explicit(&b->sleepers, 1, memory_order_relaxed);
+
+	return 0;
+}
+
+/*
+ * once_t runs an initializer exactly once, however many threads call
+ * once_call on it. Once it has run, once_call costs a single acquire load. It
+ * is initialized with ONCE_INIT or once_init.
+ */
+typedef struct {
+	/* 0: not run, 1: running, 2: running and threads may be asleep, 3: done */
+	atomic_int state;
+} once_t;
+
+#define ONCE_INIT {0}
+
+static inline void once_init(once_t *o)
+{
+	atomic_init(&o->state, 0);
+}
+
+/* Internal: the slow path of once_call, taken until the initializer is done */
+static inline void _once_call_slow(once_t *o, void (*fn)(void *arg), void *arg)
+{
+	int c = 0;
+
+	if (atomic_compare_exchange_strong_explicit(&o->state, &c, 1,
+				memory_order_acquire, memory_order_acquire)) {
+		fn(arg);
+		if (atomic_exchange_explicit(&o->state, 3, memory_order_release) == 2)
+			_sync_futex_wake(&o->state, INT_MAX);
+		return;
+	}
+
+	while (c != 3) {
+		if (c == 2 || atomic_compare_exchange_weak_explicit(&o->state, &c, 2,
+					memory_order_acquire, memory_order_acquire))
+			_sync_futex_wait(&o->state, 2, NULL);
+		c = atomic_load_explicit(&o->state, memory_order_acquire);
+	}
+}
+
+/*
+ * once_call calls fn(arg) if no call on o has yet done so, and otherwise waits
+ * until the call which did has returned: either way, whatever fn did is
+ * visible once once_call returns. fn must not call once_call on o.
+ */
+static inline void once_call(once_t *o, void (*fn)(void *arg), void *arg)
+{
+	if (atomic_load_explicit(&o->state, memory_order_acquire) != 3)
+		_once_call_slow(o, fn, arg);
+}
+
+#ifdef HLC_SYNC_STATS
+/*
+ * Lock statistics (REQUIRES stdio.h and string.h)
+ *
+ * If HLC_SYNC_STATS is defined before including any hlc header, every
+ * acquisition of a spinlock_t, mutex_t or rwlock_t is counted per call site
+ * (the file and line of the spin_lock, mutex_lock, rw_rdlock... call, which
+ * may be inside another hlc header), along with:
+ *
+ * - the acquisitions which found the lock taken and had to wait, and the total
+ *   time they waited, which are what limit scaling;
+ * - the total and longest time the lock was then held, up to the matching
+ *   unlock (or wait on a cond_t, which releases it) on the same thread.
+ *
+ * Only successful acquisitions are counted. Counters are updated with relaxed
+ * atomics and are safe to use from any thread; most are only written while
+ * the lock is held, so add little contention of their own. Each counted
+ * acquisition reads the clock twice and looks up its site by name, which adds
+ * around a hundred nanoseconds to it.
+ *
+ * Every translation unit must see the same HLC_SYNC_STATS setting, and
+ * exactly one must also define SYNC_STATS_IMPL before including this header,
+ * to provide storage for the counters. Locks taken through function pointers,
+ * or inside this header (eg. the mutex of a rwlock_t), are not counted.
+ */
+
+#ifdef SYNC_AUTO_INCLUDE
+#include <stdio.h>
+#include <string.h>
+#endif
+
+/*
+ * SYNC_STATS_SITES is the maximum number of call sites which are tracked.
+ * Acquisitions from further sites are counted together, as site "(other)".
+ */
+#ifndef SYNC_STATS_SITES
+#define SYNC_STATS_SITES 64
+#endif
+
+/*
+ * SYNC_STATS_HELD is the number of locks a thread may hold at once whose hold
+ * time is measured. Further locks are still counted, but their hold time is not.
+ */
+#ifndef SYNC_STATS_HELD
+#define SYNC_STATS_HELD 16
+#endif
+
+/* sync_lock_kind is the kind of lock, and of acquisition, at a call site */
+enum sync_lock_kind {
+	SYNC_LOCK_SPIN,
+	SYNC_LOCK_MUTEX,
+	SYNC_LOCK_READ,
+	SYNC_LOCK_WRITE,
+	SYNC_LOCK_COUNT
+};
+
+/*
+ * sync_site_t is a snapshot of the counters for one call site. Times are in
+ * nanoseconds; wait is only the time waited by contended acquisitions.
+ */
+typedef struct {
+	const char *site;
+	enum sync_lock_kind kind;
+	uint64_t acquires, contended;
+	uint64_t wait, hold, max_hold;
+} sync_site_t;
+
+/*
+ * sync_snapshot_t is a copy of all lock statistics, see sync_stats_snapshot.
+ * Sites are sorted hottest first (by time spent waiting, then by contended
+ * acquisitions, then by acquisitions).
+ */
+typedef struct {
+	sync_site_t sites[SYNC_STATS_SITES + 1];
+	size_t nsites;
+} sync_snapshot_t;
+
+/* Internal: live counters, mirroring sync_site_t */
+struct _sync_counters {
+	au64_t acquires, contended;
+	au64_t wait, hold, max_hold;
+};
+
+/* Internal: the name of a call site, published with a release store */
+sync_atomic_declare(const char *, _sync_name)
+
+struct _sync_stats {
+	struct {
+		_sync_name_t site;
+		aint_t kind;
+		struct _sync_counters count;
+	} sites[SYNC_STATS_SITES];
+	struct _sync_counters other;
+};
+
+/* Internal: a lock held by the calling thread, and when it was taken */
+struct _sync_held {
+	const void *lock;
+	struct _sync_counters *c;
+	uint64_t since;
+};
+
+extern struct _sync_stats _sync_stats;
+extern _Thread_local struct _sync_held _sync_held[SYNC_STATS_HELD];
+extern _Thread_local int _sync_nheld;
+#ifdef SYNC_STATS_IMPL
+struct _sync_stats _sync_stats;
+_Thread_local struct _sync_held _sync_held[SYNC_STATS_HELD];
+_Thread_local int _sync_nheld;
+#endif
+
+/* Internal: returns the CLOCK_MONOTONIC time in nanoseconds */
+static inline uint64_t _sync_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Internal: returns the counters for site, claiming a slot if required */
+static inline struct _sync_counters *_sync_site(enum sync_lock_kind kind, const char *site)
+{
+	size_t h = 5381;
+
+	for (const char *walk = site; *walk; walk++)
+		h = h * 33 + (unsigned char)*walk;
+
+	for (size_t i = 0; i < SYNC_STATS_SITES; i++) {
+		size_t slot = (h + i) % SYNC_STATS_SITES;
+		const char *name = _sync_name_load(&_sync_stats.sites[slot].site);
+
+		if (!name) {
+			if (_sync_name_cas(&_sync_stats.sites[slot].site, &name, site)) {
+				aint_store_relaxed(&_sync_stats.sites[slot].kind, kind);
+				return &_sync_stats.sites[slot].count;
+			}
+			/* lost the race: name is now the winner */
+		}
+		if (name == site || strcmp(name, site) == 0)
+			return &_sync_stats.sites[slot].count;
+	}
+
+	return &_sync_stats.other;
+}
+
+/* Internal: adds n to counter c */
+#define _sync_count(c, n) au64_add_relaxed(&(c), (n))
+
+/*
+ * Internal: records an acquisition of lock from site, which waited since
+ * start if contended, and starts timing its hold.
+ */
+static inline void _sync_acquired(const void *lock, enum sync_lock_kind kind, const char *site,
+		int contended, uint64_t start)
+{
+	struct _sync_counters *c = _sync_site(kind, site);
+	uint64_t now = _sync_now();
+
+	_sync_count(c->acquires, 1);
+	if (contended) {
+		_sync_count(c->contended, 1);
+		_sync_count(c->wait, now - start);
+	}
+
+	if (_sync_nheld < SYNC_STATS_HELD)
+		_sync_held[_sync_nheld++] = (struct _sync_held){lock, c, now};
+}
+
+/* Internal: returns the most recent hold of lock by the calling thread, if any */
+static inline struct _sync_held *_sync_find_held(const void *lock)
+{
+	for (int i = _sync_nheld - 1; i >= 0; i--) {
+		if (_sync_held[i].lock == lock)
+			return &_sync_held[i];
+	}
+
+	return NULL;
+}
+
+/* Internal: records the time since h was taken as held */
+static inline void _sync_hold_end(struct _sync_held *h)
+{
+	uint64_t held = _sync_now() - h->since;
+	uint64_t max = au64_load_relaxed(&h->c->max_hold);
+
+	_sync_count(h->c->hold, held);
+	while (held > max && !au64_cas_weak(&h->c->max_hold, &max, held));
+}
+
+/* Internal: records the release of lock, which must still be held */
+static inline void _sync_released(const void *lock)
+{
+	struct _sync_held *h = _sync_find_held(lock);
+
+	if (!h)
+		return;
+
+	_sync_hold_end(h);
+	memmove(h, h + 1, (size_t)(&_sync_held[--_sync_nheld] - h) * sizeof(*h));
+}
+
+/* Internal: the counting versions of the lock operations, see below */
+static inline int _sync_spin_trylock(spinlock_t *l, const char *site)
+{
+	if (!spin_trylock(l))
+		return 0;
+	_sync_acquired(l, SYNC_LOCK_SPIN, site, 0, 0);
+	return 1;
+}
+
+static inline void _sync_spin_lock(spinlock_t *l, const char *site)
+{
+	uint64_t start = 0;
+	int contended = !spin_trylock(l);
+
+	if (contended) {
+		start = _sync_now();
+		spin_lock(l);
+	}
+	_sync_acquired(l, SYNC_LOCK_SPIN, site, contended, start);
+}
+
+static inline void _sync_spin_unlock(spinlock_t *l)
+{
+	_sync_released(l);
+	spin_unlock(l);
+}
+
+static inline int _sync_mutex_trylock(mutex_t *m, const char *site)
+{
+	if (!mutex_trylock(m))
+		return 0;
+	_sync_acquired(m, SYNC_LOCK_MUTEX, site, 0, 0);
+	return 1;
+}
+
+static inline int _sync_mutex_timedlock(mutex_t *m, const struct timespec *deadline,
+		const char *site)
+{
+	uint64_t start = 0;
+	int contended = !mutex_trylock(m);
+
+	if (contended) {
+		start = _sync_now();
+		if (!_mutex_lock_slow(m, deadline))
+			return 0;
+	}
+	_sync_acquired(m, SYNC_LOCK_MUTEX, site, contended, start);
+	return 1;
+}
+
+static inline void _sync_mutex_unlock(mutex_t *m)
+{
+	_sync_released(m);
+	mutex_unlock(m);
+}
+
+static inline int _sync_cond_timedwait(cond_t *c, mutex_t *m, const struct timespec *deadline)
+{
+	struct _sync_held *h = _sync_find_held(m);
+	int ret;
+
+	/* the mutex is not held while waiting */
+	if (h)
+		_sync_hold_end(h);
+	ret = cond_timedwait(c, m, deadline);
+	if (h)
+		h->since = _sync_now();
+
+	return ret;
+}
+
+static inline int _sync_rw_rdlock(rwlock_t *l, const char *site)
+{
+	uint64_t start = 0;
+	int token = _rw_rdlock_try(l), contended = token < 0;
+
+	if (contended) {
+		start = _sync_now();
+		token = rw_rdlock(l);
+	}
+	_sync_acquired(l, SYNC_LOCK_READ, site, contended, start);
+	return token;
+}
+
+static inline void _sync_rw_rdunlock(rwlock_t *l, int token)
+{
+	_sync_released(l);
+	rw_rdunlock(l, token);
+}
+
+static inline void _sync_rw_wrlock(rwlock_t *l, const char *site)
+{
+	uint64_t start = _sync_now();
+	int contended = !mutex_trylock(&l->wlock);
+
+	if (contended)
+		_mutex_lock_slow(&l->wlock, NULL);
+	contended |= _rw_drain(l);
+	_sync_acquired(l, SYNC_LOCK_WRITE, site, contended, start);
+}
+
+static inline void _sync_rw_wrunlock(rwlock_t *l)
+{
+	_sync_released(l);
+	rw_wrunlock(l);
+}
+
+/* Internal: the call site of a lock operation, as "file:line" */
+#define _SYNC_STR(x) #x
+#define _SYNC_XSTR(x) _SYNC_STR(x)
+#define _SYNC_SITE __FILE__ ":" _SYNC_XSTR(__LINE__)
+
+/*
+ * From here on, the lock operations are replaced by their counting versions,
+ * wherever they are called (their addresses remain those of the originals).
+ */
+#define spin_trylock(l) _sync_spin_trylock(l, _SYNC_SITE)
+#define spin_lock(l) _sync_spin_lock(l, _SYNC_SITE)
+#define spin_unlock(l) _sync_spin_unlock(l)
+#define mutex_trylock(m) _sync_mutex_trylock(m, _SYNC_SITE)
+#define mutex_lock(m) ((void)_sync_mutex_timedlock(m, NULL, _SYNC_SITE))
+#define mutex_timedlock(m, deadline) _sync_mutex_timedlock(m, deadline, _SYNC_SITE)
+#define mutex_unlock(m) _sync_mutex_unlock(m)
+#define cond_timedwait(c, m, deadline) _sync_cond_timedwait(c, m, deadline)
+#define cond_wait(c, m) ((void)_sync_cond_timedwait(c, m, NULL))
+#define rw_rdlock(l) _sync_rw_rdlock(l, _SYNC_SITE)
+#define rw_rdunlock(l, token) _sync_rw_rdunlock(l, token)
+#define rw_wrlock(l) _sync_rw_wrlock(l, _SYNC_SITE)
+#define rw_wrunlock(l) _sync_rw_wrunlock(l)
+
+/*
+ * sync_lock_kind_name returns a printable name for the lock kind kind.
+ */
+static inline const char *sync_lock_kind_name(enum sync_lock_kind kind)
+{
+	static const char *names[SYNC_LOCK_COUNT] = {"spin", "mutex", "read", "write"};
+
+	return (kind < SYNC_LOCK_COUNT) ? names[kind] : "?";
+}
+
+/* Internal: copies live counters c to out */
+static inline void _sync_load(sync_site_t *out, struct _sync_counters *c)
+{
+	out->acquires = au64_load_relaxed(&c->acquires);
+	out->contended = au64_load_relaxed(&c->contended);
+	out->wait = au64_load_relaxed(&c->wait);
+	out->hold = au64_load_relaxed(&c->hold);
+	out->max_hold = au64_load_relaxed(&c->max_hold);
+}
+
+/* Internal: qsort comparator ordering sites hottest first */
+static inline int _sync_site_cmp(const void *a, const void *b)
+{
+	const sync_site_t *x = a, *y = b;
+
+	if (x->wait != y->wait)
+		return (x->wait < y->wait) - (x->wait > y->wait);
+	if (x->contended != y->contended)
+		return (x->contended < y->contended) - (x->contended > y->contended);
+	return (x->acquires < y->acquires) - (x->acquires > y->acquires);
+}
+
+/*
+ * sync_stats_snapshot copies the current lock statistics to snap. Counters
+ * are read individually, so a snapshot taken while other threads are locking
+ * may be very slightly inconsistent.
+ */
+static inline void sync_stats_snapshot(sync_snapshot_t *snap)
+{
+	memset(snap, 0, sizeof(*snap));
+
+	for (size_t i = 0; i < SYNC_STATS_SITES; i++) {
+		const char *site = _sync_name_load(&_sync_stats.sites[i].site);
+		if (!site)
+			continue;
+
+		snap->sites[snap->nsites].site = site;
+		snap->sites[snap->nsites].kind = aint_load_relaxed(&_sync_stats.sites[i].kind);
+		_sync_load(&snap->sites[snap->nsites], &_sync_stats.sites[i].count);
+		snap->nsites++;
+	}
+
+	_sync_load(&snap->sites[snap->nsites], &_sync_stats.other);
+	if (snap->sites[snap->nsites].acquires) {
+		snap->sites[snap->nsites].site = "(other)";
+		snap->sites[snap->nsites].kind = SYNC_LOCK_COUNT;
+		snap->nsites++;
+	}
+
+	qsort(snap->sites, snap->nsites, sizeof(snap->sites[0]), _sync_site_cmp);
+}
+
+/*
+ * sync_stats_reset zeroes all lock statistics. It must not be called
+ * concurrently with any lock operation.
+ */
+static inline void sync_stats_reset(void)
+{
+	memset(&_sync_stats, 0, sizeof(_sync_stats));
+}
+
+/*
+ * sync_stats_dump writes a human-readable table of the current lock
+ * statistics to f, with call sites sorted hottest first. Times are in
+ * microseconds.
+ */
+static inline void sync_stats_dump(FILE *f)
+{
+	sync_snapshot_t snap;
+
+	sync_stats_snapshot(&snap);
+
+	fprintf(f, "%-32s %-5s %12s %12s %6s %12s %12s %12s\n", "site", "kind",
+			"acquires", "contended", "%", "wait", "hold", "max hold");
+	for (size_t i = 0; i < snap.nsites; i++) {
+		sync_site_t *s = &snap.sites[i];
+		fprintf(f, "%-32s %-5s %12llu %12llu %6.2f %12.1f %12.1f %12.1f\n", s->site,
+				sync_lock_kind_name(s->kind), (unsigned long long)s->acquires,
+				(unsigned long long)s->contended,
+				s->acquires ? 100.0 * (double)s->contended / (double)s->acquires : 0.0,
+				(double)s->wait / 1000, (double)s->hold / 1000,
+				(double)s->max_hold / 1000);
+	}
+}
+
+#endif /* HLC_SYNC_STATS */
+
+#endif /* HLC_SYNC_H */
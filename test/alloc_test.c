@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HLC_AUTO_INCLUDE
+#define HLC_ALLOC_STATS
+#define ALLOC_STATS_IMPL
+#include "../alloc.h"
+#include "../vect.h"
+#include "../str/str.c"
+
+vect_declare(int, vector_int);
+
+/* counts live blocks and bytes, checking that sizes are passed back intact */
+typedef struct {
+	size_t blocks, bytes;
+	size_t allocs, resizes;
+} counter_t;
+
+static void *counter_alloc(void *ctx, size_t size)
+{
+	counter_t *c = ctx;
+	c->blocks++, c->allocs++;
+	c->bytes += size;
+	return malloc(size);
+}
+
+static void *counter_resize(void *ctx, void *ptr, size_t oldsize, size_t newsize)
+{
+	counter_t *c = ctx;
+	void *ret = realloc(ptr, newsize);
+	if (ret) {
+		c->resizes++;
+		c->bytes = c->bytes - oldsize + newsize;
+	}
+	return ret;
+}
+
+static void counter_release(void *ctx, void *ptr, size_t size)
+{
+	counter_t *c = ctx;
+	if (c->bytes < size) {
+		printf("released more bytes than allocated (release: %lu, live: %lu)\n", size, c->bytes);
+		exit(1);
+	}
+	c->blocks--;
+	c->bytes -= size;
+	free(ptr);
+}
+
+static void check_empty(const char *what, counter_t *c)
+{
+	printf("%s: %lu allocs, %lu resizes, %lu blocks live (%lu bytes)\n",
+			what, c->allocs, c->resizes, c->blocks, c->bytes);
+	if (c->blocks != 0 || c->bytes != 0) {
+		printf("%s leaked through the allocator\n", what);
+		exit(1);
+	}
+	if (c->allocs == 0) {
+		printf("%s did not use the allocator\n", what);
+		exit(1);
+	}
+}
+
+void test_calls()
+{
+	counter_t c = {0};
+	allocator_t a = {counter_alloc, NULL, counter_release, &c};
+
+	/* no resize routine: must fall back to alloc + copy + release */
+	char *p = alloc_malloc(&a, 4);
+	memcpy(p, "abc", 4);
+	p = alloc_realloc(&a, p, 4, 64);
+	if (strcmp(p, "abc") != 0) {
+		printf("copying realloc lost data (got \"%s\")\n", p);
+		exit(1);
+	}
+	alloc_free(&a, p, 64);
+
+	int *z = alloc_calloc(&a, 16, sizeof(int));
+	for (int i = 0; i < 16; i++) {
+		if (z[i] != 0) {
+			printf("calloc did not zero at index %d\n", i);
+			exit(1);
+		}
+	}
+	alloc_free(&a, z, 16 * sizeof(int));
+
+	if (alloc_calloc(&a, (size_t)-1, 2)) {
+		printf("overflowing calloc succeeded\n");
+		exit(1);
+	}
+
+	check_empty("direct", &c);
+}
+
+void test_containers()
+{
+	counter_t c = {0};
+	allocator_t a = {counter_alloc, counter_resize, counter_release, &c};
+
+	vector_int v = vect_init_alloc(vector_int, &a);
+	for (int i = 0; i < 100; i++)
+		vect_append(&v, i);
+	vect_destroy(&v);
+	check_empty("vect", &c);
+
+	memset(&c, 0, sizeof(c));
+	string_t str = str_from_alloc("Hello, allocator! This string is longer than the initial buffer", &a);
+	string_t clone = str_clone(&str);
+	str_append(&str, &clone);
+	str_compact(&str);
+	str_free(&str);
+	str_free(&clone);
+	check_empty("string", &c);
+}
+
+static alloc_site_t *find_site(alloc_snapshot_t *snap, const char *name)
+{
+	for (size_t i = 0; i < snap->nsites; i++) {
+		if (strcmp(snap->sites[i].site, name) == 0)
+			return &snap->sites[i];
+	}
+
+	printf("call site %s was not recorded\n", name);
+	exit(1);
+}
+
+void test_stats()
+{
+	alloc_snapshot_t snap;
+
+	alloc_stats_reset();
+
+	vector_int v = vect_init(vector_int);
+	for (int i = 0; i < 1000; i++)
+		vect_append(&v, i);
+
+	string_t s = str_new();
+	for (int i = 0; i < 100; i++) {
+		string_t part = str_from("stats");
+		str_append(&s, &part);
+		str_free(&part);
+	}
+
+	alloc_stats_snapshot(&snap);
+	alloc_count_t *vc = &snap.modules[ALLOC_MOD_VECT];
+	if (vc->allocs != 1 || vc->reallocs == 0 || vc->live != vc->peak || vc->live < 1000 * sizeof(int)) {
+		printf("wrong vect stats (allocs: %lu, reallocs: %lu, live: %lu, peak: %lu)\n",
+				vc->allocs, vc->reallocs, vc->live, vc->peak);
+		exit(1);
+	}
+	if (find_site(&snap, "_vect_resize")->module != ALLOC_MOD_VECT) {
+		printf("_vect_resize attributed to wrong module\n");
+		exit(1);
+	}
+
+	alloc_count_t *sc = &snap.modules[ALLOC_MOD_STR];
+	if (sc->allocs != 101 || sc->frees != 100) {
+		printf("wrong str stats (allocs: %lu, frees: %lu)\n", sc->allocs, sc->frees);
+		exit(1);
+	}
+	alloc_site_t *grow = find_site(&snap, "str_grow");
+	if (grow->count.reallocs == 0 || grow->count.copied < grow->count.copies) {
+		printf("wrong str_grow stats (reallocs: %lu, copies: %lu, copied: %lu)\n",
+				grow->count.reallocs, grow->count.copies, grow->count.copied);
+		exit(1);
+	}
+
+	vect_destroy(&v);
+	str_free(&s);
+	alloc_stats_dump(stdout);
+
+	alloc_stats_snapshot(&snap);
+	for (int i = 0; i < ALLOC_MOD_COUNT; i++) {
+		if (snap.modules[i].live != 0) {
+			printf("module %s has %lu bytes live after free\n",
+					alloc_module_name(i), snap.modules[i].live);
+			exit(1);
+		}
+	}
+}
+
+int main()
+{
+	test_calls();
+	test_containers();
+	test_stats();
+}
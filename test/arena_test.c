@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HLC_AUTO_INCLUDE
+#include "../alloc.h"
+#include "../arena.h"
+#include "../vect.h"
+#include "../str/str.c"
+
+vect_declare(int, vector_int);
+
+void test_alloc()
+{
+	arena_t a;
+	arena_init(&a, 128);
+
+	for (size_t i = 1; i < 64; i++) {
+		char *p = arena_alloc(&a, i);
+		if (!p) {
+			printf("arena alloc failed (size: %lu)\n", i);
+			exit(1);
+		}
+		if ((uintptr_t)p % ARENA_ALIGN != 0) {
+			printf("arena alloc misaligned (%p, align %lu)\n", (void *)p, ARENA_ALIGN);
+			exit(1);
+		}
+		memset(p, 0xAA, i);
+	}
+
+	/* larger than a chunk */
+	char *big = arena_alloc(&a, 1024);
+	memset(big, 0, 1024);
+
+	for (size_t align = 1; align <= 4096; align <<= 1) {
+		void *p = arena_alloc_aligned(&a, 3, align);
+		if (!p || (uintptr_t)p % align != 0) {
+			printf("aligned alloc failed (%p, align %lu)\n", p, align);
+			exit(1);
+		}
+	}
+	if (arena_alloc_aligned(&a, 8, 3)) {
+		printf("aligned alloc accepted non power of two\n");
+		exit(1);
+	}
+
+	arena_free(&a);
+}
+
+void test_realloc()
+{
+	arena_t a;
+	arena_init(&a, 256);
+
+	char *p = arena_alloc(&a, 8);
+	strcpy(p, "abcdefg");
+	char *q = arena_realloc(&a, p, 8, 64);
+	if (q != p) {
+		printf("realloc of last block was not in place (%p -> %p)\n", (void *)p, (void *)q);
+		exit(1);
+	}
+
+	/* no longer the last block: must move and copy */
+	arena_alloc(&a, 1);
+	q = arena_realloc(&a, p, 64, 128);
+	if (q == p || strcmp(q, "abcdefg") != 0) {
+		printf("realloc of old block did not copy (got \"%s\")\n", q);
+		exit(1);
+	}
+
+	/* growing past the chunk must still work */
+	q = arena_realloc(&a, q, 128, 4096);
+	if (!q || strcmp(q, "abcdefg") != 0) {
+		printf("realloc past chunk lost data\n");
+		exit(1);
+	}
+
+	arena_free(&a);
+}
+
+void test_marks()
+{
+	arena_t a;
+	arena_init(&a, 64);
+
+	char *keep = arena_alloc(&a, 16);
+	strcpy(keep, "persistent");
+
+	arena_mark_t m = arena_save(&a);
+	char *tmp = arena_alloc(&a, 16);
+	for (int i = 0; i < 32; i++)
+		arena_alloc(&a, 48);
+	arena_restore(&a, m);
+
+	char *again = arena_alloc(&a, 16);
+	if (again != tmp) {
+		printf("restore did not rewind arena (%p, expect %p)\n", (void *)again, (void *)tmp);
+		exit(1);
+	}
+	if (strcmp(keep, "persistent") != 0) {
+		printf("restore clobbered memory before mark\n");
+		exit(1);
+	}
+	if (a.head->prev) {
+		printf("restore kept chunks from after mark\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < 32; i++)
+		arena_alloc(&a, 48);
+	struct _arena_chunk *head = a.head;
+	arena_reset(&a);
+	if (a.head != head || a.head->prev || a.head->used != 0) {
+		printf("reset did not keep exactly one empty chunk\n");
+		exit(1);
+	}
+
+	arena_free(&a);
+	if (a.head) {
+		printf("free left chunks in arena\n");
+		exit(1);
+	}
+}
+
+void test_containers()
+{
+	arena_t a;
+	arena_init(&a, 0);
+	const allocator_t *al = arena_allocator(&a);
+
+	string_t s = str_from_alloc("arena backed ", al);
+	for (int i = 0; i < 10; i++) {
+		string_t part = str_from_alloc("string ", al);
+		str_append(&s, &part);
+	}
+	printf("%s\n", str_cstr(&s));
+	if (str_len(&s) != strlen("arena backed ") + 10 * strlen("string ")) {
+		printf("wrong arena string length (%lu)\n", str_len(&s));
+		exit(1);
+	}
+
+	vector_int v = vect_init_alloc(vector_int, al);
+	for (int i = 0; i < 1000; i++)
+		vect_append(&v, i);
+	for (int i = 0; i < 1000; i++) {
+		if (vect_get(&v, i) != i) {
+			printf("wrong arena vector value at %d\n", i);
+			exit(1);
+		}
+	}
+	printf("vector (len: %lu, cap: %lu)\n", vect_len(&v), vect_cap(&v));
+
+	/* everything dies together */
+	arena_free(&a);
+}
+
+int main()
+{
+	test_alloc();
+	test_realloc();
+	test_marks();
+	test_containers();
+}
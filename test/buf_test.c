@@ -2,6 +2,11 @@
 #include <stdio.h>
 #include <string.h>
 
+/* allow allocation failure to be simulated */
+static int fail_realloc = 0;
+#define BUF_REALLOC(ptr, oldsize, newsize) (fail_realloc ? NULL : realloc(ptr, newsize))
+
+#include "../alloc.h"
 #include "../buf.h"
 
 static const char longish[] = "abcdefghijklmnopqrstuvwxyz";
@@ -44,6 +49,43 @@ void test_attach()
 	free(testbuf.strbuf);
 }
 
+void test_try_push()
+{
+	BUF_NEW(int, a);
+
+	for (int i = 0; i < 4; i++) {
+		if (!BUF_TRY_PUSH(a, i)) {
+			fprintf(stderr, "try push failed with memory available\n");
+			exit(1);
+		}
+	}
+
+	/* fill to capacity, then make sure growth fails cleanly */
+	while (BUF_LEN(a) < BUF_CAP(a))
+		BUF_PUSH(a, 0);
+
+	fail_realloc = 1;
+	size_t len = BUF_LEN(a), cap = BUF_CAP(a);
+	if (BUF_TRY_PUSH(a, 42)) {
+		fprintf(stderr, "try push succeeded without memory\n");
+		exit(1);
+	}
+	if (BUF_LEN(a) != len || BUF_CAP(a) != cap) {
+		fprintf(stderr, "failed try push modified buffer (%lu:%lu, expect %lu:%lu)\n",
+				BUF_LEN(a), BUF_CAP(a), len, cap);
+		exit(1);
+	}
+	fail_realloc = 0;
+
+	if (!BUF_TRY_PUSH(a, 42) || *BUF_GET(a, len) != 42) {
+		fprintf(stderr, "try push did not recover after failure\n");
+		exit(1);
+	}
+	printf("try push: %lu:%lu\n", BUF_LEN(a), BUF_CAP(a));
+
+	BUF_FREE(a);
+}
+
 int main()
 {
 	BUF_NEW(char, a);
@@ -64,4 +106,5 @@ int main()
 	BUF_FREE(a);
 
 	test_attach();
+	test_try_push();
 }
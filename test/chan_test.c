@@ -0,0 +1,726 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define HLC_AUTO_INCLUDE
+#define CHAN_IMPL
+#define TIMER_IMPL
+#include "../chan.h"
+
+#define NMSG 200000
+#define NPROD 16
+#define NPERPROD 10000
+
+typedef struct {
+	long seq, sum;
+	char tag[20];
+} msg_t;
+
+chan_declare(long, lchan);
+chan_declare(msg_t, mchan);
+
+static void *long_sender(void *arg)
+{
+	lchan *ch = arg;
+
+	for (long i = 0; i < NMSG; i++) {
+		if (!chan_send(ch, i)) {
+			printf("chan_send failed on open channel\n");
+			exit(1);
+		}
+	}
+	chan_close(ch);
+	return NULL;
+}
+
+/* a tiny buffer keeps both sides parking on each other */
+void test_spsc(size_t cap)
+{
+	lchan *ch = chan_new(lchan, cap, CHAN_SPSC);
+	pthread_t sender;
+	long v, next = 0;
+
+	pthread_create(&sender, NULL, long_sender, ch);
+	while (chan_recv(ch, &v)) {
+		if (v != next++) {
+			printf("spsc(%zu): received %ld, expected %ld\n", cap, v, next - 1);
+			exit(1);
+		}
+	}
+	pthread_join(sender, NULL);
+
+	printf("spsc(%zu): %ld received\n", cap, next);
+	if (next != NMSG) {
+		printf("spsc(%zu) lost values\n", cap);
+		exit(1);
+	}
+	chan_free(ch);
+}
+
+static void *msg_sender(void *arg)
+{
+	mchan *ch = arg;
+	msg_t m = {0, 0, "hello"};
+
+	for (m.seq = 0; m.seq < 1000; m.seq++) {
+		m.sum += m.seq;
+		chan_send(ch, m);
+	}
+	chan_close(ch);
+	return NULL;
+}
+
+void test_by_value()
+{
+	mchan *ch = chan_new(mchan, 3, CHAN_SPSC);
+	pthread_t sender;
+	msg_t m;
+	long sum = 0, n = 0;
+
+	pthread_create(&sender, NULL, msg_sender, ch);
+	while (chan_recv(ch, &m)) {
+		sum += m.seq;
+		if (m.seq != n++ || m.sum != sum || strcmp(m.tag, "hello") != 0) {
+			printf("struct value corrupted in channel\n");
+			exit(1);
+		}
+	}
+	pthread_join(sender, NULL);
+	chan_free(ch);
+}
+
+void test_try()
+{
+	lchan *ch = chan_new(lchan, 3, CHAN_SPSC);
+	long v;
+
+	if (chan_cap(ch) != 3 || chan_len(ch) != 0 || chan_try_recv(ch, &v)) {
+		printf("new channel not empty\n");
+		exit(1);
+	}
+	for (long i = 0; i < 3; i++) {
+		if (!chan_try_send(ch, i)) {
+			printf("chan_try_send failed below capacity\n");
+			exit(1);
+		}
+	}
+	if (chan_try_send(ch, 3) || chan_len(ch) != 3) {
+		printf("chan_try_send exceeded capacity\n");
+		exit(1);
+	}
+	if (!chan_try_recv(ch, &v) || v != 0 || !chan_try_send(ch, 3)) {
+		printf("chan_try_recv did not make room\n");
+		exit(1);
+	}
+
+	chan_close(ch);
+	if (!chan_closed(ch) || chan_send(ch, 4) || chan_try_send(ch, 4)) {
+		printf("sent on closed channel\n");
+		exit(1);
+	}
+	for (long i = 1; i <= 3; i++) {
+		if (!chan_recv(ch, &v) || v != i) {
+			printf("closed channel not drained\n");
+			exit(1);
+		}
+	}
+	if (chan_recv(ch, &v) || chan_try_recv(ch, &v)) {
+		printf("received from closed, drained channel\n");
+		exit(1);
+	}
+	chan_free(ch);
+}
+
+static void *blocked_recv(void *arg)
+{
+	long v;
+
+	return (void *)(intptr_t)chan_recv((lchan *)arg, &v);
+}
+
+/* closing must wake a receiver which is already asleep */
+void test_close_wakes()
+{
+	lchan *ch = chan_new(lchan, 1, CHAN_SPSC);
+	pthread_t t;
+	void *ret;
+
+	pthread_create(&t, NULL, blocked_recv, ch);
+	while (!atomic_load(&ch->c.recvq.len))
+		sync_yield();
+	chan_close(ch);
+	pthread_join(t, &ret);
+
+	if (ret) {
+		printf("receiver woken by close received a value\n");
+		exit(1);
+	}
+	chan_free(ch);
+}
+
+typedef struct {
+	lchan *ch;
+	long id;
+} producer_t;
+
+/* each producer sends id * NPERPROD up to (id + 1) * NPERPROD - 1 */
+static void *producer(void *arg)
+{
+	producer_t *p = arg;
+
+	for (long i = 0; i < NPERPROD; i++)
+		chan_send(p->ch, p->id * NPERPROD + i);
+	return NULL;
+}
+
+static atomic_int seen[NPROD * NPERPROD];
+
+static void *consumer(void *arg)
+{
+	lchan *ch = arg;
+	long v, last[NPROD];
+
+	for (int i = 0; i < NPROD; i++)
+		last[i] = -1;
+	while (chan_recv(ch, &v)) {
+		/* a single producer's values are received in order, by any one consumer */
+		if (v <= last[v / NPERPROD]) {
+			printf("mpmc: values from one producer out of order\n");
+			exit(1);
+		}
+		last[v / NPERPROD] = v;
+		atomic_fetch_add(&seen[v], 1);
+	}
+	return NULL;
+}
+
+/* NPROD producers and nconsumers consumers; every value must arrive once */
+void test_mpmc(size_t cap, int nconsumers)
+{
+	lchan *ch = chan_new(lchan, cap, CHAN_MPMC);
+	pthread_t prod[NPROD], cons[NPROD];
+	producer_t args[NPROD];
+
+	for (long i = 0; i < NPROD * NPERPROD; i++)
+		atomic_store(&seen[i], 0);
+	for (int i = 0; i < nconsumers; i++)
+		pthread_create(&cons[i], NULL, consumer, ch);
+	for (int i = 0; i < NPROD; i++) {
+		args[i].ch = ch;
+		args[i].id = i;
+		pthread_create(&prod[i], NULL, producer, &args[i]);
+	}
+	for (int i = 0; i < NPROD; i++)
+		pthread_join(prod[i], NULL);
+	chan_close(ch);
+	for (int i = 0; i < nconsumers; i++)
+		pthread_join(cons[i], NULL);
+
+	for (long i = 0; i < NPROD * NPERPROD; i++) {
+		if (atomic_load(&seen[i]) != 1) {
+			printf("mpmc(%zu, %d): value %ld received %d times\n", cap, nconsumers,
+					i, atomic_load(&seen[i]));
+			exit(1);
+		}
+	}
+	printf("mpmc(%zu, %d): %d received\n", cap, nconsumers, NPROD * NPERPROD);
+	chan_free(ch);
+}
+
+void test_mpmc_try()
+{
+	lchan *ch = chan_new(lchan, 3, CHAN_MPMC);
+	long v;
+
+	/* the ring is rounded up to four slots, but only three may be used */
+	for (long lap = 0; lap < 5; lap++) {
+		for (long i = 0; i < 3; i++) {
+			if (!chan_try_send(ch, lap * 3 + i)) {
+				printf("mpmc: chan_try_send failed below capacity\n");
+				exit(1);
+			}
+		}
+		if (chan_try_send(ch, -1) || chan_len(ch) != 3) {
+			printf("mpmc: chan_try_send exceeded capacity\n");
+			exit(1);
+		}
+		for (long i = 0; i < 3; i++) {
+			if (!chan_try_recv(ch, &v) || v != lap * 3 + i) {
+				printf("mpmc: chan_try_recv out of order\n");
+				exit(1);
+			}
+		}
+		if (chan_try_recv(ch, &v)) {
+			printf("mpmc: received from empty channel\n");
+			exit(1);
+		}
+	}
+	chan_free(ch);
+}
+
+static void *blocked_send(void *arg)
+{
+	return (void *)(intptr_t)chan_send((lchan *)arg, 1);
+}
+
+/* closing must wake every sleeping sender and receiver */
+void test_mpmc_close()
+{
+	lchan *full = chan_new(lchan, 1, CHAN_MPMC), *empty = chan_new(lchan, 1, CHAN_MPMC);
+	pthread_t senders[4], receivers[4];
+	void *ret;
+
+	chan_send(full, 0);
+	for (int i = 0; i < 4; i++) {
+		pthread_create(&senders[i], NULL, blocked_send, full);
+		pthread_create(&receivers[i], NULL, blocked_recv, empty);
+	}
+	while (atomic_load(&full->c.sendq.len) != 4 || atomic_load(&empty->c.recvq.len) != 4)
+		sync_yield();
+	chan_close(full);
+	chan_close(empty);
+
+	for (int i = 0; i < 4; i++) {
+		pthread_join(senders[i], &ret);
+		if (ret) {
+			printf("mpmc: sent on closed channel\n");
+			exit(1);
+		}
+		pthread_join(receivers[i], &ret);
+		if (ret) {
+			printf("mpmc: received from closed, empty channel\n");
+			exit(1);
+		}
+	}
+	chan_free(full);
+	chan_free(empty);
+}
+
+/* with several cases ready, each must be chosen some of the time */
+void test_select_ready()
+{
+	lchan *a = chan_new(lchan, 1024, CHAN_MPMC), *b = chan_new(lchan, 1024, CHAN_MPMC);
+	long x, y, chosen[3] = {0};
+	chan_case_t cs[3];
+
+	for (long i = 0; i < 1000; i++) {
+		chan_send(a, i);
+		chan_send(b, i);
+	}
+	for (int i = 0; i < 1000; i++) {
+		cs[0] = chan_case_recv(a, &x);
+		cs[1] = chan_case_recv(b, &y);
+		cs[2] = chan_case_recv(a, &x);
+		cs[2].c = NULL;
+		chosen[chan_try_select(cs, 3)]++;
+	}
+	if (chosen[0] < 300 || chosen[1] < 300 || chosen[2]) {
+		printf("select: unfair choice (%ld, %ld, %ld)\n", chosen[0], chosen[1], chosen[2]);
+		exit(1);
+	}
+
+	while (chan_try_recv(a, &x))
+		;
+	cs[0] = chan_case_recv(a, &x);
+	cs[1] = chan_case_send(b, &y);
+	if (chan_try_select(cs, 2) != 1 || !cs[1].ok) {
+		printf("select: send case not taken\n");
+		exit(1);
+	}
+	if (chan_try_select(cs, 1) != -1) {
+		printf("select: empty channel selected\n");
+		exit(1);
+	}
+	struct timespec deadline = sync_deadline(1000000);
+	if (chan_timedselect(cs, 1, &deadline) != -1) {
+		printf("select: timed select did not time out\n");
+		exit(1);
+	}
+
+	chan_close(a);
+	if (chan_select(cs, 1) != 0 || cs[0].ok) {
+		printf("select: closed channel not selected\n");
+		exit(1);
+	}
+	chan_free(a);
+	chan_free(b);
+}
+
+typedef struct {
+	lchan *ch;
+	long from, to;
+} range_t;
+
+static void *range_sender(void *arg)
+{
+	range_t *r = arg;
+
+	for (long i = r->from; i < r->to; i++)
+		chan_send(r->ch, i);
+	chan_close(r->ch);
+	return NULL;
+}
+
+/* one thread selecting over two busy channels must receive every value */
+void test_select_fanin()
+{
+	lchan *ch[2] = {chan_new(lchan, 1, CHAN_SPSC), chan_new(lchan, 4, CHAN_SPSC)};
+	range_t r[2] = {{ch[0], 0, NMSG / 2}, {ch[1], NMSG / 2, NMSG}};
+	pthread_t t[2];
+	chan_case_t cs[2];
+	long v, sum = 0, n = 0;
+	int k;
+
+	for (int i = 0; i < 2; i++)
+		pthread_create(&t[i], NULL, range_sender, &r[i]);
+	cs[0] = chan_case_recv(ch[0], &v);
+	cs[1] = chan_case_recv(ch[1], &v);
+	while (cs[0].c || cs[1].c) {
+		k = chan_select(cs, 2);
+		if (!cs[k].ok) {
+			cs[k].c = NULL;
+			continue;
+		}
+		sum += v;
+		n++;
+	}
+	for (int i = 0; i < 2; i++)
+		pthread_join(t[i], NULL);
+
+	printf("select fan-in: %ld received\n", n);
+	if (n != NMSG || sum != (long)NMSG * (NMSG - 1) / 2) {
+		printf("select fan-in lost values\n");
+		exit(1);
+	}
+	chan_free(ch[0]);
+	chan_free(ch[1]);
+}
+
+/* batches must wrap around the ring and stop at capacity */
+void test_batch_try(enum chan_mode mode)
+{
+	lchan *ch = chan_new(lchan, 6, mode);
+	long in[10], out[10];
+
+	for (long i = 0; i < 10; i++)
+		in[i] = i;
+	for (int lap = 0; lap < 5; lap++) {
+		if (chan_try_send_n(ch, in, 4) != 4 || chan_try_send_n(ch, in + 4, 6) != 2) {
+			printf("batch(%d): sent past capacity\n", mode);
+			exit(1);
+		}
+		if (chan_try_recv_n(ch, out, 3) != 3 || chan_try_recv_n(ch, out + 3, 10) != 3 ||
+				chan_try_recv_n(ch, out, 10) != 0) {
+			printf("batch(%d): wrong number received\n", mode);
+			exit(1);
+		}
+		for (long i = 0; i < 6; i++) {
+			if (out[i] != i) {
+				printf("batch(%d): received %ld, expected %ld\n", mode, out[i], i);
+				exit(1);
+			}
+		}
+		/* shift the indices, so the next lap wraps at a different place */
+		chan_send(ch, 0);
+		chan_recv(ch, out);
+	}
+
+	chan_send_n(ch, in, 4);
+	chan_close(ch);
+	if (chan_send_n(ch, in, 4) != 0 || chan_recv_n(ch, out, 10) != 4 ||
+			chan_recv_n(ch, out, 10) != 0) {
+		printf("batch(%d): closed channel mishandled\n", mode);
+		exit(1);
+	}
+	chan_free(ch);
+}
+
+static void *batch_sender(void *arg)
+{
+	range_t *r = arg;
+	long buf[37];
+	size_t n;
+
+	for (long i = r->from; i < r->to; i += n) {
+		n = (r->to - i < 37) ? r->to - i : 37;
+		for (size_t j = 0; j < n; j++)
+			buf[j] = i + j;
+		if (chan_send_n(r->ch, buf, n) != n) {
+			printf("batch: chan_send_n failed on open channel\n");
+			exit(1);
+		}
+	}
+	return NULL;
+}
+
+/* batches from several senders must arrive whole and in order per sender */
+void test_batch(enum chan_mode mode, int nsenders)
+{
+	lchan *ch = chan_new(lchan, 64, mode);
+	range_t r[4];
+	pthread_t t[4];
+	long buf[50], last[4] = {-1, -1, -1, -1}, n = 0;
+	size_t got;
+
+	for (int i = 0; i < nsenders; i++) {
+		r[i] = (range_t){ch, i * NMSG, (i + 1) * NMSG};
+		pthread_create(&t[i], NULL, batch_sender, &r[i]);
+	}
+	while (n < (long)nsenders * NMSG) {
+		got = chan_recv_n(ch, buf, 50);
+		for (size_t i = 0; i < got; i++) {
+			if (buf[i] <= last[buf[i] / NMSG]) {
+				printf("batch(%d): values out of order\n", mode);
+				exit(1);
+			}
+			last[buf[i] / NMSG] = buf[i];
+		}
+		n += got;
+	}
+	for (int i = 0; i < nsenders; i++)
+		pthread_join(t[i], NULL);
+
+	printf("batch(%d, %d): %ld received\n", mode, nsenders, n);
+	for (int i = 0; i < nsenders; i++) {
+		if (last[i] != (i + 1) * NMSG - 1) {
+			printf("batch(%d): lost values\n", mode);
+			exit(1);
+		}
+	}
+	chan_free(ch);
+}
+
+/* an unbuffered channel only passes values between waiting threads */
+void test_unbuffered_try()
+{
+	lchan *ch = chan_new(lchan, 0, CHAN_MPMC);
+	pthread_t t;
+	void *ret;
+	long v;
+
+	if (!ch || chan_cap(ch) != 0 || chan_try_send(ch, 1) || chan_try_recv(ch, &v)) {
+		printf("unbuffered: value passed with nobody waiting\n");
+		exit(1);
+	}
+	pthread_create(&t, NULL, blocked_recv, ch);
+	while (!atomic_load(&ch->c.recvq.len))
+		sync_yield();
+	if (!chan_try_send(ch, 7) || chan_len(ch) != 0) {
+		printf("unbuffered: waiting receiver not handed value\n");
+		exit(1);
+	}
+	pthread_join(t, &ret);
+	if (!ret) {
+		printf("unbuffered: receiver not woken by handoff\n");
+		exit(1);
+	}
+
+	struct timespec deadline = sync_deadline(1000000);
+	if (_chan_send(&ch->c, &v, sizeof(v), &deadline) != -1 || ch->c.sendq.len) {
+		printf("unbuffered: timed send did not time out\n");
+		exit(1);
+	}
+	pthread_create(&t, NULL, blocked_recv, ch);
+	while (!atomic_load(&ch->c.recvq.len))
+		sync_yield();
+	chan_close(ch);
+	pthread_join(t, &ret);
+	if (ret || chan_send(ch, 1)) {
+		printf("unbuffered: closed channel passed a value\n");
+		exit(1);
+	}
+	chan_free(ch);
+}
+
+/* every value sent must be received exactly once, with sends and receives paired */
+void test_unbuffered(int nsenders)
+{
+	lchan *ch = chan_new(lchan, 0, CHAN_MPMC);
+	range_t r[4];
+	pthread_t t[4];
+	long v, sum = 0, n = 0, want = 0;
+
+	for (int i = 0; i < nsenders; i++) {
+		r[i] = (range_t){ch, i * (NMSG / 4), (i + 1) * (NMSG / 4)};
+		pthread_create(&t[i], NULL, batch_sender, &r[i]);
+	}
+	for (long i = 0; i < nsenders * (NMSG / 4); i++) {
+		if (!chan_recv(ch, &v)) {
+			printf("unbuffered: chan_recv failed on open channel\n");
+			exit(1);
+		}
+		sum += v;
+		want += i;
+		n++;
+	}
+	for (int i = 0; i < nsenders; i++)
+		pthread_join(t[i], NULL);
+
+	printf("unbuffered(%d): %ld received\n", nsenders, n);
+	if (sum != want || chan_try_recv(ch, &v)) {
+		printf("unbuffered: values lost or duplicated\n");
+		exit(1);
+	}
+	chan_free(ch);
+}
+
+/* a select must be handed values directly, and only take one at a time */
+void test_unbuffered_select()
+{
+	lchan *ch[2] = {chan_new(lchan, 0, CHAN_MPMC), chan_new(lchan, 0, CHAN_MPMC)};
+	range_t r[2] = {{ch[0], 0, NMSG / 4}, {ch[1], NMSG / 4, NMSG / 2}};
+	pthread_t t[2];
+	chan_case_t cs[2];
+	long v, sum = 0, n = 0;
+	int k;
+
+	for (int i = 0; i < 2; i++)
+		pthread_create(&t[i], NULL, range_sender, &r[i]);
+	cs[0] = chan_case_recv(ch[0], &v);
+	cs[1] = chan_case_recv(ch[1], &v);
+	while (cs[0].c || cs[1].c) {
+		k = chan_select(cs, 2);
+		if (!cs[k].ok) {
+			cs[k].c = NULL;
+			continue;
+		}
+		sum += v;
+		n++;
+	}
+	for (int i = 0; i < 2; i++)
+		pthread_join(t[i], NULL);
+
+	printf("unbuffered select: %ld received\n", n);
+	if (n != NMSG / 2 || sum != (long)(NMSG / 2) * (NMSG / 2 - 1) / 2) {
+		printf("unbuffered select lost values\n");
+		exit(1);
+	}
+	chan_free(ch[0]);
+	chan_free(ch[1]);
+}
+
+static void *late_sender(void *arg)
+{
+	usleep(2000);
+	chan_send((lchan *)arg, 42);
+	return NULL;
+}
+
+/* a timed operation gives up no earlier than its deadline, and not if served in time */
+void test_timed()
+{
+	lchan *ch = chan_new(lchan, 1, CHAN_MPMC);
+	struct timespec deadline = sync_deadline(5000000);
+	pthread_t t;
+	long v;
+
+	if (chan_timedrecv(ch, &v, &deadline) != -1) {
+		printf("timed: receive from empty channel did not time out\n");
+		exit(1);
+	}
+	if (!_sync_expired(&deadline)) {
+		printf("timed: receive timed out early\n");
+		exit(1);
+	}
+	chan_send(ch, 1);
+	deadline = sync_deadline(1000000);
+	if (chan_timedsend(ch, 2, &deadline) != -1 || chan_timedrecv(ch, &v, &deadline) != 1 || v != 1) {
+		printf("timed: send to full channel did not time out\n");
+		exit(1);
+	}
+
+	/* already expired, it only succeeds if it need not wait */
+	if (chan_timedrecv(ch, &v, &deadline) != -1 || chan_timedsend(ch, 3, &deadline) != 1) {
+		printf("timed: expired deadline waited\n");
+		exit(1);
+	}
+	chan_recv(ch, &v);
+
+	pthread_create(&t, NULL, late_sender, ch);
+	deadline = sync_deadline(10000000000);
+	if (chan_timedrecv(ch, &v, &deadline) != 1 || v != 42) {
+		printf("timed: receive not woken by send\n");
+		exit(1);
+	}
+	pthread_join(t, NULL);
+	chan_close(ch);
+	if (chan_timedrecv(ch, &v, &deadline) != 0) {
+		printf("timed: receive from closed channel\n");
+		exit(1);
+	}
+	chan_free(ch);
+}
+
+/* counts the blocks live in an allocator, and hands out misaligned ones */
+static size_t live_blocks;
+
+static void *offset_alloc(void *ctx, size_t size)
+{
+	unsigned char *p = malloc(size + 16);
+	(void)ctx;
+	live_blocks++;
+	return p ? p + 16 : NULL;
+}
+
+static void offset_release(void *ctx, void *ptr, size_t size)
+{
+	(void)ctx, (void)size;
+	live_blocks--;
+	free((unsigned char *)ptr - 16);
+}
+
+/* a channel lives entirely in its allocator, aligned as it needs */
+void test_alloc()
+{
+	allocator_t a = {.alloc = offset_alloc, .release = offset_release};
+	long v;
+
+	for (int mode = CHAN_SPSC; mode <= CHAN_MPMC; mode++) {
+		lchan *ch = chan_new_alloc(lchan, 4, mode, &a);
+
+		if (!ch || (uintptr_t)&ch->c.tail % SYNC_CACHE_LINE != 0) {
+			printf("alloc: channel misaligned (%p)\n", (void *)ch);
+			exit(1);
+		}
+		/* the channel itself, its ring and (CHAN_MPMC) sequence numbers */
+		if (live_blocks != (mode == CHAN_MPMC ? 3u : 2u)) {
+			printf("alloc: %zu blocks from the allocator\n", live_blocks);
+			exit(1);
+		}
+		if (!chan_try_send(ch, 7) || !chan_try_recv(ch, &v) || v != 7) {
+			printf("alloc: channel broken\n");
+			exit(1);
+		}
+		chan_free(ch);
+	}
+	if (live_blocks != 0) {
+		printf("alloc: %zu blocks leaked\n", live_blocks);
+		exit(1);
+	}
+}
+
+int main()
+{
+	test_try();
+	test_alloc();
+	test_spsc(1);
+	test_spsc(1024);
+	test_by_value();
+	test_close_wakes();
+	test_mpmc_try();
+	test_mpmc(1, 1);
+	test_mpmc(1024, 1);
+	test_mpmc(64, 4);
+	test_mpmc_close();
+	test_select_ready();
+	test_select_fanin();
+	test_batch_try(CHAN_SPSC);
+	test_batch_try(CHAN_MPMC);
+	test_batch(CHAN_SPSC, 1);
+	test_batch(CHAN_MPMC, 4);
+	test_unbuffered_try();
+	test_unbuffered(1);
+	test_unbuffered(4);
+	test_unbuffered_select();
+	test_timed();
+}
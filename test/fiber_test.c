@@ -0,0 +1,311 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define HLC_AUTO_INCLUDE
+#define CHAN_IMPL
+#define TIMER_IMPL
+#include "../fiber.h"
+
+#define NFIBER 10000
+#define NYIELD 10
+#define NPING 20000
+
+chan_declare(long, lchan);
+
+static pool_t *pool;
+static atomic_long ran;
+
+static void count(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < NYIELD; i++)
+		fiber_yield();
+	atomic_fetch_add(&ran, 1);
+}
+
+/* many more fibers than threads, each switched out several times */
+void test_spawn()
+{
+	pool_group_t g = POOL_GROUP_INIT;
+
+	atomic_store(&ran, 0);
+	for (int i = 0; i < NFIBER; i++) {
+		if (!fiber_spawn(pool, &g, count, NULL)) {
+			printf("spawn: fiber_spawn failed\n");
+			exit(1);
+		}
+	}
+	pool_wait(pool, &g);
+	if (atomic_load(&ran) != NFIBER) {
+		printf("spawn: %ld of %d fibers finished\n", atomic_load(&ran), NFIBER);
+		exit(1);
+	}
+}
+
+typedef struct {
+	lchan *in, *out;
+} link_t;
+
+static void relay(void *arg)
+{
+	link_t *l = arg;
+	long v;
+
+	while (chan_recv(l->in, &v))
+		chan_send(l->out, v + 1);
+	chan_close(l->out);
+}
+
+/*
+ * A chain of fibers, each passing on what it receives from the last, so that
+ * all but one are parked on a channel at any time. The ends are threads.
+ */
+void test_chain(size_t cap)
+{
+	pool_group_t g = POOL_GROUP_INIT;
+	lchan **ch = malloc((NFIBER + 1) * sizeof(*ch));
+	link_t *l = malloc(NFIBER * sizeof(*l));
+	long v;
+
+	for (int i = 0; i <= NFIBER; i++)
+		ch[i] = chan_new(lchan, cap, CHAN_SPSC);
+	for (int i = 0; i < NFIBER; i++) {
+		l[i].in = ch[i];
+		l[i].out = ch[i + 1];
+		fiber_spawn(pool, &g, relay, &l[i]);
+	}
+
+	for (long i = 0; i < 10; i++) {
+		chan_send(ch[0], i);
+		if (!chan_recv(ch[NFIBER], &v) || v != i + NFIBER) {
+			printf("chain(%zu): received %ld, expected %ld\n", cap, v, i + NFIBER);
+			exit(1);
+		}
+	}
+	chan_close(ch[0]);
+	if (chan_recv(ch[NFIBER], &v)) {
+		printf("chain(%zu): close did not pass down the chain\n", cap);
+		exit(1);
+	}
+	pool_wait(pool, &g);
+
+	for (int i = 0; i <= NFIBER; i++)
+		chan_free(ch[i]);
+	free(ch);
+	free(l);
+}
+
+static void pinger(void *arg)
+{
+	link_t *l = arg;
+	long v = 0;
+
+	for (int i = 0; i < NPING; i++) {
+		chan_send(l->out, v);
+		chan_recv(l->in, &v);
+	}
+	chan_close(l->out);
+}
+
+/* two fibers on one thread must take turns, not deadlock it */
+void test_pingpong()
+{
+	pool_t *one = pool_new(1);
+	pool_group_t g = POOL_GROUP_INIT;
+	lchan *a = chan_new(lchan, 0, CHAN_SPSC), *b = chan_new(lchan, 0, CHAN_SPSC);
+	link_t ping = {b, a}, pong = {a, b};
+	long v;
+
+	fiber_spawn(one, &g, pinger, &ping);
+	fiber_spawn(one, &g, relay, &pong);
+	pool_wait(one, &g);
+	/* relay closed b after the last reply, which pinger received */
+	if (chan_recv(b, &v)) {
+		printf("pingpong: values left over\n");
+		exit(1);
+	}
+	printf("pingpong: %d round trips\n", NPING);
+
+	chan_free(a);
+	chan_free(b);
+	pool_free(one);
+}
+
+typedef struct {
+	lchan *ch[2];
+	long sum, n;
+	int timeouts;
+} sel_t;
+
+static void selector(void *arg)
+{
+	sel_t *s = arg;
+	struct timespec ts;
+	chan_case_t cs[2];
+	long v;
+	int k;
+
+	cs[0] = chan_case_recv(s->ch[0], &v);
+	cs[1] = chan_case_recv(s->ch[1], &v);
+	while (cs[0].c || cs[1].c) {
+		k = chan_select(cs, 2);
+		if (!cs[k].ok) {
+			cs[k].c = NULL;
+			continue;
+		}
+		s->sum += v;
+		s->n++;
+	}
+
+	/* with nothing left to receive, a timed select times out */
+	cs[0] = chan_case_recv(s->ch[0], &v);
+	cs[0].c = NULL;
+	ts = sync_deadline(1000000);
+	if (chan_timedselect(cs, 1, &ts) == -1)
+		s->timeouts++;
+}
+
+typedef struct {
+	lchan *ch;
+	long from, to;
+} range_t;
+
+static void *range_sender(void *arg)
+{
+	range_t *r = arg;
+
+	for (long i = r->from; i < r->to; i++)
+		chan_send(r->ch, i);
+	chan_close(r->ch);
+	return NULL;
+}
+
+/* a fiber selecting over channels fed by threads */
+void test_select()
+{
+	pool_group_t g = POOL_GROUP_INIT;
+	sel_t s = {{chan_new(lchan, 0, CHAN_MPMC), chan_new(lchan, 4, CHAN_MPMC)}, 0, 0, 0};
+	range_t r[2] = {{s.ch[0], 0, NPING}, {s.ch[1], NPING, 2 * NPING}};
+	pthread_t t[2];
+
+	fiber_spawn(pool, &g, selector, &s);
+	for (int i = 0; i < 2; i++)
+		pthread_create(&t[i], NULL, range_sender, &r[i]);
+	for (int i = 0; i < 2; i++)
+		pthread_join(t[i], NULL);
+	pool_wait(pool, &g);
+
+	printf("select: %ld received\n", s.n);
+	if (s.n != 2 * NPING || s.sum != (long)(2 * NPING) * (2 * NPING - 1) / 2) {
+		printf("select lost values\n");
+		exit(1);
+	}
+	if (s.timeouts != 1) {
+		printf("select: timed select did not time out\n");
+		exit(1);
+	}
+	chan_free(s.ch[0]);
+	chan_free(s.ch[1]);
+}
+
+typedef struct {
+	_Atomic(fiber_t *) self;
+	atomic_int woken;
+} park_t;
+
+static void parker(void *arg)
+{
+	park_t *p = arg;
+
+	atomic_store(&p->self, fiber_self());
+	while (!atomic_load(&p->woken))
+		fiber_park();
+}
+
+/* fiber_unpark from a thread, whether or not the fiber has parked yet */
+void test_park()
+{
+	pool_group_t g = POOL_GROUP_INIT;
+	park_t p;
+	fiber_t *f;
+
+	for (int i = 0; i < 1000; i++) {
+		atomic_init(&p.self, NULL);
+		atomic_init(&p.woken, 0);
+		fiber_spawn(pool, &g, parker, &p);
+		while (!(f = atomic_load(&p.self)))
+			sync_yield();
+		atomic_store(&p.woken, 1);
+		fiber_unpark(f);
+		pool_wait(pool, &g);
+	}
+}
+
+/* from fiber_tu.c */
+lchan *tu_new(void);
+void tu_send(lchan *ch, long v);
+long tu_recv(lchan *ch);
+
+static lchan *tu_chan;
+static atomic_long tu_received;
+
+static void tu_receiver(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < 100; i++)
+		atomic_fetch_add(&tu_received, tu_recv(tu_chan));
+}
+
+static void tu_sender(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < 100; i++)
+		tu_send(tu_chan, 1);
+}
+
+/*
+ * Fibers park on a channel created and used in another translation unit,
+ * rather than blocking their worker: with a single worker, whichever of the
+ * sender and receiver waited first would otherwise keep the other from
+ * running.
+ */
+void test_translation_units()
+{
+	pool_t *one = pool_new(1);
+	pool_group_t g = POOL_GROUP_INIT;
+
+	tu_chan = tu_new();
+	fiber_spawn(one, &g, tu_receiver, NULL);
+	fiber_spawn(one, &g, tu_sender, NULL);
+
+	/* pool_wait could run the sender on this thread instead */
+	for (int i = 0; i < 5000 && atomic_load(&tu_received) < 100; i++)
+		usleep(1000);
+	if (atomic_load(&tu_received) != 100) {
+		printf("translation units: a fiber blocked its worker\n");
+		exit(1);
+	}
+	pool_wait(one, &g);
+	pool_free(one);
+	chan_free(tu_chan);
+}
+
+int main()
+{
+	pool = pool_new(4);
+	if (fiber_self()) {
+		printf("fiber_self outside a fiber\n");
+		exit(1);
+	}
+
+	test_spawn();
+	test_chain(0);
+	test_chain(1);
+	test_pingpong();
+	test_select();
+	test_park();
+	test_translation_units();
+	pool_free(pool);
+}
@@ -0,0 +1,23 @@
+/* a second translation unit for fiber_test.c, which defines neither CHAN_IMPL nor TIMER_IMPL */
+#define HLC_AUTO_INCLUDE
+#include "../fiber.h"
+
+chan_declare(long, lchan);
+
+lchan *tu_new(void)
+{
+	return chan_new(lchan, 0, CHAN_MPMC);
+}
+
+void tu_send(lchan *ch, long v)
+{
+	chan_send(ch, v);
+}
+
+long tu_recv(lchan *ch)
+{
+	long v = -1;
+
+	chan_recv(ch, &v);
+	return v;
+}
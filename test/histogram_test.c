@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define HLC_AUTO_INCLUDE
+#include "../histogram.h"
+
+/* the relative error allowed by the default precision */
+static int close_to(uint64_t got, uint64_t want)
+{
+	uint64_t diff = (got > want) ? got - want : want - got;
+	return diff <= want / 64 + 1;
+}
+
+void test_buckets()
+{
+	/* every bucket must contain exactly the values which map to it */
+	for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+		uint64_t lo = _hist_lowest(i), hi = _hist_highest(i);
+		if (_hist_bucket(lo) != i || _hist_bucket(hi) != i || hi < lo) {
+			printf("bucket %lu has bad bounds [%llu, %llu]\n", i,
+					(unsigned long long)lo, (unsigned long long)hi);
+			exit(1);
+		}
+		if (i > 0 && _hist_highest(i - 1) + 1 != lo) {
+			printf("gap before bucket %lu\n", i);
+			exit(1);
+		}
+	}
+	if (_hist_highest(HISTOGRAM_BUCKETS - 1) != UINT64_MAX) {
+		printf("buckets do not cover uint64_t\n");
+		exit(1);
+	}
+}
+
+void test_percentiles()
+{
+	histogram_t h;
+	histogram_init(&h);
+
+	if (histogram_percentile(&h, 99) != 0) {
+		printf("empty histogram has nonzero p99\n");
+		exit(1);
+	}
+
+	/* 1..100000, as a latency distribution in ns */
+	for (uint64_t v = 1; v <= 100000; v++)
+		histogram_record(&h, v);
+	histogram_record_n(&h, 5000000, 10);
+
+	struct { double p; uint64_t want; } cases[] = {
+		{0, 1}, {50, 50005}, {90, 90009}, {99, 99010}, {100, 5000000},
+	};
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		uint64_t got = histogram_percentile(&h, cases[i].p);
+		if (!close_to(got, cases[i].want)) {
+			printf("p%g: got %llu, want %llu\n", cases[i].p,
+					(unsigned long long)got, (unsigned long long)cases[i].want);
+			exit(1);
+		}
+	}
+	if (histogram_percentile(&h, 99.995) != 5000000) {
+		printf("outliers lost from the tail\n");
+		exit(1);
+	}
+	histogram_dump(&h, stdout);
+}
+
+void test_merge_serialize()
+{
+	histogram_t a, b, c;
+	unsigned char buf[2048];
+	size_t len;
+
+	histogram_init(&a);
+	histogram_init(&b);
+	for (uint64_t v = 0; v < 1000; v++) {
+		histogram_record(&a, v * 7);
+		histogram_record(&b, v * v * 13);
+	}
+	histogram_merge(&a, &b);
+	if (a.total != 2000 || a.min != 0 || a.max != 999 * 999 * 13) {
+		printf("bad merge (total: %llu, max: %llu)\n",
+				(unsigned long long)a.total, (unsigned long long)a.max);
+		exit(1);
+	}
+
+	len = histogram_serialize(&a, NULL, 0);
+	if (len > sizeof(buf) || histogram_serialize(&a, buf, sizeof(buf)) != len) {
+		printf("bad serialized length %lu\n", len);
+		exit(1);
+	}
+	printf("serialized %lu bytes (%lu in memory)\n", len, sizeof(a));
+
+	if (!histogram_deserialize(&c, buf, len) || memcmp(&a, &c, sizeof(a)) != 0) {
+		printf("histogram changed by round trip\n");
+		exit(1);
+	}
+	if (histogram_deserialize(&c, buf, len - 1) && c.total == a.total) {
+		printf("truncated histogram accepted\n");
+		exit(1);
+	}
+	buf[1]++;
+	if (histogram_deserialize(&c, buf, len) || c.total != 0) {
+		printf("histogram of wrong precision accepted\n");
+		exit(1);
+	}
+}
+
+int main()
+{
+	test_buckets();
+	test_percentiles();
+	test_merge_serialize();
+}
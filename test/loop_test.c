@@ -0,0 +1,400 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define HLC_AUTO_INCLUDE
+#define CHAN_IMPL
+#define TIMER_IMPL
+#include "../loop.h"
+
+#define NMSG 100000
+
+chan_declare(long, lchan);
+
+static loop_t loop;
+
+typedef struct {
+	loop_fd_t w;
+	int fd;
+	long sum, n;
+} pipe_reader_t;
+
+static void read_pipe(void *arg, uint32_t events)
+{
+	pipe_reader_t *r = arg;
+	long v;
+
+	(void)events;
+	if (read(r->fd, &v, sizeof(v)) != sizeof(v)) {
+		printf("fd: short read\n");
+		exit(1);
+	}
+	r->sum += v;
+	if (++r->n == 100)
+		loop_stop(&loop);
+}
+
+static void *pipe_writer(void *arg)
+{
+	int fd = *(int *)arg;
+
+	for (long i = 0; i < 100; i++) {
+		if (write(fd, &i, sizeof(i)) != sizeof(i))
+			exit(1);
+		if (i % 10 == 0)
+			usleep(100);
+	}
+	return NULL;
+}
+
+/* a file descriptor written by another thread */
+void test_fd()
+{
+	pipe_reader_t r;
+	int fds[2];
+	pthread_t t;
+
+	memset(&r, 0, sizeof(r));
+	if (pipe(fds) || loop_add_fd(&loop, &r.w, fds[0], EPOLLIN, read_pipe, &r)) {
+		printf("fd: loop_add_fd failed\n");
+		exit(1);
+	}
+	r.fd = fds[0];
+	pthread_create(&t, NULL, pipe_writer, &fds[1]);
+	loop_run(&loop);
+	pthread_join(t, NULL);
+
+	if (r.sum != 99 * 100 / 2) {
+		printf("fd: read %ld values summing %ld\n", r.n, r.sum);
+		exit(1);
+	}
+	loop_del_fd(&loop, &r.w);
+	close(fds[0]);
+	close(fds[1]);
+}
+
+typedef struct {
+	wtimer_t t;
+	uint64_t deadline;
+	int fired;
+} timer_rec_t;
+
+static int timers_left;
+
+static void timer_fired(void *arg)
+{
+	timer_rec_t *r = arg;
+
+	if (timer_now() < r->deadline) {
+		printf("timer: fired %ldns early\n", (long)(r->deadline - timer_now()));
+		exit(1);
+	}
+	r->fired++;
+	if (!--timers_left)
+		loop_stop(&loop);
+}
+
+/* timers fire no earlier than their deadline, and never once stopped */
+void test_timer()
+{
+	timer_rec_t r[20];
+	uint64_t now = timer_now();
+
+	timers_left = 0;
+	for (int i = 0; i < 20; i++) {
+		wtimer_init(&r[i].t);
+		r[i].deadline = now + (uint64_t)(i % 10) * 2000000;
+		r[i].fired = 0;
+		loop_add_timer(&loop, &r[i].t, r[i].deadline, timer_fired, &r[i]);
+		timers_left++;
+	}
+	for (int i = 1; i < 20; i += 2) {
+		if (loop_del_timer(&loop, &r[i].t))
+			timers_left--;
+	}
+	loop_run(&loop);
+
+	for (int i = 0; i < 20; i++) {
+		if (r[i].fired != !(i % 2)) {
+			printf("timer: timer %d fired %d times\n", i, r[i].fired);
+			exit(1);
+		}
+	}
+}
+
+typedef struct {
+	loop_chan_t w;
+	long v, sum, n;
+	int closed;
+} chan_reader_t;
+
+static int open_readers;
+
+static void chan_received(void *arg, int ok)
+{
+	chan_reader_t *r = arg;
+
+	if (!ok) {
+		r->closed = 1;
+		if (!--open_readers)
+			loop_stop(&loop);
+		return;
+	}
+	r->sum += r->v;
+	r->n++;
+}
+
+typedef struct {
+	lchan *ch;
+	long from, to;
+} range_t;
+
+static void *range_sender(void *arg)
+{
+	range_t *r = arg;
+
+	for (long i = r->from; i < r->to; i++)
+		chan_send(r->ch, i);
+	chan_close(r->ch);
+	return NULL;
+}
+
+/*
+ * Channels fed by threads, buffered and not, all received by the loop at
+ * once: every value arrives once, and closing is seen.
+ */
+void test_chan_recv()
+{
+	lchan *ch[3] = {chan_new(lchan, 0, CHAN_MPMC), chan_new(lchan, 1, CHAN_SPSC),
+		chan_new(lchan, 64, CHAN_MPMC)};
+	range_t r[3];
+	chan_reader_t rd[3];
+	pthread_t t[3];
+
+	open_readers = 3;
+	for (int i = 0; i < 3; i++) {
+		memset(&rd[i], 0, sizeof(rd[i]));
+		loop_add_chan(&loop, &rd[i].w, chan_case_recv(ch[i], &rd[i].v), chan_received, &rd[i]);
+		r[i] = (range_t){ch[i], i * NMSG, (i + 1) * NMSG};
+		pthread_create(&t[i], NULL, range_sender, &r[i]);
+	}
+	loop_run(&loop);
+	for (int i = 0; i < 3; i++)
+		pthread_join(t[i], NULL);
+
+	for (int i = 0; i < 3; i++) {
+		if (!rd[i].closed || rd[i].n != NMSG ||
+				rd[i].sum != (long)NMSG * (2 * i * NMSG + NMSG - 1) / 2) {
+			printf("chan(%zu): %ld received, closed %d\n", chan_cap(ch[i]), rd[i].n,
+					rd[i].closed);
+			exit(1);
+		}
+		printf("chan(%zu): %ld received\n", chan_cap(ch[i]), rd[i].n);
+		chan_free(ch[i]);
+	}
+}
+
+typedef struct {
+	loop_chan_t w;
+	long v, n;
+} chan_writer_t;
+
+static void chan_sent(void *arg, int ok)
+{
+	chan_writer_t *s = arg;
+
+	if (!ok) {
+		printf("chan send: channel closed\n");
+		exit(1);
+	}
+	if (++s->v == s->n) {
+		loop_del_chan(&loop, &s->w);
+		loop_stop(&loop);
+	}
+}
+
+static void *chan_drain(void *arg)
+{
+	long v, sum = 0;
+
+	while (chan_recv((lchan *)arg, &v))
+		sum += v;
+	return (void *)sum;
+}
+
+/* the loop sends n values on a channel drained by a thread, then removes itself */
+static void send_drained(size_t cap, long n)
+{
+	lchan *ch = chan_new(lchan, cap, CHAN_MPMC);
+	chan_writer_t s;
+	pthread_t t;
+	void *sum;
+
+	s.v = 0;
+	s.n = n;
+	pthread_create(&t, NULL, chan_drain, ch);
+	loop_add_chan(&loop, &s.w, chan_case_send(ch, &s.v), chan_sent, &s);
+	loop_run(&loop);
+	chan_close(ch);
+	pthread_join(t, &sum);
+
+	if ((long)sum != n * (n - 1) / 2) {
+		printf("chan send(%zu): received %ld\n", cap, (long)sum);
+		exit(1);
+	}
+	chan_free(ch);
+}
+
+void test_chan_send()
+{
+	send_drained(0, NMSG);
+	send_drained(4, NMSG);
+}
+
+/*
+ * Many short runs over a buffered channel, where the loop often finds the
+ * channel ready while queueing itself, before the receiver has released the
+ * slot it took: the loop must retry, rather than sleep with nothing queued.
+ */
+void test_chan_send_stress()
+{
+	for (int i = 0; i < 2000; i++)
+		send_drained(4, 200);
+}
+
+static void never(void *arg, int ok)
+{
+	(void)arg;
+	(void)ok;
+	printf("del: removed watcher called\n");
+	exit(1);
+}
+
+static void *late_send(void *arg)
+{
+	usleep(1000);
+	chan_send((lchan *)arg, 1);
+	return NULL;
+}
+
+/*
+ * A watcher removed while queued is never called, and leaves what was sent
+ * in the meantime on the channel.
+ */
+void test_chan_del()
+{
+	lchan *ch = chan_new(lchan, 1, CHAN_MPMC);
+	chan_reader_t rd;
+	pthread_t t;
+	long v;
+
+	memset(&rd, 0, sizeof(rd));
+	loop_add_chan(&loop, &rd.w, chan_case_recv(ch, &rd.v), never, NULL);
+	loop_run_once(&loop, 0);
+	pthread_create(&t, NULL, late_send, ch);
+	usleep(5000);
+	if (loop_del_chan(&loop, &rd.w)) {
+		printf("del: buffered channel handed off\n");
+		exit(1);
+	}
+	loop_run_once(&loop, 0);
+	if (!chan_try_recv(ch, &v)) {
+		printf("del: value lost\n");
+		exit(1);
+	}
+	pthread_join(t, NULL);
+	chan_free(ch);
+}
+
+typedef struct {
+	lchan *ch;
+	size_t pos;
+} half_send_t;
+
+/* finishes the send begun on slot pos, as _chan_try_send would */
+static void *finish_send(void *arg)
+{
+	half_send_t *h = arg;
+	struct _chan_t *c = &h->ch->c;
+	long v = 42;
+
+	usleep(20000);
+	memcpy(c->buf + (h->pos & c->mask) * c->tsiz, &v, sizeof(v));
+	atomic_store_explicit(&c->seq[h->pos & c->mask], h->pos + 1, memory_order_release);
+	_chan_wq_wake(&c->recvq, 1);
+	return NULL;
+}
+
+/*
+ * A watcher whose channel looks ready, but which cannot proceed until a
+ * sender part way through finishes, sleeps until woken rather than polling.
+ */
+void test_chan_blocks()
+{
+	lchan *ch = chan_new(lchan, 2, CHAN_MPMC);
+	half_send_t h = {ch, 0};
+	chan_reader_t rd;
+	pthread_t t;
+	int runs = 0;
+
+	memset(&rd, 0, sizeof(rd));
+	/* claim a slot without publishing it */
+	h.pos = atomic_fetch_add(&ch->c.tail, 1);
+	loop_add_chan(&loop, &rd.w, chan_case_recv(ch, &rd.v), chan_received, &rd);
+	pthread_create(&t, NULL, finish_send, &h);
+	while (!rd.n) {
+		if (loop_run_once(&loop, 1) < 0) {
+			perror("loop_run_once");
+			exit(1);
+		}
+		runs++;
+	}
+	pthread_join(t, NULL);
+
+	printf("blocks: received %ld after %d runs\n", rd.v, runs);
+	if (rd.v != 42 || runs > 5) {
+		printf("blocks: loop polled a watcher which could not proceed\n");
+		exit(1);
+	}
+	loop_del_chan(&loop, &rd.w);
+	chan_free(ch);
+}
+
+static void *stopper(void *arg)
+{
+	usleep(2000);
+	loop_stop(arg);
+	return NULL;
+}
+
+/* loop_stop from another thread wakes a loop with nothing to do */
+void test_stop()
+{
+	pthread_t t;
+
+	pthread_create(&t, NULL, stopper, &loop);
+	loop_run(&loop);
+	pthread_join(t, NULL);
+
+	/* a stop before the loop runs is not lost */
+	loop_stop(&loop);
+	loop_run(&loop);
+}
+
+int main()
+{
+	if (loop_init(&loop)) {
+		perror("loop_init");
+		exit(1);
+	}
+	test_fd();
+	test_timer();
+	test_chan_recv();
+	test_chan_send();
+	test_chan_send_stress();
+	test_chan_del();
+	test_chan_blocks();
+	test_stop();
+	loop_destroy(&loop);
+}
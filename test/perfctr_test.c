@@ -0,0 +1,47 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HLC_AUTO_INCLUDE
+#include "../perfctr.h"
+
+void test_counters()
+{
+	perfctr_t p;
+	volatile unsigned long sum = 0;
+	int n = perfctr_open(&p);
+
+	/* counters are often restricted, in which case everything reads zero */
+	printf("%d counters available\n", n);
+	if (n == 0 && p.leader != -1) {
+		printf("leader set with no counters open\n");
+		exit(1);
+	}
+
+	perfctr_start(&p);
+	for (unsigned long i = 0; i < 1000000; i++)
+		sum += i;
+	perfctr_stop(&p);
+
+	for (int i = 0; i < PERFCTR_COUNT; i++) {
+		printf("%s: %llu\n", perfctr_name(i), (unsigned long long)p.values[i]);
+		if (!perfctr_available(&p, i) && p.values[i] != 0) {
+			printf("unavailable counter %s read nonzero\n", perfctr_name(i));
+			exit(1);
+		}
+	}
+	if (perfctr_available(&p, PERFCTR_INSTRUCTIONS) && p.values[PERFCTR_INSTRUCTIONS] < 1000000) {
+		printf("too few instructions counted\n");
+		exit(1);
+	}
+
+	perfctr_close(&p);
+	if (perfctr_available(&p, PERFCTR_CYCLES)) {
+		printf("counter still open after close\n");
+		exit(1);
+	}
+}
+
+int main()
+{
+	test_counters();
+}
@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HLC_AUTO_INCLUDE
+#include "../slice.h"
+#include "../pool.h"
+
+#define NTASK 100000
+
+static pool_t *pool;
+static atomic_long ran;
+
+static void count(void *arg)
+{
+	(void)arg;
+	atomic_fetch_add(&ran, 1);
+}
+
+/* tasks spawned from outside the pool all run before pool_wait returns */
+void test_spawn()
+{
+	pool_group_t g = POOL_GROUP_INIT;
+
+	atomic_store(&ran, 0);
+	for (int i = 0; i < NTASK; i++)
+		pool_spawn(pool, &g, count, NULL);
+	pool_wait(pool, &g);
+	if (atomic_load(&ran) != NTASK) {
+		printf("spawn: %ld of %d tasks ran\n", atomic_load(&ran), NTASK);
+		exit(1);
+	}
+
+	/* groups are reusable once waited on */
+	pool_spawn(pool, &g, count, NULL);
+	pool_wait(pool, &g);
+	pool_wait(pool, &g);
+	if (atomic_load(&ran) != NTASK + 1) {
+		printf("spawn: reused group did not wait\n");
+		exit(1);
+	}
+}
+
+typedef struct {
+	int n;
+	long result;
+} fib_t;
+
+/* fork-join: each task spawns and waits for its own subtasks */
+static void fib(void *arg)
+{
+	fib_t *f = arg, a, b;
+	pool_group_t g = POOL_GROUP_INIT;
+
+	if (f->n < 2) {
+		f->result = f->n;
+		return;
+	}
+	a.n = f->n - 1;
+	b.n = f->n - 2;
+	pool_spawn(pool, &g, fib, &a);
+	fib(&b);
+	pool_wait(pool, &g);
+	f->result = a.result + b.result;
+}
+
+void test_fork_join()
+{
+	pool_group_t g = POOL_GROUP_INIT;
+	fib_t f = {24, 0};
+
+	pool_spawn(pool, &g, fib, &f);
+	pool_wait(pool, &g);
+	printf("fib(%d) = %ld\n", f.n, f.result);
+	if (f.result != 46368) {
+		printf("fork-join: wrong result\n");
+		exit(1);
+	}
+}
+
+/* a worker which spawns more tasks than its deque holds must grow it */
+static void spawn_many(void *arg)
+{
+	pool_group_t *g = arg;
+
+	for (int i = 0; i < 5000; i++)
+		pool_spawn(pool, g, count, NULL);
+}
+
+void test_grow()
+{
+	pool_group_t g = POOL_GROUP_INIT;
+
+	atomic_store(&ran, 0);
+	for (int i = 0; i < 8; i++)
+		pool_spawn(pool, &g, spawn_many, &g);
+	pool_wait(pool, &g);
+	if (atomic_load(&ran) != 8 * 5000) {
+		printf("grow: %ld of %d tasks ran\n", atomic_load(&ran), 8 * 5000);
+		exit(1);
+	}
+}
+
+typedef struct {
+	slice_t *s;
+	atomic_long sum;
+	atomic_int calls;
+} sum_t;
+
+static void sum_range(void *arg, size_t lo, size_t hi)
+{
+	sum_t *st = arg;
+	long *v = st->s->buf, sum = 0;
+
+	for (size_t i = lo; i < hi; i++)
+		sum += v[i];
+	atomic_fetch_add(&st->sum, sum);
+	atomic_fetch_add(&st->calls, 1);
+}
+
+/* pool_for must cover the whole range exactly once */
+void test_for(size_t n, size_t grain)
+{
+	slice_t s = slc_make(long, n, n);
+	sum_t st = {&s, 0, 0};
+	long *v = s.buf;
+
+	for (size_t i = 0; i < n; i++)
+		v[i] = (long)i;
+	pool_for(pool, slc_len(&s), grain, sum_range, &st);
+	if (atomic_load(&st.sum) != (long)(n * (n - 1) / 2) ||
+			(n && (size_t)atomic_load(&st.calls) > n / grain + 1)) {
+		printf("for(%zu, %zu): wrong sum %ld in %d calls\n", n, grain,
+				atomic_load(&st.sum), atomic_load(&st.calls));
+		exit(1);
+	}
+	slc_free(&s);
+}
+
+int main()
+{
+	pool = pool_new(4);
+	if (!pool || pool_threads(pool) != 4) {
+		printf("pool_new failed\n");
+		exit(1);
+	}
+
+	test_spawn();
+	test_fork_join();
+	test_grow();
+	test_for(0, 1);
+	test_for(1, 1);
+	test_for(1000, 1);
+	test_for(1000000, 1000);
+	test_for(1000, 5000);
+	pool_free(pool);
+
+	/* a pool freed with work queued runs it first */
+	pool = pool_new(0);
+	atomic_store(&ran, 0);
+	for (int i = 0; i < 1000; i++)
+		pool_spawn(pool, NULL, count, NULL);
+	pool_free(pool);
+	if (atomic_load(&ran) != 1000) {
+		printf("pool_free dropped queued tasks\n");
+		exit(1);
+	}
+}
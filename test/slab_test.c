@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define HLC_AUTO_INCLUDE
+#define SLAB_IMPL
+#include "../alloc.h"
+#include "../slab.h"
+#include "../str/str.c"
+
+#define NTHREADS 8
+#define NITER 20000
+
+void test_classes()
+{
+	slab_t s;
+	slab_init(&s);
+
+	size_t sizes[] = {1, 8, 16, 17, 32, 33, 100, 128, 200, 256};
+	for (size_t i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		char *p = slab_alloc(&s, sizes[i]);
+		if (!p || (uintptr_t)p % 16 != 0) {
+			printf("bad slab block for size %lu (%p)\n", sizes[i], (void *)p);
+			exit(1);
+		}
+		memset(p, 0xAA, sizes[i]);
+
+		/* freed blocks should be handed straight back out */
+		slab_free(&s, p, sizes[i]);
+		if (slab_alloc(&s, sizes[i]) != p) {
+			printf("freed block was not reused (size %lu)\n", sizes[i]);
+			exit(1);
+		}
+		slab_free(&s, p, sizes[i]);
+	}
+
+	/* same class resize is free, cross class copies */
+	char *p = slab_alloc(&s, 20);
+	strcpy(p, "slab block");
+	if (slab_realloc(&s, p, 20, 32) != p) {
+		printf("same class realloc moved block\n");
+		exit(1);
+	}
+	char *q = slab_realloc(&s, p, 32, 1000);
+	if (!q || strcmp(q, "slab block") != 0) {
+		printf("realloc to large block lost data\n");
+		exit(1);
+	}
+	q = slab_realloc(&s, q, 1000, 64);
+	if (!q || strcmp(q, "slab block") != 0) {
+		printf("realloc from large block lost data\n");
+		exit(1);
+	}
+	slab_free(&s, q, 64);
+
+	/* more blocks than fit in a page */
+	void *blocks[8192];
+	for (int i = 0; i < 8192; i++)
+		blocks[i] = slab_alloc(&s, 16);
+	for (int i = 0; i < 8192; i++)
+		slab_free(&s, blocks[i], 16);
+
+	slab_destroy(&s);
+}
+
+static slab_t shared;
+static void *handoff[NTHREADS][64];
+
+static void *worker(void *arg)
+{
+	size_t id = (size_t)arg;
+
+	for (int i = 0; i < NITER; i++) {
+		size_t size = SLAB_MIN << (i % SLAB_CLASSES);
+		unsigned char *p = slab_alloc(&shared, size);
+		if (!p) {
+			printf("slab alloc failed in thread %lu\n", id);
+			exit(1);
+		}
+		memset(p, (int)id, size);
+		if (p[size - 1] != id) {
+			printf("block shared between threads\n");
+			exit(1);
+		}
+		slab_free(&shared, p, size);
+	}
+
+	/* leave some blocks for another thread to free */
+	for (int i = 0; i < 64; i++)
+		handoff[id][i] = slab_alloc(&shared, 48);
+
+	slab_flush(&shared);
+	return NULL;
+}
+
+void test_threads()
+{
+	pthread_t threads[NTHREADS];
+
+	slab_init(&shared);
+	for (size_t i = 0; i < NTHREADS; i++)
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+	for (size_t i = 0; i < NTHREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	for (int i = 0; i < NTHREADS; i++) {
+		for (int j = 0; j < 64; j++)
+			slab_free(&shared, handoff[i][j], 48);
+	}
+
+	slab_destroy(&shared);
+}
+
+void test_strings()
+{
+	slab_t s;
+	slab_init(&s);
+	const allocator_t *a = slab_allocator(&s);
+
+	for (int i = 0; i < 1000; i++) {
+		string_t str = str_new_alloc(a);
+		string_t suffix = str_from_alloc("-suffix", a);
+		str_append(&str, &suffix);
+		if (strcmp(str_cstr(&str), "-suffix") != 0) {
+			printf("wrong slab string contents: %s\n", str_cstr(&str));
+			exit(1);
+		}
+		str_free(&suffix);
+		str_free(&str);
+	}
+
+	slab_destroy(&s);
+}
+
+/* a thread using more slabs than it caches still gets each slab's own blocks */
+void test_many_slabs()
+{
+	enum { NSLABS = SLAB_TCACHES * 2, NBLOCKS = 100 };
+	slab_t slabs[NSLABS];
+	char *blocks[NSLABS][NBLOCKS];
+
+	for (int i = 0; i < NSLABS; i++)
+		slab_init(&slabs[i]);
+
+	for (int j = 0; j < NBLOCKS; j++) {
+		for (int i = 0; i < NSLABS; i++) {
+			blocks[i][j] = slab_alloc(&slabs[i], 24);
+			memset(blocks[i][j], i, 24);
+		}
+	}
+	for (int j = 0; j < NBLOCKS; j++) {
+		for (int i = 0; i < NSLABS; i++) {
+			if (blocks[i][j][0] != i || blocks[i][j][23] != i) {
+				printf("slab %d block %d was shared\n", i, j);
+				exit(1);
+			}
+			slab_free(&slabs[i], blocks[i][j], 24);
+		}
+	}
+
+	for (int i = 0; i < NSLABS; i++)
+		slab_destroy(&slabs[i]);
+}
+
+/* from slab_tu.c */
+void *tu_alloc(slab_t *s, size_t size);
+void tu_free(slab_t *s, void *ptr, size_t size);
+
+/* returns the number of free blocks in the depot of class c of s */
+static size_t depot_blocks(slab_t *s, int c)
+{
+	size_t n = 0;
+
+	for (struct _slab_obj *o = s->classes[c].free; o; o = o->next)
+		n++;
+	return n;
+}
+
+/* blocks cached through another translation unit are still flushed */
+void test_translation_units()
+{
+	slab_t s;
+	void *p;
+	size_t before;
+
+	slab_init(&s);
+	p = tu_alloc(&s, 16);
+	tu_free(&s, p, 16);
+
+	before = depot_blocks(&s, 0);
+	slab_flush(&s);
+	if (depot_blocks(&s, 0) != before + SLAB_BATCH) {
+		printf("flush missed the blocks cached by another translation unit\n");
+		exit(1);
+	}
+
+	slab_destroy(&s);
+}
+
+int main()
+{
+	test_classes();
+	test_threads();
+	test_strings();
+	test_many_slabs();
+	test_translation_units();
+}
@@ -0,0 +1,14 @@
+/* a second translation unit for slab_test.c, which does not define SLAB_IMPL */
+#define HLC_AUTO_INCLUDE
+#include "../alloc.h"
+#include "../slab.h"
+
+void *tu_alloc(slab_t *s, size_t size)
+{
+	return slab_alloc(s, size);
+}
+
+void tu_free(slab_t *s, void *ptr, size_t size)
+{
+	slab_free(s, ptr, size);
+}
@@ -164,6 +164,50 @@ void test_copy()
 	slc_free(&over);
 }
 
+/* counts live bytes, which must be handed back intact by the slice */
+static size_t live;
+
+static void *count_alloc(void *ctx, size_t size)
+{
+	(void)ctx;
+	live += size;
+	return malloc(size);
+}
+
+static void count_release(void *ctx, void *ptr, size_t size)
+{
+	(void)ctx;
+	live -= size;
+	free(ptr);
+}
+
+void test_alloc()
+{
+	allocator_t a = {count_alloc, NULL, count_release, NULL};
+	slice_t s = slc_make_alloc(int32_t, 2, 4, &a);
+	if (live != 4 * sizeof(int32_t)) {
+		printf("slice did not allocate through allocator (live: %lu)\n", live);
+		exit(1);
+	}
+
+	((int32_t *)s.buf)[1] = 42;
+	slc_grow(&s, 100);
+	if (((int32_t *)s.buf)[1] != 42) {
+		printf("data lost on allocator realloc\n");
+		exit(1);
+	}
+	if (live != 100 * sizeof(int32_t)) {
+		printf("wrong live size after growth (live: %lu)\n", live);
+		exit(1);
+	}
+
+	slc_free(&s);
+	if (live != 0) {
+		printf("slice leaked %lu bytes through allocator\n", live);
+		exit(1);
+	}
+}
+
 int main()
 {
 	test_new();
@@ -171,4 +215,5 @@ int main()
 	test_ref();
 	test_reslice();
 	test_copy();
+	test_alloc();
 }
@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define HLC_AUTO_INCLUDE
+#define HLC_SYNC_STATS
+#define SYNC_STATS_IMPL
+#include "../sync.h"
+
+#define NTHREADS 8
+#define NITER 1000
+
+static spinlock_t spin = SPINLOCK_INIT;
+static mutex_t mutex = MUTEX_INIT;
+static cond_t cond = COND_INIT;
+static rwlock_t rw;
+static atomic_int started;
+
+/* returns the counters of the lock operation on line of this file */
+static sync_site_t site(int line)
+{
+	sync_snapshot_t snap;
+	char name[256];
+
+	snprintf(name, sizeof(name), "%s:%d", __FILE__, line);
+	sync_stats_snapshot(&snap);
+	for (size_t i = 0; i < snap.nsites; i++) {
+		if (strcmp(snap.sites[i].site, name) == 0)
+			return snap.sites[i];
+	}
+
+	printf("no statistics for %s\n", name);
+	exit(1);
+}
+
+static void expect(const char *what, sync_site_t s, enum sync_lock_kind kind,
+		uint64_t acquires, uint64_t contended)
+{
+	if (s.kind != kind || s.acquires != acquires || s.contended != contended) {
+		printf("%s: %s %llu acquires, %llu contended, expected %s %llu, %llu\n", what,
+				sync_lock_kind_name(s.kind), (unsigned long long)s.acquires,
+				(unsigned long long)s.contended, sync_lock_kind_name(kind),
+				(unsigned long long)acquires, (unsigned long long)contended);
+		exit(1);
+	}
+}
+
+/* uncontended acquisitions are counted against their own call site */
+void test_uncontended()
+{
+	int line, tryline, token;
+
+	for (int i = 0; i < 10; i++) {
+		line = __LINE__; spin_lock(&spin);
+		spin_unlock(&spin);
+	}
+	tryline = __LINE__; if (!mutex_trylock(&mutex)) exit(1);
+	mutex_unlock(&mutex);
+	expect("spin", site(line), SYNC_LOCK_SPIN, 10, 0);
+	expect("trylock", site(tryline), SYNC_LOCK_MUTEX, 1, 0);
+
+	line = __LINE__; token = rw_rdlock(&rw);
+	rw_rdunlock(&rw, token);
+	expect("read", site(line), SYNC_LOCK_READ, 1, 0);
+}
+
+/* holding a lock is timed up to its unlock, but not while waiting on a cond */
+void test_hold()
+{
+	struct timespec deadline;
+	int line;
+
+	line = __LINE__; mutex_lock(&mutex);
+	usleep(2000);
+	mutex_unlock(&mutex);
+	if (site(line).max_hold < 2000000) {
+		printf("hold: %lluns\n", (unsigned long long)site(line).max_hold);
+		exit(1);
+	}
+
+	line = __LINE__; mutex_lock(&mutex);
+	deadline = sync_deadline(20 * 1000000);
+	cond_timedwait(&cond, &mutex, &deadline);
+	mutex_unlock(&mutex);
+	if (site(line).max_hold >= 20000000) {
+		printf("cond: hold includes the wait (%lluns)\n",
+				(unsigned long long)site(line).max_hold);
+		exit(1);
+	}
+}
+
+static int waiter_line, read_token;
+
+static void *mutex_waiter(void *arg)
+{
+	(void)arg;
+	atomic_store(&started, 1);
+	waiter_line = __LINE__; mutex_lock(&mutex);
+	mutex_unlock(&mutex);
+	return NULL;
+}
+
+static void *writer(void *arg)
+{
+	(void)arg;
+	atomic_store(&started, 1);
+	waiter_line = __LINE__; rw_wrlock(&rw);
+	rw_wrunlock(&rw);
+	return NULL;
+}
+
+/* runs fn, which must wait for the lock held by the caller, then releases it */
+static void contend(void *(*fn)(void *), void (*unlock)(void))
+{
+	pthread_t t;
+
+	atomic_store(&started, 0);
+	pthread_create(&t, NULL, fn, NULL);
+	while (!atomic_load(&started))
+		sync_yield();
+	usleep(5000);
+	unlock();
+	pthread_join(t, NULL);
+}
+
+static void unlock_mutex(void) { mutex_unlock(&mutex); }
+static void unlock_read(void) { rw_rdunlock(&rw, read_token); }
+
+/* an acquisition which had to wait is contended, and its wait is timed */
+void test_contended()
+{
+	sync_snapshot_t snap;
+	sync_site_t s;
+
+	mutex_lock(&mutex);
+	contend(mutex_waiter, unlock_mutex);
+	s = site(waiter_line);
+	expect("mutex", s, SYNC_LOCK_MUTEX, 1, 1);
+	if (s.wait < 1000000) {
+		printf("mutex: waited %lluns\n", (unsigned long long)s.wait);
+		exit(1);
+	}
+
+	/* a writer waits for the readers to leave */
+	read_token = rw_rdlock(&rw);
+	contend(writer, unlock_read);
+	expect("write", site(waiter_line), SYNC_LOCK_WRITE, 1, 1);
+
+	/* sites come hottest first */
+	sync_stats_snapshot(&snap);
+	for (size_t i = 1; i < snap.nsites; i++) {
+		if (snap.sites[i].wait > snap.sites[i - 1].wait) {
+			printf("snapshot not sorted by wait\n");
+			exit(1);
+		}
+	}
+	sync_stats_dump(stdout);
+}
+
+/* the first worker stores the line of its spin_lock in *arg */
+static void *spin_worker(void *arg)
+{
+	for (int i = 0; i < NITER; i++) {
+		if (arg && !i)
+			*(int *)arg = __LINE__ + 1;
+		spin_lock(&spin);
+		spin_unlock(&spin);
+	}
+	return NULL;
+}
+
+/* every acquisition is counted, from any number of threads */
+void test_threads()
+{
+	pthread_t threads[NTHREADS];
+	sync_site_t s;
+	int line;
+
+	sync_stats_reset();
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_create(&threads[i], NULL, spin_worker, i ? NULL : &line);
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	s = site(line);
+	if (s.acquires != NTHREADS * NITER || s.contended > s.acquires) {
+		printf("threads: %llu acquires, %llu contended\n", (unsigned long long)s.acquires,
+				(unsigned long long)s.contended);
+		exit(1);
+	}
+}
+
+int main()
+{
+	rw_init(&rw);
+	test_uncontended();
+	test_hold();
+	test_contended();
+	test_threads();
+}
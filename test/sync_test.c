@@ -0,0 +1,682 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define HLC_AUTO_INCLUDE
+#include "../sync.h"
+
+#define NTHREADS 32
+#define NITER 2000
+
+static spinlock_t spin = SPINLOCK_INIT;
+static ticketlock_t ticket = TICKETLOCK_INIT;
+static mcslock_t mcs = MCSLOCK_INIT;
+static mutex_t mutex = MUTEX_INIT;
+
+/* deliberately non-atomic: only correct if the locks exclude each other */
+static long counter;
+
+static void *spin_worker(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < NITER; i++) {
+		spin_lock(&spin);
+		counter++;
+		spin_unlock(&spin);
+	}
+	return NULL;
+}
+
+static void *ticket_worker(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < NITER; i++) {
+		ticket_lock(&ticket);
+		counter++;
+		ticket_unlock(&ticket);
+	}
+	return NULL;
+}
+
+static void *mcs_worker(void *arg)
+{
+	mcs_node_t node;
+	(void)arg;
+
+	for (int i = 0; i < NITER; i++) {
+		mcs_lock(&mcs, &node);
+		counter++;
+		mcs_unlock(&mcs, &node);
+	}
+	return NULL;
+}
+
+static void *mutex_worker(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < NITER; i++) {
+		mutex_lock(&mutex);
+		counter++;
+		mutex_unlock(&mutex);
+	}
+	return NULL;
+}
+
+static void run(const char *name, void *(*worker)(void *))
+{
+	pthread_t threads[NTHREADS];
+
+	counter = 0;
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_create(&threads[i], NULL, worker, NULL);
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	printf("%s: %ld\n", name, counter);
+	if (counter != (long)NTHREADS * NITER) {
+		printf("%s lost updates (expected %ld)\n", name, (long)NTHREADS * NITER);
+		exit(1);
+	}
+}
+
+void test_trylock()
+{
+	mcs_node_t a, b;
+
+	if (!spin_trylock(&spin) || spin_trylock(&spin)) {
+		printf("spin_trylock acquired held lock\n");
+		exit(1);
+	}
+	spin_unlock(&spin);
+
+	if (!ticket_trylock(&ticket) || ticket_trylock(&ticket)) {
+		printf("ticket_trylock acquired held lock\n");
+		exit(1);
+	}
+	ticket_unlock(&ticket);
+
+	if (!mcs_trylock(&mcs, &a) || mcs_trylock(&mcs, &b)) {
+		printf("mcs_trylock acquired held lock\n");
+		exit(1);
+	}
+	mcs_unlock(&mcs, &a);
+	if (!mcs_trylock(&mcs, &b)) {
+		printf("mcs lock not released\n");
+		exit(1);
+	}
+	mcs_unlock(&mcs, &b);
+}
+
+void test_timedlock()
+{
+	struct timespec deadline = sync_deadline(20 * 1000000);
+
+	mutex_lock(&mutex);
+	if (mutex_trylock(&mutex)) {
+		printf("mutex_trylock acquired held lock\n");
+		exit(1);
+	}
+	if (mutex_timedlock(&mutex, &deadline)) {
+		printf("mutex_timedlock acquired held lock\n");
+		exit(1);
+	}
+	if (!_sync_expired(&deadline)) {
+		printf("mutex_timedlock returned before its deadline\n");
+		exit(1);
+	}
+	mutex_unlock(&mutex);
+
+	deadline = sync_deadline(20 * 1000000);
+	if (!mutex_timedlock(&mutex, &deadline)) {
+		printf("mutex_timedlock failed on free lock\n");
+		exit(1);
+	}
+	mutex_unlock(&mutex);
+}
+
+/* a queue of one int, guarded by mutex */
+static cond_t nonempty = COND_INIT, nonfull = COND_INIT, released = COND_INIT;
+static int slot, full, gate;
+
+static void *producer(void *arg)
+{
+	(void)arg;
+	for (int i = 1; i <= NITER; i++) {
+		mutex_lock(&mutex);
+		while (full)
+			cond_wait(&nonfull, &mutex);
+		slot = i;
+		full = 1;
+		cond_signal(&nonempty);
+		mutex_unlock(&mutex);
+	}
+	return NULL;
+}
+
+static void *gated(void *arg)
+{
+	(void)arg;
+	mutex_lock(&mutex);
+	while (!gate)
+		cond_wait(&released, &mutex);
+	counter++;
+	mutex_unlock(&mutex);
+	return NULL;
+}
+
+void test_cond()
+{
+	pthread_t threads[NTHREADS];
+	long sum = 0;
+
+	pthread_create(&threads[0], NULL, producer, NULL);
+	for (int i = 1; i <= NITER; i++) {
+		mutex_lock(&mutex);
+		while (!full)
+			cond_wait(&nonempty, &mutex);
+		if (slot != i) {
+			printf("consumed %d, expected %d\n", slot, i);
+			exit(1);
+		}
+		sum += slot;
+		full = 0;
+		cond_signal(&nonfull);
+		mutex_unlock(&mutex);
+	}
+	pthread_join(threads[0], NULL);
+	printf("cond: consumed %ld\n", sum);
+
+	/* broadcast must release every waiter */
+	counter = 0;
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_create(&threads[i], NULL, gated, NULL);
+	mutex_lock(&mutex);
+	gate = 1;
+	cond_broadcast(&released);
+	mutex_unlock(&mutex);
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_join(threads[i], NULL);
+	if (counter != NTHREADS) {
+		printf("broadcast released %ld of %d waiters\n", counter, NTHREADS);
+		exit(1);
+	}
+
+	/* a timed wait with nobody signalling must time out */
+	struct timespec deadline = sync_deadline(10 * 1000000);
+	mutex_lock(&mutex);
+	if (cond_timedwait(&nonempty, &mutex, &deadline)) {
+		printf("cond_timedwait returned without a signal\n");
+		exit(1);
+	}
+	mutex_unlock(&mutex);
+}
+
+/* read-mostly data: the two fields must always be seen equal */
+static struct { long a, b; } shared;
+static rwlock_t rw;
+static seqlock_t seq = SEQLOCK_INIT;
+static atomic_int started, writing, torn;
+
+/* waits for all threads to start, so the reads and writes overlap */
+static void start_together(void)
+{
+	atomic_fetch_add(&started, 1);
+	while (atomic_load(&started) < NTHREADS)
+		sync_yield();
+}
+
+/* thread 0 writes, yielding mid-write; the rest read until it is done */
+static void *rw_worker(void *arg)
+{
+	start_together();
+	if ((size_t)arg == 0) {
+		for (int i = 0; i < NITER / 4; i++) {
+			rw_wrlock(&rw);
+			shared.a++;
+			sync_yield();
+			shared.b++;
+			rw_wrunlock(&rw);
+		}
+		atomic_store(&writing, 0);
+		return NULL;
+	}
+
+	for (int i = 0; atomic_load(&writing); i++) {
+		int token = rw_rdlock(&rw);
+		long a = shared.a;
+		if (i % 8 == 0)
+			sync_yield();
+		if (a != shared.b)
+			atomic_store(&torn, 1);
+		rw_rdunlock(&rw, token);
+	}
+	return NULL;
+}
+
+static void *seq_worker(void *arg)
+{
+	long a, b;
+	unsigned s;
+
+	start_together();
+	if ((size_t)arg == 0) {
+		for (int i = 0; i < NITER / 4; i++) {
+			seq_write_begin(&seq);
+			shared.a++;
+			sync_yield();
+			shared.b++;
+			seq_write_end(&seq);
+		}
+		atomic_store(&writing, 0);
+		return NULL;
+	}
+
+	for (int i = 0; atomic_load(&writing); i++) {
+		do {
+			s = seq_read_begin(&seq);
+			if (i % 8 == 0)
+				sync_yield();
+			a = shared.a;
+			b = shared.b;
+		} while (seq_read_retry(&seq, s));
+		if (a != b)
+			atomic_store(&torn, 1);
+	}
+	return NULL;
+}
+
+static void run_read_mostly(const char *name, void *(*worker)(void *))
+{
+	pthread_t threads[NTHREADS];
+
+	shared.a = shared.b = 0;
+	atomic_store(&started, 0);
+	atomic_store(&writing, 1);
+	for (size_t i = 0; i < NTHREADS; i++)
+		pthread_create(&threads[i], NULL, worker, (void *)i);
+	for (size_t i = 0; i < NTHREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	printf("%s: %ld writes\n", name, shared.a);
+	if (torn || shared.a != NITER / 4) {
+		printf("%s let readers see a partial write\n", name);
+		exit(1);
+	}
+}
+
+void test_read_mostly()
+{
+	rw_init(&rw);
+	run_read_mostly("rwlock", rw_worker);
+	run_read_mostly("seqlock", seq_worker);
+}
+
+void test_padding()
+{
+	if (sizeof(spinlock_t) != SYNC_CACHE_LINE || sizeof(mcslock_t) != SYNC_CACHE_LINE ||
+			sizeof(ticketlock_t) != 2 * SYNC_CACHE_LINE) {
+		printf("locks not padded to cache lines\n");
+		exit(1);
+	}
+}
+
+void test_atomics()
+{
+	SYNC_PADDED(aint_t) slots[4];
+	aint_t a;
+	au64_t u = {0};
+	aptr_t p = {0};
+	aflag_t f = AFLAG_INIT;
+	int expected = 1;
+	void *want = NULL;
+	unsigned char *block;
+
+	aint_init(&a, 5);
+	if (aint_add(&a, 3) != 5 || aint_sub(&a, 1) != 8 || aint_or(&a, 8) != 7 ||
+			aint_and(&a, 6) != 15 || aint_xor(&a, 1) != 6 || aint_load(&a) != 7) {
+		printf("aint fetch operations wrong\n");
+		exit(1);
+	}
+	if (aint_cas(&a, &expected, 9) || expected != 7 || !aint_cas(&a, &expected, 9) ||
+			aint_exchange(&a, 2) != 9 || aint_load_relaxed(&a) != 2) {
+		printf("aint_cas wrong\n");
+		exit(1);
+	}
+	au64_store(&u, UINT64_MAX);
+	if (au64_add_relaxed(&u, 2) != UINT64_MAX || au64_load(&u) != 1) {
+		printf("au64 wrong\n");
+		exit(1);
+	}
+	if (!aptr_cas(&p, &want, &a) || aptr_load(&p) != &a) {
+		printf("aptr_cas wrong\n");
+		exit(1);
+	}
+	if (aflag_set(&f) || !aflag_set(&f)) {
+		printf("aflag_set wrong\n");
+		exit(1);
+	}
+	aflag_clear(&f);
+	if (aflag_set(&f)) {
+		printf("aflag_clear wrong\n");
+		exit(1);
+	}
+
+	if (sizeof(slots[0]) != SYNC_CACHE_LINE || (uintptr_t)&slots[1] % SYNC_CACHE_LINE) {
+		printf("SYNC_PADDED not padded to a cache line\n");
+		exit(1);
+	}
+	block = sync_aligned_alloc(100);
+	if (!block || (uintptr_t)block % SYNC_CACHE_LINE) {
+		printf("sync_aligned_alloc misaligned\n");
+		exit(1);
+	}
+	block[99] = 1;
+	free(block);
+}
+
+/* lo counts updates, and hi must always be its complement */
+static sync_dword_t dword;
+
+static void *dwcas_worker(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < NITER; i++) {
+		sync_dword_t old = sync_dwload(&dword), new;
+
+		do {
+			if (old.hi != ~old.lo) {
+				atomic_store(&torn, 1);
+				return NULL;
+			}
+			new.lo = old.lo + 1;
+			new.hi = ~new.lo;
+		} while (!sync_dwcas(&dword, &old, new));
+	}
+	return NULL;
+}
+
+void test_dwcas()
+{
+	pthread_t threads[NTHREADS];
+
+	dword.lo = 0;
+	dword.hi = ~(uintptr_t)0;
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_create(&threads[i], NULL, dwcas_worker, NULL);
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	printf("dwcas: %lu\n", (unsigned long)dword.lo);
+	if (torn || dword.lo != (uintptr_t)NTHREADS * NITER || dword.hi != ~dword.lo) {
+		printf("sync_dwcas lost or tore updates\n");
+		exit(1);
+	}
+}
+
+static waitgroup_t wg = WAITGROUP_INIT;
+static atomic_int finished;
+
+static void *wg_worker(void *arg)
+{
+	(void)arg;
+	sync_yield();
+	atomic_fetch_add(&finished, 1);
+	wg_done(&wg);
+	return NULL;
+}
+
+static void *wg_waiter(void *arg)
+{
+	(void)arg;
+	wg_wait(&wg);
+	if (atomic_load(&finished) != NTHREADS) {
+		printf("wg_wait returned with %d of %d done\n", atomic_load(&finished), NTHREADS);
+		exit(1);
+	}
+	return NULL;
+}
+
+/* every waiter returns once, and only once, every task is done; and reuse */
+void test_waitgroup()
+{
+	pthread_t threads[NTHREADS], waiters[4];
+	struct timespec deadline;
+
+	for (int round = 0; round < 10; round++) {
+		atomic_store(&finished, 0);
+		wg_add(&wg, NTHREADS);
+		for (int i = 0; i < 4; i++)
+			pthread_create(&waiters[i], NULL, wg_waiter, NULL);
+		for (int i = 0; i < NTHREADS; i++)
+			pthread_create(&threads[i], NULL, wg_worker, NULL);
+		wg_waiter(NULL);
+		for (int i = 0; i < NTHREADS; i++)
+			pthread_join(threads[i], NULL);
+		for (int i = 0; i < 4; i++)
+			pthread_join(waiters[i], NULL);
+	}
+
+	wg_add(&wg, 1);
+	deadline = sync_deadline(10 * 1000000);
+	if (wg_timedwait(&wg, &deadline) || !_sync_expired(&deadline)) {
+		printf("wg_timedwait did not time out\n");
+		exit(1);
+	}
+	wg_done(&wg);
+	if (!wg_timedwait(&wg, &deadline)) {
+		printf("wg_timedwait failed with nothing to wait for\n");
+		exit(1);
+	}
+}
+
+#define NUNITS 3
+
+static semaphore_t sem = SEMAPHORE_INIT(NUNITS);
+static atomic_int holders, max_holders;
+
+static void *sema_worker(void *arg)
+{
+	int h, m;
+
+	(void)arg;
+	for (int i = 0; i < NITER; i++) {
+		sema_wait(&sem);
+		h = atomic_fetch_add(&holders, 1) + 1;
+		m = atomic_load(&max_holders);
+		while (h > m && !atomic_compare_exchange_weak(&max_holders, &m, h))
+			;
+		if (i % 16 == 0)
+			sync_yield();
+		atomic_fetch_sub(&holders, 1);
+		sema_post(&sem, 1);
+	}
+	return NULL;
+}
+
+/* no more threads than units may hold the semaphore at once */
+void test_semaphore()
+{
+	pthread_t threads[NTHREADS];
+	struct timespec deadline;
+	int n = 0;
+
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_create(&threads[i], NULL, sema_worker, NULL);
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_join(threads[i], NULL);
+	printf("semaphore: at most %d of %d units held\n", atomic_load(&max_holders), NUNITS);
+	if (atomic_load(&max_holders) > NUNITS) {
+		printf("semaphore over-committed\n");
+		exit(1);
+	}
+
+	while (sema_trywait(&sem))
+		n++;
+	deadline = sync_deadline(10 * 1000000);
+	if (n != NUNITS || sema_timedwait(&sem, &deadline) || !_sync_expired(&deadline)) {
+		printf("semaphore: %d units left, or sema_timedwait did not time out\n", n);
+		exit(1);
+	}
+	sema_post(&sem, NUNITS);
+}
+
+#define NROUNDS 200
+
+static barrier_t barrier;
+static int arrived_round[NTHREADS];
+static atomic_int serial;
+
+static void *barrier_worker(void *arg)
+{
+	int id = (int)(intptr_t)arg;
+
+	for (int round = 1; round <= NROUNDS; round++) {
+		arrived_round[id] = round;
+		if (barrier_wait(&barrier))
+			atomic_fetch_add(&serial, 1);
+		/* everyone has written this round, and nobody the next */
+		for (int i = 0; i < NTHREADS; i++) {
+			if (arrived_round[i] != round) {
+				printf("barrier: thread %d in round %d, not %d\n", i, arrived_round[i], round);
+				exit(1);
+			}
+		}
+		if (barrier_wait(&barrier))
+			atomic_fetch_add(&serial, 1);
+	}
+	return NULL;
+}
+
+/* nobody passes the barrier before everyone arrives, round after round */
+void test_barrier()
+{
+	pthread_t threads[NTHREADS];
+
+	barrier_init(&barrier, NTHREADS);
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_create(&threads[i], NULL, barrier_worker, (void *)(intptr_t)i);
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_join(threads[i], NULL);
+	if (atomic_load(&serial) != 2 * NROUNDS) {
+		printf("barrier: %d serial threads in %d rounds\n", atomic_load(&serial), 2 * NROUNDS);
+		exit(1);
+	}
+}
+
+static once_t once = ONCE_INIT;
+static int initialized;
+
+static void init_once(void *arg)
+{
+	(void)arg;
+	/* long enough for the other threads to wait */
+	for (int i = 0; i < 100; i++)
+		sync_yield();
+	initialized++;
+}
+
+static void *once_worker(void *arg)
+{
+	(void)arg;
+	once_call(&once, init_once, NULL);
+	if (initialized != 1) {
+		printf("once_call returned before its initializer\n");
+		exit(1);
+	}
+	return NULL;
+}
+
+/* the initializer runs exactly once, and before once_call returns anywhere */
+void test_once()
+{
+	pthread_t threads[NTHREADS];
+
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_create(&threads[i], NULL, once_worker, NULL);
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_join(threads[i], NULL);
+	once_worker(NULL);
+}
+
+static counter_t hits;
+static atomic_int adding;
+
+static void *counter_worker(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < NITER; i++) {
+		counter_inc(&hits);
+		counter_add(&hits, 2);
+		counter_add(&hits, -1);
+	}
+	atomic_fetch_sub(&adding, 1);
+	return NULL;
+}
+
+/* no add is lost, whether read at the end or taken while adding */
+void test_counter()
+{
+	pthread_t threads[NTHREADS];
+	int64_t taken = 0;
+
+	counter_init(&hits);
+	atomic_store(&adding, NTHREADS);
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_create(&threads[i], NULL, counter_worker, NULL);
+	while (atomic_load(&adding))
+		taken += counter_take(&hits);
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_join(threads[i], NULL);
+	taken += counter_read(&hits);
+	if (taken != (int64_t)NTHREADS * NITER * 2) {
+		printf("counter: %ld counted, not %ld\n", (long)taken, (long)NTHREADS * NITER * 2);
+		exit(1);
+	}
+}
+
+/* from sync_tu.c */
+unsigned tu_thread_id(void);
+
+static void *thread_ids(void *arg)
+{
+	unsigned *ids = arg;
+
+	ids[0] = _sync_thread_id();
+	ids[1] = tu_thread_id();
+	return NULL;
+}
+
+/* a thread has the same number in every translation unit, and no other has it */
+void test_thread_ids()
+{
+	unsigned mine[2] = {_sync_thread_id(), tu_thread_id()}, theirs[2];
+	pthread_t t;
+
+	pthread_create(&t, NULL, thread_ids, theirs);
+	pthread_join(t, NULL);
+	if (mine[0] != mine[1] || theirs[0] != theirs[1] || mine[0] == theirs[0]) {
+		printf("thread ids: %u/%u and %u/%u\n", mine[0], mine[1], theirs[0], theirs[1]);
+		exit(1);
+	}
+}
+
+int main()
+{
+	test_atomics();
+	test_padding();
+	test_trylock();
+	run("spinlock", spin_worker);
+	run("ticketlock", ticket_worker);
+	run("mcslock", mcs_worker);
+	run("mutex", mutex_worker);
+	test_timedlock();
+	test_cond();
+	test_read_mostly();
+	test_dwcas();
+	test_waitgroup();
+	test_semaphore();
+	test_barrier();
+	test_once();
+	test_counter();
+	test_thread_ids();
+}
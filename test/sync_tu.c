@@ -0,0 +1,8 @@
+/* a second translation unit for sync_test.c */
+#define HLC_AUTO_INCLUDE
+#include "../sync.h"
+
+unsigned tu_thread_id(void)
+{
+	return _sync_thread_id();
+}
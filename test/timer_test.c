@@ -0,0 +1,300 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#define HLC_AUTO_INCLUDE
+#define CHAN_IMPL
+#define TIMER_IMPL
+#include "../timer.h"
+#include "../chan.h"
+
+#define NTIMER 100000
+#define NSHARED 1000
+
+typedef struct {
+	wtimer_t t;
+	uint64_t deadline, fired_at;
+	int fired, cancelled;
+} rec_t;
+
+static timer_wheel_t wheel;
+static uint64_t now, prev;
+
+/* must be called from the first advance which reached its deadline */
+static void record(void *arg)
+{
+	rec_t *r = arg;
+
+	if (r->deadline > now || r->deadline <= prev) {
+		printf("wheel: deadline %lu fired at %lu, after %lu\n", (unsigned long)r->deadline,
+				(unsigned long)now, (unsigned long)prev);
+		exit(1);
+	}
+	r->fired++;
+	r->fired_at = now;
+}
+
+/* a random 64-bit number (xorshift64) */
+static uint64_t rnd(void)
+{
+	static uint64_t x = 88172645463325252u;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return x;
+}
+
+/*
+ * Timers spread over every level (and beyond the top) of a wheel of 1ns
+ * ticks, advanced in random steps: each must fire exactly once, at the first
+ * advance which reaches its deadline, unless cancelled.
+ */
+void test_wheel()
+{
+	rec_t *r = calloc(NTIMER, sizeof(*r));
+	uint64_t next, end = 0;
+	size_t fired = 0;
+	int level;
+
+	now = 1000;
+	timer_wheel_init(&wheel, 1, now);
+	for (int i = 0; i < NTIMER; i++) {
+		wtimer_init(&r[i].t);
+		level = (int)(rnd() % (TIMER_LEVELS + 1));
+		r[i].deadline = now + 1 + rnd() % ((uint64_t)64 << (6 * level));
+		if (r[i].deadline > end)
+			end = r[i].deadline;
+		timer_wheel_add(&wheel, &r[i].t, r[i].deadline, record, &r[i]);
+	}
+	for (int i = 0; i < NTIMER; i += 3) {
+		if (!timer_wheel_del(&wheel, &r[i].t) || wtimer_pending(&r[i].t)) {
+			printf("wheel: cancel failed\n");
+			exit(1);
+		}
+		r[i].cancelled = 1;
+	}
+
+	prev = now;
+	while (now < end) {
+		/* nothing may fire before the time timer_wheel_next gives */
+		next = timer_wheel_next(&wheel);
+		if (next > now + 1 && next != UINT64_MAX) {
+			now = (next - 1 - now < 1000000) ? next - 1 : now + 1000000;
+			if (timer_wheel_advance(&wheel, now)) {
+				printf("wheel: fired before %lu\n", (unsigned long)next);
+				exit(1);
+			}
+			prev = now;
+		}
+		now += 1 + rnd() % ((rnd() % 2) ? 64 : (uint64_t)1 << (rnd() % 40));
+		fired += timer_wheel_advance(&wheel, now);
+		prev = now;
+	}
+
+	for (int i = 0; i < NTIMER; i++) {
+		if (r[i].fired != !r[i].cancelled) {
+			printf("wheel: timer %d fired %d times\n", i, r[i].fired);
+			exit(1);
+		}
+	}
+	printf("wheel: %zu fired\n", fired);
+	if (timer_wheel_next(&wheel) != UINT64_MAX) {
+		printf("wheel: timers left over\n");
+		exit(1);
+	}
+	free(r);
+}
+
+typedef struct {
+	wtimer_t t;
+	int left;
+} periodic_t;
+
+/* restarts itself from its own function until it has run out */
+static void periodic(void *arg)
+{
+	periodic_t *p = arg;
+
+	if (--p->left)
+		timer_wheel_add(&wheel, &p->t, now + 10, periodic, p);
+}
+
+void test_restart()
+{
+	periodic_t p = {WTIMER_INIT, 100};
+
+	now = 0;
+	timer_wheel_init(&wheel, 1, now);
+	timer_wheel_add(&wheel, &p.t, 10, periodic, &p);
+	while (p.left && now < 100000)
+		timer_wheel_advance(&wheel, now += 3);
+	if (p.left || wtimer_pending(&p.t)) {
+		printf("restart: %d runs left\n", p.left);
+		exit(1);
+	}
+}
+
+static atomic_int shared_fired;
+
+static void record_shared(void *arg)
+{
+	rec_t *r = arg;
+
+	r->fired_at = timer_now();
+	r->fired++;
+	atomic_fetch_add(&shared_fired, 1);
+}
+
+/* timers on the shared wheel fire no earlier than their deadline, unless stopped */
+void test_shared()
+{
+	rec_t *r = calloc(NSHARED, sizeof(*r));
+	uint64_t start = timer_now();
+	int stopped = 0;
+
+	for (int i = 0; i < NSHARED; i++) {
+		r[i].deadline = start + (uint64_t)(i % 50) * 1000000;
+		wtimer_start(&r[i].t, r[i].deadline, record_shared, &r[i]);
+	}
+	for (int i = NSHARED - 1; i >= 0; i -= 2) {
+		if (wtimer_stop(&r[i].t)) {
+			r[i].cancelled = 1;
+			stopped++;
+		}
+	}
+	while (atomic_load(&shared_fired) < NSHARED - stopped)
+		sync_yield();
+	/* no stopped timer may fire late */
+	usleep(60000);
+
+	for (int i = 0; i < NSHARED; i++) {
+		if (r[i].fired != !r[i].cancelled || (r[i].fired && r[i].fired_at < r[i].deadline)) {
+			printf("shared: timer %d fired %d times, %ldns after its deadline\n", i,
+					r[i].fired, (long)(r[i].fired_at - r[i].deadline));
+			exit(1);
+		}
+	}
+	printf("shared: %d stopped, %d fired\n", stopped, atomic_load(&shared_fired));
+	free(r);
+}
+
+typedef struct {
+	wtimer_t t;
+	atomic_int running, calls;
+} rearm_t;
+
+/* restarts itself straight away, then takes a while to return */
+static void rearm(void *arg)
+{
+	rearm_t *r = arg;
+
+	atomic_store(&r->running, 1);
+	atomic_fetch_add(&r->calls, 1);
+	wtimer_start(&r->t, timer_now(), rearm, r);
+	usleep(200);
+	atomic_store(&r->running, 0);
+}
+
+/* once wtimer_stop returns, a timer which restarts itself is neither running nor pending */
+void test_stop_rearmed()
+{
+	rearm_t r;
+	int calls;
+
+	for (int i = 0; i < 50; i++) {
+		wtimer_init(&r.t);
+		atomic_init(&r.running, 0);
+		atomic_init(&r.calls, 0);
+		wtimer_start(&r.t, timer_now(), rearm, &r);
+		usleep(500 + (useconds_t)(rnd() % 3000));
+		wtimer_stop(&r.t);
+		calls = atomic_load(&r.calls);
+		if (atomic_load(&r.running) || wtimer_pending(&r.t)) {
+			printf("stop: timer still running or pending\n");
+			exit(1);
+		}
+		usleep(3000);
+		if (atomic_load(&r.calls) != calls) {
+			printf("stop: timer ran after being stopped\n");
+			exit(1);
+		}
+	}
+}
+
+void test_after()
+{
+	uint64_t start = timer_now(), at;
+	chan_timer_t *ct = chan_after(5000000);
+
+	if (!chan_recv(ct->ch, &at) || at < start + 5000000) {
+		printf("after: fired %ldns early\n", (long)(start + 5000000 - at));
+		exit(1);
+	}
+	if (chan_timer_stop(ct)) {
+		printf("after: stopped after firing\n");
+		exit(1);
+	}
+
+	/* stopped before it fires, it never does */
+	ct = chan_after(1000000000);
+	if (!chan_timer_stop(ct)) {
+		printf("after: could not stop\n");
+		exit(1);
+	}
+}
+
+/* a ticker keeps its phase, and drops ticks nobody was ready for */
+void test_ticker()
+{
+	uint64_t start = timer_now(), at, prev = start;
+	chan_timer_t *ct = chan_ticker(2000000);
+
+	for (int i = 0; i < 5; i++) {
+		chan_recv(ct->ch, &at);
+		if (at < prev || (at - start) < (uint64_t)(i + 1) * 2000000) {
+			printf("ticker: tick %d at %ldns\n", i, (long)(at - start));
+			exit(1);
+		}
+		prev = at;
+	}
+	usleep(20000);
+	if (chan_len(ct->ch) != 1) {
+		printf("ticker: %zu ticks buffered\n", chan_len(ct->ch));
+		exit(1);
+	}
+	chan_timer_stop(ct);
+}
+
+/* from timer_tu.c */
+void tu_start(wtimer_t *t, uint64_t deadline, void (*fn)(void *arg), void *arg);
+
+static void never_fired(void *arg)
+{
+	(void)arg;
+	printf("translation units: stopped timer fired\n");
+	exit(1);
+}
+
+/* a timer started in one translation unit is stopped from another */
+void test_translation_units()
+{
+	wtimer_t t;
+
+	tu_start(&t, timer_now() + 20000000, never_fired, NULL);
+	if (!wtimer_pending(&t) || !wtimer_stop(&t)) {
+		printf("translation units: timer not found on the shared wheel\n");
+		exit(1);
+	}
+	usleep(40000);
+}
+
+int main()
+{
+	test_wheel();
+	test_restart();
+	test_shared();
+	test_stop_rearmed();
+	test_after();
+	test_ticker();
+	test_translation_units();
+}
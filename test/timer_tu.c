@@ -0,0 +1,8 @@
+/* a second translation unit for timer_test.c, which does not define TIMER_IMPL */
+#define HLC_AUTO_INCLUDE
+#include "../timer.h"
+
+void tu_start(wtimer_t *t, uint64_t deadline, void (*fn)(void *arg), void *arg)
+{
+	wtimer_start(t, deadline, fn, arg);
+}
@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define HLC_AUTO_INCLUDE
+#define HLC_TRACE
+#define TRACE_IMPL
+#define TRACE_RING_SIZE 256
+#include "../trace.h"
+#include "../vect.h"
+#include "../slice.h"
+#include "../str/str.c"
+
+#define NTHREADS 4
+
+vect_declare(int, vector_int);
+
+/* dumps the trace to memory and returns it; the caller frees the result */
+static char *dump(size_t *events)
+{
+	char *buf;
+	size_t len;
+	FILE *f = open_memstream(&buf, &len);
+
+	*events = trace_dump(f);
+	fclose(f);
+	return buf;
+}
+
+static size_t count(const char *haystack, const char *needle)
+{
+	size_t n = 0;
+	for (const char *walk = haystack; (walk = strstr(walk, needle)); walk++)
+		n++;
+	return n;
+}
+
+void test_containers()
+{
+	size_t events;
+
+	trace_clear();
+
+	vector_int v = vect_init(vector_int);
+	for (int i = 0; i < 100; i++)
+		vect_append(&v, i);
+	vect_destroy(&v);
+
+	slice_t s = slc_new(int);
+	slc_grow(&s, 64);
+	slc_free(&s);
+
+	string_t str = str_new();
+	string_t part = str_from("trace");
+	for (int i = 0; i < 20; i++)
+		str_append(&str, &part);
+	str_free(&part);
+	str_free(&str);
+
+	TRACE_COUNTER("quo\"ted", 42);
+
+	char *out = dump(&events);
+	printf("%lu events\n", events);
+	if (count(out, "\"name\":\"_vect_resize\",\"ph\":\"B\"") == 0 ||
+			count(out, "\"name\":\"_vect_resize\",\"ph\":\"B\"") !=
+			count(out, "\"name\":\"_vect_resize\",\"ph\":\"E\"")) {
+		printf("unbalanced or missing _vect_resize spans:\n%s", out);
+		exit(1);
+	}
+	if (count(out, "\"name\":\"slc_grow\",\"ph\":\"B\",") != 1 ||
+			!strstr(out, "\"args\":{\"value\":256}")) {
+		printf("missing slc_grow span:\n%s", out);
+		exit(1);
+	}
+	if (count(out, "\"name\":\"str_grow\",\"ph\":\"E\"") == 0) {
+		printf("missing str_grow span:\n%s", out);
+		exit(1);
+	}
+	if (!strstr(out, "\"name\":\"quo\\\"ted\",\"ph\":\"C\"")) {
+		printf("counter not escaped:\n%s", out);
+		exit(1);
+	}
+	free(out);
+
+	trace_clear();
+	out = dump(&events);
+	if (events != 0) {
+		printf("trace_clear left %lu events:\n%s", events, out);
+		exit(1);
+	}
+	free(out);
+}
+
+static void *worker(void *arg)
+{
+	(void)arg;
+	for (int i = 0; i < 10000; i++) {
+		TRACE_BEGIN("work");
+		TRACE_COUNTER("iteration", i);
+		TRACE_END("work");
+	}
+	return NULL;
+}
+
+void test_threads()
+{
+	pthread_t threads[NTHREADS];
+	size_t events;
+
+	trace_clear();
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_create(&threads[i], NULL, worker, NULL);
+
+	/* dumping while threads are tracing must be safe */
+	free(dump(&events));
+	for (int i = 0; i < NTHREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	/* only the newest TRACE_RING_SIZE - 1 events of each thread are kept */
+	char *out = dump(&events);
+	if (events != NTHREADS * (TRACE_RING_SIZE - 1)) {
+		printf("expected %d events, got %lu\n", NTHREADS * (TRACE_RING_SIZE - 1), events);
+		exit(1);
+	}
+	if (!strstr(out, "\"args\":{\"value\":9999}") || strstr(out, "\"args\":{\"value\":0}")) {
+		printf("ring did not keep the newest events\n");
+		exit(1);
+	}
+	free(out);
+}
+
+int main()
+{
+	test_containers();
+	test_threads();
+}
@@ -5,6 +5,7 @@
 #include <stdio.h>
 #include <wchar.h>
 
+#include "../alloc.h"
 #include "../utf.h"
 
 int main(void)
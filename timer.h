@@ -0,0 +1,480 @@
+/*
+ * timer.h - C11 hierarchical timer wheel
+ * Copyright (C) Ethan Marshall - 2023
+ *
+ * Requirements: stddef.h stdint.h stdlib.h string.h limits.h errno.h time.h
+ *               stdatomic.h pthread.h sync.h
+ *               TIMER_IMPL in one translation unit (see below)
+ *
+ * A timer wheel (after Varghese and Lauck) keeps timers in buckets by the
+ * tick at which they expire, rather than in order, so that starting and
+ * stopping a timer are both O(1): a list insertion or removal, whatever the
+ * number of timers. The price is resolution: a timer expires at the first
+ * tick (TIMER_TICK_NS) at or after its deadline, never before.
+ *
+ * The wheel has TIMER_LEVELS levels of 64 slots each. Level 0 holds the
+ * timers due in the next 64 ticks, one slot per tick; each level above holds
+ * timers 64 times further out, in slots 64 times as wide. Whenever level 0
+ * comes round, the next slot of the level above is emptied into the levels
+ * below (cascaded), so each timer is moved at most once per level, and only
+ * if it is still pending by then: timeouts, which are nearly always stopped
+ * long before they expire, rarely move at all.
+ *
+ * timer_wheel_t is a bare wheel, which its owner advances with the time and
+ * must lock if it is shared. The timers of wtimer_start instead go on a wheel
+ * shared by the whole program, advanced by a thread of its own which sleeps
+ * until the next timer is due, and which runs their functions. chan.h builds
+ * its timed operations, and chan_after and chan_ticker, on these.
+ *
+ * Exactly one translation unit of a program using the shared wheel (directly
+ * or through chan.h) must define TIMER_IMPL before including this header, to
+ * provide storage for it.
+ */
+
+#ifndef HLC_TIMER_H
+#define HLC_TIMER_H
+
+#ifdef HLC_AUTO_INCLUDE
+#define TIMER_AUTO_INCLUDE
+#endif
+
+#ifdef TIMER_AUTO_INCLUDE
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "sync.h"
+#endif
+
+/*
+ * TIMER_TICK_NS is the resolution, in nanoseconds, of the shared wheel of
+ * wtimer_start (and so of the timed operations of chan.h).
+ */
+#ifndef TIMER_TICK_NS
+#define TIMER_TICK_NS 1000000
+#endif
+
+/*
+ * TIMER_LEVELS is the number of levels of each wheel, at most 10. A wheel
+ * spans 64 to the power of TIMER_LEVELS ticks (over two years of 1ms ticks,
+ * with 6 levels); timers further out are kept at the top level until they
+ * come within reach.
+ */
+#ifndef TIMER_LEVELS
+#define TIMER_LEVELS 6
+#endif
+
+#define _TIMER_BITS 6
+#define _TIMER_SLOTS (1 << _TIMER_BITS)
+#define _TIMER_MASK (_TIMER_SLOTS - 1)
+
+/* Internal: where a timer is, when not in a slot */
+enum {
+	_TIMER_IDLE = -1,
+	_TIMER_FIRED = -2
+};
+
+/*
+ * wtimer_t is a timer: a function to be called with its argument once a
+ * deadline has passed. It is linked into the wheel while pending, so must
+ * stay in place until it has expired or been stopped.
+ */
+typedef struct wtimer {
+	struct wtimer *next, **pprev;
+	/* the tick at which it expires */
+	uint64_t expires;
+	void (*fn)(void *arg);
+	void *arg;
+	/* its slot (level * 64 + index), or _TIMER_IDLE or _TIMER_FIRED */
+	int slot;
+} wtimer_t;
+
+#define WTIMER_INIT {NULL, NULL, 0, NULL, NULL, _TIMER_IDLE}
+
+static inline void wtimer_init(wtimer_t *t)
+{
+	t->slot = _TIMER_IDLE;
+}
+
+/*
+ * wtimer_pending returns true (>0) if t has been started and has neither
+ * expired nor been stopped.
+ */
+static inline int wtimer_pending(const wtimer_t *t)
+{
+	return t->slot != _TIMER_IDLE;
+}
+
+/*
+ * timer_wheel_t is a timer wheel. It is initialized with timer_wheel_init,
+ * and needs no destruction.
+ */
+typedef struct {
+	/* the next tick to run, and the length of a tick */
+	uint64_t tick, tick_ns;
+	size_t count;
+	/* a bit per non-empty slot, per level */
+	uint64_t occupied[TIMER_LEVELS];
+	wtimer_t *slots[TIMER_LEVELS][_TIMER_SLOTS];
+	/* timers which have expired, but whose functions have not yet run */
+	wtimer_t *fired;
+} timer_wheel_t;
+
+/* Internal: links t at the head of the list at *head */
+static inline void _timer_link(wtimer_t **head, wtimer_t *t)
+{
+	if ((t->next = *head))
+		t->next->pprev = &t->next;
+	t->pprev = head;
+	*head = t;
+}
+
+/* Internal: unlinks t from whichever list it is in */
+static inline void _timer_unlink(wtimer_t *t)
+{
+	if ((*t->pprev = t->next))
+		t->next->pprev = t->pprev;
+}
+
+/*
+ * Internal: puts t, which is not linked, into the slot of w for its expiry:
+ * the lowest level whose span from the current tick reaches it.
+ */
+static inline void _timer_wheel_insert(timer_wheel_t *w, wtimer_t *t)
+{
+	uint64_t expires = t->expires, delta;
+	int level = 0, index;
+
+	if (expires < w->tick)
+		expires = w->tick;
+	delta = expires - w->tick;
+	while (level < TIMER_LEVELS - 1 && delta >> (_TIMER_BITS * (level + 1)))
+		level++;
+	/* beyond the top level: park it in the furthest slot, to be put back later */
+	if (delta >> (_TIMER_BITS * TIMER_LEVELS))
+		expires = w->tick + ((uint64_t)1 << (_TIMER_BITS * TIMER_LEVELS)) - 1;
+
+	index = (int)(expires >> (_TIMER_BITS * level)) & _TIMER_MASK;
+	_timer_link(&w->slots[level][index], t);
+	w->occupied[level] |= (uint64_t)1 << index;
+	t->slot = level * _TIMER_SLOTS + index;
+}
+
+/* Internal: takes t, which is pending, out of w */
+static inline void _timer_wheel_remove(timer_wheel_t *w, wtimer_t *t)
+{
+	int level = t->slot / _TIMER_SLOTS, index = t->slot % _TIMER_SLOTS;
+
+	_timer_unlink(t);
+	if (t->slot >= 0) {
+		if (!w->slots[level][index])
+			w->occupied[level] &= ~((uint64_t)1 << index);
+		w->count--;
+	}
+	t->slot = _TIMER_IDLE;
+}
+
+/* Internal: empties one slot of w, putting its timers back in by their expiry */
+static inline void _timer_wheel_cascade(timer_wheel_t *w, int level, int index)
+{
+	wtimer_t *t = w->slots[level][index], *next;
+
+	w->slots[level][index] = NULL;
+	w->occupied[level] &= ~((uint64_t)1 << index);
+	for (; t; t = next) {
+		next = t->next;
+		_timer_wheel_insert(w, t);
+	}
+}
+
+/*
+ * Internal: returns the next tick, from the current one on, at which anything
+ * happens in w: a slot of level 0 expires, or a slot above it is cascaded.
+ * Returns UINT64_MAX if w is empty.
+ */
+static inline uint64_t _timer_wheel_due(const timer_wheel_t *w)
+{
+	uint64_t due = UINT64_MAX, base, bits, at;
+	int shift, pos;
+
+	for (int level = 0; level < TIMER_LEVELS; level++) {
+		if (!(bits = w->occupied[level]))
+			continue;
+		shift = _TIMER_BITS * level;
+		base = w->tick >> shift;
+		/* part way through a slot, the next one is the first to come round */
+		if (w->tick & ~(~(uint64_t)0 << shift))
+			base++;
+		pos = (int)base & _TIMER_MASK;
+		if (pos)
+			bits = (bits >> pos) | (bits << (_TIMER_SLOTS - pos));
+		at = (base + (uint64_t)__builtin_ctzll(bits)) << shift;
+		if (at < due)
+			due = at;
+	}
+
+	return due;
+}
+
+/*
+ * Internal: runs the ticks of w up to and including now (a tick), moving the
+ * timers which expire onto the fired list. Ticks on which nothing happens are
+ * skipped, so the cost is in the slots visited, not the time passed.
+ */
+static inline void _timer_wheel_expire(timer_wheel_t *w, uint64_t now)
+{
+	wtimer_t *t, *next;
+	uint64_t tick;
+	int top, index;
+
+	while (w->tick <= now) {
+		if ((tick = _timer_wheel_due(w)) > now) {
+			w->tick = now + 1;
+			return;
+		}
+		w->tick = tick;
+
+		/* every level whose slot comes round on this tick, top down */
+		for (top = 0; top < TIMER_LEVELS - 1 &&
+				!(tick & ~(~(uint64_t)0 << (_TIMER_BITS * (top + 1)))); top++)
+			;
+		for (int level = top; level > 0; level--)
+			_timer_wheel_cascade(w, level, (int)(tick >> (_TIMER_BITS * level)) & _TIMER_MASK);
+
+		index = (int)tick & _TIMER_MASK;
+		for (t = w->slots[0][index]; t; t = next) {
+			next = t->next;
+			_timer_link(&w->fired, t);
+			t->slot = _TIMER_FIRED;
+			w->count--;
+		}
+		w->slots[0][index] = NULL;
+		w->occupied[0] &= ~((uint64_t)1 << index);
+		w->tick = tick + 1;
+	}
+}
+
+/* Internal: removes and returns a timer from the fired list of w, or NULL */
+static inline wtimer_t *_timer_wheel_pop(timer_wheel_t *w)
+{
+	wtimer_t *t = w->fired;
+
+	if (t) {
+		_timer_unlink(t);
+		t->slot = _TIMER_IDLE;
+	}
+
+	return t;
+}
+
+/*
+ * timer_wheel_init initializes w with ticks of tick_ns nanoseconds, starting
+ * from the time now (in nanoseconds, from any fixed origin).
+ */
+static inline void timer_wheel_init(timer_wheel_t *w, uint64_t tick_ns, uint64_t now)
+{
+	memset(w, 0, sizeof(*w));
+	w->tick_ns = tick_ns;
+	w->tick = now / tick_ns;
+}
+
+/*
+ * timer_wheel_add starts t on w, to call fn(arg) once the time deadline (in
+ * nanoseconds, from the origin of timer_wheel_init) has passed. t must not be
+ * pending. A deadline which has already passed expires on the next advance.
+ */
+static inline void timer_wheel_add(timer_wheel_t *w, wtimer_t *t, uint64_t deadline,
+		void (*fn)(void *arg), void *arg)
+{
+	t->fn = fn;
+	t->arg = arg;
+	/* rounded up, as timers never expire early */
+	t->expires = deadline / w->tick_ns + (deadline % w->tick_ns != 0);
+	_timer_wheel_insert(w, t);
+	w->count++;
+}
+
+/*
+ * timer_wheel_del stops t, if it is pending on w. Returns true (>0) if it
+ * was pending, in which case its function will not be called.
+ */
+static inline int timer_wheel_del(timer_wheel_t *w, wtimer_t *t)
+{
+	if (t->slot == _TIMER_IDLE)
+		return 0;
+
+	_timer_wheel_remove(w, t);
+	return 1;
+}
+
+/*
+ * timer_wheel_advance calls the functions of every timer of w whose deadline
+ * is at or before the time now, and returns how many it called. A function
+ * may start or stop timers on w, including its own.
+ */
+static inline size_t timer_wheel_advance(timer_wheel_t *w, uint64_t now)
+{
+	size_t n = 0;
+	wtimer_t *t;
+
+	_timer_wheel_expire(w, now / w->tick_ns);
+	while ((t = _timer_wheel_pop(w))) {
+		t->fn(t->arg);
+		n++;
+	}
+
+	return n;
+}
+
+/*
+ * timer_wheel_next returns the time by which w should next be advanced: the
+ * deadline of its next timer, or earlier, if that timer is yet to be cascaded.
+ * Returns UINT64_MAX if no timer is pending.
+ */
+static inline uint64_t timer_wheel_next(const timer_wheel_t *w)
+{
+	uint64_t due;
+
+	if (w->fired)
+		return w->tick * w->tick_ns;
+	if ((due = _timer_wheel_due(w)) == UINT64_MAX)
+		return UINT64_MAX;
+
+	return due * w->tick_ns;
+}
+
+/* Internal: the shared wheel of wtimer_start, and the thread which advances it */
+struct _timer_shared {
+	mutex_t lock;
+	timer_wheel_t wheel;
+	/* the timer whose function is running, if any */
+	wtimer_t *running;
+	/* the tick the thread sleeps until (zero while awake), and its futex word */
+	uint64_t sleep;
+	atomic_int seq;
+	pthread_t thread;
+};
+
+extern struct _timer_shared _timer_shared;
+extern pthread_once_t _timer_once;
+#ifdef TIMER_IMPL
+struct _timer_shared _timer_shared;
+pthread_once_t _timer_once = PTHREAD_ONCE_INIT;
+#endif
+
+/* timer_now returns the CLOCK_MONOTONIC time in nanoseconds */
+static inline uint64_t timer_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Internal: the thread which runs the shared wheel */
+static inline void *_timer_main(void *arg)
+{
+	struct timespec ts;
+	uint64_t next;
+	wtimer_t *t;
+	int seq;
+
+	(void)arg;
+	mutex_lock(&_timer_shared.lock);
+	for (;;) {
+		_timer_wheel_expire(&_timer_shared.wheel, timer_now() / TIMER_TICK_NS);
+		while ((t = _timer_wheel_pop(&_timer_shared.wheel))) {
+			_timer_shared.running = t;
+			mutex_unlock(&_timer_shared.lock);
+			t->fn(t->arg);
+			mutex_lock(&_timer_shared.lock);
+		}
+		_timer_shared.running = NULL;
+
+		next = timer_wheel_next(&_timer_shared.wheel);
+		_timer_shared.sleep = (next == UINT64_MAX) ? UINT64_MAX : next / TIMER_TICK_NS;
+		seq = atomic_load_explicit(&_timer_shared.seq, memory_order_relaxed);
+		mutex_unlock(&_timer_shared.lock);
+
+		ts.tv_sec = (time_t)(next / 1000000000u);
+		ts.tv_nsec = (long)(next % 1000000000u);
+		_sync_futex_wait(&_timer_shared.seq, seq, (next == UINT64_MAX) ? NULL : &ts);
+
+		mutex_lock(&_timer_shared.lock);
+		_timer_shared.sleep = 0;
+	}
+
+	return NULL;
+}
+
+/* Internal: starts the thread of the shared wheel, on first use */
+static inline void _timer_init(void)
+{
+	pthread_attr_t attr;
+
+	timer_wheel_init(&_timer_shared.wheel, TIMER_TICK_NS, timer_now());
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&_timer_shared.thread, &attr, _timer_main, NULL))
+		abort();
+	pthread_attr_destroy(&attr);
+}
+
+/*
+ * wtimer_start starts t on the shared wheel, to call fn(arg) from the
+ * wheel's thread once the CLOCK_MONOTONIC time deadline (in nanoseconds, see
+ * timer_now) has passed. t must not be pending. Functions run one at a time,
+ * and must be brief, as the timers due after them wait for them to return.
+ */
+static inline void wtimer_start(wtimer_t *t, uint64_t deadline, void (*fn)(void *arg), void *arg)
+{
+	int wake = 0;
+
+	pthread_once(&_timer_once, _timer_init);
+	mutex_lock(&_timer_shared.lock);
+	timer_wheel_add(&_timer_shared.wheel, t, deadline, fn, arg);
+	/* the thread need only be woken if it would otherwise sleep past t */
+	if (t->expires < _timer_shared.sleep) {
+		_timer_shared.sleep = t->expires;
+		atomic_fetch_add_explicit(&_timer_shared.seq, 1, memory_order_relaxed);
+		wake = 1;
+	}
+	mutex_unlock(&_timer_shared.lock);
+
+	if (wake)
+		_sync_futex_wake(&_timer_shared.seq, 1);
+}
+
+/*
+ * wtimer_stop stops t, if it was started with wtimer_start. Returns true
+ * (>0) if it was pending, in which case its function will not be called
+ * (again). If its function is running, waits for it to return, unless called
+ * by the function itself, then stops t again if the function restarted it:
+ * either way, t may be reused or freed once wtimer_stop returns.
+ */
+static inline int wtimer_stop(wtimer_t *t)
+{
+	unsigned spins = 0;
+	int pending;
+
+	mutex_lock(&_timer_shared.lock);
+	pending = timer_wheel_del(&_timer_shared.wheel, t);
+	if (_timer_shared.running == t && !pthread_equal(pthread_self(), _timer_shared.thread)) {
+		while (_timer_shared.running == t) {
+			mutex_unlock(&_timer_shared.lock);
+			_sync_backoff(&spins);
+			mutex_lock(&_timer_shared.lock);
+		}
+		pending |= timer_wheel_del(&_timer_shared.wheel, t);
+	}
+	mutex_unlock(&_timer_shared.lock);
+
+	return pending;
+}
+
+#endif /* HLC_TIMER_H */
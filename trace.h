@@ -0,0 +1,231 @@
+/*
+ * trace.h - lightweight event tracing with Chrome trace export
+ * Copyright (C) Ethan Marshall - 2023
+ *
+ * Requirements: none, unless HLC_TRACE is defined (see below)
+ *
+ * Code is instrumented with the TRACE_* macros, which record timestamped
+ * begin, end and counter events. Unless HLC_TRACE is defined before including
+ * any hlc header, the macros compile to nothing and tracing costs nothing, so
+ * they may be left in hot paths. The hlc containers trace their growth paths
+ * (str_grow, _vect_resize and slc_grow) this way, which allows latency spikes
+ * to be correlated with bursts of reallocation.
+ *
+ * 	TRACE_BEGIN(name)		start a span on the calling thread
+ * 	TRACE_BEGIN_ARG(name, value)	as above, attaching an integer value
+ * 	TRACE_END(name)			end the innermost span
+ * 	TRACE_COUNTER(name, value)	record the current value of a counter
+ *
+ * name must be a string literal (or otherwise live until the trace is
+ * dumped), as only the pointer is stored.
+ */
+
+#ifndef HLC_TRACE_H
+#define HLC_TRACE_H
+
+#ifdef HLC_AUTO_INCLUDE
+#define TRACE_AUTO_INCLUDE
+#endif
+
+#ifdef HLC_TRACE
+/*
+ * Tracing (REQUIRES C11, stdint.h stdio.h time.h stdatomic.h alloc.h)
+ *
+ * Each thread records into its own ring buffer, which is allocated on its first
+ * event and never freed. Recording an event takes no locks and performs no
+ * system calls, besides reading the monotonic clock. Once a ring is full, the
+ * oldest events are overwritten, so only the most recent TRACE_RING_SIZE - 1
+ * events of each thread are kept.
+ *
+ * trace_dump writes the events of every thread as Chrome trace JSON, which can
+ * be loaded into chrome://tracing or https://ui.perfetto.dev. It may be called
+ * while other threads are tracing; events which are overwritten while being
+ * read are skipped.
+ *
+ * Every translation unit must see the same HLC_TRACE setting, and exactly one
+ * must also define TRACE_IMPL before including this header, to provide
+ * storage for the trace.
+ */
+
+#ifdef TRACE_AUTO_INCLUDE
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "alloc.h"
+#endif
+
+/* TRACE_RING_SIZE is the number of events kept per thread (a power of two) */
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 4096
+#endif
+
+enum _trace_type {
+	_TRACE_BEGIN,
+	_TRACE_END,
+	_TRACE_COUNTER
+};
+
+/*
+ * Internal: a recorded event. Fields are atomic so that trace_dump can read a
+ * ring while its owner is writing to it; the stores are relaxed, which costs
+ * no more than plain stores on common hardware.
+ */
+struct _trace_event {
+	_Atomic(uint64_t) ts;
+	_Atomic(const char *) name;
+	_Atomic(int64_t) value;
+	atomic_int type;
+};
+
+/* Internal: the ring buffer of one thread. Only the owner writes head. */
+struct _trace_ring {
+	struct _trace_ring *next;
+	unsigned tid;
+	atomic_size_t head, tail;
+	struct _trace_event events[TRACE_RING_SIZE];
+};
+
+struct _trace_state {
+	_Atomic(struct _trace_ring *) rings;
+	atomic_uint tids;
+};
+
+extern struct _trace_state _trace_state;
+extern _Thread_local struct _trace_ring *_trace_local;
+#ifdef TRACE_IMPL
+struct _trace_state _trace_state;
+_Thread_local struct _trace_ring *_trace_local;
+#endif
+
+/* Internal: creates and registers the calling thread's ring */
+static inline struct _trace_ring *_trace_ring_new(void)
+{
+	struct _trace_ring *r = HLC_CALLOC(1, sizeof(*r));
+
+	if (!r)
+		return NULL;
+	r->tid = atomic_fetch_add_explicit(&_trace_state.tids, 1, memory_order_relaxed) + 1;
+
+	r->next = atomic_load_explicit(&_trace_state.rings, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(&_trace_state.rings, &r->next, r,
+				memory_order_release, memory_order_relaxed));
+
+	return _trace_local = r;
+}
+
+/* Internal: records one event on the calling thread's ring */
+static inline void _trace_record(enum _trace_type type, const char *name, int64_t value)
+{
+	struct _trace_ring *r = _trace_local;
+	struct _trace_event *e;
+	struct timespec now;
+	size_t head;
+
+	if (!r && !(r = _trace_ring_new()))
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	e = &r->events[head & (TRACE_RING_SIZE - 1)];
+	/* pairs with the fence in trace_dump, so a torn read sees the new head */
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&e->ts, (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec,
+			memory_order_relaxed);
+	atomic_store_explicit(&e->name, name, memory_order_relaxed);
+	atomic_store_explicit(&e->value, value, memory_order_relaxed);
+	atomic_store_explicit(&e->type, type, memory_order_relaxed);
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+}
+
+#define TRACE_BEGIN(name) _trace_record(_TRACE_BEGIN, name, 0)
+#define TRACE_BEGIN_ARG(name, value) _trace_record(_TRACE_BEGIN, name, (int64_t)(value))
+#define TRACE_END(name) _trace_record(_TRACE_END, name, 0)
+#define TRACE_COUNTER(name, value) _trace_record(_TRACE_COUNTER, name, (int64_t)(value))
+
+/* Internal: writes s as a JSON string */
+static inline void _trace_puts(FILE *f, const char *s)
+{
+	fputc('"', f);
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			fprintf(f, "\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			fprintf(f, "\\u%04x", (unsigned char)*s);
+		else
+			fputc(*s, f);
+	}
+	fputc('"', f);
+}
+
+/*
+ * trace_dump writes all events currently held by every thread to f as Chrome
+ * trace JSON, returning the number of events written.
+ */
+static inline size_t trace_dump(FILE *f)
+{
+	static const char phase[] = {'B', 'E', 'C'};
+	struct _trace_ring *r;
+	size_t written = 0;
+
+	fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	r = atomic_load_explicit(&_trace_state.rings, memory_order_acquire);
+	for (; r; r = r->next) {
+		size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+		size_t start = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+		/* the slot after head may be being overwritten: never read it */
+		if (head - start > TRACE_RING_SIZE - 1)
+			start = head - (TRACE_RING_SIZE - 1);
+
+		for (size_t i = start; i < head; i++) {
+			struct _trace_event *e = &r->events[i & (TRACE_RING_SIZE - 1)];
+			uint64_t ts = atomic_load_explicit(&e->ts, memory_order_relaxed);
+			const char *name = atomic_load_explicit(&e->name, memory_order_relaxed);
+			int64_t value = atomic_load_explicit(&e->value, memory_order_relaxed);
+			int type = atomic_load_explicit(&e->type, memory_order_relaxed);
+
+			/* the owner may have lapped us while we were reading */
+			atomic_thread_fence(memory_order_acquire);
+			if (i + TRACE_RING_SIZE <= atomic_load_explicit(&r->head, memory_order_relaxed))
+				continue;
+
+			fprintf(f, "%s{\"name\":", written ? ",\n" : "\n");
+			_trace_puts(f, name);
+			fprintf(f, ",\"ph\":\"%c\",\"ts\":%llu.%03llu,\"pid\":1,\"tid\":%u",
+					phase[type], (unsigned long long)(ts / 1000),
+					(unsigned long long)(ts % 1000), r->tid);
+			if (type == _TRACE_COUNTER || (type == _TRACE_BEGIN && value))
+				fprintf(f, ",\"args\":{\"value\":%lld}", (long long)value);
+			fprintf(f, "}");
+			written++;
+		}
+	}
+	fprintf(f, "\n]}\n");
+
+	return written;
+}
+
+/*
+ * trace_clear discards all events recorded so far by every thread.
+ */
+static inline void trace_clear(void)
+{
+	struct _trace_ring *r = atomic_load_explicit(&_trace_state.rings, memory_order_acquire);
+
+	for (; r; r = r->next) {
+		atomic_store_explicit(&r->tail, atomic_load_explicit(&r->head, memory_order_acquire),
+				memory_order_relaxed);
+	}
+}
+
+#else /* HLC_TRACE */
+
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_BEGIN_ARG(name, value) ((void)0)
+#define TRACE_END(name) ((void)0)
+#define TRACE_COUNTER(name, value) ((void)0)
+
+#endif /* HLC_TRACE */
+
+#endif /* HLC_TRACE_H */
@@ -2,7 +2,7 @@
  * utf.h - C99 implementation of unicode parsing
  * Copyright (C) Ethan Marshall - 2023
  *
- * Requirements: stddef.h, stdlib.h, wchar.h
+ * Requirements: stddef.h, stdlib.h, wchar.h, alloc.h
  *
  * Important note: This is *not* a UTF-8 implementation! It is a wrapper around
  * the standard C wchar routines for ease of use in simple cases. For pure
@@ -21,6 +21,7 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <wchar.h>
+#include "alloc.h"
 #endif
 
 /*
@@ -35,12 +36,15 @@ typedef wchar_t rune_t;
  * utf_decode decodes a unicode encoded wide character string into a
  * heap-allocated buffer of runes and returns a pointer to the first rune. If
  * len is not null, the number of wide characters decoded is written to len,
- * which will also be the buffer size on the heap.
+ * which will also be the buffer size on the heap. The buffer is allocated with
+ * HLC_MALLOC and must be released with HLC_FREE (free, by default).
  */
 static rune_t *utf_decode(const char *dec, size_t *len)
 {
-	size_t slen, ind = 0, clen = 16;
-	rune_t *buf = malloc(sizeof(rune_t) * clen);
+	size_t slen = 0, ind = 0, clen = 16;
+	rune_t *buf = _alloc_malloc_at(NULL, sizeof(rune_t) * clen, ALLOC_MOD_UTF, __func__);
+	if (!buf)
+		return NULL;
 
 	/*
 	 * calculate string length
@@ -51,7 +55,7 @@ static rune_t *utf_decode(const char *dec, size_t *len)
 	while (*dec) {
 		int step = mbtowc(buf + ind, dec, slen);
 		if (step < 0) {
-			free(buf);
+			_alloc_free_at(NULL, buf, sizeof(rune_t) * clen, ALLOC_MOD_UTF, __func__);
 			return NULL;
 		}
 
@@ -59,10 +63,14 @@ static rune_t *utf_decode(const char *dec, size_t *len)
 		dec += alen, slen -= alen;
 		ind++;
 		if (ind == (clen - 1)) {
-			clen *= 2;
-			buf = realloc(buf, sizeof(rune_t) * clen);
-			if (!buf)
+			rune_t *tmp = _alloc_realloc_at(NULL, buf, sizeof(rune_t) * clen,
+					sizeof(rune_t) * clen * 2, ALLOC_MOD_UTF, __func__);
+			if (!tmp) {
+				_alloc_free_at(NULL, buf, sizeof(rune_t) * clen, ALLOC_MOD_UTF, __func__);
 				return NULL;
+			}
+			buf = tmp;
+			clen *= 2;
 		}
 	}
 
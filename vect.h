@@ -2,7 +2,7 @@
  * vect.h - C99/C11 implementation of a type-safe vector
  * Copyright (C) Ethan Marshall - 2023
  *
- * Requirements: stdlib.h stdio.h stdint.h string.h
+ * Requirements: stdlib.h stdio.h stdint.h string.h alloc.h trace.h
  */
 
 #ifdef HLC_AUTO_INCLUDE
@@ -14,6 +14,8 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include "alloc.h"
+#include "trace.h"
 #endif
 
 /*
@@ -25,10 +27,13 @@
  * safe to use after being zero initialized via memset. Although void * is used
  * to pass without type safety, the vector copies elements by value, such that
  * a bad pointer (or one which goes out of scope) cannot cause a bad access.
+ *
+ * Storage is obtained from alloc, or the system allocator if alloc is NULL.
  */
 struct _vect_t {
 	void *buf;
 	size_t len, cap;
+	const allocator_t *alloc;
 };
 
 /*
@@ -47,7 +52,10 @@ static int _vect_resize(struct _vect_t *v, size_t tsiz, size_t new)
 	if (newcap <= v->cap)
 		return 1;
 
-	newbuf = realloc(v->buf, tsiz * newcap);
+	TRACE_BEGIN_ARG("_vect_resize", tsiz * newcap);
+	newbuf = _alloc_realloc_at(v->alloc, v->buf, tsiz * v->cap, tsiz * newcap,
+			ALLOC_MOD_VECT, __func__);
+	TRACE_END("_vect_resize");
 	if (!newbuf)
 		return 0;
 	v->buf = newbuf;
@@ -122,7 +130,7 @@ static void _vect_clear(struct _vect_t *v)
 static int _vect_contains(struct _vect_t *v, size_t ts, void *val)
 {
 	for (size_t i = 0; i < v->len; i++) {
-		if (memcmp(val, (void *)((uintptr_t)v->buf + i), ts) == 0) {
+		if (memcmp(val, (void *)((uintptr_t)v->buf + (i * ts)), ts) == 0) {
 			return 1;
 		}
 	}
@@ -164,7 +172,9 @@ static int _vect_contains(struct _vect_t *v, size_t ts, void *val)
 		}									\
 	}										\
 	tstore void tname##_vect_destroy(struct tname##_struct *this) {			\
-		free(this->v.buf);							\
+		_alloc_free_at(this->v.alloc, this->v.buf, this->v.cap * sizeof(type),	\
+				ALLOC_MOD_VECT, __func__);				\
+		this->v.buf = NULL;							\
 		this->v.cap = this->v.len = 0;						\
 	}										\
 	tstore type tname##_vect_get(struct tname##_struct *this, size_t ind) { 			\
@@ -211,11 +221,12 @@ static int _vect_contains(struct _vect_t *v, size_t ts, void *val)
 	{									\
 		return _vect_contains(&this->v, sizeof(val), &val);		\
 	}									\
-	tstore tname tname##_vect_init() {		\
+	tstore tname tname##_vect_init_alloc(const allocator_t *alloc) {	\
 		tname ret;				\
 		ret.v.buf = NULL;			\
 		ret.v.len = 0;				\
 		ret.v.cap = 0;				\
+		ret.v.alloc = alloc;			\
 		ret.append = tname##_vect_append;	\
 		ret.get = tname##_vect_get;		\
 		ret.set = tname##_vect_set;		\
@@ -253,7 +264,7 @@ static int _vect_contains(struct _vect_t *v, size_t ts, void *val)
  */
 #define vect_new(type, vname) 					\
 	_vect_declare(type, type##vname, inline);		\
-	type##vname vname = type##vname##_vect_init();		\
+	type##vname vname = type##vname##_vect_init_alloc(NULL);	\
 	/* see above for info about this little hack */		\
 	struct _vect_decl_isoc_workaround
 
@@ -265,7 +276,14 @@ static int _vect_contains(struct _vect_t *v, size_t ts, void *val)
  * If you have used vect_new for the vector, you need not call vect_init (not
  * that you could anyway, as vect_new's typenames are deliberately scrambled).
  */
-#define vect_init(tname) tname##_vect_init()
+#define vect_init(tname) tname##_vect_init_alloc(NULL)
+
+/*
+ * vect_init_alloc returns an initialized vector, as in vect_init, which obtains
+ * all of its storage from the allocator alloc. alloc must remain valid for the
+ * lifetime of the vector.
+ */
+#define vect_init_alloc(tname, alloc) tname##_vect_init_alloc(alloc)
 
 /*
  * vect_destroy frees all storage associated with the vector vect. It is